@@ -0,0 +1,152 @@
+#include "bench_common.h"
+#include "alloc_tracker.h"
+#include "bind_matcher.h"
+#include "macro_timelines.h"
+#include "thread_roles.h"
+
+#include <cstdio>
+#include <iostream>
+
+using namespace std;
+
+#ifdef IFF_TRACK_ALLOCS
+
+// drops every frame, so all the worker does is the macro's own work
+class NullSink {
+public:
+    using Record = RecordedEvent;
+
+    Record prepare(SinkEventType type, int32_t value) const { return Record{ 0, type, value }; }
+    void emit(const Record *records, size_t count) {
+        (void)records;
+        frames_.fetch_add(count, memory_order_relaxed);
+    }
+
+    uint64_t frames() const { return frames_.load(memory_order_relaxed); }
+
+private:
+    atomic<uint64_t> frames_{0};
+};
+
+// what a mode switch swaps between
+struct SwitchableTimelines {
+    atomic<const TimelineSet<RecordedEvent> *> current{nullptr};
+    const TimelineSet<RecordedEvent> *acquire() const { return current.load(memory_order_acquire); }
+};
+
+// the hook callbacks and the macro step loop, armed, have to leave both
+// regions at zero: a stray allocation there is a lock and a page fault on
+// the thread that can least afford either. runs the real worker with two
+// timelines behind a bind matcher, a fake hook thread presses, releases and
+// switches modes, the control ring turns the second timeline on and off.
+int runAllocBench(const BenchArgs &args) {
+    long ms = args.getInt("--ms", 1000);
+
+    // a tracker that counts nothing would pass everything below
+    allocReset();
+    {
+        IFF_ALLOC_SCOPE(AllocRegion::Hook);
+        // volatile, or the pair may be optimised away
+        int *volatile p = new int(1);
+        delete p;
+    }
+    if (allocRegionCounts(AllocRegion::Hook).allocations != 1) {
+        cerr << "alloc: the tracker missed a deliberate allocation\n";
+        return 1;
+    }
+
+    MacroControl control;
+    NullSink sink;
+    vector<MacroStep> tapI = { stepKeyDown('I'), stepWaitUs(300), stepKeyUp('I'), stepWaitUs(300) };
+    vector<MacroStep> tapO = { stepKeyDown('O'), stepWaitUs(500), stepKeyUp('O'), stepWaitUs(500) };
+    CompiledProgram<RecordedEvent> programs[2][2];
+    TimelineSet<RecordedEvent> sets[2];
+    string error;
+    for (int mode = 0; mode < 2; ++mode) {
+        for (int t = 0; t < 2; ++t) {
+            if (!compileMacroProgram(sink, mode ^ t ? tapO : tapI, programs[mode][t], error)) {
+                cerr << "alloc: " << error << "\n";
+                return 2;
+            }
+            sets[mode].programs[t] = &programs[mode][t];
+        }
+        sets[mode].count = 2;
+    }
+    SwitchableTimelines source;
+    source.current.store(&sets[0]);
+
+    BindMatcher matcher;
+    matcher.bindKey('F', 0);
+    matcher.bindMouse(MouseButton::X1, 1);
+
+    atomic<bool> armed{false};
+    thread worker([&] {
+        applyThreadRole(ThreadRole::Worker, RealtimeProfile{});
+        DeadlineScheduler sched;
+        armed.store(true);
+        runMacroTimelines(sink, sched, source, control);
+    });
+    while (!armed.load()) this_thread::yield();
+    // everything from here on is the armed app
+    this_thread::sleep_for(chrono::milliseconds(20));
+    allocReset();
+
+    uint64_t hookCalls = 0, edges = 0;
+    thread hook([&] {
+        applyThreadRole(ThreadRole::Hook, RealtimeProfile{});
+        static const uint32_t kMsgs[] = { kMsgKeyDown, kMsgKeyUp, kMsgXButtonDown, kMsgXButtonUp, kMsgMouseMove };
+        int64_t end = monotonicNowNs() + ms * 1000000LL;
+        for (uint32_t i = 0; monotonicNowNs() < end; ++i) {
+            IFF_ALLOC_SCOPE(AllocRegion::Hook);
+            uint32_t msg = kMsgs[i % 5];
+            BindHit hit = msg < kMsgMouseMove ? matcher.hitKey(msg, 'F') : matcher.hitMouse(msg, 1);
+            ++hookCalls;
+            if (hit) {
+                control.pushEdge(bindHitEdge(hit), monotonicNowNs(), bindHitTimeline(hit));
+                ++edges;
+            }
+            // the control thread and a mode switch now and then
+            if (i % 64 == 0) control.pushCommand(i & 64 ? BindEdge::On : BindEdge::Off, monotonicNowNs(), 1);
+            if (i % 512 == 0) {
+                source.current.store(&sets[(i >> 9) & 1]);
+                control.wake.signal();
+            }
+            this_thread::sleep_for(chrono::microseconds(200));
+        }
+    });
+    hook.join();
+    AllocCounts hookCounts = allocRegionCounts(AllocRegion::Hook);
+    AllocCounts stepCounts = allocRegionCounts(AllocRegion::MacroStep);
+    control.requestStop();
+    worker.join();
+
+    string report = allocReport();
+    bool ok = hookCounts.allocations == 0 && stepCounts.allocations == 0 && sink.frames() > 0;
+    JsonWriter json;
+    json.beginObject();
+    json.field("bench", "alloc");
+    json.field("hook_calls", static_cast<int64_t>(hookCalls));
+    json.field("edges", static_cast<int64_t>(edges));
+    json.field("frames", static_cast<int64_t>(sink.frames()));
+    json.field("hook_allocations", static_cast<int64_t>(hookCounts.allocations));
+    json.field("hook_bytes", static_cast<int64_t>(hookCounts.bytes));
+    json.field("macro_step_allocations", static_cast<int64_t>(stepCounts.allocations));
+    json.field("macro_step_bytes", static_cast<int64_t>(stepCounts.bytes));
+    json.field("pass", static_cast<int64_t>(ok));
+    json.endObject();
+    fprintf(stderr, "hook calls %llu  edges %llu  frames %llu\nhook %llu allocations  macro step %llu allocations\n%s",
+        static_cast<unsigned long long>(hookCalls), static_cast<unsigned long long>(edges), static_cast<unsigned long long>(sink.frames()),
+        static_cast<unsigned long long>(hookCounts.allocations), static_cast<unsigned long long>(stepCounts.allocations), report.c_str());
+    if (!writeBenchOutput(args.get("--out", "-"), json.str())) return 1;
+    return ok ? 0 : 1;
+}
+
+#else
+
+int runAllocBench(const BenchArgs &args) {
+    (void)args;
+    cerr << "alloc: built without IFF_TRACK_ALLOCS, nothing is counted\n";
+    return 2;
+}
+
+#endif
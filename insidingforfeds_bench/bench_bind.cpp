@@ -0,0 +1,129 @@
+#include "bench_common.h"
+#include "bind_matcher.h"
+
+#include <cstdio>
+#include <iostream>
+#include <random>
+
+using namespace std;
+
+struct SyntheticEvent {
+    uint32_t msg;
+    uint32_t code; // vk for keys, HIWORD(mouseData) for mouse
+};
+
+// roughly what a low-level hook sees while playing: mostly mouse moves, some
+// wheel and clicks, a steady trickle of keys. now and then a code past 0xFF,
+// which no vk is but a hook can still be handed
+static vector<SyntheticEvent> makeStream(size_t n, uint32_t seed) {
+    static const uint32_t buttons[] = { kMsgLButtonDown, kMsgLButtonUp, kMsgRButtonDown, kMsgRButtonUp,
+        kMsgMButtonDown, kMsgMButtonUp, kMsgXButtonDown, kMsgXButtonUp };
+    static const uint32_t keys[] = { kMsgKeyDown, kMsgKeyUp, kMsgSysKeyDown, kMsgSysKeyUp };
+    mt19937 rng(seed);
+    vector<SyntheticEvent> events(n);
+    for (auto &e : events) {
+        uint32_t r = rng() % 100;
+        if (r < 80) e = { kMsgMouseMove, 0 };
+        else if (r < 85) e = { rng() & 1 ? kMsgMouseWheel : kMsgMouseHWheel, 120 };
+        else if (r < 92) {
+            e.msg = buttons[rng() % 8];
+            e.code = e.msg >= kMsgXButtonDown ? 1 + rng() % 2 : 0;
+        } else if (r < 98) {
+            e = { keys[rng() % 4], static_cast<uint32_t>(1 + rng() % 254) };
+        } else {
+            e = { keys[rng() % 4], static_cast<uint32_t>(rng() & 1 ? 0x100 + rng() % 0x700 : rng()) };
+        }
+    }
+    return events;
+}
+
+// the if/else chain the hooks used to run, kept as the reference
+static BindEdge matchChain(KeybindType type, int vk, MouseButton mb, const SyntheticEvent &e) {
+    if (type == KeybindType::Keyboard) {
+        if ((e.msg == kMsgKeyDown || e.msg == kMsgSysKeyDown) && e.code == static_cast<uint32_t>(vk)) return BindEdge::Down;
+        if ((e.msg == kMsgKeyUp || e.msg == kMsgSysKeyUp) && e.code == static_cast<uint32_t>(vk)) return BindEdge::Up;
+        return BindEdge::None;
+    }
+    if (e.msg < kMsgMouseMove) return BindEdge::None;
+    bool isDown = false, isUp = false;
+    if (mb == MouseButton::Left) { isDown = e.msg == kMsgLButtonDown; isUp = e.msg == kMsgLButtonUp; }
+    else if (mb == MouseButton::Right) { isDown = e.msg == kMsgRButtonDown; isUp = e.msg == kMsgRButtonUp; }
+    else if (mb == MouseButton::Middle) { isDown = e.msg == kMsgMButtonDown; isUp = e.msg == kMsgMButtonUp; }
+    else if (e.msg == kMsgXButtonDown || e.msg == kMsgXButtonUp) {
+        if ((mb == MouseButton::X1 && e.code == 1) || (mb == MouseButton::X2 && e.code == 2)) {
+            isDown = e.msg == kMsgXButtonDown;
+            isUp = e.msg == kMsgXButtonUp;
+        }
+    }
+    return isDown ? BindEdge::Down : isUp ? BindEdge::Up : BindEdge::None;
+}
+
+static BindEdge matchTable(const BindMatcher &m, const SyntheticEvent &e) {
+    return e.msg < kMsgMouseMove ? m.matchKey(e.msg, e.code) : m.matchMouse(e.msg, e.code);
+}
+
+struct BindCase {
+    const char *name;
+    KeybindType type;
+    int vk;
+    MouseButton mb;
+};
+
+int runBindBench(const BenchArgs &args) {
+    size_t n = static_cast<size_t>(args.getInt("--events", 5000000));
+    vector<SyntheticEvent> events = makeStream(n, static_cast<uint32_t>(args.getInt("--seed", 1)));
+    static const BindCase cases[] = {
+        { "key_f", KeybindType::Keyboard, 0x46, MouseButton::Left },
+        { "key_lshift", KeybindType::Keyboard, 0xA0, MouseButton::Left },
+        { "mouse_left", KeybindType::Mouse, 0, MouseButton::Left },
+        { "mouse_right", KeybindType::Mouse, 0, MouseButton::Right },
+        { "mouse_middle", KeybindType::Mouse, 0, MouseButton::Middle },
+        { "mouse_x1", KeybindType::Mouse, 0, MouseButton::X1 },
+        { "mouse_x2", KeybindType::Mouse, 0, MouseButton::X2 },
+    };
+
+    JsonWriter json;
+    json.beginObject();
+    json.field("bench", "bind");
+    json.field("events", static_cast<int64_t>(n));
+    json.beginArray("cases");
+    uint64_t mismatches = 0;
+    for (const BindCase &c : cases) {
+        BindMatcher matcher;
+        if (c.type == KeybindType::Keyboard) matcher.bindKey(c.vk);
+        else matcher.bindMouse(c.mb);
+
+        uint64_t caseMismatches = 0, hits = 0;
+        for (const auto &e : events) {
+            BindEdge t = matchTable(matcher, e);
+            if (t != matchChain(c.type, c.vk, c.mb, e)) ++caseMismatches;
+            if (t != BindEdge::None) ++hits;
+        }
+        mismatches += caseMismatches;
+
+        uint64_t sumTable = 0, sumChain = 0;
+        int64_t t0 = monotonicNowNs();
+        for (const auto &e : events) sumTable += static_cast<uint64_t>(matchTable(matcher, e));
+        int64_t t1 = monotonicNowNs();
+        for (const auto &e : events) sumChain += static_cast<uint64_t>(matchChain(c.type, c.vk, c.mb, e));
+        int64_t t2 = monotonicNowNs();
+
+        double tableNs = static_cast<double>(t1 - t0) / static_cast<double>(n);
+        double chainNs = static_cast<double>(t2 - t1) / static_cast<double>(n);
+        json.beginObject();
+        json.field("bind", c.name);
+        json.field("hits", static_cast<int64_t>(hits));
+        json.field("mismatches", static_cast<int64_t>(caseMismatches));
+        json.field("table_ns_per_event", tableNs);
+        json.field("chain_ns_per_event", chainNs);
+        json.field("checksum", static_cast<int64_t>(sumTable ^ sumChain));
+        json.endObject();
+        fprintf(stderr, "%-13s hits %8llu  table %6.2fns  chain %6.2fns  mismatches %llu\n", c.name,
+            static_cast<unsigned long long>(hits), tableNs, chainNs, static_cast<unsigned long long>(caseMismatches));
+    }
+    json.endArray();
+    json.field("mismatches", static_cast<int64_t>(mismatches));
+    json.endObject();
+    if (!writeBenchOutput(args.get("--out", "-"), json.str())) return 1;
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,32 @@
+#include "bench_common.h"
+#include "thread_roles.h"
+#include "timer_calibration.h"
+
+#include <cstdio>
+
+using namespace std;
+
+// the pass the app runs on first launch, on demand. the output is the
+// timer_calibration.json format, so --out can replace the app's copy.
+int runCalibrateBench(const BenchArgs &args) {
+    int samples = static_cast<int>(args.getInt("--samples", 160));
+    RealtimeProfile profile;
+    profile.realtime = args.has("--realtime");
+    profile.workerCpu = static_cast<int>(args.getInt("--pin", -1));
+    applyProcessProfile(profile);
+
+    TimerCalibration c;
+    thread worker([&] {
+        applyThreadRole(ThreadRole::Worker, profile);
+        c = calibrateTimers(samples);
+    });
+    worker.join();
+
+    for (int i = 0; i < c.probeCount; ++i) {
+        const TimerProbe &p = c.probes[i];
+        fprintf(stderr, "%-16s late p50 %8.1fus p99 %8.1fus max %8.1fus%s\n", timerBackendName(p.backend), p.p50Ns / 1000.0, p.p99Ns / 1000.0,
+            p.maxNs / 1000.0, p.backend == c.backend ? "  <- picked" : "");
+    }
+    fprintf(stderr, "spin budget %.1fus\n", c.spinNs / 1000.0);
+    return writeBenchOutput(args.get("--out", "-"), timerCalibrationJson(c)) ? 0 : 1;
+}
@@ -0,0 +1,225 @@
+#include "bench_common.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#ifdef _WIN32
+#include <psapi.h>
+#include <tlhelp32.h>
+#else
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+void sleepMs(int ms) {
+    this_thread::sleep_for(chrono::milliseconds(ms));
+}
+
+int64_t threadCpuTimeNs() {
+#ifdef _WIN32
+    FILETIME created, exited, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user)) return 0;
+    auto ticks = [](const FILETIME &f) { return (static_cast<int64_t>(f.dwHighDateTime) << 32) | f.dwLowDateTime; };
+    return (ticks(kernel) + ticks(user)) * 100;
+#else
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+#endif
+}
+
+bool sampleProcess(ProcessSample &out) {
+    out = ProcessSample{};
+#ifdef _WIN32
+    HANDLE self = GetCurrentProcess();
+    PROCESS_MEMORY_COUNTERS mem = {};
+    if (!GetProcessMemoryInfo(self, &mem, sizeof(mem))) return false;
+    out.rssBytes = static_cast<int64_t>(mem.WorkingSetSize);
+    DWORD handles = 0;
+    if (!GetProcessHandleCount(self, &handles)) return false;
+    out.handles = handles;
+    FILETIME created, exited, kernel, user;
+    if (!GetProcessTimes(self, &created, &exited, &kernel, &user)) return false;
+    auto ticks = [](const FILETIME &f) { return (static_cast<int64_t>(f.dwHighDateTime) << 32) | f.dwLowDateTime; };
+    out.cpuNs = (ticks(kernel) + ticks(user)) * 100;
+    // the snapshot is a handle of its own, closed before the next sample
+    HANDLE snap = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+    if (snap == INVALID_HANDLE_VALUE) return false;
+    THREADENTRY32 te = {};
+    te.dwSize = sizeof(te);
+    DWORD pid = GetCurrentProcessId();
+    for (BOOL more = Thread32First(snap, &te); more; more = Thread32Next(snap, &te)) {
+        if (te.th32OwnerProcessID == pid) ++out.threads;
+    }
+    CloseHandle(snap);
+    return true;
+#else
+    long pages = 0, resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (!statm) return false;
+    bool read = fscanf(statm, "%ld %ld", &pages, &resident) == 2;
+    fclose(statm);
+    if (!read) return false;
+    out.rssBytes = static_cast<int64_t>(resident) * sysconf(_SC_PAGESIZE);
+    FILE *status = fopen("/proc/self/status", "r");
+    if (!status) return false;
+    char line[256];
+    while (fgets(line, sizeof(line), status)) {
+        if (strncmp(line, "Threads:", 8) == 0) out.threads = strtol(line + 8, nullptr, 10);
+    }
+    fclose(status);
+    DIR *fds = opendir("/proc/self/fd");
+    if (!fds) return false;
+    while (dirent *d = readdir(fds)) {
+        if (d->d_name[0] != '.') ++out.handles;
+    }
+    closedir(fds);
+    // not the one opendir just used
+    --out.handles;
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    out.cpuNs = static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+    return true;
+#endif
+}
+
+CpuLoad::CpuLoad(int threads) {
+    for (int i = 0; i < threads; ++i) {
+        threads_.emplace_back([this] {
+            volatile uint64_t x = 0;
+            while (!stop_.load(memory_order_relaxed)) {
+                for (int j = 0; j < 10000; ++j) x = x + j;
+            }
+        });
+    }
+}
+
+CpuLoad::~CpuLoad() {
+    stop_.store(true);
+    for (auto &t : threads_) t.join();
+}
+
+vector<MacroStep> makeFirstPersonSteps(int stepUs) {
+    return { stepWheel(kWheelDelta), stepWaitUs(stepUs), stepWheel(-kWheelDelta), stepWaitUs(stepUs) };
+}
+
+vector<MacroStep> makeThirdPersonSteps(int stepUs) {
+    return {
+        stepKeyDown(kVkI), stepWaitUs(stepUs), stepKeyDown(kVkO), stepWaitUs(stepUs),
+        stepKeyUp(kVkI), stepWaitUs(stepUs), stepKeyUp(kVkO), stepWaitUs(stepUs),
+    };
+}
+
+bool parseBackendName(const string &name, TimerBackend &out) {
+    if (name == "event") out = TimerBackend::EventWait;
+    else if (name == "waitable") out = TimerBackend::WaitableTimer;
+    else if (name == "futex") out = TimerBackend::Futex;
+    else if (name == "default") out = defaultTimerBackend();
+    else return false;
+    return true;
+}
+
+bool BenchArgs::has(const char *flag) const {
+    for (auto &a : args) if (a == flag) return true;
+    return false;
+}
+
+string BenchArgs::get(const char *flag, const string &fallback) const {
+    for (size_t i = 0; i + 1 < args.size(); ++i) if (args[i] == flag) return args[i + 1];
+    return fallback;
+}
+
+long BenchArgs::getInt(const char *flag, long fallback) const {
+    string v = get(flag, "");
+    if (v.empty()) return fallback;
+    char *end = nullptr;
+    long r = strtol(v.c_str(), &end, 0);
+    return *end ? fallback : r;
+}
+
+void JsonWriter::separator() {
+    if (first_.empty()) return;
+    if (!first_.back()) out_ += ",";
+    first_.back() = false;
+}
+
+void JsonWriter::beginObject(const char *key) {
+    separator();
+    if (key) out_ += "\"" + string(key) + "\":";
+    out_ += "{";
+    first_.push_back(true);
+}
+
+void JsonWriter::endObject() {
+    out_ += "}";
+    first_.pop_back();
+}
+
+void JsonWriter::beginArray(const char *key) {
+    separator();
+    out_ += "\"" + string(key) + "\":[";
+    first_.push_back(true);
+}
+
+void JsonWriter::endArray() {
+    out_ += "]";
+    first_.pop_back();
+}
+
+void JsonWriter::field(const char *key, const string &v) {
+    separator();
+    out_ += "\"" + string(key) + "\":\"";
+    for (char c : v) {
+        if (c == '"' || c == '\\') out_ += '\\';
+        out_ += c;
+    }
+    out_ += "\"";
+}
+
+void JsonWriter::field(const char *key, int64_t v) {
+    separator();
+    out_ += "\"" + string(key) + "\":" + to_string(v);
+}
+
+void JsonWriter::field(const char *key, double v) {
+    separator();
+    stringstream ss;
+    ss << setprecision(6) << v;
+    out_ += "\"" + string(key) + "\":" + ss.str();
+}
+
+void JsonWriter::field(const char *key, double v, int decimals) {
+    separator();
+    stringstream ss;
+    ss << fixed << setprecision(decimals) << v;
+    out_ += "\"" + string(key) + "\":" + ss.str();
+}
+
+void JsonWriter::histogram(const char *key, const LatencyHistogram &h) {
+    beginObject(key);
+    field("count", static_cast<int64_t>(h.count()));
+    field("p50_ns", h.percentile(50));
+    field("p90_ns", h.percentile(90));
+    field("p99_ns", h.percentile(99));
+    field("p999_ns", h.percentile(99.9));
+    field("max_ns", h.max());
+    endObject();
+}
+
+bool writeBenchOutput(const string &path, const string &text) {
+    if (path.empty() || path == "-") {
+        cout << text << "\n";
+        return true;
+    }
+    ofstream f(path, ios::binary | ios::trunc);
+    f << text << "\n";
+    return static_cast<bool>(f);
+}
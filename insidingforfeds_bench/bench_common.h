@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+#include "macro_loops.h"
+#include "latency_stats.h"
+
+int64_t threadCpuTimeNs();
+
+// for waiting on the bench's own threads and devices, never inside a loop
+// that emits
+void sleepMs(int ms);
+
+// what a long run watches for growth, for this process as a whole
+struct ProcessSample {
+    int64_t rssBytes = 0;
+    // open handles on windows, open fds elsewhere
+    int64_t handles = 0;
+    int64_t threads = 0;
+    int64_t cpuNs = 0;
+};
+
+bool sampleProcess(ProcessSample &out);
+
+// keeps N threads spinning until stopped, to see how the scheduler copes
+// with a saturated machine
+class CpuLoad {
+public:
+    explicit CpuLoad(int threads);
+    ~CpuLoad();
+
+private:
+    std::atomic<bool> stop_{false};
+    std::vector<std::thread> threads_;
+};
+
+// forwards to the inner sink and stops the loop once it has seen enough
+// batches, so a bench run covers an exact number of steps
+template <class Inner>
+class StopAfterSink {
+public:
+    using Record = typename Inner::Record;
+
+    StopAfterSink(Inner &inner, MacroControl &control, uint64_t batches) : inner_(inner), control_(control), remaining_(batches) {}
+
+    Record prepare(SinkEventType type, int32_t value) const { return inner_.prepare(type, value); }
+    void emit(const Record *records, size_t count) {
+        inner_.emit(records, count);
+        if (remaining_ && --remaining_ == 0) control_.requestStop();
+    }
+    void emit(const Record &r) { emit(&r, 1); }
+
+private:
+    Inner &inner_;
+    MacroControl &control_;
+    uint64_t remaining_;
+};
+
+std::vector<MacroStep> makeFirstPersonSteps(int stepUs);
+std::vector<MacroStep> makeThirdPersonSteps(int stepUs);
+
+bool parseBackendName(const std::string &name, TimerBackend &out);
+
+struct BenchArgs {
+    std::vector<std::string> args;
+
+    bool has(const char *flag) const;
+    std::string get(const char *flag, const std::string &fallback) const;
+    long getInt(const char *flag, long fallback) const;
+};
+
+class JsonWriter {
+public:
+    void beginObject(const char *key = nullptr);
+    void endObject();
+    void beginArray(const char *key);
+    void endArray();
+    void field(const char *key, const std::string &v);
+    void field(const char *key, const char *v) { field(key, std::string(v)); }
+    void field(const char *key, int64_t v);
+    void field(const char *key, double v);
+    // fixed point, for values like trace timestamps that need every digit
+    void field(const char *key, double v, int decimals);
+    void histogram(const char *key, const LatencyHistogram &h);
+    const std::string &str() const { return out_; }
+
+private:
+    void separator();
+
+    std::string out_;
+    std::vector<bool> first_;
+};
+
+bool writeBenchOutput(const std::string &path, const std::string &text);
@@ -0,0 +1,256 @@
+#include "bench_common.h"
+#include "console_renderer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <random>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// what a renderer's output left on screen. on linux the ansi it writes to a
+// pipe is played onto a cell grid like a terminal would, on windows it draws
+// into a screen buffer of its own that gets read back.
+class Screen {
+public:
+#ifdef _WIN32
+    Screen() {
+        out_ = CreateConsoleScreenBuffer(GENERIC_READ | GENERIC_WRITE, 0, nullptr, CONSOLE_TEXTMODE_BUFFER, nullptr);
+    }
+    ~Screen() {
+        if (ok()) CloseHandle(out_);
+    }
+    bool ok() const { return out_ != INVALID_HANDLE_VALUE; }
+    HANDLE output() const { return out_; }
+#else
+    Screen() {
+        if (pipe(fds_) == 0) fcntl(fds_[0], F_SETFL, fcntl(fds_[0], F_GETFL) | O_NONBLOCK);
+    }
+    ~Screen() {
+        for (int fd : fds_) if (fd >= 0) close(fd);
+    }
+    bool ok() const { return fds_[0] >= 0; }
+    int output() const { return fds_[1]; }
+#endif
+    Screen(const Screen &) = delete;
+    Screen &operator=(const Screen &) = delete;
+
+    void resize(int cols, int rows) {
+        cols_ = cols;
+        rows_ = rows;
+        cells_.assign(static_cast<size_t>(cols) * rows, ConsoleCell{ ' ', CellColor::Default });
+    }
+
+    // picks up everything presented since the last call, returns the bytes
+    // written (0 on windows, the console api doesn't say)
+    size_t update() {
+#ifdef _WIN32
+        vector<CHAR_INFO> buf(cells_.size());
+        CONSOLE_SCREEN_BUFFER_INFO csbi{};
+        GetConsoleScreenBufferInfo(out_, &csbi);
+        COORD size = { static_cast<SHORT>(cols_), static_cast<SHORT>(rows_) };
+        COORD at = { 0, 0 };
+        SMALL_RECT rect = { csbi.srWindow.Left, csbi.srWindow.Top, static_cast<SHORT>(csbi.srWindow.Left + cols_ - 1), static_cast<SHORT>(csbi.srWindow.Top + rows_ - 1) };
+        if (!cells_.empty() && ReadConsoleOutputW(out_, buf.data(), size, at, &rect)) {
+            for (size_t i = 0; i < cells_.size(); ++i) cells_[i] = ConsoleCell{ static_cast<uint16_t>(buf[i].Char.UnicodeChar), colorOf(buf[i].Attributes) };
+        }
+        return 0;
+#else
+        char buf[4096];
+        size_t total = 0;
+        ssize_t r;
+        while ((r = read(fds_[0], buf, sizeof(buf))) > 0) {
+            bytes_.append(buf, static_cast<size_t>(r));
+            total += static_cast<size_t>(r);
+        }
+        play();
+        return total;
+#endif
+    }
+
+    const vector<ConsoleCell> &cells() const { return cells_; }
+    // cells written outside the grid
+    uint64_t outside() const { return outside_; }
+
+private:
+#ifdef _WIN32
+    CellColor colorOf(WORD attr) const {
+        if (attr == (FOREGROUND_GREEN | FOREGROUND_INTENSITY)) return CellColor::Green;
+        if (attr == (FOREGROUND_RED | FOREGROUND_INTENSITY)) return CellColor::Red;
+        if (attr == (FOREGROUND_GREEN | FOREGROUND_BLUE | FOREGROUND_INTENSITY)) return CellColor::Cyan;
+        return CellColor::Default;
+    }
+#else
+    // the renderer only writes "esc[row;colH", "esc[0m" / "esc[1;3xm" and utf-8
+    void play() {
+        size_t i = 0;
+        while (i < bytes_.size()) {
+            unsigned char c = static_cast<unsigned char>(bytes_[i]);
+            if (c == 0x1b) {
+                int params[2] = { 0, 0 };
+                int n = 0;
+                size_t j = i + 2;
+                for (; j < bytes_.size() && bytes_[j] != 'H' && bytes_[j] != 'm'; ++j) {
+                    if (bytes_[j] == ';') ++n;
+                    else if (n < 2) params[n] = params[n] * 10 + (bytes_[j] - '0');
+                }
+                if (j == bytes_.size()) break;
+                if (bytes_[j] == 'H') {
+                    row_ = params[0] - 1;
+                    col_ = params[1] - 1;
+                } else {
+                    color_ = n == 0 ? CellColor::Default : params[1] == 32 ? CellColor::Green : params[1] == 31 ? CellColor::Red : CellColor::Cyan;
+                }
+                i = j + 1;
+                continue;
+            }
+            uint16_t ch = c;
+            size_t len = 1;
+            if (c >= 0xE0) {
+                len = 3;
+                if (i + 2 < bytes_.size()) ch = static_cast<uint16_t>(((c & 0x0F) << 12) | ((bytes_[i + 1] & 0x3F) << 6) | (bytes_[i + 2] & 0x3F));
+            } else if (c >= 0xC0) {
+                len = 2;
+                if (i + 1 < bytes_.size()) ch = static_cast<uint16_t>(((c & 0x1F) << 6) | (bytes_[i + 1] & 0x3F));
+            }
+            if (i + len > bytes_.size()) break;
+            if (row_ >= 0 && row_ < rows_ && col_ >= 0 && col_ < cols_) cells_[static_cast<size_t>(row_) * cols_ + col_] = ConsoleCell{ ch, color_ };
+            else ++outside_;
+            ++col_;
+            i += len;
+        }
+        bytes_.erase(0, i);
+    }
+#endif
+
+#ifdef _WIN32
+    HANDLE out_ = INVALID_HANDLE_VALUE;
+#else
+    int fds_[2] = { -1, -1 };
+    string bytes_;
+    int row_ = 0;
+    int col_ = 0;
+    CellColor color_ = CellColor::Default;
+#endif
+    int cols_ = 0;
+    int rows_ = 0;
+    vector<ConsoleCell> cells_;
+    uint64_t outside_ = 0;
+};
+
+static bool sameCells(const vector<ConsoleCell> &a, const vector<ConsoleCell> &b, size_t &firstDiff) {
+    if (a.size() != b.size()) {
+        firstDiff = 0;
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i].ch != b[i].ch || a[i].color != b[i].color) {
+            firstDiff = i;
+            return false;
+        }
+    }
+    return true;
+}
+
+// a status box like the app's with a counter that moves every frame, and
+// every few frames text in random places and colors, some of it hanging off
+// the edges and some of it latin-1
+static void drawFrame(ConsoleRenderer &r, uint32_t seed, long frame) {
+    mt19937 rng(seed + static_cast<uint32_t>(frame));
+    static const CellColor colors[] = { CellColor::Default, CellColor::Green, CellColor::Red, CellColor::Cyan };
+    r.clear();
+    vector<string> lines = { "insidingforfeds macro", "mode:     3rd person", "activation: hold", "cycles:   " + to_string(frame * 37),
+        "trigger->emit: p50 " + to_string(frame % 7) + "." + to_string(frame % 10) + "ms" };
+    r.drawBox(lines, static_cast<int>(frame / 10 % lines.size()), colors[1 + frame / 25 % 3]);
+    if (frame % 5) return;
+    int puts = 1 + static_cast<int>(rng() % 6);
+    for (int i = 0; i < puts; ++i) {
+        string text(1 + rng() % 30, ' ');
+        for (char &c : text) c = rng() % 8 ? static_cast<char>('!' + rng() % 90) : static_cast<char>(0xC0 + rng() % 64);
+        int row = static_cast<int>(rng() % static_cast<uint32_t>(r.rows() + 2)) - 1;
+        int col = static_cast<int>(rng() % static_cast<uint32_t>(r.cols() + 20)) - 10;
+        r.put(row, col, text.data(), text.size(), colors[rng() % 4]);
+    }
+}
+
+// every frame presented as a diff has to leave the screen exactly as a fresh
+// renderer painting the same frame in full, and a diff writes only what changed
+int runConsoleBench(const BenchArgs &args) {
+    long frames = args.getInt("--frames", 500);
+    uint32_t seed = static_cast<uint32_t>(args.getInt("--seed", 1));
+    int failures = 0;
+
+    Screen screen;
+    if (!screen.ok()) {
+        cerr << "can't open a screen to render into\n";
+        return 2;
+    }
+    ConsoleRenderer renderer(screen.output());
+    screen.resize(renderer.cols(), renderer.rows());
+    size_t diffCells = 0, diffBytes = 0, fullCells = 0, fullBytes = 0;
+    for (long f = 0; f < frames; ++f) {
+        drawFrame(renderer, seed, f);
+        diffCells += renderer.present();
+        diffBytes += screen.update();
+
+        Screen fresh;
+        ConsoleRenderer full(fresh.output());
+        fresh.resize(full.cols(), full.rows());
+        drawFrame(full, seed, f);
+        fullCells += full.present();
+        fullBytes += fresh.update();
+
+        size_t at = 0;
+        if (!sameCells(screen.cells(), fresh.cells(), at)) {
+            if (failures++ < 5) {
+                int cols = max(renderer.cols(), 1);
+                fprintf(stderr, "frame %ld: screen differs from a full repaint at row %d col %d\n", f, static_cast<int>(at) / cols, static_cast<int>(at) % cols);
+            }
+        }
+    }
+    if (screen.outside()) {
+        ++failures;
+        fprintf(stderr, "%llu cells written off screen\n", static_cast<unsigned long long>(screen.outside()));
+    }
+
+    // nothing changed: nothing written. one cell changed: one cell written
+    drawFrame(renderer, seed, frames - 1);
+    size_t idle = renderer.present();
+    size_t idleBytes = screen.update();
+    drawFrame(renderer, seed, frames - 1);
+    renderer.put(0, 0, "#", 1, CellColor::Red);
+    size_t one = renderer.present();
+    screen.update();
+    if (idle || idleBytes) {
+        ++failures;
+        fprintf(stderr, "unchanged frame wrote %zu cells, %zu bytes\n", idle, idleBytes);
+    }
+    if (one != 1) {
+        ++failures;
+        fprintf(stderr, "one changed cell wrote %zu cells\n", one);
+    }
+
+    double n = frames > 0 ? static_cast<double>(frames) : 1.0;
+    JsonWriter json;
+    json.beginObject();
+    json.field("bench", "console");
+    json.field("cols", static_cast<int64_t>(renderer.cols()));
+    json.field("rows", static_cast<int64_t>(renderer.rows()));
+    json.field("frames", static_cast<int64_t>(frames));
+    json.field("seed", static_cast<int64_t>(seed));
+    json.field("diff_cells_per_frame", static_cast<double>(diffCells) / n);
+    json.field("full_cells_per_frame", static_cast<double>(fullCells) / n);
+    json.field("diff_bytes_per_frame", static_cast<double>(diffBytes) / n);
+    json.field("full_bytes_per_frame", static_cast<double>(fullBytes) / n);
+    json.field("failures", static_cast<int64_t>(failures));
+    json.endObject();
+    fprintf(stderr, "%dx%d, %ld frames: %.1f cells / %.0f bytes per diffed frame vs %.1f / %.0f repainting, %d failures\n", renderer.cols(), renderer.rows(), frames,
+        static_cast<double>(diffCells) / n, static_cast<double>(diffBytes) / n, static_cast<double>(fullCells) / n, static_cast<double>(fullBytes) / n, failures);
+    if (!writeBenchOutput(args.get("--out", "-"), json.str())) return 1;
+    return failures ? 1 : 0;
+}
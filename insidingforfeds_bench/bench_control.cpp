@@ -0,0 +1,309 @@
+#include "bench_common.h"
+#include "control_channel.h"
+#include "macro_timelines.h"
+#include "settings.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static const char *statusName(uint8_t status) {
+    switch (static_cast<ControlStatus>(status)) {
+    case ControlStatus::Ok: return "ok";
+    case ControlStatus::BadRequest: return "bad request";
+    case ControlStatus::Failed: return "failed";
+    }
+    return "?";
+}
+
+// positional words after the bench name, flags and their values skipped
+static vector<string> words(const BenchArgs &args) {
+    vector<string> r;
+    for (size_t i = 0; i < args.args.size(); ++i) {
+        if (args.args[i].compare(0, 2, "--") == 0) {
+            if (args.args[i] == "--name" || args.args[i] == "--out" || args.args[i] == "--rounds") ++i;
+            continue;
+        }
+        r.push_back(args.args[i]);
+    }
+    return r;
+}
+
+static bool parseBindWord(const string &w, ControlRequest &req) {
+    static const char *const kButtons[] = { "left", "right", "middle", "x1", "x2" };
+    for (uint32_t i = 0; i < 5; ++i) {
+        if (w == kButtons[i]) {
+            req.kind = static_cast<uint8_t>(KeybindType::Mouse);
+            req.value = i;
+            return true;
+        }
+    }
+    char *end = nullptr;
+    unsigned long vk = strtoul(w.c_str(), &end, 0);
+    if (w.empty() || *end || vk == 0 || vk > 0xFE) return false;
+    req.kind = static_cast<uint8_t>(KeybindType::Keyboard);
+    req.value = static_cast<uint32_t>(vk);
+    return true;
+}
+
+static bool parseCommand(const vector<string> &w, ControlRequest &req) {
+    req = ControlRequest{};
+    if (w.empty()) return false;
+    size_t timelineAt = 1;
+    if (w[0] == "enable") req.op = static_cast<uint8_t>(ControlOp::Enable);
+    else if (w[0] == "disable") req.op = static_cast<uint8_t>(ControlOp::Disable);
+    else if (w[0] == "stats") req.op = static_cast<uint8_t>(ControlOp::QueryStats);
+    else if (w[0] == "shutdown") req.op = static_cast<uint8_t>(ControlOp::Shutdown);
+    else if (w[0] == "mode" && w.size() >= 2) {
+        req.op = static_cast<uint8_t>(ControlOp::SetMode);
+        if (w[1] == "first") req.kind = static_cast<uint8_t>(MacroMode::FirstPerson);
+        else if (w[1] == "third") req.kind = static_cast<uint8_t>(MacroMode::ThirdPerson);
+        else if (w[1] == "custom") req.kind = static_cast<uint8_t>(MacroMode::Custom);
+        else return false;
+        timelineAt = 2;
+    } else if (w[0] == "bind" && w.size() >= 2) {
+        req.op = static_cast<uint8_t>(ControlOp::SetBind);
+        if (!parseBindWord(w[1], req)) return false;
+        timelineAt = 2;
+    } else {
+        return false;
+    }
+    if (w.size() > timelineAt) {
+        long t = strtol(w[timelineAt].c_str(), nullptr, 10);
+        if (t < 0 || t >= kMaxTimelines) return false;
+        req.timeline = static_cast<uint8_t>(t);
+    }
+    return true;
+}
+
+static void replyJson(JsonWriter &json, const ControlReply &r) {
+    json.field("status", statusName(r.status));
+    json.field("enabled", static_cast<int64_t>(r.enabled));
+    json.field("timelines", static_cast<int64_t>(r.timelines));
+    if (r.op != static_cast<uint8_t>(ControlOp::QueryStats)) return;
+    json.field("trigger_to_emit_p50_ns", r.stats.triggerToEmitP50Ns);
+    json.field("trigger_to_emit_p99_ns", r.stats.triggerToEmitP99Ns);
+    json.field("step_jitter_p99_ns", r.stats.stepJitterP99Ns);
+    if (!(r.flags & kControlHaveCounters)) return;
+    json.field("cycles", static_cast<int64_t>(r.stats.cycles));
+    json.field("emitted_events", static_cast<int64_t>(r.stats.emittedEvents));
+    json.field("missed_deadlines", static_cast<int64_t>(r.stats.missedDeadlines));
+    json.field("activations", static_cast<int64_t>(r.stats.activations));
+    json.field("send_failures", static_cast<int64_t>(r.stats.sendFailures));
+    json.field("hook_calls", static_cast<int64_t>(r.stats.hookCalls));
+    json.field("hook_max_ns", r.stats.hookMaxNs);
+}
+
+// counts frames and keeps the time of the first one since arm()
+class StampSink {
+public:
+    using Record = RecordedEvent;
+
+    Record prepare(SinkEventType type, int32_t value) const { return Record{ 0, type, value }; }
+    void emit(const Record *records, size_t count) {
+        (void)records;
+        (void)count;
+        if (!firstNs_.load(memory_order_relaxed)) firstNs_.store(monotonicNowNs(), memory_order_relaxed);
+        frames_.fetch_add(1, memory_order_release);
+    }
+
+    void arm() { firstNs_.store(0, memory_order_relaxed); }
+    uint64_t frames() const { return frames_.load(memory_order_acquire); }
+    int64_t firstNs() const { return firstNs_.load(memory_order_relaxed); }
+
+private:
+    atomic<uint64_t> frames_{0};
+    atomic<int64_t> firstNs_{0};
+};
+
+// what SetMode swaps between in the self test
+struct SwitchableTimelines {
+    atomic<const TimelineSet<RecordedEvent> *> current{nullptr};
+    const TimelineSet<RecordedEvent> *acquire() const { return current.load(memory_order_acquire); }
+};
+
+template <class Pred>
+static bool spinFor(Pred pred, int64_t timeoutNs) {
+    int64_t end = monotonicNowNs() + timeoutNs;
+    while (!pred()) {
+        if (monotonicNowNs() > end) return false;
+        this_thread::yield();
+    }
+    return true;
+}
+
+static string selfTestName() {
+#ifdef _WIN32
+    return "\\\\.\\pipe\\insidingforfeds_selftest_" + to_string(GetCurrentProcessId());
+#else
+    return "/tmp/insidingforfeds_selftest_" + to_string(getpid()) + ".sock";
+#endif
+}
+
+// the real server and client in one process, a handler that does what the
+// app's does with a macro loop behind it: how long a command takes to come
+// back and to reach the worker
+static int runSelfTest(const BenchArgs &args) {
+    long rounds = args.getInt("--rounds", 1000);
+    MacroControl control;
+    StampSink sink;
+    // a 400us cycle, so a disabled macro is parked again well before the
+    // next round
+    vector<MacroStep> tapI = { stepKeyDown('I'), stepWaitUs(200), stepKeyUp('I'), stepWaitUs(200) };
+    vector<MacroStep> tapO = { stepKeyDown('O'), stepWaitUs(200), stepKeyUp('O'), stepWaitUs(200) };
+    CompiledProgram<RecordedEvent> programs[2];
+    TimelineSet<RecordedEvent> sets[2];
+    string error;
+    compileMacroProgram(sink, tapI, programs[0], error);
+    compileMacroProgram(sink, tapO, programs[1], error);
+    for (int i = 0; i < 2; ++i) {
+        sets[i].programs[0] = &programs[i];
+        sets[i].count = 1;
+    }
+    SwitchableTimelines source;
+    source.current.store(&sets[0]);
+
+    ControlServer server;
+    const string name = args.get("--name", selfTestName());
+    if (!server.open(name, error)) {
+        cerr << error << "\n";
+        return 2;
+    }
+    ControlHandler handler = [&](const ControlRequest &req) {
+        ControlReply r{};
+        r.op = req.op;
+        switch (static_cast<ControlOp>(req.op)) {
+        case ControlOp::Enable:
+        case ControlOp::Disable:
+            if (req.timeline >= 1) r.status = static_cast<uint8_t>(ControlStatus::BadRequest);
+            else control.pushCommand(req.op == static_cast<uint8_t>(ControlOp::Enable) ? BindEdge::On : BindEdge::Off, monotonicNowNs(), req.timeline);
+            break;
+        case ControlOp::SetMode:
+            source.current.store(&sets[req.kind == static_cast<uint8_t>(MacroMode::ThirdPerson) ? 1 : 0]);
+            control.wake.signal();
+            break;
+        case ControlOp::QueryStats:
+            fillControlStats(control, nullptr, r);
+            break;
+        case ControlOp::Shutdown:
+            control.requestStop();
+            break;
+        default:
+            r.status = static_cast<uint8_t>(ControlStatus::BadRequest);
+        }
+        r.enabled = control.enabled.load() ? 1 : 0;
+        r.timelines = 1;
+        return r;
+    };
+    thread serverThread([&] { server.run(handler); });
+    thread worker([&] {
+        DeadlineScheduler sched;
+        runMacroTimelines(sink, sched, source, control);
+    });
+
+    ControlClient client;
+    if (!client.connect(name, error)) {
+        cerr << error << "\n";
+        control.requestStop();
+        server.stop();
+        worker.join();
+        serverThread.join();
+        return 2;
+    }
+    LatencyHistogram roundTrip, toFirstEmit, toWorkerOff;
+    uint64_t failures = 0;
+    auto send = [&](ControlOp op, uint8_t timeline, uint8_t kind, ControlReply &reply) {
+        ControlRequest req{ static_cast<uint8_t>(op), timeline, kind, 0, 0 };
+        int64_t t0 = monotonicNowNs();
+        if (!client.request(req, reply)) return int64_t(-1);
+        roundTrip.record(monotonicNowNs() - t0);
+        return t0;
+    };
+    for (long i = 0; i < rounds; ++i) {
+        ControlReply reply;
+        uint64_t before = sink.frames();
+        sink.arm();
+        int64_t t0 = send(ControlOp::Enable, 0, 0, reply);
+        if (t0 < 0 || reply.status != 0 || !spinFor([&] { return sink.frames() > before; }, 1000000000)) {
+            ++failures;
+            continue;
+        }
+        toFirstEmit.record(sink.firstNs() - t0);
+        t0 = send(ControlOp::Disable, 0, 0, reply);
+        if (t0 < 0 || reply.status != 0 || !spinFor([&] { return !control.enabled.load(); }, 1000000000)) {
+            ++failures;
+            continue;
+        }
+        toWorkerOff.record(monotonicNowNs() - t0);
+        // the one cycle a trigger always gets has to run out
+        sleepMs(2);
+        if (i % 100 == 99) send(ControlOp::SetMode, 0, static_cast<uint8_t>(i % 200 == 99 ? MacroMode::ThirdPerson : MacroMode::FirstPerson), reply);
+    }
+
+    // what the app must refuse and what it reports
+    ControlReply bad, badLine, stats, bye;
+    ControlRequest junk{ 99, 0, 0, 0, 0 };
+    bool badOk = client.request(junk, bad) && bad.status == static_cast<uint8_t>(ControlStatus::BadRequest);
+    bool lineOk = send(ControlOp::Enable, 3, 0, badLine) >= 0 && badLine.status == static_cast<uint8_t>(ControlStatus::BadRequest);
+    bool statsOk = send(ControlOp::QueryStats, 0, 0, stats) >= 0 && stats.status == 0 && (rounds == 0 || stats.stats.triggerToEmitP50Ns > 0);
+    bool byeOk = send(ControlOp::Shutdown, 0, 0, bye) >= 0 && bye.status == 0;
+    // the worker has to be gone soon after, the shutdown is the test
+    bool workerGone = spinFor([&] { return control.stop.load(); }, 1000000000);
+    worker.join();
+    client.close();
+    server.stop();
+    serverThread.join();
+
+    JsonWriter json;
+    json.beginObject();
+    json.field("bench", "control");
+    json.field("rounds", static_cast<int64_t>(rounds));
+    json.field("failures", static_cast<int64_t>(failures));
+    json.field("rejects_bad_op", badOk ? "yes" : "no");
+    json.field("rejects_bad_timeline", lineOk ? "yes" : "no");
+    json.field("stats_reply", statsOk ? "yes" : "no");
+    json.field("shutdown", byeOk && workerGone ? "yes" : "no");
+    json.histogram("round_trip", roundTrip);
+    json.histogram("enable_to_first_emit", toFirstEmit);
+    json.histogram("disable_to_worker_off", toWorkerOff);
+    json.endObject();
+    fprintf(stderr, "%ld rounds, %llu failed: round trip p50 %.1fus p99 %.1fus, enable->first emit p50 %.1fus p99 %.1fus, disable->worker off p50 %.1fus p99 %.1fus\n",
+        rounds, static_cast<unsigned long long>(failures), roundTrip.percentile(50) / 1000.0, roundTrip.percentile(99) / 1000.0,
+        toFirstEmit.percentile(50) / 1000.0, toFirstEmit.percentile(99) / 1000.0, toWorkerOff.percentile(50) / 1000.0, toWorkerOff.percentile(99) / 1000.0);
+    if (!writeBenchOutput(args.get("--out", "-"), json.str())) return 1;
+    return failures == 0 && badOk && lineOk && statsOk && byeOk && workerGone ? 0 : 1;
+}
+
+int runControlBench(const BenchArgs &args) {
+    if (args.has("--selftest")) return runSelfTest(args);
+    ControlRequest req;
+    if (!parseCommand(words(args), req)) {
+        cerr << "control enable|disable [n], mode first|third|custom [n], bind <vk>|left|right|middle|x1|x2 [n], stats, shutdown\n";
+        return 2;
+    }
+    ControlClient client;
+    string error;
+    if (!client.connect(args.get("--name", defaultControlName()), error)) {
+        cerr << error << "\n";
+        return 2;
+    }
+    ControlReply reply;
+    if (!client.request(req, reply)) {
+        cerr << "the macro hung up\n";
+        return 1;
+    }
+    JsonWriter json;
+    json.beginObject();
+    replyJson(json, reply);
+    json.endObject();
+    if (!writeBenchOutput(args.get("--out", "-"), json.str())) return 1;
+    return reply.status == static_cast<uint8_t>(ControlStatus::Ok) ? 0 : 1;
+}
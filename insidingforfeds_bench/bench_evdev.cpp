@@ -0,0 +1,315 @@
+#include "bench_common.h"
+#include "evdev_monitor.h"
+
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+#ifdef __linux__
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+#ifdef __linux__
+
+static vector<long> parseList(const string &s) {
+    vector<long> r;
+    stringstream ss(s);
+    string item;
+    while (getline(ss, item, ',')) {
+        if (!item.empty()) r.push_back(strtol(item.c_str(), nullptr, 10));
+    }
+    return r;
+}
+
+// pops edges the way the worker would, until done is set and the ring is
+// empty. counts per timeline and direction
+struct EdgeDrain {
+    MacroControl &control;
+    atomic<bool> done{false};
+    uint64_t counts[2][2] = {};
+    bool print = false;
+
+    explicit EdgeDrain(MacroControl &c) : control(c) {}
+
+    void run() {
+        for (;;) {
+            uint32_t seen = control.wake.sequence();
+            TriggerEdge e;
+            bool any = false;
+            while (control.edges.pop(e)) {
+                any = true;
+                if (e.timeline < 2) counts[e.timeline][e.edge == BindEdge::Down ? 0 : 1]++;
+                if (print) fprintf(stderr, "timeline %u %s\n", e.timeline, e.edge == BindEdge::Down ? "down" : "up");
+            }
+            if (!any && done.load()) return;
+            control.wake.wait(seen, monotonicNowNs() + 10000000);
+        }
+    }
+};
+
+static void putEvent(input_event *out, size_t &n, uint16_t type, uint16_t code, int32_t value) {
+    input_event &ev = out[n++];
+    memset(&ev, 0, sizeof(ev));
+    ev.type = type;
+    ev.code = code;
+    ev.value = value;
+}
+
+// the reader has to find the fifo through inotify and open it before a
+// writer can, so this doubles as the hotplug check
+static int openWriter(const string &path) {
+    for (int attempt = 0; attempt < 200; ++attempt) {
+        int fd = open(path.c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+        if (fd >= 0) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+            return fd;
+        }
+        sleepMs(10);
+    }
+    return -1;
+}
+
+template <class Pred>
+static bool waitFor(Pred pred, int ms) {
+    for (int i = 0; i < ms && !pred(); ++i) sleepMs(1);
+    return pred();
+}
+
+// fifos stand in for event nodes: the monitor watches a temp folder with
+// anyNode set, the fifos are created after it started and fed input_event
+// reports, mostly mouse motion with a bind press now and then
+static bool runSynthetic(JsonWriter &json, int deviceCount, long reports, uint32_t seed) {
+    char dir[] = "/tmp/insidingforfeds_evdev_XXXXXX";
+    if (!mkdtemp(dir)) {
+        cerr << "mkdtemp: " << strerror(errno) << "\n";
+        return false;
+    }
+    MacroControl control;
+    EvdevMonitor monitor(control);
+    EvdevMonitorOptions options;
+    options.dir = dir;
+    options.anyNode = true;
+    string error;
+    if (!monitor.open(options, error)) {
+        cerr << error << "\n";
+        rmdir(dir);
+        return false;
+    }
+    BindMatcher matcher;
+    matcher.bindKey('I', 0);
+    matcher.bindMouse(MouseButton::X2, 1);
+    monitor.setMatcher(&matcher);
+
+    int64_t monitorCpuNs = 0;
+    thread reader([&] {
+        int64_t start = threadCpuTimeNs();
+        monitor.run();
+        monitorCpuNs = threadCpuTimeNs() - start;
+    });
+    EdgeDrain drain(control);
+    thread drainer([&] { drain.run(); });
+
+    vector<string> paths;
+    vector<int> writers;
+    bool hotplugOk = true;
+    for (int i = 0; i < deviceCount; ++i) {
+        paths.push_back(string(dir) + "/event" + to_string(i));
+        if (mkfifo(paths.back().c_str(), 0600) < 0) {
+            hotplugOk = false;
+            break;
+        }
+        int fd = openWriter(paths.back());
+        if (fd < 0) {
+            hotplugOk = false;
+            break;
+        }
+        writers.push_back(fd);
+    }
+
+    mt19937 rng(seed);
+    uint64_t sentEvents = 0, sentEdges[2][2] = {};
+    bool keyDown[2] = {};
+    if (hotplugOk) {
+        for (long r = 0; r < reports; ++r) {
+            input_event buf[4];
+            size_t n = 0;
+            if (r % 8 == 7) {
+                // alternate the two binds, each pressing and releasing in turn
+                int line = static_cast<int>((r / 8) % 2);
+                keyDown[line] = !keyDown[line];
+                putEvent(buf, n, EV_KEY, line == 0 ? KEY_I : BTN_EXTRA, keyDown[line] ? 1 : 0);
+                sentEdges[line][keyDown[line] ? 0 : 1]++;
+            } else {
+                putEvent(buf, n, EV_REL, REL_X, static_cast<int32_t>(rng() % 7) - 3);
+                putEvent(buf, n, EV_REL, REL_Y, static_cast<int32_t>(rng() % 7) - 3);
+            }
+            putEvent(buf, n, EV_SYN, SYN_REPORT, 0);
+            int fd = writers[rng() % writers.size()];
+            if (write(fd, buf, n * sizeof(input_event)) != static_cast<ssize_t>(n * sizeof(input_event))) break;
+            sentEvents += n;
+            // real devices trickle; let the reader and the drain keep up so
+            // the edge ring measures the monitor and not a one-cpu box
+            if (r % 64 == 63) this_thread::sleep_for(chrono::microseconds(50));
+        }
+    }
+    bool allRead = waitFor([&] { return monitor.events.load() >= sentEvents; }, 5000);
+    int opened = monitor.deviceCount();
+    // a writer going away is the fifo's unplug
+    for (int fd : writers) close(fd);
+    bool unplugOk = waitFor([&] { return monitor.deviceCount() == 0; }, 2000);
+    monitor.stop();
+    reader.join();
+    drain.done.store(true);
+    control.wake.signal();
+    drainer.join();
+    for (const string &p : paths) unlink(p.c_str());
+    rmdir(dir);
+
+    uint64_t received = monitor.events.load(), wakes = monitor.wakes.load(), dropped = control.droppedEdges.load();
+    uint64_t sentTotal = 0, gotTotal = 0;
+    bool edgesOk = true;
+    for (int line = 0; line < 2; ++line) {
+        for (int side = 0; side < 2; ++side) {
+            sentTotal += sentEdges[line][side];
+            gotTotal += drain.counts[line][side];
+        }
+    }
+    // a full ring drops, but never loses track of one
+    if (gotTotal + dropped != sentTotal) edgesOk = false;
+    if (!dropped) {
+        for (int line = 0; line < 2; ++line) {
+            for (int side = 0; side < 2; ++side) edgesOk = edgesOk && drain.counts[line][side] == sentEdges[line][side];
+        }
+    }
+    double nsPerEvent = received ? static_cast<double>(monitorCpuNs) / static_cast<double>(received) : 0.0;
+    double eventsPerWake = wakes ? static_cast<double>(received) / static_cast<double>(wakes) : 0.0;
+
+    json.beginObject();
+    json.field("devices", static_cast<int64_t>(deviceCount));
+    json.field("devices_opened", static_cast<int64_t>(opened));
+    json.field("hotplug_ok", hotplugOk ? "yes" : "no");
+    json.field("unplug_ok", unplugOk ? "yes" : "no");
+    json.field("sent_events", static_cast<int64_t>(sentEvents));
+    json.field("read_events", static_cast<int64_t>(received));
+    json.field("sent_edges", static_cast<int64_t>(sentTotal));
+    json.field("queued_edges", static_cast<int64_t>(gotTotal));
+    json.field("dropped_edges", static_cast<int64_t>(dropped));
+    json.field("wakes", static_cast<int64_t>(wakes));
+    json.field("events_per_wake", eventsPerWake);
+    json.field("monitor_cpu_ns_per_event", nsPerEvent);
+    json.histogram("dispatch", monitor.dispatch);
+    json.endObject();
+
+    fprintf(stderr, "%3d devices: %llu/%llu events in %llu wakes (%.1f per wake), %.0f ns cpu/event, dispatch p50 %.2fus p99 %.2fus, edges %llu/%llu (%llu dropped)%s%s\n",
+        deviceCount, static_cast<unsigned long long>(received), static_cast<unsigned long long>(sentEvents), static_cast<unsigned long long>(wakes), eventsPerWake,
+        nsPerEvent, monitor.dispatch.percentile(50) / 1000.0, monitor.dispatch.percentile(99) / 1000.0,
+        static_cast<unsigned long long>(gotTotal), static_cast<unsigned long long>(sentTotal), static_cast<unsigned long long>(dropped),
+        hotplugOk ? "" : ", HOTPLUG MISSED", unplugOk ? "" : ", UNPLUG MISSED");
+    return hotplugOk && unplugOk && allRead && received == sentEvents && edgesOk;
+}
+
+static bool parseButton(const string &name, MouseButton &out) {
+    static const struct { const char *name; MouseButton mb; } kNames[] = {
+        { "left", MouseButton::Left }, { "right", MouseButton::Right }, { "middle", MouseButton::Middle },
+        { "x1", MouseButton::X1 }, { "x2", MouseButton::X2 },
+    };
+    for (const auto &n : kNames) {
+        if (name == n.name) { out = n.mb; return true; }
+    }
+    return false;
+}
+
+// the real thing: every keyboard and mouse on the machine, edges printed as
+// the worker would get them
+static int runLive(const BenchArgs &args) {
+    BindMatcher matcher;
+    if (args.has("--vk")) {
+        matcher.bindKey(static_cast<int>(args.getInt("--vk", 0)));
+    } else {
+        MouseButton mb;
+        if (!parseButton(args.get("--mouse", "x1"), mb)) {
+            cerr << "--mouse: left, right, middle, x1 or x2\n";
+            return 2;
+        }
+        matcher.bindMouse(mb);
+    }
+    MacroControl control;
+    EvdevMonitor monitor(control);
+    EvdevMonitorOptions options;
+    options.grab = args.has("--grab");
+    string error;
+    if (!monitor.open(options, error)) {
+        cerr << error << "\n";
+        return 2;
+    }
+    if (monitor.deviceCount() == 0) {
+        cerr << "no keyboard or mouse readable under /dev/input (needs root or the input group)\n";
+        return 2;
+    }
+    fprintf(stderr, "listening on %d devices%s\n", monitor.deviceCount(), options.grab ? ", grabbed" : "");
+    monitor.setMatcher(&matcher);
+    thread reader([&] { monitor.run(); });
+    EdgeDrain drain(control);
+    drain.print = true;
+    thread drainer([&] { drain.run(); });
+    sleepMs(static_cast<int>(args.getInt("--seconds", 10) * 1000));
+    monitor.stop();
+    reader.join();
+    drain.done.store(true);
+    control.wake.signal();
+    drainer.join();
+
+    JsonWriter json;
+    json.beginObject();
+    json.field("bench", "evdev");
+    json.field("devices", static_cast<int64_t>(monitor.deviceCount()));
+    json.field("events", static_cast<int64_t>(monitor.events.load()));
+    json.histogram("kernel_to_queue", control.latency.hookDelivery);
+    json.histogram("dispatch", monitor.dispatch);
+    json.endObject();
+    fprintf(stderr, "kernel -> queue p50 %.1fus p99 %.1fus, dispatch p99 %.2fus\n", control.latency.hookDelivery.percentile(50) / 1000.0,
+        control.latency.hookDelivery.percentile(99) / 1000.0, monitor.dispatch.percentile(99) / 1000.0);
+    return writeBenchOutput(args.get("--out", "-"), json.str()) ? 0 : 1;
+}
+
+int runEvdevBench(const BenchArgs &args) {
+    if (args.has("--live")) return runLive(args);
+    vector<long> counts = parseList(args.get("--devices", "1,8,64"));
+    long reports = args.getInt("--reports", 20000);
+    uint32_t seed = static_cast<uint32_t>(args.getInt("--seed", 1));
+
+    JsonWriter json;
+    json.beginObject();
+    json.field("bench", "evdev");
+    json.field("reports", static_cast<int64_t>(reports));
+    json.beginArray("runs");
+    bool ok = true;
+    for (long n : counts) {
+        if (n < 1 || n > EvdevMonitor::kMaxDevices) {
+            cerr << "--devices: 1-" << EvdevMonitor::kMaxDevices << " each\n";
+            return 2;
+        }
+        ok = runSynthetic(json, static_cast<int>(n), reports, seed) && ok;
+    }
+    json.endArray();
+    json.endObject();
+    if (!writeBenchOutput(args.get("--out", "-"), json.str())) return 1;
+    return ok ? 0 : 1;
+}
+
+#else
+
+int runEvdevBench(const BenchArgs &args) {
+    (void)args;
+    cerr << "evdev is the linux trigger source, linux only\n";
+    return 2;
+}
+
+#endif
@@ -0,0 +1,146 @@
+#include "bench_common.h"
+#include "thread_roles.h"
+#include "trace_recorder.h"
+#include "shared_stats.h"
+#include "macro_timelines.h"
+
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+
+static vector<long> parseList(const string &s) {
+    vector<long> r;
+    stringstream ss(s);
+    string item;
+    while (getline(ss, item, ',')) {
+        if (!item.empty()) r.push_back(strtol(item.c_str(), nullptr, 10));
+    }
+    return r;
+}
+
+static void runOne(JsonWriter &json, const string &name, const vector<MacroStep> &steps, long stepUs, long loadThreads, long cycles, TimerBackend backend, int64_t spinNs, const RealtimeProfile &profile, TraceRing *trace, SharedStatsBlock *stats) {
+    RecordingSink recorder(static_cast<size_t>(cycles) * 8 + 64);
+    MacroControl control;
+    control.trace = trace;
+    control.stats = stats;
+    CompiledProgram<RecordedEvent> program;
+    string error;
+    if (!compileMacroProgram(recorder, steps, program, error)) {
+        cerr << name << ": " << error << "\n";
+        return;
+    }
+    StopAfterSink<RecordingSink> sink(recorder, control, static_cast<uint64_t>(cycles) * program.frames.size());
+    TimelineSet<RecordedEvent> set;
+    set.programs[0] = &program;
+    set.count = 1;
+    FixedTimelines<RecordedEvent> source{ set };
+
+    int64_t cpuNs = 0;
+    int64_t wallNs = 0;
+    string granted;
+    {
+        CpuLoad load(static_cast<int>(loadThreads));
+        control.pushEdge(BindEdge::Down, monotonicNowNs(), 0);
+        thread worker([&] {
+            granted = applyThreadRole(ThreadRole::Worker, profile);
+            DeadlineScheduler sched(backend, spinNs);
+            int64_t cpu0 = threadCpuTimeNs();
+            int64_t wall0 = monotonicNowNs();
+            runMacroTimelines(sink, sched, source, control);
+            cpuNs = threadCpuTimeNs() - cpu0;
+            wallNs = monotonicNowNs() - wall0;
+        });
+        worker.join();
+    }
+
+    const vector<RecordedEvent> &ev = recorder.events();
+    const size_t perCycle = program.records.size();
+    LatencyHistogram cycleError;
+    int64_t drift = 0;
+    if (ev.size() >= perCycle * static_cast<size_t>(cycles) && cycles > 1) {
+        for (long k = 1; k < cycles; ++k) {
+            int64_t period = ev[k * perCycle].timeNs - ev[(k - 1) * perCycle].timeNs;
+            int64_t err = period - program.periodNs;
+            cycleError.record(err < 0 ? -err : err);
+        }
+        drift = ev[(cycles - 1) * perCycle].timeNs - ev[0].timeNs - (cycles - 1) * program.periodNs;
+    }
+
+    json.beginObject();
+    json.field("program", name);
+    json.field("step_us", static_cast<int64_t>(stepUs));
+    json.field("load_threads", static_cast<int64_t>(loadThreads));
+    json.field("worker_role", granted);
+    json.field("period_ns", program.periodNs);
+    json.field("events", static_cast<int64_t>(ev.size()));
+    json.histogram("cycle_error", cycleError);
+    json.histogram("step_jitter", control.latency.stepJitter);
+    json.field("drift_ns", drift);
+    json.field("wall_ns", wallNs);
+    json.field("worker_cpu_ns", cpuNs);
+    json.field("worker_cpu_pct", wallNs ? 100.0 * static_cast<double>(cpuNs) / static_cast<double>(wallNs) : 0.0);
+    json.endObject();
+
+    fprintf(stderr, "%-6s step %5ldus load %2ld: cycle err p99 %8.1fus max %8.1fus, jitter p99 %8.1fus, drift %8.1fus, cpu %5.1f%%\n",
+        name.c_str(), stepUs, loadThreads, cycleError.percentile(99) / 1000.0, cycleError.max() / 1000.0,
+        control.latency.stepJitter.percentile(99) / 1000.0, drift / 1000.0,
+        wallNs ? 100.0 * static_cast<double>(cpuNs) / static_cast<double>(wallNs) : 0.0);
+}
+
+int runJitterBench(const BenchArgs &args) {
+    long cycles = args.getInt("--cycles", 100);
+    vector<long> delaysMs = parseList(args.get("--delays", "1,2,4,5,10"));
+    long hw = static_cast<long>(thread::hardware_concurrency());
+    vector<long> loads = parseList(args.get("--load", "0," + to_string(hw > 0 ? hw : 4)));
+    string programs = args.get("--programs", "first,third");
+    TimerBackend backend = defaultTimerBackend();
+    if (!parseBackendName(args.get("--backend", "default"), backend)) {
+        cerr << "unknown backend\n";
+        return 2;
+    }
+    int64_t spinNs = args.getInt("--spin-us", kDefaultSpinNs / 1000) * 1000;
+    RealtimeProfile profile;
+    profile.realtime = args.has("--realtime");
+    profile.workerCpu = static_cast<int>(args.getInt("--pin", -1));
+    profile.lockMemory = args.has("--lock-memory");
+    // lets `insidingforfeds_bench stats` watch a bench run like the real app
+    SharedStats stats;
+    if (args.has("--shared-stats")) {
+        string error;
+        if (!stats.create(error)) {
+            cerr << error << "\n";
+            return 2;
+        }
+    }
+    TraceRing trace;
+    string tracePath = args.get("--trace", "");
+    if (!tracePath.empty()) {
+        string error;
+        if (!trace.open(tracePath, static_cast<uint64_t>(args.getInt("--trace-records", 1 << 20)), error)) {
+            cerr << error << "\n";
+            return 2;
+        }
+    }
+
+    DeadlineScheduler probe(backend, spinNs);
+    JsonWriter json;
+    json.beginObject();
+    json.field("bench", "jitter");
+    json.field("backend", timerBackendName(probe.backend()));
+    json.field("spin_ns", spinNs);
+    json.field("process_role", applyProcessProfile(profile));
+    json.field("cycles", static_cast<int64_t>(cycles));
+    json.beginArray("runs");
+    for (long load : loads) {
+        for (long ms : delaysMs) {
+            int stepUs = static_cast<int>(ms * 1000);
+            if (programs.find("first") != string::npos) runOne(json, "first", makeFirstPersonSteps(stepUs), stepUs, load, cycles, backend, spinNs, profile, trace.isOpen() ? &trace : nullptr, stats.block());
+            if (programs.find("third") != string::npos) runOne(json, "third", makeThirdPersonSteps(stepUs), stepUs, load, cycles, backend, spinNs, profile, trace.isOpen() ? &trace : nullptr, stats.block());
+        }
+    }
+    json.endArray();
+    json.endObject();
+    return writeBenchOutput(args.get("--out", "-"), json.str()) ? 0 : 1;
+}
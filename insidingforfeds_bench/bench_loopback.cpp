@@ -0,0 +1,291 @@
+#include "bench_common.h"
+#include "thread_roles.h"
+#include "macro_timelines.h"
+
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+
+#ifdef __linux__
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#endif
+
+using namespace std;
+
+#ifdef __linux__
+
+static const uint64_t kFnvOffset = 1469598103934665603ULL;
+
+// fingerprint of one report: every (type, code, value) in order, SYN left out
+static uint64_t hashEvent(uint64_t h, uint16_t type, uint16_t code, int32_t value) {
+    uint64_t parts[3] = { type, code, static_cast<uint32_t>(value) };
+    for (uint64_t p : parts) {
+        h ^= p;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+struct SentReport {
+    int64_t emitNs;
+    int64_t returnNs;
+    uint64_t hash;
+};
+
+struct ReceivedReport {
+    int64_t kernelNs;
+    int64_t readNs;
+    uint64_t hash;
+};
+
+// stamps and fingerprints every batch on its way to uinput. each batch is
+// one SYN_REPORT on the other side, so the n-th report read back belongs to
+// the n-th batch sent and the fingerprints have to agree.
+class StampingSink {
+public:
+    using Record = UinputRecord;
+
+    StampingSink(UinputSink &inner, vector<SentReport> &sent) : inner_(inner), sent_(sent) {}
+
+    Record prepare(SinkEventType type, int32_t value) const { return inner_.prepare(type, value); }
+    void emit(const Record *records, size_t count) {
+        uint64_t h = kFnvOffset;
+        size_t events = 0;
+        for (size_t i = 0; i < count; ++i) {
+            for (uint8_t j = 0; j < records[i].count; ++j) h = hashEvent(h, records[i].ev[j].type, records[i].ev[j].code, records[i].ev[j].value);
+            events += records[i].count;
+        }
+        SentReport r{ monotonicNowNs(), 0, h };
+        inner_.emit(records, count);
+        r.returnNs = monotonicNowNs();
+        // uinput sends nothing for a batch with no mapped keys
+        if (events && sent_.size() < sent_.capacity()) sent_.push_back(r);
+    }
+    void emit(const Record &r) { emit(&r, 1); }
+
+private:
+    UinputSink &inner_;
+    vector<SentReport> &sent_;
+};
+
+// reads reports off the grabbed event node until `target` of them are in,
+// or stop is set and nothing arrived for a while
+static void readReports(int fd, const atomic<size_t> &target, const atomic<bool> &stop, vector<ReceivedReport> &out, uint64_t &dropped) {
+    input_event buf[64];
+    uint64_t h = kFnvOffset;
+    bool skipping = false;
+    int idlePolls = 0;
+    while (out.size() < target.load()) {
+        pollfd p{ fd, POLLIN, 0 };
+        if (poll(&p, 1, 100) <= 0) {
+            if (stop.load() && ++idlePolls >= 10) break;
+            continue;
+        }
+        idlePolls = 0;
+        ssize_t n = read(fd, buf, sizeof(buf));
+        int64_t now = monotonicNowNs();
+        if (n <= 0) continue;
+        for (size_t i = 0; i < static_cast<size_t>(n) / sizeof(input_event); ++i) {
+            const input_event &ev = buf[i];
+            if (ev.type == EV_SYN && ev.code == SYN_DROPPED) {
+                // the kernel threw away our buffer, everything up to the next
+                // report is incomplete
+                ++dropped;
+                skipping = true;
+                continue;
+            }
+            if (ev.type == EV_SYN && ev.code == SYN_REPORT) {
+                if (!skipping && out.size() < out.capacity()) {
+                    int64_t kernelNs = static_cast<int64_t>(ev.input_event_sec) * 1000000000LL + static_cast<int64_t>(ev.input_event_usec) * 1000;
+                    out.push_back(ReceivedReport{ kernelNs, now, h });
+                }
+                skipping = false;
+                h = kFnvOffset;
+                continue;
+            }
+            if (ev.type == EV_SYN || ev.type == EV_MSC) continue;
+            h = hashEvent(h, ev.type, ev.code, ev.value);
+        }
+    }
+}
+
+// the event node shows up a moment after UI_DEV_CREATE and udev may still be
+// fixing its permissions, keep trying for a bit
+static int openEventNode(const UinputSink &sink, string &node) {
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        node = sink.eventNode();
+        if (!node.empty()) {
+            int fd = open(node.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+            if (fd >= 0) return fd;
+        }
+        sleepMs(20);
+    }
+    return -1;
+}
+
+static vector<long> parseList(const string &s) {
+    vector<long> r;
+    stringstream ss(s);
+    string item;
+    while (getline(ss, item, ',')) {
+        if (!item.empty()) r.push_back(strtol(item.c_str(), nullptr, 10));
+    }
+    return r;
+}
+
+static bool runOne(JsonWriter &json, UinputSink &device, int fd, const string &name, const vector<MacroStep> &steps, long stepUs, long cycles, const RealtimeProfile &profile) {
+    vector<SentReport> sent;
+    vector<ReceivedReport> received;
+    MacroControl control;
+    StampingSink stamping(device, sent);
+    CompiledProgram<UinputRecord> program;
+    string error;
+    if (!compileMacroProgram(stamping, steps, program, error)) {
+        cerr << name << ": " << error << "\n";
+        return false;
+    }
+    const size_t frames = program.frames.size();
+    const size_t batches = static_cast<size_t>(cycles) * frames;
+    // plus the release batch at the end
+    sent.reserve(batches + 8);
+    received.reserve(batches + 8);
+    StopAfterSink<StampingSink> sink(stamping, control, batches);
+
+    // whatever is still queued from the previous run
+    input_event junk[64];
+    while (read(fd, junk, sizeof(junk)) > 0) {}
+
+    atomic<size_t> target{ static_cast<size_t>(-1) };
+    atomic<bool> senderDone{false};
+    uint64_t dropped = 0;
+    string readerRole;
+    thread reader([&] {
+        readerRole = applyThreadRole(ThreadRole::Hook, profile);
+        readReports(fd, target, senderDone, received, dropped);
+    });
+    TimelineSet<UinputRecord> set;
+    set.programs[0] = &program;
+    set.count = 1;
+    FixedTimelines<UinputRecord> source{ set };
+    control.pushEdge(BindEdge::Down, monotonicNowNs(), 0);
+    thread worker([&] {
+        applyThreadRole(ThreadRole::Worker, profile);
+        DeadlineScheduler sched;
+        runMacroTimelines(sink, sched, source, control);
+    });
+    worker.join();
+    target.store(sent.size());
+    senderDone.store(true);
+    reader.join();
+
+    LatencyHistogram toKernel, toRead, writeCall, kernelSpacing, readSpacing;
+    size_t paired = min(sent.size(), received.size());
+    size_t mismatched = 0;
+    for (size_t i = 0; i < paired; ++i) {
+        if (sent[i].hash != received[i].hash) {
+            // pairing is off from here on, numbers past this point would lie
+            mismatched = paired - i;
+            paired = i;
+            break;
+        }
+        toKernel.record(received[i].kernelNs - sent[i].emitNs);
+        toRead.record(received[i].readNs - sent[i].emitNs);
+        writeCall.record(sent[i].returnNs - sent[i].emitNs);
+        // spacing as the consumer sees it against the configured step, the
+        // final release batch has no configured slot
+        if (i == 0 || i >= batches) continue;
+        const CompiledFrame &cur = program.frames[i % frames];
+        const CompiledFrame &prev = program.frames[(i - 1) % frames];
+        int64_t configured = cur.atNs - prev.atNs + (i % frames == 0 ? program.periodNs : 0);
+        int64_t kernelGap = received[i].kernelNs - received[i - 1].kernelNs - configured;
+        int64_t readGap = received[i].readNs - received[i - 1].readNs - configured;
+        kernelSpacing.record(kernelGap < 0 ? -kernelGap : kernelGap);
+        readSpacing.record(readGap < 0 ? -readGap : readGap);
+    }
+    size_t lost = sent.size() > received.size() ? sent.size() - received.size() : 0;
+
+    json.beginObject();
+    json.field("program", name);
+    json.field("step_us", static_cast<int64_t>(stepUs));
+    json.field("reader_role", readerRole);
+    json.field("sent_reports", static_cast<int64_t>(sent.size()));
+    json.field("received_reports", static_cast<int64_t>(received.size()));
+    json.field("matched", static_cast<int64_t>(paired));
+    json.field("mismatched", static_cast<int64_t>(mismatched));
+    json.field("lost", static_cast<int64_t>(lost));
+    json.field("syn_dropped", static_cast<int64_t>(dropped));
+    json.histogram("write_call", writeCall);
+    json.histogram("emit_to_kernel", toKernel);
+    json.histogram("emit_to_read", toRead);
+    json.histogram("kernel_spacing_error", kernelSpacing);
+    json.histogram("read_spacing_error", readSpacing);
+    json.endObject();
+
+    fprintf(stderr, "%-6s step %5ldus: %zu/%zu matched, emit->read p50 %7.1fus p99 %7.1fus max %7.1fus, read spacing err p99 %7.1fus, write p99 %6.1fus\n",
+        name.c_str(), stepUs, paired, sent.size(), toRead.percentile(50) / 1000.0, toRead.percentile(99) / 1000.0, toRead.max() / 1000.0,
+        readSpacing.percentile(99) / 1000.0, writeCall.percentile(99) / 1000.0);
+    return mismatched == 0 && lost == 0 && dropped == 0;
+}
+
+int runLoopbackBench(const BenchArgs &args) {
+    long cycles = args.getInt("--cycles", 200);
+    vector<long> delaysMs = parseList(args.get("--delays", "1,4"));
+    string programs = args.get("--programs", "first,third");
+    RealtimeProfile profile;
+    profile.realtime = args.has("--realtime");
+
+    UinputSink device;
+    if (!device.open("insidingforfeds loopback")) {
+        cerr << "can't create a uinput device: " << strerror(errno) << " (needs write access to /dev/uinput: root, the input group or a udev rule, and the uinput module loaded)\n";
+        return 2;
+    }
+    string node;
+    int fd = openEventNode(device, node);
+    if (fd < 0) {
+        cerr << "can't open the event node of the loopback device" << (node.empty() ? string() : " " + node) << ": " << strerror(errno) << "\n";
+        return 2;
+    }
+    // grabbed, the keys only reach us and never the focused window
+    if (ioctl(fd, EVIOCGRAB, 1) < 0) {
+        cerr << "can't grab " << node << ": " << strerror(errno) << ", not typing into the desktop\n";
+        close(fd);
+        return 2;
+    }
+    int clock = CLOCK_MONOTONIC;
+    ioctl(fd, EVIOCSCLOCKID, &clock);
+
+    JsonWriter json;
+    json.beginObject();
+    json.field("bench", "loopback");
+    json.field("device", node);
+    json.field("process_role", applyProcessProfile(profile));
+    json.field("cycles", static_cast<int64_t>(cycles));
+    json.beginArray("runs");
+    bool ok = true;
+    for (long ms : delaysMs) {
+        int stepUs = static_cast<int>(ms * 1000);
+        if (programs.find("first") != string::npos) ok = runOne(json, device, fd, "first", makeFirstPersonSteps(stepUs), stepUs, cycles, profile) && ok;
+        if (programs.find("third") != string::npos) ok = runOne(json, device, fd, "third", makeThirdPersonSteps(stepUs), stepUs, cycles, profile) && ok;
+    }
+    json.endArray();
+    json.endObject();
+    ioctl(fd, EVIOCGRAB, 0);
+    close(fd);
+    if (!writeBenchOutput(args.get("--out", "-"), json.str())) return 1;
+    return ok ? 0 : 1;
+}
+
+#else
+
+int runLoopbackBench(const BenchArgs &args) {
+    (void)args;
+    cerr << "loopback reads the events back through evdev, linux only\n";
+    return 2;
+}
+
+#endif
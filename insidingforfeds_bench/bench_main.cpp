@@ -0,0 +1,71 @@
+#include "bench_common.h"
+
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+int runJitterBench(const BenchArgs &args);
+int runBindBench(const BenchArgs &args);
+int runTraceAnalyzer(const BenchArgs &args);
+int runSimBench(const BenchArgs &args);
+int runStatsReader(const BenchArgs &args);
+int runMultiBench(const BenchArgs &args);
+int runLoopbackBench(const BenchArgs &args);
+int runCalibrateBench(const BenchArgs &args);
+int runEvdevBench(const BenchArgs &args);
+int runControlBench(const BenchArgs &args);
+int runAllocBench(const BenchArgs &args);
+int runRecordBench(const BenchArgs &args);
+int runSoakBench(const BenchArgs &args);
+int runConsoleBench(const BenchArgs &args);
+int runWatchBench(const BenchArgs &args);
+
+static int usage() {
+    cerr << "usage: insidingforfeds_bench <bench> [options]\n"
+            "  jitter   [--cycles N] [--delays 1,2,4,5,10] [--load 0,8] [--programs first,third]\n"
+            "           [--backend default|event|waitable|futex] [--spin-us N] [--out file.json]\n"
+            "           [--realtime] [--pin cpu] [--lock-memory] [--trace file.trace] [--shared-stats]\n"
+            "  bind     [--events N] [--seed N] [--out file.json]\n"
+            "  trace    --in file.trace [--miss-us 500] [--chrome chrome.json] [--out file.json]\n"
+            "  sim      [--fuzz N] [--seed N] [--verbose] [--out file.json]\n"
+            "  multi    [--timelines 1,2,4,8,16] [--step-us 4000] [--stagger-us 0] [--sim-s 600] [--real-ms 1000] [--out file.json]\n"
+            "  loopback [--cycles N] [--delays 1,4] [--programs first,third] [--realtime] [--out file.json]   linux, uinput -> evdev\n"
+            "  evdev    [--devices 1,8,64] [--reports N] [--seed N] [--out file.json]   linux, fifos standing in for devices\n"
+            "  evdev    --live [--mouse x1 | --vk N] [--grab] [--seconds 10] [--out file.json]   linux, every keyboard and mouse\n"
+            "  calibrate [--samples 160] [--realtime] [--pin cpu] [--out timer_calibration.json]\n"
+            "  control  enable|disable [n] | mode first|third|custom [n] | bind <vk>|x1|x2|... [n] | stats | shutdown [--name pipe]\n"
+            "           talks to a running --headless / --control macro, prints the reply as json\n"
+            "  control  --selftest [--rounds 1000] [--out file.json]   server, client and macro loop in one process\n"
+            "  alloc    [--ms 1000] [--out file.json]   fails if the armed hook or macro step allocates\n"
+            "  record   [--quantum-us 1000] [--cycles 20] [--fuzz 2000] [--seed N] [--out file.json]   recorded -> compiled -> replayed\n"
+            "  record   --live [--quantum-us 1000] [--seconds 30] [--out file.json]   linux, records from the real devices until esc\n"
+            "  soak     [--seconds 3600] [--interval-s 10] [--warmup-s N] [--reload-s 5] [--step-us 500] [--out file.json]\n"
+            "           fails if memory, handles, threads, cpu or cycle drift grow over the run\n"
+            "  console  [--frames 500] [--seed N] [--out file.json]   status screen diffs against full repaints\n"
+            "  watch    [--quiet-ms 100] [--rounds 5] [--out file.json]   every way of saving the config is one reload\n"
+            "  stats    [--interval-ms 500] [--count N] [--json]   reads the live counters of a running macro\n";
+    return 2;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) return usage();
+    BenchArgs args;
+    for (int i = 2; i < argc; ++i) args.args.push_back(argv[i]);
+    if (strcmp(argv[1], "jitter") == 0) return runJitterBench(args);
+    if (strcmp(argv[1], "bind") == 0) return runBindBench(args);
+    if (strcmp(argv[1], "trace") == 0) return runTraceAnalyzer(args);
+    if (strcmp(argv[1], "sim") == 0) return runSimBench(args);
+    if (strcmp(argv[1], "stats") == 0) return runStatsReader(args);
+    if (strcmp(argv[1], "multi") == 0) return runMultiBench(args);
+    if (strcmp(argv[1], "loopback") == 0) return runLoopbackBench(args);
+    if (strcmp(argv[1], "calibrate") == 0) return runCalibrateBench(args);
+    if (strcmp(argv[1], "evdev") == 0) return runEvdevBench(args);
+    if (strcmp(argv[1], "control") == 0) return runControlBench(args);
+    if (strcmp(argv[1], "alloc") == 0) return runAllocBench(args);
+    if (strcmp(argv[1], "record") == 0) return runRecordBench(args);
+    if (strcmp(argv[1], "soak") == 0) return runSoakBench(args);
+    if (strcmp(argv[1], "console") == 0) return runConsoleBench(args);
+    if (strcmp(argv[1], "watch") == 0) return runWatchBench(args);
+    return usage();
+}
@@ -0,0 +1,138 @@
+#include "bench_common.h"
+#include "sim_harness.h"
+#include "macro_timelines.h"
+
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+
+// counts what the scheduler hands over and drops it, so the virtual runs
+// measure the scheduler and nothing else
+class CountingSink {
+public:
+    using Record = RecordedEvent;
+
+    Record prepare(SinkEventType type, int32_t value) const { return Record{ 0, type, value }; }
+    void emit(const Record *records, size_t count) {
+        (void)records;
+        events_ += count;
+        batches_++;
+    }
+
+    uint64_t events() const { return events_; }
+    uint64_t batches() const { return batches_; }
+
+private:
+    uint64_t events_ = 0;
+    uint64_t batches_ = 0;
+};
+
+// timeline i taps its own key every stepUs + i * staggerUs. one record per
+// frame, so frames sent = events and frames merged = events - batches.
+static vector<MacroStep> tapSteps(int line, long stepUs, long staggerUs) {
+    uint16_t vk = static_cast<uint16_t>('A' + line);
+    int32_t us = static_cast<int32_t>(stepUs + line * staggerUs);
+    return { stepKeyDown(vk), stepWaitUs(us), stepKeyUp(vk), stepWaitUs(us) };
+}
+
+template <class Sink>
+static void compileTimelines(Sink &sink, int n, long stepUs, long staggerUs, vector<CompiledProgram<RecordedEvent>> &programs, TimelineSet<RecordedEvent> &set) {
+    programs.resize(n);
+    string error;
+    for (int i = 0; i < n; ++i) {
+        compileMacroProgram(sink, tapSteps(i, stepUs, staggerUs), programs[i], error);
+        set.programs[i] = &programs[i];
+    }
+    set.count = n;
+}
+
+static vector<long> parseList(const string &s) {
+    vector<long> r;
+    stringstream ss(s);
+    string item;
+    while (getline(ss, item, ',')) {
+        if (!item.empty()) r.push_back(strtol(item.c_str(), nullptr, 10));
+    }
+    return r;
+}
+
+int runMultiBench(const BenchArgs &args) {
+    vector<long> counts = parseList(args.get("--timelines", "1,2,4,8,16"));
+    long stepUs = args.getInt("--step-us", 4000);
+    long staggerUs = args.getInt("--stagger-us", 0);
+    long simSeconds = args.getInt("--sim-s", 600);
+    long realMs = args.getInt("--real-ms", 1000);
+
+    JsonWriter json;
+    json.beginObject();
+    json.field("bench", "multi");
+    json.field("step_us", static_cast<int64_t>(stepUs));
+    json.field("stagger_us", static_cast<int64_t>(staggerUs));
+    json.beginArray("runs");
+    for (long n : counts) {
+        if (n < 1 || n > kMaxTimelines) {
+            cerr << "--timelines: 1-" << kMaxTimelines << " each\n";
+            return 2;
+        }
+        int lines = static_cast<int>(n);
+
+        // scheduling cost: every timeline held down for simSeconds of
+        // virtual time, no sleeping, so the wall time is all loop overhead
+        MacroControl control;
+        vector<SimInput> script;
+        for (int i = 0; i < lines; ++i) script.push_back(SimInput{ 0, SimInput::Down, static_cast<uint8_t>(i) });
+        VirtualScheduler virt(control, script, simSeconds * 1000000000LL);
+        CountingSink counter;
+        vector<CompiledProgram<RecordedEvent>> programs;
+        TimelineSet<RecordedEvent> set;
+        compileTimelines(counter, lines, stepUs, staggerUs, programs, set);
+        FixedTimelines<RecordedEvent> source{ set };
+        int64_t cpu0 = threadCpuTimeNs();
+        runMacroTimelines(counter, virt, source, control);
+        int64_t schedNs = threadCpuTimeNs() - cpu0;
+        double nsPerFrame = counter.events() ? static_cast<double>(schedNs) / static_cast<double>(counter.events()) : 0.0;
+
+        // the same on the real clock: how close to its deadline every step
+        // lands with n timelines sharing one thread
+        MacroControl live;
+        RecordingSink recorder(static_cast<size_t>(realMs) * 1000 / static_cast<size_t>(stepUs > 0 ? stepUs : 1) * lines + 64);
+        vector<CompiledProgram<RecordedEvent>> livePrograms;
+        TimelineSet<RecordedEvent> liveSet;
+        compileTimelines(recorder, lines, stepUs, staggerUs, livePrograms, liveSet);
+        FixedTimelines<RecordedEvent> liveSource{ liveSet };
+        for (int i = 0; i < lines; ++i) live.pushEdge(BindEdge::Down, monotonicNowNs(), static_cast<uint8_t>(i));
+        int64_t cpuNs = 0;
+        thread worker([&] {
+            DeadlineScheduler sched;
+            int64_t start = threadCpuTimeNs();
+            runMacroTimelines(recorder, sched, liveSource, live);
+            cpuNs = threadCpuTimeNs() - start;
+        });
+        this_thread::sleep_for(chrono::milliseconds(realMs));
+        live.requestStop();
+        worker.join();
+        size_t liveEvents = recorder.events().size();
+
+        json.beginObject();
+        json.field("timelines", static_cast<int64_t>(lines));
+        json.field("sim_frames", static_cast<int64_t>(counter.events()));
+        json.field("sim_batches", static_cast<int64_t>(counter.batches()));
+        json.field("frames_per_batch", counter.batches() ? static_cast<double>(counter.events()) / static_cast<double>(counter.batches()) : 0.0);
+        json.field("sched_ns_per_frame", nsPerFrame);
+        json.field("live_frames", static_cast<int64_t>(liveEvents));
+        json.field("live_batches", static_cast<int64_t>(recorder.batches()));
+        json.histogram("step_jitter", live.latency.stepJitter);
+        json.field("worker_cpu_ns_per_frame", liveEvents ? static_cast<double>(cpuNs) / static_cast<double>(liveEvents) : 0.0);
+        json.endObject();
+
+        fprintf(stderr, "%2d timelines: %6.1f ns/frame scheduling, %5.2f frames per batch, live jitter p99 %8.1fus max %8.1fus, cpu %6.0f ns/frame\n",
+            lines, nsPerFrame, counter.batches() ? static_cast<double>(counter.events()) / static_cast<double>(counter.batches()) : 0.0,
+            live.latency.stepJitter.percentile(99) / 1000.0, live.latency.stepJitter.max() / 1000.0,
+            liveEvents ? static_cast<double>(cpuNs) / static_cast<double>(liveEvents) : 0.0);
+    }
+    json.endArray();
+    json.endObject();
+    return writeBenchOutput(args.get("--out", "-"), json.str()) ? 0 : 1;
+}
@@ -0,0 +1,281 @@
+#include "bench_common.h"
+#include "evdev_monitor.h"
+#include "sequence_recorder.h"
+#include "macro_timelines.h"
+
+#include <cstdio>
+#include <iostream>
+#include <random>
+
+using namespace std;
+
+static const uint16_t kVkW = 'W';
+static const uint16_t kVkS = 'S';
+static const uint16_t kVkLShift = 0xA0;
+
+struct ScriptInput {
+    double atMs;
+    RecordedKind kind;
+    int32_t arg;
+};
+
+// a short combo as someone would play it: a held key with autorepeat, a tap
+// shorter than any grid, two wheel notches back to back, a key still held
+// when esc goes down, and a release from before the recording started
+static const ScriptInput kScript[] = {
+    { -5.0, RecordedKind::KeyUp, kVkS },
+    { 0.0, RecordedKind::KeyDown, kVkW },
+    { 12.3, RecordedKind::KeyDown, kVkI },
+    { 12.6, RecordedKind::KeyUp, kVkI },
+    { 33.0, RecordedKind::KeyDown, kVkW },
+    { 40.2, RecordedKind::Wheel, kWheelDelta },
+    { 40.25, RecordedKind::Wheel, kWheelDelta },
+    { 55.7, RecordedKind::KeyDown, kVkO },
+    { 66.0, RecordedKind::KeyDown, kVkW },
+    { 81.9, RecordedKind::KeyUp, kVkO },
+    { 99.0, RecordedKind::KeyDown, kVkW },
+    { 120.4, RecordedKind::Wheel, -kWheelDelta },
+    { 140.0, RecordedKind::KeyUp, kVkW },
+    { 150.1, RecordedKind::KeyDown, kVkLShift },
+};
+static const double kScriptStopMs = 180.0;
+
+// through the recorder the way the hook feeds it, then drained
+static bool recordScript(SequenceRecorder &rec, const vector<RecordedInput> &script, int64_t stopNs, vector<RecordedInput> &out) {
+    rec.arm();
+    for (const RecordedInput &in : script) {
+        if (in.kind == RecordedKind::Wheel) rec.wheel(in.arg, in.atNs);
+        else rec.key(in.kind == RecordedKind::KeyDown, static_cast<uint16_t>(in.arg), in.atNs);
+    }
+    rec.key(true, kRecordStopVk, stopNs);
+    out.clear();
+    return rec.waitFinished(out, monotonicNowNs() + 1000000000LL) && !rec.dropped();
+}
+
+// what the replay has to hold to: presses and releases pair up, a release
+// comes at least a step after its press, every wait is whole steps and the
+// cycle is as long as the report says
+static bool checkSteps(const vector<MacroStep> &steps, const RecordingReport &report, int64_t quantumNs, string &why) {
+    bool held[256] = {};
+    int64_t downAt[256] = {};
+    int64_t t = 0;
+    size_t edges = 0;
+    for (const MacroStep &s : steps) {
+        if (s.op == StepOp::Wait) {
+            t += static_cast<int64_t>(s.arg) * 1000;
+            if ((static_cast<int64_t>(s.arg) * 1000) % quantumNs) { why = "wait off the grid"; return false; }
+            continue;
+        }
+        ++edges;
+        if (s.op == StepOp::Wheel) continue;
+        uint8_t vk = static_cast<uint8_t>(s.arg);
+        if (s.op == StepOp::KeyDown) {
+            if (held[vk]) { why = "pressed twice"; return false; }
+            held[vk] = true;
+            downAt[vk] = t;
+        } else {
+            if (!held[vk]) { why = "released without a press"; return false; }
+            if (t - downAt[vk] < quantumNs) { why = "release on the press's step"; return false; }
+            held[vk] = false;
+        }
+    }
+    for (bool h : held) if (h) { why = "key left held"; return false; }
+    if (t != report.periodNs) { why = "cycle length differs from the report"; return false; }
+    if (edges != report.edges || edges != report.recordedNs.size()) { why = "edge count differs from the report"; return false; }
+    return true;
+}
+
+// recorded -> compiled -> binary -> back, and the invariants above
+static bool compileAndCheck(const vector<RecordedInput> &in, int64_t stopNs, int quantumUs, vector<MacroStep> &steps, RecordingReport &report, string &why) {
+    if (!compileRecording(in, stopNs, quantumUs, steps, report, why)) return false;
+    if (!checkSteps(steps, report, static_cast<int64_t>(quantumUs) * 1000, why)) return false;
+    vector<MacroStep> decoded;
+    if (!decodeMacroSequenceText(encodeMacroSequenceText(steps), decoded, why)) return false;
+    if (decoded.size() != steps.size()) { why = "binary round trip lost steps"; return false; }
+    for (size_t i = 0; i < steps.size(); ++i) {
+        if (decoded[i].op != steps[i].op || decoded[i].arg != steps[i].arg) { why = "binary round trip changed step " + to_string(i); return false; }
+    }
+    CompiledProgram<RecordedEvent> program;
+    RecordingSink probe(0);
+    return compileMacroProgram(probe, steps, program, why);
+}
+
+// random performances: keys from a small set pressed and released at random
+// with autorepeat and stray releases, wheel bursts, any grid
+static void makeFuzzScript(mt19937 &rng, vector<RecordedInput> &out, int64_t &stopNs) {
+    static const uint16_t keys[] = { 'A', 'D', kVkI, kVkO, kVkW, kVkLShift, 0x20 };
+    out.clear();
+    int64_t t = 1000000000LL;
+    size_t n = 1 + rng() % 200;
+    for (size_t i = 0; i < n; ++i) {
+        t += static_cast<int64_t>(rng() % 30000000);
+        uint32_t r = rng() % 10;
+        if (r < 2) out.push_back(RecordedInput{ t, RecordedKind::Wheel, rng() & 1 ? kWheelDelta : -kWheelDelta });
+        else out.push_back(RecordedInput{ t, r < 6 ? RecordedKind::KeyDown : RecordedKind::KeyUp, keys[rng() % 7] });
+    }
+    stopNs = t + static_cast<int64_t>(rng() % 50000000);
+}
+
+static void replayJson(JsonWriter &json, const char *name, LatencyHistogram &h) {
+    json.histogram(name, h);
+    fprintf(stderr, "  %-24s p50 %7.1fus  p99 %7.1fus  max %7.1fus\n", name, h.percentile(50) / 1000.0, h.percentile(99) / 1000.0, h.max() / 1000.0);
+}
+
+#ifdef __linux__
+static int runLiveRecording(const BenchArgs &args) {
+    int quantumUs = static_cast<int>(args.getInt("--quantum-us", kDefaultRecordQuantumUs));
+    MacroControl control;
+    EvdevMonitor monitor(control);
+    SequenceRecorder rec;
+    EvdevMonitorOptions options;
+    string error;
+    if (!monitor.open(options, error)) {
+        cerr << error << "\n";
+        return 2;
+    }
+    monitor.setRecorder(&rec);
+    rec.arm();
+    thread reader([&] { monitor.run(); });
+    fprintf(stderr, "recording from %d devices: play the sequence, esc ends it\n", monitor.deviceCount());
+    vector<RecordedInput> inputs;
+    bool finished = rec.waitFinished(inputs, monotonicNowNs() + args.getInt("--seconds", 30) * 1000000000LL);
+    monitor.stop();
+    reader.join();
+    vector<MacroStep> steps;
+    RecordingReport report;
+    if (!finished) {
+        cerr << "no esc before the time ran out\n";
+        return 1;
+    }
+    if (!compileRecording(inputs, rec.endNs(), quantumUs, steps, report, error)) {
+        cerr << error << "\n";
+        return 1;
+    }
+    JsonWriter json;
+    json.beginObject();
+    json.field("bench", "record");
+    json.field("inputs", static_cast<int64_t>(report.inputs));
+    json.field("steps", static_cast<int64_t>(report.edges));
+    json.field("merged", static_cast<int64_t>(report.merged));
+    json.field("period_ns", report.periodNs);
+    json.field("quantize_error_mean_ns", report.meanErrorNs);
+    json.field("quantize_error_max_ns", report.maxErrorNs);
+    json.field("sequence", formatMacroSequence(steps));
+    json.field("recording", encodeMacroSequenceText(steps));
+    json.endObject();
+    return writeBenchOutput(args.get("--out", "-"), json.str()) ? 0 : 1;
+}
+#endif
+
+// records a scripted performance through SequenceRecorder, compiles it, then
+// replays it on the real worker and clock: how far each replayed step lands
+// from when it was performed, and from the compiled step. --fuzz random
+// performances only go through the compile checks.
+int runRecordBench(const BenchArgs &args) {
+#ifdef __linux__
+    if (args.has("--live")) return runLiveRecording(args);
+#endif
+    int quantumUs = static_cast<int>(args.getInt("--quantum-us", kDefaultRecordQuantumUs));
+    long cycles = args.getInt("--cycles", 20);
+    long fuzz = args.getInt("--fuzz", 2000);
+    uint64_t failures = 0;
+
+    SequenceRecorder rec;
+    vector<RecordedInput> script, inputs;
+    const int64_t base = 1000000000LL;
+    for (const ScriptInput &s : kScript) script.push_back(RecordedInput{ base + static_cast<int64_t>(s.atMs * 1000000.0), s.kind, s.arg });
+    const int64_t stopNs = base + static_cast<int64_t>(kScriptStopMs * 1000000.0);
+    vector<MacroStep> steps;
+    RecordingReport report;
+    string why;
+    if (!recordScript(rec, script, stopNs, inputs) || inputs.size() != script.size()) {
+        cerr << "record: the recorder lost inputs\n";
+        return 1;
+    }
+    if (!compileAndCheck(inputs, stopNs, quantumUs, steps, report, why)) {
+        cerr << "record: " << why << "\n";
+        return 1;
+    }
+
+    mt19937 rng(static_cast<uint32_t>(args.getInt("--seed", 1)));
+    static const int grids[] = { 100, 250, 500, 1000, 2000, 5000 };
+    vector<MacroStep> fuzzSteps;
+    RecordingReport fuzzReport;
+    vector<RecordedInput> fuzzScript;
+    for (long i = 0; i < fuzz; ++i) {
+        int64_t fuzzStop = 0;
+        makeFuzzScript(rng, fuzzScript, fuzzStop);
+        int grid = grids[rng() % 6];
+        // a performance of nothing but stray releases is refused, that's fine
+        bool onlyUps = true;
+        for (const RecordedInput &in : fuzzScript) onlyUps = onlyUps && in.kind == RecordedKind::KeyUp;
+        if (!recordScript(rec, fuzzScript, fuzzStop, inputs)) { ++failures; continue; }
+        if (!compileAndCheck(inputs, fuzzStop, grid, fuzzSteps, fuzzReport, why) && !onlyUps) {
+            if (failures++ < 5) fprintf(stderr, "fuzz %ld (%dus grid): %s\n", i, grid, why.c_str());
+        }
+    }
+
+    RecordingSink recorder(static_cast<size_t>(cycles) * steps.size() + 64);
+    MacroControl control;
+    CompiledProgram<RecordedEvent> program;
+    compileMacroProgram(recorder, steps, program, why);
+    StopAfterSink<RecordingSink> sink(recorder, control, static_cast<uint64_t>(cycles) * program.frames.size());
+    TimelineSet<RecordedEvent> set;
+    set.programs[0] = &program;
+    set.count = 1;
+    FixedTimelines<RecordedEvent> source{ set };
+    control.pushEdge(BindEdge::Down, monotonicNowNs(), 0);
+    thread worker([&] {
+        DeadlineScheduler sched;
+        runMacroTimelines(sink, sched, source, control);
+    });
+    worker.join();
+
+    // record i of a cycle is step i of the recording, a frame per grid tick
+    vector<int64_t> frameAt(program.records.size());
+    for (const CompiledFrame &f : program.frames) {
+        for (uint32_t k = 0; k < f.count; ++k) frameAt[f.first + k] = f.atNs;
+    }
+    const vector<RecordedEvent> &ev = recorder.events();
+    const size_t perCycle = program.records.size();
+    LatencyHistogram toRecorded, toProgram;
+    uint64_t mismatches = 0;
+    if (ev.size() != perCycle * static_cast<size_t>(cycles)) ++failures;
+    for (size_t j = 0; j < ev.size() && j < perCycle * static_cast<size_t>(cycles); ++j) {
+        size_t i = j % perCycle;
+        if (ev[j].type != program.records[i].type || ev[j].value != program.records[i].value) ++mismatches;
+        int64_t offset = ev[j].timeNs - ev[0].timeNs - static_cast<int64_t>(j / perCycle) * program.periodNs;
+        int64_t a = offset - report.recordedNs[i], b = offset - frameAt[i];
+        toRecorded.record(a < 0 ? -a : a);
+        toProgram.record(b < 0 ? -b : b);
+    }
+    failures += mismatches;
+
+    JsonWriter json;
+    json.beginObject();
+    json.field("bench", "record");
+    json.field("quantum_us", static_cast<int64_t>(quantumUs));
+    json.field("inputs", static_cast<int64_t>(report.inputs));
+    json.field("steps", static_cast<int64_t>(report.edges));
+    json.field("merged", static_cast<int64_t>(report.merged));
+    json.field("binary_bytes", static_cast<int64_t>(encodeMacroSequence(steps).size()));
+    json.field("text_bytes", static_cast<int64_t>(formatMacroSequence(steps).size()));
+    json.field("period_ns", report.periodNs);
+    json.field("quantize_error_mean_ns", report.meanErrorNs);
+    json.field("quantize_error_max_ns", report.maxErrorNs);
+    json.field("cycles", static_cast<int64_t>(cycles));
+    json.field("replayed_events", static_cast<int64_t>(ev.size()));
+    json.field("mismatches", static_cast<int64_t>(mismatches));
+    fprintf(stderr, "%zu inputs -> %zu steps (%zu merged), %zu bytes binary / %zu as text, cycle %.1fms\n"
+        "quantized %.1fus avg / %.1fus max off the performance on a %dus grid, %ld replays:\n",
+        report.inputs, report.edges, report.merged, encodeMacroSequence(steps).size(), formatMacroSequence(steps).size(),
+        report.periodNs / 1000000.0, report.meanErrorNs / 1000.0, report.maxErrorNs / 1000.0, quantumUs, cycles);
+    replayJson(json, "replay_to_recorded", toRecorded);
+    replayJson(json, "replay_to_program", toProgram);
+    json.field("fuzz", static_cast<int64_t>(fuzz));
+    json.field("failures", static_cast<int64_t>(failures));
+    json.endObject();
+    fprintf(stderr, "%ld fuzz recordings: %llu failures\n", fuzz, static_cast<unsigned long long>(failures));
+    if (!writeBenchOutput(args.get("--out", "-"), json.str())) return 1;
+    return failures ? 1 : 0;
+}
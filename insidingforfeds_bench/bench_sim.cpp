@@ -0,0 +1,423 @@
+#include "bench_common.h"
+#include "sim_harness.h"
+#include "macro_timelines.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+using namespace std;
+
+struct SimResult {
+    vector<RecordedEvent> events;
+};
+
+// one bind on timeline 0
+static SimResult runScript(const vector<MacroStep> &steps, bool toggle, const vector<SimInput> &script, int64_t endNs = -1) {
+    MacroControl control;
+    VirtualScheduler sched(control, script, endNs);
+    SimSink sink(sched);
+    CompiledProgram<RecordedEvent> program;
+    string error;
+    compileMacroProgram(sink, steps, program, error);
+    TimelineSet<RecordedEvent> set;
+    set.programs[0] = &program;
+    set.toggle[0] = toggle;
+    set.count = 1;
+    FixedTimelines<RecordedEvent> source{ set };
+    runMacroTimelines(sink, sched, source, control);
+    return SimResult{ sink.events() };
+}
+
+// "1000 +73, 5000 +79" : time in us, + / - key down / up, w wheel
+static string formatEvents(const vector<RecordedEvent> &events) {
+    stringstream ss;
+    for (size_t i = 0; i < events.size(); ++i) {
+        const RecordedEvent &e = events[i];
+        if (i) ss << ", ";
+        ss << e.timeNs / 1000;
+        if (e.timeNs % 1000) ss << "." << e.timeNs % 1000;
+        switch (e.type) {
+        case SinkEventType::KeyDown: case SinkEventType::ScanDown: ss << " +"; break;
+        case SinkEventType::KeyUp: case SinkEventType::ScanUp: ss << " -"; break;
+        case SinkEventType::Wheel: ss << " w"; break;
+        }
+        ss << e.value;
+    }
+    return ss.str();
+}
+
+static int64_t ms(double v) {
+    return static_cast<int64_t>(v * 1000000.0);
+}
+
+struct Scenario {
+    const char *name;
+    bool thirdPerson;
+    bool toggle;
+    vector<SimInput> script;
+    const char *expected;
+};
+
+// steps are 4ms, so a third person cycle is I down, O down, I up, O up at
+// +0/4/8/12ms and a first person cycle wheel up/down at +0/4ms
+static vector<Scenario> scenarios() {
+    const SimInput::Kind D = SimInput::Down, U = SimInput::Up, S = SimInput::Stop;
+    return {
+        { "hold, released on a step", true, false, { { ms(1), D }, { ms(21), U } },
+            "1000 +73, 5000 +79, 9000 -73, 13000 -79, 17000 +73, 21000 -73" },
+        { "hold, tap shorter than a step", true, false, { { ms(1), D }, { ms(1.1), U } },
+            "1000 +73, 5000 +79, 9000 -73, 13000 -79" },
+        { "hold, press and release in one burst", true, false, { { ms(1), D }, { ms(1), U } },
+            "1000 +73, 5000 +79, 9000 -73, 13000 -79" },
+        { "hold, autorepeat downs", true, false, { { ms(1), D }, { ms(2), D }, { ms(3), D }, { ms(6), U } },
+            "1000 +73, 5000 +79, 9000 -73, 13000 -79" },
+        { "hold, release and re-press in one burst", true, false, { { ms(1), D }, { ms(30), U }, { ms(30), D }, { ms(40), S } },
+            "1000 +73, 5000 +79, 9000 -73, 13000 -79, 17000 +73, 21000 +79, 25000 -73, 29000 -79, 33000 +73, 37000 +79, 40000 -73, 40000 -79" },
+        { "toggle, off mid-step", true, true, { { ms(1), D }, { ms(1.05), U }, { ms(23), D }, { ms(23.05), U } },
+            "1000 +73, 5000 +79, 9000 -73, 13000 -79, 17000 +73, 21000 +79, 23000 -73, 23000 -79" },
+        { "toggle, off inside the first cycle", true, true, { { ms(1), D }, { ms(1.05), U }, { ms(7), D }, { ms(7.05), U } },
+            "1000 +73, 5000 +79, 9000 -73, 13000 -79" },
+        { "toggle, double tap inside one step", true, true, { { ms(1), D }, { ms(1.05), U }, { ms(2), D }, { ms(2.05), U } },
+            "1000 +73, 5000 +79, 9000 -73, 13000 -79" },
+        { "toggle, autorepeat is one press", true, true, { { ms(1), D }, { ms(1.5), D }, { ms(2), D }, { ms(3), U }, { ms(30), S } },
+            "1000 +73, 5000 +79, 9000 -73, 13000 -79, 17000 +73, 21000 +79, 25000 -73, 29000 -79" },
+        { "shutdown with keys held", true, false, { { ms(1), D }, { ms(7), S } },
+            "1000 +73, 5000 +79, 7000 -73, 7000 -79" },
+        { "shutdown on an emit deadline", true, false, { { ms(1), D }, { ms(9), S } },
+            "1000 +73, 5000 +79, 9000 -73, 9000 -79" },
+        { "first person, hold", false, false, { { ms(1), D }, { ms(10), U } },
+            "1000 w120, 5000 w-120, 9000 w120" },
+        { "first person, toggle then stop", false, true, { { ms(1), D }, { ms(1.2), U }, { ms(6), S } },
+            "1000 w120, 5000 w-120" },
+    };
+}
+
+// checks that hold for any script: time never goes back, no key is pressed
+// twice or released while up, nothing is left held, nothing is pressed after
+// stop, and a key down only goes out while the latch is on or inside the one
+// guaranteed cycle after a trigger
+static string checkInvariants(const vector<RecordedEvent> &events, const vector<SimInput> &script, bool toggle, int64_t periodNs, int64_t endNs) {
+    int64_t stopNs = endNs;
+    for (const SimInput &in : script) if (in.kind == SimInput::Stop && (stopNs < 0 || in.atNs < stopNs)) stopNs = in.atNs;
+    uint8_t held[256] = {};
+    int64_t last = 0;
+    size_t next = 0;
+    ActivationLatch latch;
+    latch.setToggle(toggle);
+    int64_t windowEnd = -1;
+    for (const RecordedEvent &e : events) {
+        if (e.timeNs < last) return "time went backwards";
+        last = e.timeNs;
+        while (next < script.size() && script[next].atNs <= e.timeNs) {
+            const SimInput &in = script[next++];
+            if (in.kind == SimInput::Stop) continue;
+            bool was = latch.on();
+            if (latch.apply(in.kind == SimInput::Down ? BindEdge::Down : BindEdge::Up) && !was) windowEnd = in.atNs + periodNs;
+        }
+        bool down = e.type == SinkEventType::KeyDown || e.type == SinkEventType::ScanDown;
+        bool up = e.type == SinkEventType::KeyUp || e.type == SinkEventType::ScanUp;
+        if (down || e.type == SinkEventType::Wheel) {
+            if (stopNs >= 0 && e.timeNs >= stopNs) return "input sent after stop";
+            if (!latch.on() && e.timeNs >= windowEnd) return "input sent while off at " + to_string(e.timeNs);
+        }
+        uint8_t &h = held[e.value & 0xFF];
+        if (down) {
+            if (h) return "key " + to_string(e.value) + " pressed twice";
+            h = 1;
+        } else if (up) {
+            if (!h) return "key " + to_string(e.value) + " released while up";
+            h = 0;
+        }
+    }
+    for (int vk = 0; vk < 256; ++vk) if (held[vk]) return "key " + to_string(vk) + " left held";
+    return string();
+}
+
+static vector<SimInput> randomScript(mt19937 &rng) {
+    vector<SimInput> script;
+    int64_t t = 0;
+    int n = 1 + static_cast<int>(rng() % 24);
+    bool pressed = false;
+    for (int i = 0; i < n; ++i) {
+        // mostly short gaps, zero gaps make bursts
+        uint32_t r = rng() % 10;
+        t += r < 2 ? 0 : r < 6 ? static_cast<int64_t>(rng() % 2000000) : static_cast<int64_t>(rng() % 40000000);
+        // an extra down now and then is autorepeat
+        SimInput::Kind k = pressed && rng() % 8 ? SimInput::Up : SimInput::Down;
+        pressed = k == SimInput::Down;
+        script.push_back(SimInput{ t, k });
+    }
+    if (rng() % 2) script.push_back(SimInput{ t + static_cast<int64_t>(rng() % 30000000), SimInput::Stop });
+    return script;
+}
+
+// timelines don't disturb each other: every timeline sends its own keys, so
+// its share of the merged output has to match what the same bind sends with
+// its script run alone, to the nanosecond
+static const int kSimTimelines = 3;
+
+static vector<MacroStep> timelineSteps(int line, int stepUs) {
+    if (line == 0) return makeThirdPersonSteps(stepUs);
+    if (line == 1) return makeFirstPersonSteps(stepUs);
+    // a step that drifts against the other two
+    int us = stepUs + 333;
+    return { stepKeyDown('A'), stepWaitUs(us), stepKeyDown('B'), stepWaitUs(us), stepKeyUp('A'), stepKeyUp('B'), stepWaitUs(us) };
+}
+
+static int timelineOf(const RecordedEvent &e) {
+    if (e.type == SinkEventType::Wheel) return 1;
+    return e.value == 'A' || e.value == 'B' ? 2 : 0;
+}
+
+struct TimelinesResult {
+    vector<RecordedEvent> events;
+    uint64_t batches;
+};
+
+static TimelinesResult runTimelinesScript(const vector<vector<MacroStep>> &steps, const bool *toggle, const vector<SimInput> &script, int64_t endNs = -1) {
+    MacroControl control;
+    VirtualScheduler sched(control, script, endNs);
+    SimSink sink(sched);
+    vector<CompiledProgram<RecordedEvent>> programs(steps.size());
+    TimelineSet<RecordedEvent> set;
+    string error;
+    for (size_t i = 0; i < steps.size(); ++i) {
+        compileMacroProgram(sink, steps[i], programs[i], error);
+        set.programs[i] = &programs[i];
+        set.toggle[i] = toggle[i];
+    }
+    set.count = static_cast<int>(steps.size());
+    FixedTimelines<RecordedEvent> source{ set };
+    runMacroTimelines(sink, sched, source, control);
+    return TimelinesResult{ sink.events(), sink.batches() };
+}
+
+// two binds pressed on the same tick: third person on timeline 0, a 4ms a
+// down/up on timeline 1. their frames at 1ms and 5ms go out together.
+static string checkTimelineBatching() {
+    vector<vector<MacroStep>> steps = { makeThirdPersonSteps(4000), { stepKeyDown('A'), stepWaitUs(4000), stepKeyUp('A'), stepWaitUs(4000) } };
+    bool toggle[2] = { false, false };
+    vector<SimInput> script = { { ms(1), SimInput::Down, 0 }, { ms(1), SimInput::Down, 1 }, { ms(9), SimInput::Up, 0 }, { ms(9), SimInput::Up, 1 } };
+    TimelinesResult r = runTimelinesScript(steps, toggle, script);
+    string expected = "1000 +73, 1000 +65, 5000 +79, 5000 -65, 9000 -73, 13000 -79";
+    string got = formatEvents(r.events);
+    if (got != expected) return "expected " + expected + "\n  got      " + got;
+    if (r.batches != 4) return "expected 4 batches, got " + to_string(r.batches);
+    return string();
+}
+
+// hands out the second set from switchNs on, like a config reload
+struct SwitchAt {
+    const VirtualScheduler &clock;
+    int64_t switchNs;
+    const TimelineSet<RecordedEvent> &before;
+    const TimelineSet<RecordedEvent> &after;
+    const TimelineSet<RecordedEvent> *acquire() const { return clock.now() >= switchNs ? &after : &before; }
+};
+
+// timeline 0 goes from third person to first person while both binds are
+// held, the new set picks it up on the 9ms wake. timeline 0 finishes its
+// cycle and starts first person one period after it began, timeline 1 kept
+// the same program and must not notice.
+static string checkTimelineSwap() {
+    MacroControl control;
+    vector<SimInput> script = { { ms(1), SimInput::Down, 0 }, { ms(1), SimInput::Down, 1 }, { ms(30), SimInput::Up, 0 }, { ms(30), SimInput::Up, 1 } };
+    VirtualScheduler sched(control, script);
+    SimSink sink(sched);
+    CompiledProgram<RecordedEvent> third, first, tap;
+    string error;
+    compileMacroProgram(sink, makeThirdPersonSteps(4000), third, error);
+    compileMacroProgram(sink, makeFirstPersonSteps(4000), first, error);
+    compileMacroProgram(sink, { stepKeyDown('A'), stepWaitUs(4000), stepKeyUp('A'), stepWaitUs(4000) }, tap, error);
+    TimelineSet<RecordedEvent> before, after;
+    before.programs[0] = &third;
+    after.programs[0] = &first;
+    before.programs[1] = after.programs[1] = &tap;
+    before.count = after.count = 2;
+    SwitchAt source{ sched, ms(6), before, after };
+    runMacroTimelines(sink, sched, source, control);
+    string expected = "1000 +73, 1000 +65, 5000 +79, 5000 -65, 9000 -73, 9000 +65, 13000 -79, 13000 -65, "
+        "17000 w120, 17000 +65, 21000 w-120, 21000 -65, 25000 w120, 25000 +65, 29000 w-120, 29000 -65";
+    string got = formatEvents(sink.events());
+    if (got != expected) return "expected " + expected + "\n  got      " + got;
+    return string();
+}
+
+// a reload hands over the set built so far, the last one whose time has come
+struct ReloadsAt {
+    const VirtualScheduler &clock;
+    vector<pair<int64_t, const TimelineSet<RecordedEvent> *>> sets;
+    const TimelineSet<RecordedEvent> *acquire() const {
+        const TimelineSet<RecordedEvent> *set = sets.front().second;
+        for (const auto &s : sets) if (clock.now() >= s.first) set = s.second;
+        return set;
+    }
+};
+
+// what the app publishes when a save changes nothing: a new set holding the
+// same programs. picked up on the 5ms wake, it must leave both running binds
+// alone and not hold back the next reload, which swaps timeline 1 on the
+// 9ms wake and starts it at its 17ms cycle. had the 5ms set swapped timeline
+// 0 too, that reload would wait for its cycle to end at 17ms.
+static string checkIdenticalReload() {
+    MacroControl control;
+    vector<SimInput> script = { { ms(1), SimInput::Down, 0 }, { ms(1), SimInput::Down, 1 }, { ms(30), SimInput::Up, 0 }, { ms(30), SimInput::Up, 1 } };
+    VirtualScheduler sched(control, script);
+    SimSink sink(sched);
+    CompiledProgram<RecordedEvent> third, tap, tapB;
+    string error;
+    compileMacroProgram(sink, makeThirdPersonSteps(4000), third, error);
+    compileMacroProgram(sink, { stepKeyDown('A'), stepWaitUs(4000), stepKeyUp('A'), stepWaitUs(4000) }, tap, error);
+    compileMacroProgram(sink, { stepKeyDown('B'), stepWaitUs(4000), stepKeyUp('B'), stepWaitUs(4000) }, tapB, error);
+    TimelineSet<RecordedEvent> first, same, changed;
+    first.programs[0] = same.programs[0] = changed.programs[0] = &third;
+    first.programs[1] = same.programs[1] = &tap;
+    changed.programs[1] = &tapB;
+    first.count = same.count = changed.count = 2;
+    ReloadsAt source{ sched, { { 0, &first }, { ms(2), &same }, { ms(6), &changed } } };
+    runMacroTimelines(sink, sched, source, control);
+    string expected = "1000 +73, 1000 +65, 5000 +79, 5000 -65, 9000 -73, 9000 +65, 13000 -79, 13000 -65, "
+        "17000 +73, 17000 +66, 21000 +79, 21000 -66, 25000 -73, 25000 +66, 29000 -79, 29000 -66";
+    string got = formatEvents(sink.events());
+    if (got != expected) return "expected " + expected + "\n  got      " + got;
+    return string();
+}
+
+static string checkTimelines(mt19937 &rng, int stepUs) {
+    vector<vector<MacroStep>> steps;
+    vector<vector<SimInput>> own(kSimTimelines);
+    vector<SimInput> merged;
+    bool toggle[kSimTimelines];
+    int64_t last = 0;
+    for (int line = 0; line < kSimTimelines; ++line) {
+        steps.push_back(timelineSteps(line, stepUs));
+        toggle[line] = rng() % 2 != 0;
+        for (SimInput in : randomScript(rng)) {
+            if (in.kind == SimInput::Stop) continue;
+            in.timeline = static_cast<uint8_t>(line);
+            own[line].push_back(in);
+            merged.push_back(in);
+            last = max(last, in.atNs);
+        }
+    }
+    if (rng() % 2) {
+        SimInput stop{ last + static_cast<int64_t>(rng() % 30000000), SimInput::Stop };
+        for (auto &o : own) o.push_back(stop);
+        merged.push_back(stop);
+    }
+    stable_sort(merged.begin(), merged.end(), [](const SimInput &a, const SimInput &b) { return a.atNs < b.atNs; });
+    int64_t endNs = last + 50000000;
+
+    TimelinesResult multi = runTimelinesScript(steps, toggle, merged, endNs);
+    for (int line = 0; line < kSimTimelines; ++line) {
+        vector<SimInput> alone = own[line];
+        for (SimInput &in : alone) in.timeline = 0;
+        vector<RecordedEvent> mine;
+        for (const RecordedEvent &e : multi.events) if (timelineOf(e) == line) mine.push_back(e);
+        string want = formatEvents(runScript(steps[line], toggle[line], alone, endNs).events);
+        string got = formatEvents(mine);
+        if (got != want) return "timeline " + to_string(line) + (toggle[line] ? " (toggle)" : " (hold)") + "\n  alone    " + want + "\n  timeline " + got;
+    }
+    return string();
+}
+
+int runSimBench(const BenchArgs &args) {
+    long fuzz = args.getInt("--fuzz", 20000);
+    uint32_t seed = static_cast<uint32_t>(args.getInt("--seed", 1));
+    bool verbose = args.has("--verbose");
+    int failures = 0;
+
+    for (const Scenario &s : scenarios()) {
+        vector<MacroStep> steps = s.thirdPerson ? makeThirdPersonSteps(4000) : makeFirstPersonSteps(4000);
+        string got = formatEvents(runScript(steps, s.toggle, s.script).events);
+        if (got != s.expected) {
+            ++failures;
+            fprintf(stderr, "FAIL %s\n  expected %s\n  got      %s\n", s.name, s.expected, got.c_str());
+        } else if (verbose) {
+            fprintf(stderr, "ok   %s\n", s.name);
+        }
+    }
+
+    string batching = checkTimelineBatching();
+    if (!batching.empty()) {
+        ++failures;
+        fprintf(stderr, "FAIL timelines, same tick batching\n  %s\n", batching.c_str());
+    } else if (verbose) {
+        fprintf(stderr, "ok   timelines, same tick batching\n");
+    }
+
+    string swap = checkTimelineSwap();
+    if (!swap.empty()) {
+        ++failures;
+        fprintf(stderr, "FAIL timelines, program swap at the cycle boundary\n  %s\n", swap.c_str());
+    } else if (verbose) {
+        fprintf(stderr, "ok   timelines, program swap at the cycle boundary\n");
+    }
+
+    string reload = checkIdenticalReload();
+    if (!reload.empty()) {
+        ++failures;
+        fprintf(stderr, "FAIL timelines, reload with nothing changed\n  %s\n", reload.c_str());
+    } else if (verbose) {
+        fprintf(stderr, "ok   timelines, reload with nothing changed\n");
+    }
+
+    mt19937 rng(seed);
+    int fuzzFailures = 0;
+    int64_t simulatedNs = 0;
+    auto start = chrono::steady_clock::now();
+    for (long i = 0; i < fuzz; ++i) {
+        vector<SimInput> script = randomScript(rng);
+        bool toggle = rng() % 2 != 0;
+        int stepUs = 500 + static_cast<int>(rng() % 10000);
+        bool third = rng() % 2 != 0;
+        vector<MacroStep> steps = third ? makeThirdPersonSteps(stepUs) : makeFirstPersonSteps(stepUs);
+        int64_t endNs = script.back().atNs + 50000000;
+        SimResult a = runScript(steps, toggle, script, endNs);
+        SimResult b = runScript(steps, toggle, script, endNs);
+        int64_t period = static_cast<int64_t>(stepUs) * 1000 * (third ? 4 : 2);
+        string problem = checkInvariants(a.events, script, toggle, period, endNs);
+        if (problem.empty() && formatEvents(a.events) != formatEvents(b.events)) problem = "two runs of the same script differ";
+        if (!a.events.empty()) simulatedNs += a.events.back().timeNs;
+        if (!problem.empty()) {
+            if (fuzzFailures++ < 5) {
+                fprintf(stderr, "FAIL fuzz #%ld (%s, %s, %dus): %s\n  script:", i, third ? "third" : "first", toggle ? "toggle" : "hold", stepUs, problem.c_str());
+                for (const SimInput &in : script) fprintf(stderr, " %lld%s", static_cast<long long>(in.atNs), in.kind == SimInput::Down ? "D" : in.kind == SimInput::Up ? "U" : "S");
+                fprintf(stderr, "\n  events: %s\n", formatEvents(a.events).c_str());
+            }
+        }
+    }
+    double wallS = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    failures += fuzzFailures;
+
+    // a quarter as many timeline runs, each is three bind scripts
+    long timelineRuns = fuzz / 4;
+    int timelineFailures = 0;
+    for (long i = 0; i < timelineRuns; ++i) {
+        int stepUs = 500 + static_cast<int>(rng() % 10000);
+        string problem = checkTimelines(rng, stepUs);
+        if (!problem.empty() && timelineFailures++ < 5) fprintf(stderr, "FAIL timelines #%ld (%dus): %s\n", i, stepUs, problem.c_str());
+    }
+    failures += timelineFailures;
+
+    JsonWriter json;
+    json.beginObject();
+    json.field("bench", "sim");
+    json.field("scenarios", static_cast<int64_t>(scenarios().size()));
+    json.field("fuzz_scripts", static_cast<int64_t>(fuzz));
+    json.field("seed", static_cast<int64_t>(seed));
+    json.field("timeline_scripts", static_cast<int64_t>(timelineRuns));
+    json.field("failures", static_cast<int64_t>(failures));
+    // each script runs twice for the determinism check
+    json.field("scripts_per_s", wallS > 0 ? 2.0 * static_cast<double>(fuzz) / wallS : 0.0);
+    json.field("simulated_s", static_cast<double>(simulatedNs) / 1e9);
+    json.endObject();
+    fprintf(stderr, "%zu scenarios, %ld fuzz scripts, %ld timeline scripts: %d failures, %.0f scripts/s\n", scenarios().size(), fuzz, timelineRuns, failures,
+        wallS > 0 ? 2.0 * static_cast<double>(fuzz) / wallS : 0.0);
+    if (!writeBenchOutput(args.get("--out", "-"), json.str())) return 1;
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,456 @@
+#include "bench_common.h"
+#include "bind_matcher.h"
+#include "control_channel.h"
+#include "macro_timelines.h"
+#include "rcu_slot.h"
+#include "sequence_recorder.h"
+#include "thread_roles.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static const int kSoakTimelines = 4;
+// timeline 0 presses this once a cycle, the sink times it
+static const uint16_t kMarkerVk = 'Z';
+static const uint16_t kRecordedVk = 'R';
+
+// what a reload publishes: every program and the set pointing at them
+struct SoakConfig {
+    CompiledProgram<RecordedEvent> programs[kSoakTimelines];
+    TimelineSet<RecordedEvent> set;
+};
+
+// the worker's end of the slot
+struct SoakSource {
+    RcuSlot<SoakConfig, 1> slot;
+
+    const TimelineSet<RecordedEvent> *acquire() { return &slot.acquire(0)->set; }
+};
+
+// keeps counters only, so hours of frames cost no memory. every marker
+// press is checked against where it should be: the earliest one plus whole
+// periods. a reload swaps timeline 0's program at a cycle boundary without
+// moving its deadlines, so with absolute deadlines that error stays bounded
+// by one step's lateness for the whole run; with sleeps measured from the
+// last wake it grows every cycle. only a skip-ahead the worker counted
+// starts the count over, however late a press is.
+class SoakSink {
+public:
+    using Record = RecordedEvent;
+
+    SoakSink(int64_t periodNs, const atomic<uint64_t> &skippedCycles) : periodNs_(periodNs), skippedCycles_(skippedCycles) {}
+
+    Record prepare(SinkEventType type, int32_t value) const { return Record{ 0, type, value }; }
+    void emit(const Record *records, size_t count) {
+        events_.fetch_add(count, memory_order_relaxed);
+        for (size_t i = 0; i < count; ++i) {
+            if (records[i].type == SinkEventType::ScanDown && records[i].value == kMarkerVk) marker(monotonicNowNs());
+        }
+    }
+
+    uint64_t events() const { return events_.load(memory_order_relaxed); }
+    uint64_t markers() const { return markers_.load(memory_order_relaxed); }
+    uint64_t rebases() const { return rebases_.load(memory_order_relaxed); }
+    int64_t lastDriftNs() const { return lastDriftNs_.load(memory_order_relaxed); }
+    // the largest drift since the last call
+    int64_t takeMaxDriftNs() { return maxDriftNs_.exchange(0, memory_order_relaxed); }
+
+private:
+    void marker(int64_t now) {
+        markers_.fetch_add(1, memory_order_relaxed);
+        // emit runs on the worker, after any skip that led to this press
+        uint64_t skips = skippedCycles_.load(memory_order_relaxed);
+        if (!anchored_) {
+            anchored_ = true;
+            anchorNs_ = now;
+            seenSkips_ = skips;
+            return;
+        }
+        ++cycles_;
+        int64_t drift = now - (anchorNs_ + cycles_ * periodNs_);
+        // a timeline fell a whole period behind and restarted from now
+        if (skips != seenSkips_) {
+            seenSkips_ = skips;
+            anchorNs_ = now;
+            cycles_ = 0;
+            rebases_.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+        // a press is never early, so an early one means the anchor was late
+        if (drift < 0) {
+            anchorNs_ += drift;
+            drift = 0;
+        }
+        lastDriftNs_.store(drift, memory_order_relaxed);
+        if (drift > maxDriftNs_.load(memory_order_relaxed)) maxDriftNs_.store(drift, memory_order_relaxed);
+    }
+
+    const int64_t periodNs_;
+    const atomic<uint64_t> &skippedCycles_;
+    // worker thread only
+    bool anchored_ = false;
+    int64_t anchorNs_ = 0;
+    int64_t cycles_ = 0;
+    uint64_t seenSkips_ = 0;
+
+    atomic<uint64_t> events_{0};
+    atomic<uint64_t> markers_{0};
+    atomic<uint64_t> rebases_{0};
+    atomic<int64_t> lastDriftNs_{0};
+    atomic<int64_t> maxDriftNs_{0};
+};
+
+struct SoakSample {
+    double atS = 0;
+    ProcessSample process;
+    double cpuPercent = 0;
+    int64_t driftMaxNs = 0;
+    int64_t driftLastNs = 0;
+    uint64_t events = 0;
+    uint64_t markers = 0;
+    // since the previous sample
+    uint64_t rebases = 0;
+    uint64_t reloads = 0;
+    uint64_t controlRounds = 0;
+    uint64_t retired = 0;
+};
+
+static double median(vector<double> v) {
+    if (v.empty()) return 0;
+    sort(v.begin(), v.end());
+    return v[v.size() / 2];
+}
+
+// least squares slope of rss over time, times the span: how much it grew
+// from the first sample to the last with the noise averaged out
+static double rssGrowthBytes(const vector<SoakSample> &s) {
+    double n = static_cast<double>(s.size()), sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (const SoakSample &x : s) {
+        double y = static_cast<double>(x.process.rssBytes);
+        sx += x.atS;
+        sy += y;
+        sxx += x.atS * x.atS;
+        sxy += x.atS * y;
+    }
+    double den = n * sxx - sx * sx;
+    if (den <= 0) return 0;
+    return (n * sxy - sx * sy) / den * (s.back().atS - s.front().atS);
+}
+
+static string soakControlName() {
+#ifdef _WIN32
+    return "\\\\.\\pipe\\insidingforfeds_soak_" + to_string(GetCurrentProcessId());
+#else
+    return "/tmp/insidingforfeds_soak_" + to_string(getpid()) + ".sock";
+#endif
+}
+
+static bool buildSoakConfig(const SoakSink &sink, int stepUs, uint64_t generation, const vector<MacroStep> &recorded, unique_ptr<SoakConfig> &out, string &error) {
+    unique_ptr<SoakConfig> c(new SoakConfig());
+    int alt = stepUs + static_cast<int>(generation % 3) * stepUs / 2;
+    vector<MacroStep> steps[kSoakTimelines] = {
+        { stepKeyDown(kMarkerVk), stepWaitUs(stepUs), stepKeyUp(kMarkerVk), stepWaitUs(stepUs),
+          stepKeyDown('X'), stepWaitUs(stepUs), stepKeyUp('X'), stepWaitUs(stepUs) },
+        { stepKeyDown('I'), stepWaitUs(alt), stepKeyUp('I'), stepWaitUs(alt) },
+        { stepKeyDown('O'), stepWaitUs(stepUs), stepKeyUp('O'), stepWaitUs(alt), stepWheel(-120), stepWaitUs(stepUs) },
+        recorded,
+    };
+    for (int t = 0; t < kSoakTimelines; ++t) {
+        if (!compileMacroProgram(sink, steps[t], c->programs[t], error)) return false;
+        c->set.programs[t] = &c->programs[t];
+    }
+    c->set.count = kSoakTimelines;
+    out = move(c);
+    return true;
+}
+
+// the whole app minus the os for hours: the real worker with four binds at
+// a short step, a fake hook pressing three of them and playing a recording,
+// the config reloaded (and the recording redone) every --reload-s, the
+// control channel connected and dropped ten times a second. every
+// --interval-s it samples memory, handles, threads, cpu and how far the
+// always-on bind's presses are from where absolute deadlines put them, then
+// fits a trend over everything after the warmup and fails on growth.
+int runSoakBench(const BenchArgs &args) {
+    long seconds = args.getInt("--seconds", 3600);
+    long intervalS = max(1L, args.getInt("--interval-s", 10));
+    long warmupS = args.getInt("--warmup-s", max(2 * intervalS, seconds / 10));
+    long reloadS = max(1L, args.getInt("--reload-s", 5));
+    int stepUs = static_cast<int>(max(100L, args.getInt("--step-us", 500)));
+    const int64_t periodNs = 4LL * stepUs * 1000;
+
+    MacroControl control;
+    SoakSource source;
+    SoakSink sink(periodNs, control.skippedCycles);
+    string error;
+    vector<MacroStep> recorded = { stepKeyDown(kRecordedVk), stepWaitUs(1000), stepKeyUp(kRecordedVk), stepWaitUs(1000) };
+    unique_ptr<SoakConfig> initial;
+    if (!buildSoakConfig(sink, stepUs, 0, recorded, initial, error)) {
+        cerr << "soak: " << error << "\n";
+        return 2;
+    }
+    source.slot.publish(move(initial));
+
+    ControlServer server;
+    const string name = soakControlName();
+    if (!server.open(name, error)) {
+        cerr << "soak: " << error << "\n";
+        return 2;
+    }
+    thread serverThread([&] {
+        server.run([&](const ControlRequest &req) {
+            ControlReply r{};
+            r.op = req.op;
+            if (req.op == static_cast<uint8_t>(ControlOp::QueryStats)) fillControlStats(control, nullptr, r);
+            else r.status = static_cast<uint8_t>(ControlStatus::BadRequest);
+            r.enabled = control.enabled.load() ? 1 : 0;
+            r.timelines = kSoakTimelines;
+            return r;
+        });
+    });
+
+    thread worker([&] {
+        applyThreadRole(ThreadRole::Worker, RealtimeProfile{});
+        DeadlineScheduler sched;
+        runMacroTimelines(sink, sched, source, control);
+    });
+    control.pushCommand(BindEdge::On, monotonicNowNs(), 0);
+
+    atomic<bool> done{false};
+    SequenceRecorder recorder;
+    BindMatcher matcher;
+    matcher.bindKey('F', 1);
+    matcher.bindKey('G', 2);
+    matcher.bindKey('H', 3);
+    thread hook([&] {
+        applyThreadRole(ThreadRole::Hook, RealtimeProfile{});
+        static const uint16_t kKeys[] = { 'F', 'G', 'H' };
+        int recordedEdges = 0;
+        for (uint32_t i = 0; !done.load(); ++i) {
+            // each bind held for a while, then the next one
+            uint16_t vk = kKeys[(i / 64) % 3];
+            if (i % 64 == 0 || i % 64 == 40) {
+                BindHit hit = matcher.hitKey(i % 64 ? kMsgKeyUp : kMsgKeyDown, vk);
+                if (hit) control.pushEdge(bindHitEdge(hit), monotonicNowNs(), bindHitTimeline(hit));
+            }
+            if (recorder.armed()) {
+                int64_t now = monotonicNowNs();
+                if (++recordedEdges <= 24) {
+                    recorder.key(recordedEdges & 1, kRecordedVk, now);
+                } else {
+                    recorder.key(true, kRecordStopVk, now);
+                    recordedEdges = 0;
+                }
+            }
+            this_thread::sleep_for(chrono::microseconds(500));
+        }
+    });
+
+    atomic<uint64_t> reloads{0}, retired{0}, reloadFailures{0};
+    thread config([&] {
+        vector<RecordedInput> inputs;
+        vector<MacroStep> steps;
+        RecordingReport report;
+        string err;
+        int64_t next = monotonicNowNs();
+        for (uint64_t generation = 1; !done.load(); ++generation) {
+            next += reloadS * 1000000000LL;
+            while (!done.load() && monotonicNowNs() < next) this_thread::sleep_for(chrono::milliseconds(50));
+            if (done.load()) break;
+            inputs.clear();
+            recorder.arm();
+            unique_ptr<SoakConfig> c;
+            if (!recorder.waitFinished(inputs, monotonicNowNs() + 2000000000LL) ||
+                !compileRecording(inputs, recorder.endNs(), kDefaultRecordQuantumUs, steps, report, err) ||
+                !buildSoakConfig(sink, stepUs, generation, steps, c, err)) {
+                reloadFailures.fetch_add(1);
+                continue;
+            }
+            source.slot.publish(move(c));
+            control.wake.signal();
+            reloads.fetch_add(1);
+            retired.store(source.slot.retiredCount());
+        }
+    });
+
+    fprintf(stderr, "soak %lds, sample every %lds, warmup %lds, reload every %lds, %dus steps\n", seconds, intervalS, warmupS, reloadS, stepUs);
+    fprintf(stderr, "%8s %10s %8s %8s %7s %10s %10s %12s\n", "t_s", "rss_kb", "handles", "threads", "cpu_%", "drift_us", "events", "ctl_rounds");
+    vector<SoakSample> samples;
+    uint64_t controlRounds = 0, controlFailures = 0;
+    const int64_t start = monotonicNowNs();
+    int64_t nextSample = start + intervalS * 1000000000LL, nextRound = start;
+    const int64_t end = start + seconds * 1000000000LL;
+    ProcessSample previous;
+    sampleProcess(previous);
+    int64_t previousNs = start;
+    uint64_t previousRebases = 0;
+    while (monotonicNowNs() < end) {
+        int64_t now = monotonicNowNs();
+        if (now >= nextRound) {
+            nextRound += 100000000LL;
+            ControlClient client;
+            ControlReply reply;
+            if (client.connect(name, error) && client.request(ControlRequest{ static_cast<uint8_t>(ControlOp::QueryStats), 0, 0, 0, 0 }, reply)) ++controlRounds;
+            else ++controlFailures;
+        }
+        if (now >= nextSample) {
+            nextSample += intervalS * 1000000000LL;
+            SoakSample s;
+            if (!sampleProcess(s.process)) {
+                cerr << "soak: can't sample the process\n";
+                break;
+            }
+            s.atS = (now - start) / 1e9;
+            s.cpuPercent = 100.0 * (s.process.cpuNs - previous.cpuNs) / max<int64_t>(now - previousNs, 1);
+            s.driftMaxNs = sink.takeMaxDriftNs();
+            s.driftLastNs = sink.lastDriftNs();
+            s.events = sink.events();
+            s.markers = sink.markers();
+            s.rebases = sink.rebases() - previousRebases;
+            previousRebases += s.rebases;
+            s.reloads = reloads.load();
+            s.controlRounds = controlRounds;
+            s.retired = retired.load();
+            previous = s.process;
+            previousNs = now;
+            samples.push_back(s);
+            fprintf(stderr, "%8.0f %10lld %8lld %8lld %7.1f %10.1f %10llu %12llu\n", s.atS, static_cast<long long>(s.process.rssBytes / 1024),
+                static_cast<long long>(s.process.handles), static_cast<long long>(s.process.threads), s.cpuPercent, s.driftMaxNs / 1000.0,
+                static_cast<unsigned long long>(s.events), static_cast<unsigned long long>(s.controlRounds));
+        }
+        int64_t wake = min(min(nextRound, nextSample), end);
+        now = monotonicNowNs();
+        if (wake > now) this_thread::sleep_for(chrono::nanoseconds(wake - now));
+    }
+
+    done.store(true);
+    hook.join();
+    config.join();
+    control.requestStop();
+    worker.join();
+    server.stop();
+    serverThread.join();
+
+    vector<SoakSample> trend;
+    for (const SoakSample &s : samples) {
+        if (s.atS >= warmupS) trend.push_back(s);
+    }
+    if (trend.size() < 4) {
+        cerr << "soak: " << trend.size() << " samples after the warmup, need 4 (longer --seconds or shorter --interval-s)\n";
+        return 2;
+    }
+    // first and last quarter of the run after the warmup
+    size_t quarter = max<size_t>(1, trend.size() / 4);
+    auto firstQ = [&](size_t i) { return i < quarter; };
+    auto lastQ = [&](size_t i) { return i >= trend.size() - quarter; };
+    int64_t handlesFirstMax = 0, threadsFirstMax = 0, handlesLastMin = INT64_MAX, threadsLastMin = INT64_MAX;
+    vector<double> cpuFirst, cpuLast, driftFirst, driftLast, rebasesFirst, rebasesLast;
+    for (size_t i = 0; i < trend.size(); ++i) {
+        const SoakSample &s = trend[i];
+        if (firstQ(i)) {
+            handlesFirstMax = max(handlesFirstMax, s.process.handles);
+            threadsFirstMax = max(threadsFirstMax, s.process.threads);
+            cpuFirst.push_back(s.cpuPercent);
+            driftFirst.push_back(static_cast<double>(s.driftMaxNs));
+            rebasesFirst.push_back(static_cast<double>(s.rebases));
+        }
+        if (lastQ(i)) {
+            handlesLastMin = min(handlesLastMin, s.process.handles);
+            threadsLastMin = min(threadsLastMin, s.process.threads);
+            cpuLast.push_back(s.cpuPercent);
+            driftLast.push_back(static_cast<double>(s.driftMaxNs));
+            rebasesLast.push_back(static_cast<double>(s.rebases));
+        }
+    }
+    double rssGrowth = rssGrowthBytes(trend);
+    double rssLimit = max(2.0 * 1024 * 1024, 0.1 * trend.front().process.rssBytes);
+    double cpuLimit = median(cpuFirst) * 1.5 + 2.0;
+    double driftLimit = median(driftFirst) * 2 + 500000.0;
+
+    // a leak raises the floor, a connection caught mid round only a peak
+    string failed;
+    auto check = [&](bool ok, const char *what) {
+        if (ok) return;
+        if (!failed.empty()) failed += ",";
+        failed += what;
+    };
+    check(rssGrowth <= rssLimit, "rss");
+    check(handlesLastMin <= handlesFirstMax, "handles");
+    check(threadsLastMin <= threadsFirstMax, "threads");
+    check(median(cpuLast) <= cpuLimit, "cpu");
+    check(median(driftLast) <= driftLimit, "drift");
+    // the worker falling behind more and more often is growth too
+    check(median(rebasesLast) <= median(rebasesFirst), "rebases");
+    check(controlFailures == 0, "control");
+    check(reloadFailures.load() == 0 && sink.markers() > 0, "macro");
+
+    JsonWriter json;
+    json.beginObject();
+    json.field("bench", "soak");
+    json.field("seconds", static_cast<int64_t>(seconds));
+    json.field("step_us", static_cast<int64_t>(stepUs));
+    json.field("period_ns", periodNs);
+    json.field("events", static_cast<int64_t>(sink.events()));
+    json.field("markers", static_cast<int64_t>(sink.markers()));
+    json.field("reloads", static_cast<int64_t>(reloads.load()));
+    json.field("reload_failures", static_cast<int64_t>(reloadFailures.load()));
+    json.field("rebases", static_cast<int64_t>(sink.rebases()));
+    json.field("skipped_cycles", static_cast<int64_t>(control.skippedCycles.load()));
+    json.field("control_rounds", static_cast<int64_t>(controlRounds));
+    json.field("control_failures", static_cast<int64_t>(controlFailures));
+    json.field("dropped_edges", static_cast<int64_t>(control.droppedEdges.load()));
+    json.histogram("step_jitter", control.latency.stepJitter);
+    json.histogram("trigger_to_emit", control.latency.triggerToEmit);
+    json.beginObject("trend");
+    json.field("samples", static_cast<int64_t>(trend.size()));
+    json.field("rss_growth_bytes", rssGrowth);
+    json.field("rss_limit_bytes", rssLimit);
+    json.field("handles_first_max", handlesFirstMax);
+    json.field("handles_last_min", handlesLastMin);
+    json.field("threads_first_max", threadsFirstMax);
+    json.field("threads_last_min", threadsLastMin);
+    json.field("cpu_first_pct", median(cpuFirst));
+    json.field("cpu_last_pct", median(cpuLast));
+    json.field("drift_first_ns", median(driftFirst));
+    json.field("drift_last_ns", median(driftLast));
+    json.field("rebases_first", median(rebasesFirst));
+    json.field("rebases_last", median(rebasesLast));
+    json.field("failed", failed);
+    json.endObject();
+    json.beginArray("samples");
+    for (const SoakSample &s : samples) {
+        json.beginObject();
+        json.field("t_s", s.atS);
+        json.field("rss_bytes", s.process.rssBytes);
+        json.field("handles", s.process.handles);
+        json.field("threads", s.process.threads);
+        json.field("cpu_pct", s.cpuPercent);
+        json.field("drift_max_ns", s.driftMaxNs);
+        json.field("drift_last_ns", s.driftLastNs);
+        json.field("events", static_cast<int64_t>(s.events));
+        json.field("markers", static_cast<int64_t>(s.markers));
+        json.field("rebases", static_cast<int64_t>(s.rebases));
+        json.field("reloads", static_cast<int64_t>(s.reloads));
+        json.field("control_rounds", static_cast<int64_t>(s.controlRounds));
+        json.field("retired_configs", static_cast<int64_t>(s.retired));
+        json.endObject();
+    }
+    json.endArray();
+    json.field("pass", static_cast<int64_t>(failed.empty()));
+    json.endObject();
+    fprintf(stderr, "rss %+.0fkB (limit %.0fkB)  handles %lld -> %lld  threads %lld -> %lld  cpu %.1f%% -> %.1f%%  drift %.1fus -> %.1fus\n%s\n",
+        rssGrowth / 1024, rssLimit / 1024, static_cast<long long>(handlesFirstMax), static_cast<long long>(handlesLastMin),
+        static_cast<long long>(threadsFirstMax), static_cast<long long>(threadsLastMin), median(cpuFirst), median(cpuLast),
+        median(driftFirst) / 1000, median(driftLast) / 1000, failed.empty() ? "pass" : ("grew: " + failed).c_str());
+    if (!writeBenchOutput(args.get("--out", "-"), json.str())) return 1;
+    return failed.empty() ? 0 : 1;
+}
@@ -0,0 +1,63 @@
+#include "bench_common.h"
+#include "shared_stats.h"
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+
+using namespace std;
+
+// polls the block a running macro publishes. read only, the macro never
+// knows we are here
+int runStatsReader(const BenchArgs &args) {
+    long intervalMs = args.getInt("--interval-ms", 500);
+    long count = args.getInt("--count", 0);
+    bool json = args.has("--json");
+    string name = args.get("--name", kSharedStatsName);
+
+    SharedStats stats;
+    string error;
+    if (!stats.open(error, name.c_str())) {
+        cerr << error << "\n";
+        return 1;
+    }
+    SharedStatsSnapshot prev{};
+    if (!stats.snapshot(prev)) {
+        cerr << "shared stats stayed locked\n";
+        return 1;
+    }
+    if (!json) fprintf(stderr, "pid %u, stats v%u\n", prev.pid, prev.version);
+    for (long i = 0; count == 0 || i < count; ++i) {
+        this_thread::sleep_for(chrono::milliseconds(intervalMs));
+        SharedStatsSnapshot s{};
+        if (!stats.snapshot(s)) continue;
+        double secs = static_cast<double>(intervalMs) / 1000.0;
+        if (json) {
+            JsonWriter w;
+            w.beginObject();
+            w.field("running", static_cast<int64_t>(s.running));
+            w.field("cycles", static_cast<int64_t>(s.cycles));
+            w.field("emitted_events", static_cast<int64_t>(s.emittedEvents));
+            w.field("missed_deadlines", static_cast<int64_t>(s.missedDeadlines));
+            w.field("activations", static_cast<int64_t>(s.activations));
+            w.field("period_ns", s.periodNs);
+            w.field("send_failures", static_cast<int64_t>(s.sendFailures));
+            w.field("short_writes", static_cast<int64_t>(s.shortWrites));
+            w.field("hook_calls", static_cast<int64_t>(s.hookCalls));
+            w.field("hook_max_ns", s.hookMaxNs);
+            w.endObject();
+            cout << w.str() << "\n" << flush;
+        } else {
+            printf("%s  %7.1f cycles/s %8.1f events/s  period %6.2fms  missed %llu  send fail %llu short %llu  activations %llu  hook max %.1fus\n",
+                s.running ? "RUN " : "idle", static_cast<double>(s.cycles - prev.cycles) / secs,
+                static_cast<double>(s.emittedEvents - prev.emittedEvents) / secs, static_cast<double>(s.periodNs) / 1e6,
+                static_cast<unsigned long long>(s.missedDeadlines), static_cast<unsigned long long>(s.sendFailures),
+                static_cast<unsigned long long>(s.shortWrites), static_cast<unsigned long long>(s.activations),
+                static_cast<double>(s.hookMaxNs) / 1000.0);
+            fflush(stdout);
+        }
+        prev = s;
+    }
+    return 0;
+}
@@ -0,0 +1,176 @@
+#include "bench_common.h"
+#include "trace_recorder.h"
+
+#include <cstdio>
+#include <iostream>
+
+using namespace std;
+
+struct MissedDeadline {
+    int64_t atNs;
+    int64_t lateNs;
+    uint16_t frame;
+};
+
+static double toUs(int64_t ns) {
+    return static_cast<double>(ns) / 1000.0;
+}
+
+// chrome://tracing and ui.perfetto.dev both read this: emits are complete
+// events on the worker track, edges instants on the hook track, lateness a
+// counter track
+static string chromeTrace(const vector<TraceRecord> &records, int64_t originNs) {
+    JsonWriter json;
+    json.beginObject();
+    json.field("displayTimeUnit", "ns");
+    json.beginArray("traceEvents");
+    const char *threads[] = { "hook", "worker" };
+    for (int t = 0; t < 2; ++t) {
+        json.beginObject();
+        json.field("name", "thread_name");
+        json.field("ph", "M");
+        json.field("pid", static_cast<int64_t>(1));
+        json.field("tid", static_cast<int64_t>(t + 1));
+        json.beginObject("args");
+        json.field("name", threads[t]);
+        json.endObject();
+        json.endObject();
+    }
+    for (const TraceRecord &r : records) {
+        TraceKind kind = static_cast<TraceKind>(r.kind);
+        bool hook = kind == TraceKind::EdgeDown || kind == TraceKind::EdgeUp;
+        json.beginObject();
+        json.field("name", kind == TraceKind::Emit ? "emit " + to_string(r.arg) : string(traceKindName(r.kind)));
+        json.field("pid", static_cast<int64_t>(1));
+        json.field("tid", static_cast<int64_t>(hook ? 1 : 2));
+        json.field("ts", toUs(r.timeNs - originNs), 3);
+        if (kind == TraceKind::Emit) {
+            json.field("ph", "X");
+            json.field("dur", toUs(r.durationNs), 3);
+            json.beginObject("args");
+            json.field("late_us", toUs(r.timeNs - r.auxNs), 3);
+            json.endObject();
+        } else {
+            json.field("ph", "i");
+            json.field("s", "t");
+        }
+        json.endObject();
+        if (kind == TraceKind::Emit) {
+            json.beginObject();
+            json.field("name", "lateness_us");
+            json.field("ph", "C");
+            json.field("pid", static_cast<int64_t>(1));
+            json.field("ts", toUs(r.timeNs - originNs), 3);
+            json.beginObject("args");
+            json.field("late", toUs(r.timeNs - r.auxNs), 3);
+            json.endObject();
+            json.endObject();
+        }
+    }
+    json.endArray();
+    json.endObject();
+    return json.str();
+}
+
+int runTraceAnalyzer(const BenchArgs &args) {
+    string path = args.get("--in", "");
+    if (path.empty()) {
+        cerr << "trace: --in <file> is required\n";
+        return 2;
+    }
+    int64_t missNs = args.getInt("--miss-us", 500) * 1000;
+    vector<TraceRecord> records;
+    int64_t createdNs = 0;
+    string error;
+    if (!readTraceFile(path, records, createdNs, error)) {
+        cerr << error << "\n";
+        return 1;
+    }
+
+    LatencyHistogram lateness, sinkCall, intervalError, triggerToEmit;
+    vector<MissedDeadline> missed;
+    uint64_t missedCount = 0, early = 0, emits = 0, edges = 0, cycles = 0, parks = 0;
+    int64_t lastEmitNs = 0, lastDeadline = 0, pendingTrigger = 0;
+    for (const TraceRecord &r : records) {
+        switch (static_cast<TraceKind>(r.kind)) {
+        case TraceKind::EdgeDown:
+            ++edges;
+            if (!pendingTrigger) pendingTrigger = r.timeNs;
+            break;
+        case TraceKind::EdgeUp:
+            ++edges;
+            break;
+        case TraceKind::CycleStart:
+            ++cycles;
+            break;
+        case TraceKind::Park:
+        case TraceKind::Program:
+            // the next emit starts a new run, its gap to the last one means nothing
+            parks += r.kind == static_cast<uint8_t>(TraceKind::Park);
+            lastEmitNs = 0;
+            break;
+        case TraceKind::Emit: {
+            ++emits;
+            int64_t late = r.timeNs - r.auxNs;
+            if (late < 0) ++early;
+            lateness.record(late);
+            sinkCall.record(r.durationNs);
+            if (late > missNs) {
+                ++missedCount;
+                if (missed.size() < 32) missed.push_back(MissedDeadline{ r.timeNs - createdNs, late, r.arg });
+            }
+            if (lastEmitNs) {
+                int64_t err = (r.timeNs - lastEmitNs) - (r.auxNs - lastDeadline);
+                intervalError.record(err < 0 ? -err : err);
+            }
+            if (pendingTrigger) {
+                triggerToEmit.record(r.timeNs - pendingTrigger);
+                pendingTrigger = 0;
+            }
+            lastEmitNs = r.timeNs;
+            lastDeadline = r.auxNs;
+            break;
+        }
+        }
+    }
+
+    JsonWriter json;
+    json.beginObject();
+    json.field("trace", path);
+    json.field("records", static_cast<int64_t>(records.size()));
+    // the ring only keeps the newest lap, seq 1 gone means the start is lost
+    json.field("wrapped", static_cast<int64_t>(!records.empty() && records.front().seq > 1));
+    json.field("span_ns", records.empty() ? static_cast<int64_t>(0) : records.back().timeNs - records.front().timeNs);
+    json.field("edges", static_cast<int64_t>(edges));
+    json.field("cycles", static_cast<int64_t>(cycles));
+    json.field("parks", static_cast<int64_t>(parks));
+    json.field("emits", static_cast<int64_t>(emits));
+    json.field("early_emits", static_cast<int64_t>(early));
+    json.histogram("emit_lateness", lateness);
+    json.histogram("interval_error", intervalError);
+    json.histogram("sink_call", sinkCall);
+    json.histogram("trigger_to_emit", triggerToEmit);
+    json.field("miss_threshold_ns", missNs);
+    json.field("missed_deadlines", static_cast<int64_t>(missedCount));
+    json.beginArray("first_missed");
+    for (const MissedDeadline &m : missed) {
+        json.beginObject();
+        json.field("at_ns", m.atNs);
+        json.field("late_ns", m.lateNs);
+        json.field("frame", static_cast<int64_t>(m.frame));
+        json.endObject();
+    }
+    json.endArray();
+    json.endObject();
+
+    fprintf(stderr, "%zu records, %llu emits: lateness p99 %.1fus max %.1fus, sink call p99 %.1fus, %llu missed (> %.0fus)\n",
+        records.size(), static_cast<unsigned long long>(emits), toUs(lateness.percentile(99)), toUs(lateness.max()),
+        toUs(sinkCall.percentile(99)), static_cast<unsigned long long>(missedCount), toUs(missNs));
+
+    string chrome = args.get("--chrome", "");
+    if (!chrome.empty() && !writeBenchOutput(chrome, chromeTrace(records, createdNs))) {
+        cerr << "can't write " << chrome << "\n";
+        return 1;
+    }
+    return writeBenchOutput(args.get("--out", "-"), json.str()) ? 0 : 1;
+}
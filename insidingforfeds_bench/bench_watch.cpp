@@ -0,0 +1,175 @@
+#include "bench_common.h"
+#include "config_watcher.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+
+#ifndef _WIN32
+#include <cstdlib>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// a directory of its own under the temp dir, removed with whatever is left
+class ScratchDir {
+public:
+    ScratchDir() {
+#ifdef _WIN32
+        char base[MAX_PATH];
+        DWORD n = GetTempPathA(MAX_PATH, base);
+        if (n && n < MAX_PATH) {
+            string dir = string(base) + "insidingforfeds_watch_" + to_string(GetCurrentProcessId());
+            if (CreateDirectoryA(dir.c_str(), nullptr)) path_ = dir;
+        }
+#else
+        char dir[] = "/tmp/insidingforfeds_watch_XXXXXX";
+        if (mkdtemp(dir)) path_ = dir;
+#endif
+    }
+    ~ScratchDir() {
+        if (path_.empty()) return;
+        for (const string &f : files_) remove(file(f).c_str());
+#ifdef _WIN32
+        RemoveDirectoryA(path_.c_str());
+#else
+        rmdir(path_.c_str());
+#endif
+    }
+    ScratchDir(const ScratchDir &) = delete;
+    ScratchDir &operator=(const ScratchDir &) = delete;
+
+    bool ok() const { return !path_.empty(); }
+    string file(const string &name) const { return path_ + "/" + name; }
+    void track(const string &name) { files_.push_back(name); }
+
+private:
+    string path_;
+    vector<string> files_;
+};
+
+static bool writeFile(const string &path, const string &text) {
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+    bool ok = fwrite(text.data(), 1, text.size(), f) == text.size();
+    return fclose(f) == 0 && ok;
+}
+
+// how editors that save atomically put the new file in place
+static bool replaceFile(const string &from, const string &to) {
+#ifdef _WIN32
+    return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+struct WatchCase {
+    const char *name;
+    int reloads;
+};
+
+// every save the way some editor does it has to come out as exactly one
+// reload through waitForSave, the loop the app's config reloader runs; other
+// files in the directory as none
+int runWatchBench(const BenchArgs &args) {
+    int quietMs = static_cast<int>(max(10L, args.getInt("--quiet-ms", 100)));
+    long rounds = max(1L, args.getInt("--rounds", 5));
+
+    ScratchDir dir;
+    if (!dir.ok()) {
+        cerr << "can't make a scratch directory\n";
+        return 2;
+    }
+    const string config = dir.file("config.json");
+    const string temp = dir.file("config.json.tmp");
+    const string other = dir.file("other.json");
+    dir.track("config.json");
+    dir.track("config.json.tmp");
+    dir.track("other.json");
+    if (!writeFile(config, "{}\n")) {
+        cerr << "can't write " << config << "\n";
+        return 2;
+    }
+
+    ConfigWatcher watcher(config);
+    if (!watcher.ok()) {
+        cerr << "can't watch " << config << "\n";
+        return 2;
+    }
+    atomic<int> reloads{0};
+    thread reloader([&] {
+        while (watcher.waitForSave(quietMs) == WatchResult::Changed) reloads.fetch_add(1);
+    });
+    // settles well past the quiet time so a late event still gets counted
+    // against the case that caused it
+    auto settle = [&] { this_thread::sleep_for(chrono::milliseconds(quietMs * 4)); };
+
+    const WatchCase cases[] = {
+        { "write in place", 1 },
+        { "write a temp file, rename it over", 1 },
+        { "write in place, then rename a temp file over", 1 },
+        { "three writes in a row", 1 },
+        { "another file in the directory", 0 },
+    };
+    int failures = 0;
+    JsonWriter json;
+    json.beginObject();
+    json.field("bench", "watch");
+    json.field("quiet_ms", static_cast<int64_t>(quietMs));
+    json.field("rounds", static_cast<int64_t>(rounds));
+    json.beginArray("cases");
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+        int wrong = 0;
+        for (long round = 0; round < rounds; ++round) {
+            string text = "{ \"round\": " + to_string(round) + " }\n";
+            int before = reloads.load();
+            bool ok = true;
+            switch (c) {
+            case 0:
+                ok = writeFile(config, text);
+                break;
+            case 1:
+                ok = writeFile(temp, text) && replaceFile(temp, config);
+                break;
+            case 2:
+                ok = writeFile(config, text) && writeFile(temp, text) && replaceFile(temp, config);
+                break;
+            case 3:
+                for (int i = 0; i < 3 && ok; ++i) ok = writeFile(config, text + string(static_cast<size_t>(i), ' '));
+                break;
+            default:
+                ok = writeFile(other, text);
+                break;
+            }
+            settle();
+            int got = reloads.load() - before;
+            if (!ok) {
+                ++wrong;
+                if (failures + wrong <= 5) fprintf(stderr, "%s: writing failed\n", cases[c].name);
+            } else if (got != cases[c].reloads) {
+                ++wrong;
+                if (failures + wrong <= 5) fprintf(stderr, "%s: %d reloads, expected %d\n", cases[c].name, got, cases[c].reloads);
+            }
+        }
+        failures += wrong;
+        json.beginObject();
+        json.field("case", cases[c].name);
+        json.field("expected_reloads", static_cast<int64_t>(cases[c].reloads));
+        json.field("wrong_rounds", static_cast<int64_t>(wrong));
+        json.endObject();
+    }
+    json.endArray();
+    json.field("failures", static_cast<int64_t>(failures));
+    json.endObject();
+
+    watcher.stop();
+    reloader.join();
+    fprintf(stderr, "%zu cases x %ld rounds, %dms quiet time: %d failures\n", sizeof(cases) / sizeof(cases[0]), rounds, quietMs, failures);
+    if (!writeBenchOutput(args.get("--out", "-"), json.str())) return 1;
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "macro_loops.h"
+#include "input_sink.h"
+
+// one scripted input: a bind edge, or the app shutting down. timeline picks
+// the bind when several macros run side by side.
+struct SimInput {
+    enum Kind : uint8_t { Down, Up, Stop };
+    int64_t atNs;
+    Kind kind;
+    uint8_t timeline = 0;
+};
+
+// stands in for DeadlineScheduler. time only moves when the loop waits, and
+// jumps straight to the next deadline or the next scripted input, whichever
+// comes first; inputs are fed to the control block the moment the clock
+// reaches them. everything runs on the calling thread, so a run is a pure
+// function of program + script and takes microseconds however long it spans.
+class VirtualScheduler {
+public:
+    // a script that leaves the macro on would run forever, past endNs the
+    // clock stops the loop as if the app was closed then. -1 = no limit
+    VirtualScheduler(MacroControl &control, const std::vector<SimInput> &script, int64_t endNs = -1) : control_(control), script_(script), endNs_(endNs) {}
+
+    int64_t now() const { return now_; }
+
+    bool waitUntil(int64_t deadlineNs, const WakeEvent &cancel, uint32_t seen) {
+        if (cancel.sequence() != seen) return false;
+        if (next_ < script_.size() && script_[next_].atNs <= deadlineNs) {
+            deliverNext();
+            return false;
+        }
+        if (endNs_ >= 0 && deadlineNs >= endNs_) {
+            now_ = std::max(now_, endNs_);
+            control_.requestStop();
+            return false;
+        }
+        now_ = std::max(now_, deadlineNs);
+        return true;
+    }
+
+    void park(const WakeEvent &wake, uint32_t seen) {
+        if (wake.sequence() != seen) return;
+        // nothing left to happen, a real app would wait forever
+        if (next_ < script_.size()) deliverNext();
+        else control_.requestStop();
+    }
+
+private:
+    // inputs with the same timestamp arrive as one burst, like a hook that
+    // got ahead of the worker
+    void deliverNext() {
+        int64_t at = script_[next_].atNs;
+        now_ = std::max(now_, at);
+        while (next_ < script_.size() && script_[next_].atNs == at) {
+            const SimInput &in = script_[next_++];
+            if (in.kind == SimInput::Stop) control_.requestStop();
+            else control_.pushEdge(in.kind == SimInput::Down ? BindEdge::Down : BindEdge::Up, now_, in.timeline);
+        }
+    }
+
+    MacroControl &control_;
+    const std::vector<SimInput> &script_;
+    int64_t endNs_;
+    size_t next_ = 0;
+    int64_t now_ = 0;
+};
+
+// RecordingSink with the virtual clock's timestamps
+class SimSink {
+public:
+    using Record = RecordedEvent;
+
+    explicit SimSink(const VirtualScheduler &clock) : clock_(clock) {}
+
+    Record prepare(SinkEventType type, int32_t value) const { return Record{ 0, type, value }; }
+    void emit(const Record *records, size_t count) {
+        for (size_t i = 0; i < count; ++i) events_.push_back(Record{ clock_.now(), records[i].type, records[i].value });
+        batches_++;
+    }
+    void emit(const Record &r) { emit(&r, 1); }
+
+    const std::vector<RecordedEvent> &events() const { return events_; }
+    uint64_t batches() const { return batches_; }
+
+private:
+    const VirtualScheduler &clock_;
+    std::vector<RecordedEvent> events_;
+    uint64_t batches_ = 0;
+};
@@ -0,0 +1,150 @@
+#include "alloc_tracker.h"
+
+const char *allocRegionName(AllocRegion r) {
+    switch (r) {
+    case AllocRegion::Untagged: return "untagged";
+    case AllocRegion::Hook: return "hook";
+    case AllocRegion::MacroStep: return "macro step";
+    case AllocRegion::Ui: return "ui";
+    case AllocRegion::Config: return "config";
+    case AllocRegion::Control: return "control";
+    case AllocRegion::Count: break;
+    }
+    return "?";
+}
+
+#ifdef IFF_TRACK_ALLOCS
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <sstream>
+
+using namespace std;
+
+namespace {
+
+struct Counter {
+    atomic<uint64_t> allocations{0};
+    atomic<uint64_t> bytes{0};
+
+    void add(size_t n) {
+        allocations.fetch_add(1, memory_order_relaxed);
+        bytes.fetch_add(n, memory_order_relaxed);
+    }
+};
+
+struct ThreadSlot {
+    atomic<const char *> name{nullptr};
+    Counter counter;
+};
+
+// fixed tables, nothing here may allocate. threads past the last slot
+// share it
+const int kMaxThreads = 64;
+ThreadSlot g_threads[kMaxThreads];
+atomic<int> g_threadCount{0};
+Counter g_regions[static_cast<int>(AllocRegion::Count)];
+
+thread_local int t_slot = -1;
+thread_local AllocRegion t_region = AllocRegion::Untagged;
+
+ThreadSlot &threadSlot() {
+    if (t_slot < 0) {
+        int slot = g_threadCount.fetch_add(1, memory_order_relaxed);
+        t_slot = slot < kMaxThreads ? slot : kMaxThreads - 1;
+    }
+    return g_threads[t_slot];
+}
+
+void countAlloc(size_t n) {
+    threadSlot().counter.add(n);
+    g_regions[static_cast<int>(t_region)].add(n);
+}
+
+void *countedAlloc(size_t n) {
+    countAlloc(n);
+    return malloc(n ? n : 1);
+}
+
+} // namespace
+
+AllocScope::AllocScope(AllocRegion region) : previous_(t_region) {
+    t_region = region;
+}
+
+AllocScope::~AllocScope() {
+    t_region = previous_;
+}
+
+void allocTagThread(const char *name) {
+    threadSlot().name.store(name, memory_order_relaxed);
+}
+
+AllocCounts allocRegionCounts(AllocRegion region) {
+    AllocCounts c;
+    const Counter &r = g_regions[static_cast<int>(region)];
+    c.allocations = r.allocations.load(memory_order_relaxed);
+    c.bytes = r.bytes.load(memory_order_relaxed);
+    return c;
+}
+
+void allocReset() {
+    for (Counter &c : g_regions) {
+        c.allocations.store(0, memory_order_relaxed);
+        c.bytes.store(0, memory_order_relaxed);
+    }
+    for (ThreadSlot &t : g_threads) {
+        t.counter.allocations.store(0, memory_order_relaxed);
+        t.counter.bytes.store(0, memory_order_relaxed);
+    }
+}
+
+string allocReport() {
+    // taken before the stream below adds its own
+    uint64_t threadAllocs[kMaxThreads], threadBytes[kMaxThreads], regionAllocs[static_cast<int>(AllocRegion::Count)], regionBytes[static_cast<int>(AllocRegion::Count)];
+    int threads = g_threadCount.load(memory_order_relaxed);
+    if (threads > kMaxThreads) threads = kMaxThreads;
+    for (int i = 0; i < threads; ++i) {
+        threadAllocs[i] = g_threads[i].counter.allocations.load(memory_order_relaxed);
+        threadBytes[i] = g_threads[i].counter.bytes.load(memory_order_relaxed);
+    }
+    for (int i = 0; i < static_cast<int>(AllocRegion::Count); ++i) {
+        regionAllocs[i] = g_regions[i].allocations.load(memory_order_relaxed);
+        regionBytes[i] = g_regions[i].bytes.load(memory_order_relaxed);
+    }
+    stringstream ss;
+    for (int i = 0; i < threads; ++i) {
+        if (!threadAllocs[i]) continue;
+        const char *name = g_threads[i].name.load(memory_order_relaxed);
+        ss << "thread " << i << " (" << (name ? name : "untagged") << "): " << threadAllocs[i] << " allocations, " << threadBytes[i] << " bytes\n";
+    }
+    for (int i = 0; i < static_cast<int>(AllocRegion::Count); ++i) {
+        if (!regionAllocs[i]) continue;
+        ss << "region " << allocRegionName(static_cast<AllocRegion>(i)) << ": " << regionAllocs[i] << " allocations, " << regionBytes[i] << " bytes\n";
+    }
+    return ss.str();
+}
+
+void *operator new(size_t n) {
+    void *p = countedAlloc(n);
+    if (!p) throw bad_alloc();
+    return p;
+}
+
+void *operator new[](size_t n) {
+    void *p = countedAlloc(n);
+    if (!p) throw bad_alloc();
+    return p;
+}
+
+void *operator new(size_t n, const nothrow_t &) noexcept { return countedAlloc(n); }
+void *operator new[](size_t n, const nothrow_t &) noexcept { return countedAlloc(n); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, const nothrow_t &) noexcept { free(p); }
+void operator delete[](void *p, const nothrow_t &) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+#endif
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// code regions allocations get charged to. Hook and MacroStep must stay at
+// zero once the macro is armed, the others are only reported.
+enum class AllocRegion : uint8_t { Untagged, Hook, MacroStep, Ui, Config, Control, Count };
+
+const char *allocRegionName(AllocRegion r);
+
+// IFF_TRACK_ALLOCS (debug builds of the app, every bench build) replaces
+// the global operator new/delete with counting ones. every allocation is
+// charged to the calling thread (named by applyThreadRole) and to the
+// innermost IFF_ALLOC_SCOPE on it. without the flag the scopes compile to
+// nothing and the default allocator is untouched.
+#ifdef IFF_TRACK_ALLOCS
+
+struct AllocCounts {
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+};
+
+class AllocScope {
+public:
+    explicit AllocScope(AllocRegion region);
+    ~AllocScope();
+    AllocScope(const AllocScope &) = delete;
+    AllocScope &operator=(const AllocScope &) = delete;
+
+private:
+    AllocRegion previous_;
+};
+
+// names the calling thread in the report, the name must outlive it
+void allocTagThread(const char *name);
+AllocCounts allocRegionCounts(AllocRegion region);
+// zeroes every counter, e.g. once the macro is armed
+void allocReset();
+// one line per thread and per region that allocated
+std::string allocReport();
+
+#define IFF_ALLOC_SCOPE(region) AllocScope iffAllocScope_(region)
+
+#else
+
+inline void allocTagThread(const char *name) { (void)name; }
+inline void allocReset() {}
+
+#define IFF_ALLOC_SCOPE(region) ((void)0)
+
+#endif
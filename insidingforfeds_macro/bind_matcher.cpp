@@ -0,0 +1,35 @@
+#include "bind_matcher.h"
+
+#include <cstring>
+
+void BindMatcher::clear() {
+    memset(keys_, 0, sizeof(keys_));
+    memset(mouse_, 0, sizeof(mouse_));
+}
+
+void BindMatcher::bindKey(int vk, uint8_t timeline) {
+    if (vk <= 0 || vk > 0xFF || timeline >= 64) return;
+    uint8_t down = static_cast<uint8_t>(BindEdge::Down) | static_cast<uint8_t>(timeline << 2);
+    uint8_t up = static_cast<uint8_t>(BindEdge::Up) | static_cast<uint8_t>(timeline << 2);
+    keys_[((kMsgKeyDown - kMsgKeyDown) << 8) | vk] = down;
+    keys_[((kMsgSysKeyDown - kMsgKeyDown) << 8) | vk] = down;
+    keys_[((kMsgKeyUp - kMsgKeyDown) << 8) | vk] = up;
+    keys_[((kMsgSysKeyUp - kMsgKeyDown) << 8) | vk] = up;
+}
+
+void BindMatcher::bindMouse(MouseButton mb, uint8_t timeline) {
+    if (timeline >= 64) return;
+    uint32_t down = 0, up = 0;
+    uint32_t xFirst = 0, xLast = 3;
+    switch (mb) {
+    case MouseButton::Left: down = kMsgLButtonDown; up = kMsgLButtonUp; break;
+    case MouseButton::Right: down = kMsgRButtonDown; up = kMsgRButtonUp; break;
+    case MouseButton::Middle: down = kMsgMButtonDown; up = kMsgMButtonUp; break;
+    case MouseButton::X1: down = kMsgXButtonDown; up = kMsgXButtonUp; xFirst = xLast = 1; break;
+    case MouseButton::X2: down = kMsgXButtonDown; up = kMsgXButtonUp; xFirst = xLast = 2; break;
+    }
+    for (uint32_t x = xFirst; x <= xLast; ++x) {
+        mouse_[((down - kMsgMouseMove) << 2) | x] = static_cast<uint8_t>(BindEdge::Down) | static_cast<uint8_t>(timeline << 2);
+        mouse_[((up - kMsgMouseMove) << 2) | x] = static_cast<uint8_t>(BindEdge::Up) | static_cast<uint8_t>(timeline << 2);
+    }
+}
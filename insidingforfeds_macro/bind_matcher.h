@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+
+enum class KeybindType { Keyboard, Mouse };
+enum class MouseButton { Left, Right, Middle, X1, X2 };
+
+// On and Off set the macro directly (control channel), they never come
+// from a bind and never sit in a BindHit
+enum class BindEdge : uint8_t { None, Down, Up, On, Off };
+
+// low-level hook message ids, same values as WM_* so this builds without
+// windows.h and can be fed synthetic streams
+static const uint32_t kMsgKeyDown = 0x0100;
+static const uint32_t kMsgKeyUp = 0x0101;
+static const uint32_t kMsgSysKeyDown = 0x0104;
+static const uint32_t kMsgSysKeyUp = 0x0105;
+static const uint32_t kMsgMouseMove = 0x0200;
+static const uint32_t kMsgLButtonDown = 0x0201;
+static const uint32_t kMsgLButtonUp = 0x0202;
+static const uint32_t kMsgRButtonDown = 0x0204;
+static const uint32_t kMsgRButtonUp = 0x0205;
+static const uint32_t kMsgMButtonDown = 0x0207;
+static const uint32_t kMsgMButtonUp = 0x0208;
+static const uint32_t kMsgMouseWheel = 0x020A;
+static const uint32_t kMsgXButtonDown = 0x020B;
+static const uint32_t kMsgXButtonUp = 0x020C;
+static const uint32_t kMsgMouseHWheel = 0x020E;
+
+// a table entry: the edge in the low two bits, the timeline the bind drives
+// above them. 0 means no bind.
+typedef uint8_t BindHit;
+inline BindEdge bindHitEdge(BindHit h) { return static_cast<BindEdge>(h & 3); }
+inline uint8_t bindHitTimeline(BindHit h) { return static_cast<uint8_t>(h >> 2); }
+
+// precompiled trigger table for the hook callbacks: one bounds check and one
+// byte load per event, so mouse moves and unrelated keys fall straight
+// through. rebuilt on bind change, never touched from the hook.
+class BindMatcher {
+public:
+    BindMatcher() { clear(); }
+
+    void clear();
+    // timeline < 64, picks which macro the bind starts
+    void bindKey(int vk, uint8_t timeline = 0);
+    void bindMouse(MouseButton mb, uint8_t timeline = 0);
+
+    // msg is the hook wParam, vk the KBDLLHOOKSTRUCT vkCode
+    BindHit hitKey(uint32_t msg, uint32_t vk) const {
+        uint32_t row = msg - kMsgKeyDown;
+        if (row >= kKeyRows || vk > 0xFF) return 0;
+        return keys_[(row << 8) | vk];
+    }
+
+    // xbutton is HIWORD(mouseData); only the x button messages care, the
+    // others have every column filled so whatever it holds still matches
+    BindHit hitMouse(uint32_t msg, uint32_t xbutton) const {
+        uint32_t row = msg - kMsgMouseMove;
+        if (row >= kMouseRows) return 0;
+        return mouse_[(row << 2) | (xbutton & 3)];
+    }
+
+    BindEdge matchKey(uint32_t msg, uint32_t vk) const { return bindHitEdge(hitKey(msg, vk)); }
+    BindEdge matchMouse(uint32_t msg, uint32_t xbutton) const { return bindHitEdge(hitMouse(msg, xbutton)); }
+
+private:
+    static const uint32_t kKeyRows = 8;
+    static const uint32_t kMouseRows = 16;
+
+    uint8_t keys_[kKeyRows * 256];
+    uint8_t mouse_[kMouseRows * 4];
+};
@@ -0,0 +1,160 @@
+#include "config_watcher.h"
+
+#ifdef _WIN32
+#include <cwctype>
+#else
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#endif
+
+using namespace std;
+
+static void splitPath(const string &path, string &dir, string &name) {
+    size_t slash = path.find_last_of("\\/");
+    if (slash == string::npos) {
+        dir = ".";
+        name = path;
+    } else {
+        dir = slash == 0 ? path.substr(0, 1) : path.substr(0, slash);
+        name = path.substr(slash + 1);
+    }
+}
+
+#ifdef _WIN32
+ConfigWatcher::ConfigWatcher(const string &path) {
+    string dir;
+    splitPath(path, dir, name_);
+    for (char c : name_) wideName_.push_back(static_cast<wchar_t>(towlower(static_cast<unsigned char>(c))));
+    dir_ = CreateFileA(dir.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+        OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+    changed_ = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+    stop_ = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+    if (ok() && !arm()) {
+        CloseHandle(dir_);
+        dir_ = INVALID_HANDLE_VALUE;
+    }
+}
+
+ConfigWatcher::~ConfigWatcher() {
+    if (dir_ != INVALID_HANDLE_VALUE) {
+        CancelIoEx(dir_, &overlapped_);
+        DWORD bytes = 0;
+        GetOverlappedResult(dir_, &overlapped_, &bytes, TRUE);
+        CloseHandle(dir_);
+    }
+    if (changed_) CloseHandle(changed_);
+    if (stop_) CloseHandle(stop_);
+}
+
+bool ConfigWatcher::ok() const {
+    return dir_ != INVALID_HANDLE_VALUE && changed_ && stop_;
+}
+
+bool ConfigWatcher::arm() {
+    ResetEvent(changed_);
+    overlapped_ = OVERLAPPED{};
+    overlapped_.hEvent = changed_;
+    return ReadDirectoryChangesW(dir_, buffer_, sizeof(buffer_), FALSE,
+        FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE, nullptr, &overlapped_, nullptr) != 0;
+}
+
+WatchResult ConfigWatcher::wait(int timeoutMs) {
+    if (!ok()) return WatchResult::Stopped;
+    HANDLE handles[2] = { stop_, changed_ };
+    for (;;) {
+        DWORD r = WaitForMultipleObjects(2, handles, FALSE, timeoutMs < 0 ? INFINITE : static_cast<DWORD>(timeoutMs));
+        if (r == WAIT_TIMEOUT) return WatchResult::Timeout;
+        if (r != WAIT_OBJECT_0 + 1) return WatchResult::Stopped;
+        DWORD bytes = 0;
+        bool hit = false;
+        if (!GetOverlappedResult(dir_, &overlapped_, &bytes, FALSE) || bytes == 0) {
+            // buffer overflow, we don't know what changed
+            hit = true;
+        } else {
+            const BYTE *p = reinterpret_cast<const BYTE *>(buffer_);
+            for (;;) {
+                const FILE_NOTIFY_INFORMATION *info = reinterpret_cast<const FILE_NOTIFY_INFORMATION *>(p);
+                size_t len = info->FileNameLength / sizeof(WCHAR);
+                if (len == wideName_.size()) {
+                    bool same = true;
+                    for (size_t i = 0; i < len && same; ++i) same = towlower(info->FileName[i]) == wideName_[i];
+                    hit = hit || same;
+                }
+                if (!info->NextEntryOffset) break;
+                p += info->NextEntryOffset;
+            }
+        }
+        if (!arm()) return WatchResult::Stopped;
+        if (hit) return WatchResult::Changed;
+    }
+}
+
+void ConfigWatcher::stop() {
+    if (stop_) SetEvent(stop_);
+}
+#else
+ConfigWatcher::ConfigWatcher(const string &path) {
+    string dir;
+    splitPath(path, dir, name_);
+    inotify_ = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (inotify_ >= 0 && inotify_add_watch(inotify_, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+        close(inotify_);
+        inotify_ = -1;
+    }
+    if (pipe(stopPipe_) != 0) stopPipe_[0] = stopPipe_[1] = -1;
+}
+
+ConfigWatcher::~ConfigWatcher() {
+    if (inotify_ >= 0) close(inotify_);
+    for (int fd : stopPipe_) if (fd >= 0) close(fd);
+}
+
+bool ConfigWatcher::ok() const {
+    return inotify_ >= 0 && stopPipe_[0] >= 0;
+}
+
+WatchResult ConfigWatcher::wait(int timeoutMs) {
+    if (!ok()) return WatchResult::Stopped;
+    alignas(inotify_event) char buf[4096];
+    for (;;) {
+        pollfd fds[2] = { { stopPipe_[0], POLLIN, 0 }, { inotify_, POLLIN, 0 } };
+        int r = poll(fds, 2, timeoutMs);
+        if (r == 0) return WatchResult::Timeout;
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return WatchResult::Stopped;
+        }
+        if (fds[0].revents) return WatchResult::Stopped;
+        bool hit = false;
+        ssize_t n;
+        while ((n = read(inotify_, buf, sizeof(buf))) > 0) {
+            for (char *p = buf; p < buf + n;) {
+                const inotify_event *ev = reinterpret_cast<const inotify_event *>(p);
+                if (ev->mask & IN_Q_OVERFLOW) hit = true;
+                else if (ev->len && name_ == ev->name) hit = true;
+                p += sizeof(inotify_event) + ev->len;
+            }
+        }
+        if (hit) return WatchResult::Changed;
+    }
+}
+
+void ConfigWatcher::stop() {
+    if (stopPipe_[1] >= 0) {
+        char b = 1;
+        ssize_t r = write(stopPipe_[1], &b, 1);
+        (void)r;
+    }
+}
+#endif
+
+WatchResult ConfigWatcher::waitForSave(int quietMs) {
+    WatchResult r = wait();
+    if (r != WatchResult::Changed) return r;
+    while ((r = wait(quietMs)) == WatchResult::Changed) {}
+    return r == WatchResult::Timeout ? WatchResult::Changed : r;
+}
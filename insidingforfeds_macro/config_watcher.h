@@ -0,0 +1,44 @@
+#pragma once
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include <string>
+
+enum class WatchResult { Changed, Timeout, Stopped };
+
+// watches one file through its directory, so editors that save by writing a
+// temp file and renaming it over still count. ReadDirectoryChangesW on
+// windows, inotify on linux.
+class ConfigWatcher {
+public:
+    explicit ConfigWatcher(const std::string &path);
+    ~ConfigWatcher();
+    ConfigWatcher(const ConfigWatcher &) = delete;
+    ConfigWatcher &operator=(const ConfigWatcher &) = delete;
+
+    bool ok() const;
+    // timeoutMs < 0 waits until a change or stop()
+    WatchResult wait(int timeoutMs = -1);
+    // a change and then quietMs without another: editors tend to save in a
+    // few writes, that's one save. Changed or Stopped
+    WatchResult waitForSave(int quietMs);
+    // any thread
+    void stop();
+
+private:
+    std::string name_;
+#ifdef _WIN32
+    bool arm();
+
+    std::wstring wideName_;
+    HANDLE dir_ = INVALID_HANDLE_VALUE;
+    HANDLE changed_ = nullptr;
+    HANDLE stop_ = nullptr;
+    OVERLAPPED overlapped_{};
+    DWORD buffer_[1024];
+#else
+    int inotify_ = -1;
+    int stopPipe_[2] = { -1, -1 };
+#endif
+};
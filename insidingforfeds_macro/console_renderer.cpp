@@ -0,0 +1,272 @@
+#include "console_renderer.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifndef _WIN32
+#include <csignal>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#endif
+
+using namespace std;
+
+// changed cells closer than this get written as one run
+static const int kRunMergeGap = 4;
+static const uint16_t kUnknownCell = 0xFFFF;
+
+static bool sameCell(const ConsoleCell &a, const ConsoleCell &b) {
+    return a.ch == b.ch && a.color == b.color;
+}
+
+#ifdef _WIN32
+static WORD cellAttributes(CellColor c, WORD defaultAttr) {
+    switch (c) {
+    case CellColor::Green: return FOREGROUND_GREEN | FOREGROUND_INTENSITY;
+    case CellColor::Red: return FOREGROUND_RED | FOREGROUND_INTENSITY;
+    case CellColor::Cyan: return FOREGROUND_GREEN | FOREGROUND_BLUE | FOREGROUND_INTENSITY;
+    default: return defaultAttr;
+    }
+}
+
+ConsoleRenderer::ConsoleRenderer() : ConsoleRenderer(GetStdHandle(STD_OUTPUT_HANDLE)) {
+    HANDLE in = GetStdHandle(STD_INPUT_HANDLE);
+    if (GetConsoleMode(in, &savedInputMode_) && SetConsoleMode(in, savedInputMode_ | ENABLE_WINDOW_INPUT)) input_ = in;
+}
+
+ConsoleRenderer::ConsoleRenderer(HANDLE out) : out_(out) {
+    CONSOLE_SCREEN_BUFFER_INFO csbi{};
+    if (GetConsoleScreenBufferInfo(out_, &csbi)) defaultAttr_ = csbi.wAttributes;
+    if (!defaultAttr_) defaultAttr_ = FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE;
+    updateSize();
+}
+
+ConsoleRenderer::~ConsoleRenderer() {
+    if (input_) SetConsoleMode(input_, savedInputMode_);
+}
+
+bool ConsoleRenderer::updateSize() {
+    CONSOLE_SCREEN_BUFFER_INFO csbi{};
+    int cols = 80, rows = 25;
+    if (GetConsoleScreenBufferInfo(out_, &csbi)) {
+        cols = csbi.srWindow.Right - csbi.srWindow.Left + 1;
+        rows = csbi.srWindow.Bottom - csbi.srWindow.Top + 1;
+    }
+    bool moved = csbi.srWindow.Left != originX_ || csbi.srWindow.Top != originY_;
+    originX_ = csbi.srWindow.Left;
+    originY_ = csbi.srWindow.Top;
+    if (cols == cols_ && rows == rows_ && !moved) return false;
+    cols_ = max(cols, 0);
+    rows_ = max(rows, 0);
+    size_t n = static_cast<size_t>(cols_) * rows_;
+    back_.assign(n, ConsoleCell{ ' ', CellColor::Default });
+    front_.assign(n, ConsoleCell{ kUnknownCell, CellColor::Default });
+    scratch_.resize(static_cast<size_t>(cols_));
+    return true;
+}
+
+bool ConsoleRenderer::drainEvents() {
+    if (!input_) return false;
+    bool resized = false;
+    INPUT_RECORD records[16];
+    DWORD pending = 0;
+    while (GetNumberOfConsoleInputEvents(input_, &pending) && pending) {
+        DWORD read = 0;
+        if (!ReadConsoleInputW(input_, records, 16, &read) || !read) break;
+        for (DWORD i = 0; i < read; ++i) {
+            if (records[i].EventType == WINDOW_BUFFER_SIZE_EVENT) resized = true;
+        }
+    }
+    return resized;
+}
+
+void ConsoleRenderer::writeRun(int row, int first, int last) {
+    int len = last - first;
+    const ConsoleCell *cells = &back_[static_cast<size_t>(row) * cols_ + first];
+    for (int i = 0; i < len; ++i) {
+        scratch_[i].Char.UnicodeChar = static_cast<WCHAR>(cells[i].ch);
+        scratch_[i].Attributes = cellAttributes(cells[i].color, defaultAttr_);
+    }
+    COORD size = { static_cast<SHORT>(len), 1 };
+    COORD at = { 0, 0 };
+    SMALL_RECT rect = { static_cast<SHORT>(originX_ + first), static_cast<SHORT>(originY_ + row),
+        static_cast<SHORT>(originX_ + last - 1), static_cast<SHORT>(originY_ + row) };
+    WriteConsoleOutputW(out_, scratch_.data(), size, at, &rect);
+}
+#else
+static int g_winchPipe[2] = { -1, -1 };
+
+static void onSigwinch(int) {
+    char b = 1;
+    ssize_t r = write(g_winchPipe[1], &b, 1);
+    (void)r;
+}
+
+static const char *ansiColor(CellColor c) {
+    switch (c) {
+    case CellColor::Green: return "\x1b[1;32m";
+    case CellColor::Red: return "\x1b[1;31m";
+    case CellColor::Cyan: return "\x1b[1;36m";
+    default: return "\x1b[0m";
+    }
+}
+
+ConsoleRenderer::ConsoleRenderer() : ConsoleRenderer(STDOUT_FILENO) {
+    resizeEvents_ = true;
+    if (g_winchPipe[0] < 0 && pipe(g_winchPipe) == 0) {
+        for (int fd : g_winchPipe) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = onSigwinch;
+        sa.sa_flags = SA_RESTART;
+        sigaction(SIGWINCH, &sa, nullptr);
+    }
+}
+
+ConsoleRenderer::ConsoleRenderer(int outFd) : out_(outFd) {
+    updateSize();
+}
+
+ConsoleRenderer::~ConsoleRenderer() {
+    static const char reset[] = "\x1b[0m";
+    ssize_t r = write(out_, reset, sizeof(reset) - 1);
+    (void)r;
+}
+
+int ConsoleRenderer::eventFd() const {
+    return resizeEvents_ ? g_winchPipe[0] : -1;
+}
+
+bool ConsoleRenderer::updateSize() {
+    winsize ws{};
+    int cols = 80, rows = 25;
+    if (ioctl(out_, TIOCGWINSZ, &ws) == 0 && ws.ws_col && ws.ws_row) {
+        cols = ws.ws_col;
+        rows = ws.ws_row;
+    }
+    if (cols == cols_ && rows == rows_) return false;
+    cols_ = cols;
+    rows_ = rows;
+    lastColor_ = static_cast<CellColor>(0xFF);
+    size_t n = static_cast<size_t>(cols_) * rows_;
+    back_.assign(n, ConsoleCell{ ' ', CellColor::Default });
+    front_.assign(n, ConsoleCell{ kUnknownCell, CellColor::Default });
+    // worst case: every cell with its own move, color and 3 byte character
+    scratch_.reserve(n * 24);
+    return true;
+}
+
+bool ConsoleRenderer::drainEvents() {
+    if (!resizeEvents_) return false;
+    bool resized = false;
+    char buf[64];
+    while (g_winchPipe[0] >= 0 && read(g_winchPipe[0], buf, sizeof(buf)) > 0) resized = true;
+    return resized;
+}
+
+void ConsoleRenderer::writeRun(int row, int first, int last) {
+    char move[32];
+    int n = snprintf(move, sizeof(move), "\x1b[%d;%dH", row + 1, first + 1);
+    scratch_.append(move, static_cast<size_t>(n));
+    const ConsoleCell *cells = &back_[static_cast<size_t>(row) * cols_ + first];
+    for (int i = 0; i < last - first; ++i) {
+        if (cells[i].color != lastColor_) {
+            scratch_.append(ansiColor(cells[i].color));
+            lastColor_ = cells[i].color;
+        }
+        uint16_t c = cells[i].ch;
+        if (c < 0x80) {
+            scratch_.push_back(static_cast<char>(c));
+        } else if (c < 0x800) {
+            scratch_.push_back(static_cast<char>(0xC0 | (c >> 6)));
+            scratch_.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+        } else {
+            scratch_.push_back(static_cast<char>(0xE0 | (c >> 12)));
+            scratch_.push_back(static_cast<char>(0x80 | ((c >> 6) & 0x3F)));
+            scratch_.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+        }
+    }
+}
+#endif
+
+void ConsoleRenderer::clear() {
+    fill(back_.begin(), back_.end(), ConsoleCell{ ' ', CellColor::Default });
+}
+
+void ConsoleRenderer::put(int row, int col, const char *text, size_t len, CellColor color) {
+    if (row < 0 || row >= rows_) return;
+    ConsoleCell *line = &back_[static_cast<size_t>(row) * cols_];
+    for (size_t i = 0; i < len; ++i) {
+        int c = col + static_cast<int>(i);
+        if (c < 0) continue;
+        if (c >= cols_) break;
+        line[c] = ConsoleCell{ static_cast<uint8_t>(text[i]), color };
+    }
+}
+
+void ConsoleRenderer::drawBox(const vector<string> &lines, int highlight, CellColor color) {
+    size_t width = 0;
+    for (auto &l : lines) width = max(width, l.size());
+    int boxCols = static_cast<int>(width) + 4;
+    int boxRows = static_cast<int>(lines.size()) + 2;
+    int left = max(0, cols_ - boxCols) / 2;
+    int top = max(0, rows_ - boxRows) / 2;
+
+    char edge[256];
+    size_t edgeLen = min(sizeof(edge), static_cast<size_t>(boxCols));
+    memset(edge, '-', edgeLen);
+    edge[0] = '+';
+    edge[edgeLen - 1] = '+';
+    put(top, left, edge, edgeLen, CellColor::Default);
+    for (size_t i = 0; i < lines.size(); ++i) {
+        int row = top + 1 + static_cast<int>(i);
+        put(row, left, "| ", 2, CellColor::Default);
+        put(row, left + 2, lines[i].data(), lines[i].size(), static_cast<int>(i) == highlight ? color : CellColor::Default);
+        put(row, left + boxCols - 2, " |", 2, CellColor::Default);
+    }
+    put(top + boxRows - 1, left, edge, edgeLen, CellColor::Default);
+}
+
+size_t ConsoleRenderer::present() {
+    size_t written = 0;
+#ifndef _WIN32
+    scratch_.clear();
+#endif
+    for (int row = 0; row < rows_; ++row) {
+        const ConsoleCell *b = &back_[static_cast<size_t>(row) * cols_];
+        const ConsoleCell *f = &front_[static_cast<size_t>(row) * cols_];
+        int col = 0;
+        while (col < cols_) {
+            while (col < cols_ && sameCell(b[col], f[col])) ++col;
+            if (col == cols_) break;
+            int first = col;
+            int last = col;
+            int gap = 0;
+            while (col < cols_ && gap < kRunMergeGap) {
+                if (sameCell(b[col], f[col])) ++gap;
+                else { gap = 0; last = col + 1; }
+                ++col;
+            }
+            writeRun(row, first, last);
+            written += static_cast<size_t>(last - first);
+            col = last;
+        }
+    }
+#ifndef _WIN32
+    if (!scratch_.empty()) {
+        const char *p = scratch_.data();
+        size_t left = scratch_.size();
+        while (left) {
+            ssize_t r = write(out_, p, left);
+            if (r <= 0) break;
+            p += r;
+            left -= static_cast<size_t>(r);
+        }
+    }
+#endif
+    front_.swap(back_);
+    // back keeps the previous frame, callers clear() before drawing anyway
+    return written;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum class CellColor : uint8_t { Default, Green, Red, Cyan };
+
+struct ConsoleCell {
+    uint16_t ch;
+    CellColor color;
+};
+
+// double buffered status screen. callers draw into the back frame, present()
+// diffs it against what is already on screen and writes only the changed
+// runs. frames and the output scratch only grow on resize, so a steady-state
+// redraw allocates nothing. console api on windows, ansi on linux.
+class ConsoleRenderer {
+public:
+    ConsoleRenderer();
+    // draws into another screen buffer / fd and takes no resize events
+#ifdef _WIN32
+    explicit ConsoleRenderer(HANDLE out);
+#else
+    explicit ConsoleRenderer(int outFd);
+#endif
+    ~ConsoleRenderer();
+    ConsoleRenderer(const ConsoleRenderer &) = delete;
+    ConsoleRenderer &operator=(const ConsoleRenderer &) = delete;
+
+    // re-reads the window size, true if it changed. the next present() then
+    // repaints everything.
+    bool updateSize();
+    int cols() const { return cols_; }
+    int rows() const { return rows_; }
+
+    void clear();
+    void put(int row, int col, const char *text, size_t len, CellColor color);
+    // lines inside a +---+ box centered on screen, line `highlight` in color
+    void drawBox(const std::vector<std::string> &lines, int highlight, CellColor color);
+    // returns the number of cells written
+    size_t present();
+
+    // resize notifications: console input events on windows, SIGWINCH on
+    // linux. wait on the handle / fd, then call drainEvents().
+#ifdef _WIN32
+    HANDLE eventHandle() const { return input_; }
+#else
+    int eventFd() const;
+#endif
+    // true if anything size related came in
+    bool drainEvents();
+
+private:
+    void writeRun(int row, int first, int last);
+
+    int cols_ = 0;
+    int rows_ = 0;
+    std::vector<ConsoleCell> back_;
+    std::vector<ConsoleCell> front_;
+#ifdef _WIN32
+    HANDLE out_ = nullptr;
+    HANDLE input_ = nullptr;
+    DWORD savedInputMode_ = 0;
+    WORD defaultAttr_ = 0;
+    SHORT originX_ = 0;
+    SHORT originY_ = 0;
+    std::vector<CHAR_INFO> scratch_;
+#else
+    int out_ = 1;
+    bool resizeEvents_ = false;
+    std::string scratch_;
+    CellColor lastColor_ = CellColor::Default;
+#endif
+};
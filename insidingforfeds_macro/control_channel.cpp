@@ -0,0 +1,282 @@
+#include "control_channel.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+#include "macro_loops.h"
+
+using namespace std;
+
+string defaultControlName() {
+#ifdef _WIN32
+    return "\\\\.\\pipe\\insidingforfeds_macro";
+#else
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    return string(dir && *dir ? dir : "/tmp") + "/insidingforfeds_macro.sock";
+#endif
+}
+
+void fillControlStats(const MacroControl &control, const SharedStats *shared, ControlReply &reply) {
+    ControlStats &s = reply.stats;
+    s.triggerToEmitP50Ns = control.latency.triggerToEmit.percentile(50);
+    s.triggerToEmitP99Ns = control.latency.triggerToEmit.percentile(99);
+    s.stepJitterP99Ns = control.latency.stepJitter.percentile(99);
+    SharedStatsSnapshot snap;
+    if (!shared || !shared->snapshot(snap)) return;
+    s.cycles = snap.cycles;
+    s.emittedEvents = snap.emittedEvents;
+    s.missedDeadlines = snap.missedDeadlines;
+    s.activations = snap.activations;
+    s.sendFailures = snap.sendFailures;
+    s.hookCalls = snap.hookCalls;
+    s.hookMaxNs = snap.hookMaxNs;
+    reply.flags |= kControlHaveCounters;
+}
+
+#ifdef _WIN32
+
+ControlServer::~ControlServer() {
+    if (pipe_) CloseHandle(pipe_);
+    if (io_) CloseHandle(io_);
+    if (stop_) CloseHandle(stop_);
+}
+
+bool ControlServer::open(const string &name, string &error) {
+    name_ = name;
+    stop_ = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+    io_ = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+    // a single instance: one client at a time, and a second macro can't
+    // take over the name. the default dacl only lets this user write to it
+    pipe_ = CreateNamedPipeA(name.c_str(), PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+        PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, 1,
+        sizeof(ControlReply) * 4, sizeof(ControlRequest) * 4, 0, nullptr);
+    if (pipe_ == INVALID_HANDLE_VALUE) {
+        pipe_ = nullptr;
+        DWORD e = GetLastError();
+        error = e == ERROR_ACCESS_DENIED ? name + " is already in use" : "can't create " + name + " (" + to_string(e) + ")";
+        return false;
+    }
+    if (!stop_ || !io_) {
+        error = "can't create events (" + to_string(GetLastError()) + ")";
+        return false;
+    }
+    return true;
+}
+
+// waits for one overlapped call, false if it failed or stop() came first.
+// a cancelled call is waited out, the OVERLAPPED lives on our stack
+bool ControlServer::finish(int started, void *overlapped, unsigned long &bytes) {
+    OVERLAPPED *ov = static_cast<OVERLAPPED *>(overlapped);
+    DWORD done = 0;
+    if (!started && GetLastError() != ERROR_IO_PENDING) return false;
+    HANDLE handles[2] = { stop_, io_ };
+    if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0 + 1) {
+        CancelIo(pipe_);
+        GetOverlappedResult(pipe_, ov, &done, TRUE);
+        return false;
+    }
+    BOOL ok = GetOverlappedResult(pipe_, ov, &done, FALSE);
+    bytes = done;
+    return ok != 0;
+}
+
+void ControlServer::run(const ControlHandler &handler) {
+    while (WaitForSingleObject(stop_, 0) != WAIT_OBJECT_0) {
+        OVERLAPPED ov = {};
+        ov.hEvent = io_;
+        unsigned long bytes = 0;
+        ResetEvent(io_);
+        BOOL started = ConnectNamedPipe(pipe_, &ov);
+        bool connected = (!started && GetLastError() == ERROR_PIPE_CONNECTED) || finish(started, &ov, bytes);
+        if (!connected) {
+            if (WaitForSingleObject(stop_, 0) == WAIT_OBJECT_0) return;
+            DisconnectNamedPipe(pipe_);
+            continue;
+        }
+        for (;;) {
+            ControlRequest req;
+            size_t have = 0;
+            while (have < sizeof(req)) {
+                ov = OVERLAPPED{};
+                ov.hEvent = io_;
+                ResetEvent(io_);
+                started = ReadFile(pipe_, reinterpret_cast<char *>(&req) + have, static_cast<DWORD>(sizeof(req) - have), nullptr, &ov);
+                if (!finish(started, &ov, bytes) || bytes == 0) break;
+                have += bytes;
+            }
+            if (have < sizeof(req)) break;
+            ControlReply reply = handler(req);
+            ov = OVERLAPPED{};
+            ov.hEvent = io_;
+            ResetEvent(io_);
+            started = WriteFile(pipe_, &reply, sizeof(reply), nullptr, &ov);
+            if (!finish(started, &ov, bytes) || bytes != sizeof(reply)) break;
+        }
+        DisconnectNamedPipe(pipe_);
+    }
+}
+
+void ControlServer::stop() {
+    if (stop_) SetEvent(stop_);
+}
+
+bool ControlClient::connect(const string &name, string &error) {
+    close();
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        HANDLE h = CreateFileA(name.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+        if (h != INVALID_HANDLE_VALUE) {
+            pipe_ = h;
+            return true;
+        }
+        // the one instance is serving someone else
+        if (GetLastError() != ERROR_PIPE_BUSY || !WaitNamedPipeA(name.c_str(), 2000)) break;
+    }
+    error = "can't connect to " + name + " (" + to_string(GetLastError()) + "), is the macro running with --headless or --control?";
+    return false;
+}
+
+bool ControlClient::request(const ControlRequest &req, ControlReply &reply) {
+    DWORD bytes = 0;
+    if (!WriteFile(pipe_, &req, sizeof(req), &bytes, nullptr) || bytes != sizeof(req)) return false;
+    size_t have = 0;
+    while (have < sizeof(reply)) {
+        if (!ReadFile(pipe_, reinterpret_cast<char *>(&reply) + have, static_cast<DWORD>(sizeof(reply) - have), &bytes, nullptr) || bytes == 0) return false;
+        have += bytes;
+    }
+    return true;
+}
+
+void ControlClient::close() {
+    if (pipe_) CloseHandle(pipe_);
+    pipe_ = nullptr;
+}
+
+#else
+
+ControlServer::~ControlServer() {
+    if (listen_ >= 0) {
+        ::close(listen_);
+        unlink(name_.c_str());
+    }
+    if (stop_ >= 0) ::close(stop_);
+}
+
+static bool makeAddress(const string &path, sockaddr_un &addr, string &error) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        error = path + ": path too long for a unix socket";
+        return false;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+bool ControlServer::open(const string &name, string &error) {
+    name_ = name;
+    sockaddr_un addr;
+    if (!makeAddress(name, addr, error)) return false;
+    stop_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || stop_ < 0) {
+        error = string("socket: ") + strerror(errno);
+        if (fd >= 0) ::close(fd);
+        return false;
+    }
+    // a socket file nobody answers on is left over from a crash
+    if (::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0) {
+        ::close(fd);
+        error = name + " is already in use";
+        return false;
+    }
+    ::close(fd);
+    unlink(name.c_str());
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 || chmod(name.c_str(), 0600) < 0 || listen(fd, 4) < 0) {
+        error = "can't listen on " + name + ": " + strerror(errno);
+        if (fd >= 0) ::close(fd);
+        return false;
+    }
+    listen_ = fd;
+    return true;
+}
+
+// blocks until fd has something or stop() was called, false for the latter
+bool ControlServer::waitReadable(int fd) {
+    pollfd p[2] = { { fd, POLLIN, 0 }, { stop_, POLLIN, 0 } };
+    for (;;) {
+        if (poll(p, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        return !(p[1].revents & POLLIN);
+    }
+}
+
+void ControlServer::run(const ControlHandler &handler) {
+    while (waitReadable(listen_)) {
+        int client = accept4(listen_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0) continue;
+        for (;;) {
+            ControlRequest req;
+            size_t have = 0;
+            while (have < sizeof(req) && waitReadable(client)) {
+                ssize_t n = recv(client, reinterpret_cast<char *>(&req) + have, sizeof(req) - have, 0);
+                if (n <= 0 && !(n < 0 && errno == EINTR)) break;
+                if (n > 0) have += static_cast<size_t>(n);
+            }
+            if (have < sizeof(req)) break;
+            ControlReply reply = handler(req);
+            if (send(client, &reply, sizeof(reply), MSG_NOSIGNAL) != static_cast<ssize_t>(sizeof(reply))) break;
+        }
+        ::close(client);
+    }
+}
+
+void ControlServer::stop() {
+    uint64_t one = 1;
+    if (stop_ >= 0 && write(stop_, &one, sizeof(one)) < 0) {}
+}
+
+bool ControlClient::connect(const string &name, string &error) {
+    close();
+    sockaddr_un addr;
+    if (!makeAddress(name, addr, error)) return false;
+    fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd_ < 0 || ::connect(fd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+        error = "can't connect to " + name + ": " + strerror(errno) + ", is the macro running with --headless or --control?";
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool ControlClient::request(const ControlRequest &req, ControlReply &reply) {
+    if (send(fd_, &req, sizeof(req), MSG_NOSIGNAL) != static_cast<ssize_t>(sizeof(req))) return false;
+    size_t have = 0;
+    while (have < sizeof(reply)) {
+        ssize_t n = recv(fd_, reinterpret_cast<char *>(&reply) + have, sizeof(reply) - have, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        have += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+void ControlClient::close() {
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+}
+
+#endif
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+struct MacroControl;
+class SharedStats;
+
+// wire format of the control channel: the client writes fixed 8 byte
+// requests and gets one fixed size reply per request, in order. both ends
+// are on the same machine, so it is plain little endian structs.
+enum class ControlOp : uint8_t { Enable = 1, Disable = 2, SetMode = 3, SetBind = 4, QueryStats = 5, Shutdown = 6 };
+enum class ControlStatus : uint8_t { Ok = 0, BadRequest = 1, Failed = 2 };
+
+struct ControlRequest {
+    uint8_t op;        // ControlOp
+    uint8_t timeline;  // which bind, 0 = the main one
+    uint8_t kind;      // SetMode: MacroMode, SetBind: KeybindType
+    uint8_t reserved;
+    uint32_t value;    // SetBind: the vk or the MouseButton
+};
+static_assert(sizeof(ControlRequest) == 8, "control wire format");
+
+struct ControlStats {
+    uint64_t cycles;
+    uint64_t emittedEvents;
+    uint64_t missedDeadlines;
+    uint64_t activations;
+    uint64_t sendFailures;
+    uint64_t hookCalls;
+    int64_t hookMaxNs;
+    int64_t triggerToEmitP50Ns;
+    int64_t triggerToEmitP99Ns;
+    int64_t stepJitterP99Ns;
+};
+
+// the counters in ControlStats are filled, off with --no-shared-stats
+static const uint32_t kControlHaveCounters = 1;
+
+struct ControlReply {
+    uint8_t status;      // ControlStatus
+    uint8_t op;          // the request's, echoed
+    uint8_t enabled;     // any macro running, as of the reply
+    uint8_t timelines;   // binds configured
+    uint32_t flags;
+    ControlStats stats;  // QueryStats only
+};
+static_assert(sizeof(ControlReply) == 88, "control wire format");
+
+typedef std::function<ControlReply(const ControlRequest &)> ControlHandler;
+
+// \\.\pipe\insidingforfeds_macro on windows, insidingforfeds_macro.sock in
+// $XDG_RUNTIME_DIR (or /tmp) elsewhere
+std::string defaultControlName();
+
+// latency percentiles always, the shared counters when there are any
+void fillControlStats(const MacroControl &control, const SharedStats *shared, ControlReply &reply);
+
+// one client at a time, every request answered before the next one is
+// read. between requests the thread sits in the kernel (overlapped pipe
+// io, poll on the socket) and stop() wakes it, nothing runs on a timer.
+// local only: the pipe rejects remote clients, the socket is 0600.
+class ControlServer {
+public:
+    ControlServer() = default;
+    ~ControlServer();
+    ControlServer(const ControlServer &) = delete;
+    ControlServer &operator=(const ControlServer &) = delete;
+
+    // fails if another process already serves that name
+    bool open(const std::string &name, std::string &error);
+    // returns once stop() is called
+    void run(const ControlHandler &handler);
+    void stop();
+    const std::string &name() const { return name_; }
+
+private:
+    std::string name_;
+#ifdef _WIN32
+    bool finish(int started, void *overlapped, unsigned long &bytes);
+    void *pipe_ = nullptr;
+    void *stop_ = nullptr;
+    void *io_ = nullptr;
+#else
+    bool waitReadable(int fd);
+    int listen_ = -1;
+    int stop_ = -1;
+#endif
+};
+
+class ControlClient {
+public:
+    ControlClient() = default;
+    ~ControlClient() { close(); }
+    ControlClient(const ControlClient &) = delete;
+    ControlClient &operator=(const ControlClient &) = delete;
+
+    bool connect(const std::string &name, std::string &error);
+    bool request(const ControlRequest &req, ControlReply &reply);
+    void close();
+
+private:
+#ifdef _WIN32
+    void *pipe_ = nullptr;
+#else
+    int fd_ = -1;
+#endif
+};
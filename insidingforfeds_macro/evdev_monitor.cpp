@@ -0,0 +1,254 @@
+#include "evdev_monitor.h"
+
+#ifdef __linux__
+#include "alloc_tracker.h"
+#include "input_sink.h"
+#include "macro_loops.h"
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+
+using namespace std;
+
+// epoll data for the two fds that are not devices, device slots use 0..63
+static const uint32_t kInotifyTag = 0x10000;
+static const uint32_t kStopTag = 0x10001;
+// our own uinput output, reading it back would retrigger the macro
+static const char kOwnDeviceName[] = "insidingforfeds macro";
+
+struct ButtonMessages { uint32_t down; uint32_t up; uint32_t xbutton; };
+
+// BTN_LEFT.. BTN_EXTRA as the mouse hook sees them
+static const ButtonMessages kButtons[] = {
+    { kMsgLButtonDown, kMsgLButtonUp, 0 },
+    { kMsgRButtonDown, kMsgRButtonUp, 0 },
+    { kMsgMButtonDown, kMsgMButtonUp, 0 },
+    { kMsgXButtonDown, kMsgXButtonUp, 1 },
+    { kMsgXButtonDown, kMsgXButtonUp, 2 },
+};
+
+static bool testBit(const unsigned long *bits, int bit) {
+    const int width = static_cast<int>(sizeof(unsigned long) * CHAR_BIT);
+    return (bits[bit / width] >> (bit % width)) & 1;
+}
+
+// anything with a key below the gamepad range or a mouse button, which
+// leaves out joysticks, power buttons with only KEY_POWER are let in too and
+// simply never match
+static bool isKeyboardOrMouse(int fd) {
+    unsigned long bits[KEY_MAX / (sizeof(unsigned long) * CHAR_BIT) + 1] = {};
+    if (ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(bits)), bits) < 0) return false;
+    for (int code = 1; code <= BTN_EXTRA; ++code) {
+        if (code < BTN_MISC || code >= BTN_LEFT) {
+            if (testBit(bits, code)) return true;
+        }
+    }
+    return false;
+}
+
+EvdevMonitor::~EvdevMonitor() {
+    for (int i = 0; i < kMaxDevices; ++i) closeDevice(i);
+    if (inotify_ >= 0) close(inotify_);
+    if (stop_ >= 0) close(stop_);
+    if (epoll_ >= 0) close(epoll_);
+}
+
+bool EvdevMonitor::open(const EvdevMonitorOptions &options, string &error) {
+    options_ = options;
+    // the windows hook reports the sided modifiers, so the later (sided) vk
+    // wins where two map to the same code
+    for (int vk = 1; vk < 256; ++vk) {
+        int code = vkToEvdevKey(static_cast<uint16_t>(vk));
+        if (code > 0 && code < 256) codeVk_[code] = static_cast<uint8_t>(vk);
+    }
+    epoll_ = epoll_create1(EPOLL_CLOEXEC);
+    stop_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    inotify_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (epoll_ < 0 || stop_ < 0 || inotify_ < 0) {
+        error = string("epoll/eventfd/inotify: ") + strerror(errno);
+        return false;
+    }
+    // udev creates the node and fixes its permissions a moment later, so
+    // attribute changes count as well
+    if (inotify_add_watch(inotify_, options_.dir.c_str(), IN_CREATE | IN_ATTRIB | IN_MOVED_TO) < 0) {
+        error = "can't watch " + options_.dir + ": " + strerror(errno);
+        return false;
+    }
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.u32 = kInotifyTag;
+    epoll_ctl(epoll_, EPOLL_CTL_ADD, inotify_, &ev);
+    ev.data.u32 = kStopTag;
+    epoll_ctl(epoll_, EPOLL_CTL_ADD, stop_, &ev);
+    scan();
+    return true;
+}
+
+void EvdevMonitor::scan() {
+    DIR *d = opendir(options_.dir.c_str());
+    if (!d) return;
+    while (dirent *e = readdir(d)) {
+        if (e->d_name[0] != '.') openNode(e->d_name);
+    }
+    closedir(d);
+}
+
+void EvdevMonitor::openNode(const char *name) {
+    if (!options_.anyNode && strncmp(name, "event", 5) != 0) return;
+    if (strlen(name) >= sizeof(devices_[0].name)) return;
+    int freeSlot = -1;
+    for (int i = 0; i < kMaxDevices; ++i) {
+        if (devices_[i].fd < 0) {
+            if (freeSlot < 0) freeSlot = i;
+        } else if (strcmp(devices_[i].name, name) == 0) {
+            return;
+        }
+    }
+    if (freeSlot < 0) return;
+    string path = options_.dir + "/" + name;
+    int fd = ::open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) return;
+    Device &dev = devices_[freeSlot];
+    if (!options_.anyNode) {
+        char devName[256] = {};
+        ioctl(fd, EVIOCGNAME(sizeof(devName) - 1), devName);
+        if (!isKeyboardOrMouse(fd) || strncmp(devName, kOwnDeviceName, sizeof(kOwnDeviceName) - 1) == 0) {
+            close(fd);
+            return;
+        }
+        int clock = CLOCK_MONOTONIC;
+        dev.monotonic = ioctl(fd, EVIOCSCLOCKID, &clock) == 0;
+        if (options_.grab) ioctl(fd, EVIOCGRAB, 1);
+    }
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.u32 = static_cast<uint32_t>(freeSlot);
+    if (epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        close(fd);
+        return;
+    }
+    dev.fd = fd;
+    strcpy(dev.name, name);
+    deviceCount_.fetch_add(1, memory_order_relaxed);
+}
+
+void EvdevMonitor::closeDevice(int slot) {
+    Device &dev = devices_[slot];
+    if (dev.fd < 0) return;
+    // closing takes it out of the epoll set and drops the grab
+    close(dev.fd);
+    dev = Device();
+    deviceCount_.fetch_sub(1, memory_order_relaxed);
+}
+
+void EvdevMonitor::readInotify() {
+    alignas(inotify_event) char buf[4096];
+    for (;;) {
+        ssize_t n = read(inotify_, buf, sizeof(buf));
+        if (n <= 0) return;
+        for (char *p = buf; p < buf + n;) {
+            const inotify_event *e = reinterpret_cast<const inotify_event *>(p);
+            if (e->len && !(e->mask & IN_ISDIR)) openNode(e->name);
+            p += sizeof(inotify_event) + e->len;
+        }
+    }
+}
+
+// one read takes whatever the device has queued, up to 64 events; a full
+// buffer means there may be more
+void EvdevMonitor::readDevice(int slot, const BindMatcher *matcher, SequenceRecorder *recorder) {
+    IFF_ALLOC_SCOPE(AllocRegion::Hook);
+    const Device &dev = devices_[slot];
+    input_event buf[64];
+    for (;;) {
+        ssize_t n = read(dev.fd, buf, sizeof(buf));
+        int64_t readNs = monotonicNowNs();
+        if (n < 0) {
+            // ENODEV: unplugged
+            if (errno != EAGAIN && errno != EINTR) closeDevice(slot);
+            return;
+        }
+        if (n == 0) {
+            closeDevice(slot);
+            return;
+        }
+        size_t count = static_cast<size_t>(n) / sizeof(input_event);
+        events.fetch_add(count, memory_order_relaxed);
+        bool recording = recorder && recorder->armed();
+        if (matcher || recording) {
+            for (size_t i = 0; i < count; ++i) {
+                const input_event &ev = buf[i];
+                if (recording) {
+                    int64_t atNs = dev.monotonic ? static_cast<int64_t>(ev.input_event_sec) * 1000000000LL + static_cast<int64_t>(ev.input_event_usec) * 1000 : readNs;
+                    if (ev.type == EV_KEY && ev.code < 256 && codeVk_[ev.code]) recorder->key(ev.value != 0, codeVk_[ev.code], atNs);
+                    else if (ev.type == EV_REL && ev.code == REL_WHEEL) recorder->wheel(ev.value * kWheelDelta, atNs);
+                }
+                if (!matcher || ev.type != EV_KEY) continue;
+                // value 2 is autorepeat, a keydown to the hook as well
+                BindHit hit = 0;
+                if (ev.code < 256) {
+                    uint8_t vk = codeVk_[ev.code];
+                    if (vk) hit = matcher->hitKey(ev.value ? kMsgKeyDown : kMsgKeyUp, vk);
+                } else if (ev.code >= BTN_LEFT && ev.code <= BTN_EXTRA) {
+                    const ButtonMessages &b = kButtons[ev.code - BTN_LEFT];
+                    hit = matcher->hitMouse(ev.value ? b.down : b.up, b.xbutton);
+                }
+                if (!hit) continue;
+                BindEdge edge = bindHitEdge(hit);
+                int64_t now = monotonicNowNs();
+                control_.pushEdge(edge, now, bindHitTimeline(hit));
+                if (edge == BindEdge::Down && dev.monotonic) {
+                    int64_t kernelNs = static_cast<int64_t>(ev.input_event_sec) * 1000000000LL + static_cast<int64_t>(ev.input_event_usec) * 1000;
+                    control_.latency.hookDelivery.record(now - kernelNs);
+                }
+                dispatch.record(monotonicNowNs() - readNs);
+            }
+        }
+        if (count < sizeof(buf) / sizeof(buf[0])) return;
+    }
+}
+
+void EvdevMonitor::run() {
+    epoll_event ready[16];
+    for (;;) {
+        int n = epoll_wait(epoll_, ready, 16, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        int64_t wakeNs = monotonicNowNs();
+        const BindMatcher *matcher = matcher_.load(memory_order_acquire);
+        SequenceRecorder *recorder = recorder_.load(memory_order_acquire);
+        for (int i = 0; i < n; ++i) {
+            uint32_t tag = ready[i].data.u32;
+            if (tag == kStopTag) return;
+            if (tag == kInotifyTag) {
+                readInotify();
+                continue;
+            }
+            if (devices_[tag].fd < 0) continue;
+            if (ready[i].events & EPOLLIN) readDevice(static_cast<int>(tag), matcher, recorder);
+            // hung up with nothing left to read
+            else if (ready[i].events & (EPOLLHUP | EPOLLERR)) closeDevice(static_cast<int>(tag));
+        }
+        wakes.fetch_add(1, memory_order_relaxed);
+        if (SharedStatsBlock *stats = control_.stats) {
+            statsBump(stats->hookCalls);
+            statsMax(stats->hookMaxNs, monotonicNowNs() - wakeNs);
+        }
+    }
+}
+
+void EvdevMonitor::stop() {
+    uint64_t one = 1;
+    if (stop_ >= 0 && write(stop_, &one, sizeof(one)) < 0) {}
+}
+#endif
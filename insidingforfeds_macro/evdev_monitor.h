@@ -0,0 +1,82 @@
+#pragma once
+
+#ifdef __linux__
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include "bind_matcher.h"
+#include "latency_stats.h"
+#include "sequence_recorder.h"
+
+struct MacroControl;
+
+struct EvdevMonitorOptions {
+    std::string dir = "/dev/input";
+    // EVIOCGRAB every device listened to: the bind, and everything else on
+    // that device, stops reaching other programs. meant for a dedicated pad
+    bool grab = false;
+    // take every node that shows up in dir, not only keyboards and mice
+    // named event*. lets fifos stand in for devices
+    bool anyNode = false;
+};
+
+// the linux counterpart of the low level hooks: one thread, one epoll set
+// over every keyboard and mouse event node plus an inotify watch on the
+// folder for hotplug. a wake reads whole input_event arrays and runs them
+// through the same BindMatcher table the hooks use, so an event costs a
+// table load however many devices there are.
+class EvdevMonitor {
+public:
+    static const int kMaxDevices = 64;
+
+    explicit EvdevMonitor(MacroControl &control) : control_(control) {}
+    ~EvdevMonitor();
+    EvdevMonitor(const EvdevMonitor &) = delete;
+    EvdevMonitor &operator=(const EvdevMonitor &) = delete;
+
+    // sets up epoll and inotify and opens what is already there
+    bool open(const EvdevMonitorOptions &options, std::string &error);
+    // picked up at the next wake, nullptr ignores everything. the caller
+    // keeps it alive until it is replaced
+    void setMatcher(const BindMatcher *matcher) { matcher_.store(matcher, std::memory_order_release); }
+    // keys and wheel steps go to it while it is armed, next to the binds
+    void setRecorder(SequenceRecorder *recorder) { recorder_.store(recorder, std::memory_order_release); }
+    // blocks until stop()
+    void run();
+    void stop();
+    int deviceCount() const { return deviceCount_.load(std::memory_order_relaxed); }
+
+    // read() returning -> an edge from that read queued, what we add on top
+    // of the kernel
+    LatencyHistogram dispatch;
+    std::atomic<uint64_t> events{0};
+    std::atomic<uint64_t> wakes{0};
+
+private:
+    struct Device {
+        int fd = -1;
+        // event times are on CLOCK_MONOTONIC, comparable with ours
+        bool monotonic = false;
+        char name[32] = {};
+    };
+
+    void scan();
+    void openNode(const char *name);
+    void closeDevice(int slot);
+    void readDevice(int slot, const BindMatcher *matcher, SequenceRecorder *recorder);
+    void readInotify();
+
+    MacroControl &control_;
+    EvdevMonitorOptions options_;
+    std::atomic<const BindMatcher *> matcher_{nullptr};
+    std::atomic<SequenceRecorder *> recorder_{nullptr};
+    std::atomic<int> deviceCount_{0};
+    // KEY_* code -> virtual key, so keys go through the same table as on
+    // windows
+    uint8_t codeVk_[256] = {};
+    Device devices_[kMaxDevices];
+    int epoll_ = -1;
+    int inotify_ = -1;
+    int stop_ = -1;
+};
+#endif
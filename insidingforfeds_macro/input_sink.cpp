@@ -0,0 +1,186 @@
+#include "input_sink.h"
+
+#ifdef __linux__
+#include <linux/uinput.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <dirent.h>
+#include <cstring>
+
+using namespace std;
+
+int vkToEvdevKey(uint16_t vk) {
+    static const unsigned short kLetters[26] = {
+        KEY_A, KEY_B, KEY_C, KEY_D, KEY_E, KEY_F, KEY_G, KEY_H, KEY_I, KEY_J, KEY_K, KEY_L, KEY_M,
+        KEY_N, KEY_O, KEY_P, KEY_Q, KEY_R, KEY_S, KEY_T, KEY_U, KEY_V, KEY_W, KEY_X, KEY_Y, KEY_Z
+    };
+    static const unsigned short kDigits[10] = { KEY_0, KEY_1, KEY_2, KEY_3, KEY_4, KEY_5, KEY_6, KEY_7, KEY_8, KEY_9 };
+    static const unsigned short kFunction[24] = {
+        KEY_F1, KEY_F2, KEY_F3, KEY_F4, KEY_F5, KEY_F6, KEY_F7, KEY_F8, KEY_F9, KEY_F10, KEY_F11, KEY_F12,
+        KEY_F13, KEY_F14, KEY_F15, KEY_F16, KEY_F17, KEY_F18, KEY_F19, KEY_F20, KEY_F21, KEY_F22, KEY_F23, KEY_F24
+    };
+    static const unsigned short kNumpad[10] = { KEY_KP0, KEY_KP1, KEY_KP2, KEY_KP3, KEY_KP4, KEY_KP5, KEY_KP6, KEY_KP7, KEY_KP8, KEY_KP9 };
+
+    if (vk >= 'A' && vk <= 'Z') return kLetters[vk - 'A'];
+    if (vk >= '0' && vk <= '9') return kDigits[vk - '0'];
+    if (vk >= 0x70 && vk <= 0x87) return kFunction[vk - 0x70];
+    if (vk >= 0x60 && vk <= 0x69) return kNumpad[vk - 0x60];
+    switch (vk) {
+    case 0x08: return KEY_BACKSPACE;
+    case 0x09: return KEY_TAB;
+    case 0x0D: return KEY_ENTER;
+    case 0x10: case 0xA0: return KEY_LEFTSHIFT;
+    case 0xA1: return KEY_RIGHTSHIFT;
+    case 0x11: case 0xA2: return KEY_LEFTCTRL;
+    case 0xA3: return KEY_RIGHTCTRL;
+    case 0x12: case 0xA4: return KEY_LEFTALT;
+    case 0xA5: return KEY_RIGHTALT;
+    case 0x13: return KEY_PAUSE;
+    case 0x14: return KEY_CAPSLOCK;
+    case 0x1B: return KEY_ESC;
+    case 0x20: return KEY_SPACE;
+    case 0x21: return KEY_PAGEUP;
+    case 0x22: return KEY_PAGEDOWN;
+    case 0x23: return KEY_END;
+    case 0x24: return KEY_HOME;
+    case 0x25: return KEY_LEFT;
+    case 0x26: return KEY_UP;
+    case 0x27: return KEY_RIGHT;
+    case 0x28: return KEY_DOWN;
+    case 0x2D: return KEY_INSERT;
+    case 0x2E: return KEY_DELETE;
+    case 0x5B: return KEY_LEFTMETA;
+    case 0x5C: return KEY_RIGHTMETA;
+    case 0x6A: return KEY_KPASTERISK;
+    case 0x6B: return KEY_KPPLUS;
+    case 0x6D: return KEY_KPMINUS;
+    case 0x6E: return KEY_KPDOT;
+    case 0x6F: return KEY_KPSLASH;
+    case 0x90: return KEY_NUMLOCK;
+    case 0x91: return KEY_SCROLLLOCK;
+    case 0xBA: return KEY_SEMICOLON;
+    case 0xBB: return KEY_EQUAL;
+    case 0xBC: return KEY_COMMA;
+    case 0xBD: return KEY_MINUS;
+    case 0xBE: return KEY_DOT;
+    case 0xBF: return KEY_SLASH;
+    case 0xC0: return KEY_GRAVE;
+    case 0xDB: return KEY_LEFTBRACE;
+    case 0xDC: return KEY_BACKSLASH;
+    case 0xDD: return KEY_RIGHTBRACE;
+    case 0xDE: return KEY_APOSTROPHE;
+    default: return 0;
+    }
+}
+
+UinputSink::~UinputSink() {
+    close();
+}
+
+bool UinputSink::open(const char *name) {
+    if (fd_ >= 0) return true;
+    int fd = ::open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    ioctl(fd, UI_SET_EVBIT, EV_KEY);
+    ioctl(fd, UI_SET_EVBIT, EV_REL);
+    ioctl(fd, UI_SET_EVBIT, EV_SYN);
+    for (int k = 1; k < KEY_MICMUTE; ++k) ioctl(fd, UI_SET_KEYBIT, k);
+    ioctl(fd, UI_SET_KEYBIT, BTN_LEFT);
+    ioctl(fd, UI_SET_KEYBIT, BTN_RIGHT);
+    ioctl(fd, UI_SET_KEYBIT, BTN_MIDDLE);
+    ioctl(fd, UI_SET_KEYBIT, BTN_SIDE);
+    ioctl(fd, UI_SET_KEYBIT, BTN_EXTRA);
+    ioctl(fd, UI_SET_RELBIT, REL_X);
+    ioctl(fd, UI_SET_RELBIT, REL_Y);
+    ioctl(fd, UI_SET_RELBIT, REL_WHEEL);
+    ioctl(fd, UI_SET_RELBIT, REL_WHEEL_HI_RES);
+
+    uinput_setup setup{};
+    setup.id.bustype = BUS_VIRTUAL;
+    setup.id.vendor = 0x1d6b;
+    setup.id.product = 0x0104;
+    strncpy(setup.name, name, UINPUT_MAX_NAME_SIZE - 1);
+    if (ioctl(fd, UI_DEV_SETUP, &setup) < 0 || ioctl(fd, UI_DEV_CREATE) < 0) {
+        ::close(fd);
+        return false;
+    }
+    fd_ = fd;
+    return true;
+}
+
+void UinputSink::close() {
+    if (fd_ < 0) return;
+    ioctl(fd_, UI_DEV_DESTROY);
+    ::close(fd_);
+    fd_ = -1;
+}
+
+string UinputSink::eventNode() const {
+    if (fd_ < 0) return string();
+    char sysname[64] = {};
+    if (ioctl(fd_, UI_GET_SYSNAME(sizeof(sysname) - 1), sysname) < 0) return string();
+    string dir = string("/sys/devices/virtual/input/") + sysname;
+    DIR *d = opendir(dir.c_str());
+    if (!d) return string();
+    string node;
+    while (dirent *e = readdir(d)) {
+        if (strncmp(e->d_name, "event", 5) == 0) {
+            node = string("/dev/input/") + e->d_name;
+            break;
+        }
+    }
+    closedir(d);
+    return node;
+}
+
+UinputSink::Record UinputSink::prepare(SinkEventType type, int32_t value) const {
+    Record r{};
+    if (type == SinkEventType::Wheel) {
+        r.ev[0].type = EV_REL;
+        r.ev[0].code = REL_WHEEL;
+        r.ev[0].value = value / 120;
+        r.ev[1].type = EV_REL;
+        r.ev[1].code = REL_WHEEL_HI_RES;
+        r.ev[1].value = value;
+        r.count = 2;
+        return r;
+    }
+    int code = vkToEvdevKey(static_cast<uint16_t>(value));
+    if (code == 0) return r;
+    r.ev[0].type = EV_KEY;
+    r.ev[0].code = static_cast<unsigned short>(code);
+    r.ev[0].value = (type == SinkEventType::KeyDown || type == SinkEventType::ScanDown) ? 1 : 0;
+    r.count = 1;
+    return r;
+}
+
+void UinputSink::emit(const Record *records, size_t count) {
+    if (fd_ < 0 || count == 0) return;
+    static const size_t kMaxEvents = 128;
+    input_event ev[kMaxEvents];
+    size_t n = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (n + records[i].count + 1 > kMaxEvents) {
+            memset(&ev[n], 0, sizeof(input_event));
+            ev[n].type = EV_SYN;
+            ev[n].code = SYN_REPORT;
+            writeBatch(ev, n + 1);
+            n = 0;
+        }
+        for (uint8_t j = 0; j < records[i].count; ++j) ev[n++] = records[i].ev[j];
+    }
+    if (n == 0) return;
+    memset(&ev[n], 0, sizeof(input_event));
+    ev[n].type = EV_SYN;
+    ev[n].code = SYN_REPORT;
+    writeBatch(ev, n + 1);
+}
+
+void UinputSink::writeBatch(const input_event *ev, size_t n) {
+    ssize_t w = ::write(fd_, ev, sizeof(input_event) * n);
+    if (w == static_cast<ssize_t>(sizeof(input_event) * n) || !stats_) return;
+    statsBump(w < 0 ? stats_->sendFailures : stats_->shortWrites);
+}
+#endif
@@ -0,0 +1,164 @@
+#pragma once
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#ifdef __linux__
+#include <linux/input.h>
+#endif
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "shared_stats.h"
+
+enum class SinkEventType : uint8_t { KeyDown, KeyUp, ScanDown, ScanUp, Wheel };
+
+struct RecordedEvent {
+    int64_t timeNs;
+    SinkEventType type;
+    int32_t value;
+};
+
+// every sink turns an event into its native Record once (prepare) and can
+// then emit it as often as needed. the loops in macro_loops.h are templated
+// on the sink type so the choice is resolved at compile time.
+
+class RecordingSink {
+public:
+    using Record = RecordedEvent;
+
+    explicit RecordingSink(size_t reserveEvents = 1 << 16) : origin_(std::chrono::steady_clock::now()) {
+        events_.reserve(reserveEvents);
+    }
+
+    Record prepare(SinkEventType type, int32_t value) const { return Record{ 0, type, value }; }
+    void emit(const Record *records, size_t count) {
+        int64_t t = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin_).count();
+        for (size_t i = 0; i < count; ++i) events_.push_back(Record{ t, records[i].type, records[i].value });
+        batches_++;
+    }
+    void emit(const Record &r) { emit(&r, 1); }
+
+    void keyDown(uint16_t vk) { emit(prepare(SinkEventType::KeyDown, vk)); }
+    void keyUp(uint16_t vk) { emit(prepare(SinkEventType::KeyUp, vk)); }
+    void scanDown(uint16_t vk) { emit(prepare(SinkEventType::ScanDown, vk)); }
+    void scanUp(uint16_t vk) { emit(prepare(SinkEventType::ScanUp, vk)); }
+    void wheel(int delta) { emit(prepare(SinkEventType::Wheel, delta)); }
+
+    const std::vector<RecordedEvent> &events() const { return events_; }
+    uint64_t batches() const { return batches_; }
+    void clear() { events_.clear(); batches_ = 0; origin_ = std::chrono::steady_clock::now(); }
+
+private:
+    std::chrono::steady_clock::time_point origin_;
+    std::vector<RecordedEvent> events_;
+    uint64_t batches_ = 0;
+};
+
+#ifdef _WIN32
+class Win32InputSink {
+public:
+    using Record = INPUT;
+
+    Record prepare(SinkEventType type, int32_t value) const {
+        INPUT in = {};
+        switch (type) {
+        case SinkEventType::KeyDown:
+        case SinkEventType::KeyUp:
+            in.type = INPUT_KEYBOARD;
+            in.ki.wVk = static_cast<WORD>(value);
+            if (type == SinkEventType::KeyUp) in.ki.dwFlags = KEYEVENTF_KEYUP;
+            break;
+        case SinkEventType::ScanDown:
+        case SinkEventType::ScanUp:
+            in.type = INPUT_KEYBOARD;
+            in.ki.wScan = static_cast<WORD>(MapVirtualKeyA(static_cast<UINT>(value), MAPVK_VK_TO_VSC));
+            in.ki.dwFlags = KEYEVENTF_SCANCODE;
+            if (type == SinkEventType::ScanUp) in.ki.dwFlags |= KEYEVENTF_KEYUP;
+            break;
+        case SinkEventType::Wheel:
+            in.type = INPUT_MOUSE;
+            in.mi.dwFlags = MOUSEEVENTF_WHEEL;
+            in.mi.mouseData = static_cast<DWORD>(value);
+            break;
+        }
+        return in;
+    }
+
+    // SendInput injects the whole array atomically, nothing else can land
+    // between events of one batch. it fails as a whole when something like
+    // UIPI blocks it, a short count means part of the batch was dropped
+    void emit(const Record *records, size_t count) {
+        if (!count) return;
+        UINT sent = SendInput(static_cast<UINT>(count), const_cast<INPUT *>(records), sizeof(INPUT));
+        if (sent != count && stats_) statsBump(sent == 0 ? stats_->sendFailures : stats_->shortWrites);
+    }
+    void emit(const Record &r) { emit(&r, 1); }
+
+    void keyDown(uint16_t vk) { emit(prepare(SinkEventType::KeyDown, vk)); }
+    void keyUp(uint16_t vk) { emit(prepare(SinkEventType::KeyUp, vk)); }
+    void scanDown(uint16_t vk) { emit(prepare(SinkEventType::ScanDown, vk)); }
+    void scanUp(uint16_t vk) { emit(prepare(SinkEventType::ScanUp, vk)); }
+    void wheel(int delta) { emit(prepare(SinkEventType::Wheel, delta)); }
+
+    // send errors go here, only bumped from the thread that emits
+    void setStats(SharedStatsBlock *stats) { stats_ = stats; }
+
+private:
+    SharedStatsBlock *stats_ = nullptr;
+};
+
+using PlatformSink = Win32InputSink;
+#endif
+
+#ifdef __linux__
+int vkToEvdevKey(uint16_t vk);
+
+// up to two evdev events per logical event (wheel sends REL_WHEEL and the
+// hi-res axis); a batch goes out as one write ending in a single SYN_REPORT.
+struct UinputRecord {
+    input_event ev[2];
+    uint8_t count;
+};
+
+class UinputSink {
+public:
+    using Record = UinputRecord;
+
+    UinputSink() = default;
+    ~UinputSink();
+    UinputSink(const UinputSink &) = delete;
+    UinputSink &operator=(const UinputSink &) = delete;
+
+    bool open(const char *name = "insidingforfeds macro");
+    bool isOpen() const { return fd_ >= 0; }
+    void close();
+    // "/dev/input/eventN" the kernel made for this device, empty if not
+    // known (yet). udev may still be setting up permissions on it.
+    std::string eventNode() const;
+
+    Record prepare(SinkEventType type, int32_t value) const;
+    void emit(const Record *records, size_t count);
+    void emit(const Record &r) { emit(&r, 1); }
+    // a vk without an evdev code would compile to nothing
+    bool supportsKey(uint16_t vk) const { return vkToEvdevKey(vk) != 0; }
+
+    // uinput has no separate vk/scancode paths, both map onto the same EV_KEY code
+    void keyDown(uint16_t vk) { emit(prepare(SinkEventType::KeyDown, vk)); }
+    void keyUp(uint16_t vk) { emit(prepare(SinkEventType::KeyUp, vk)); }
+    void scanDown(uint16_t vk) { emit(prepare(SinkEventType::ScanDown, vk)); }
+    void scanUp(uint16_t vk) { emit(prepare(SinkEventType::ScanUp, vk)); }
+    void wheel(int delta) { emit(prepare(SinkEventType::Wheel, delta)); }
+
+    void setStats(SharedStatsBlock *stats) { stats_ = stats; }
+
+private:
+    void writeBatch(const input_event *ev, size_t n);
+
+    int fd_ = -1;
+    SharedStatsBlock *stats_ = nullptr;
+};
+
+using PlatformSink = UinputSink;
+#endif
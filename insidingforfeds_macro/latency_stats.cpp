@@ -0,0 +1,94 @@
+#include "latency_stats.h"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace std;
+
+static int highestBit(uint64_t v) {
+#ifdef _MSC_VER
+    unsigned long i = 0;
+    _BitScanReverse64(&i, v);
+    return static_cast<int>(i);
+#else
+    return 63 - __builtin_clzll(v);
+#endif
+}
+
+LatencyHistogram::LatencyHistogram() {
+    for (auto &c : counts_) c.store(0, memory_order_relaxed);
+    total_.store(0, memory_order_relaxed);
+    max_.store(0, memory_order_relaxed);
+}
+
+int LatencyHistogram::bucketFor(int64_t ns) {
+    uint64_t v = static_cast<uint64_t>(ns);
+    if (v < 2 * kSubBuckets) return static_cast<int>(v);
+    int m = highestBit(v) - 4;
+    if (m > kMaxMagnitude - 4) return kBuckets - 1;
+    return m * kSubBuckets + static_cast<int>(v >> m);
+}
+
+int64_t LatencyHistogram::bucketLow(int b) {
+    if (b < 2 * kSubBuckets) return b;
+    int m = b / kSubBuckets - 1;
+    int64_t t = b - m * kSubBuckets;
+    return t << m;
+}
+
+int64_t LatencyHistogram::bucketHigh(int b) {
+    if (b < 2 * kSubBuckets) return b;
+    int m = b / kSubBuckets - 1;
+    int64_t t = b - m * kSubBuckets;
+    return ((t + 1) << m) - 1;
+}
+
+int64_t LatencyHistogram::percentile(double p) const {
+    uint64_t total = count();
+    if (total == 0) return 0;
+    uint64_t target = static_cast<uint64_t>(p / 100.0 * static_cast<double>(total) + 0.5);
+    if (target < 1) target = 1;
+    uint64_t seen = 0;
+    for (int b = 0; b < kBuckets; ++b) {
+        seen += bucketCount(b);
+        if (seen >= target) return min(bucketHigh(b), max());
+    }
+    return max();
+}
+
+static string formatNs(int64_t ns) {
+    stringstream ss;
+    if (ns < 1000) ss << ns << "ns";
+    else if (ns < 1000000) ss << fixed << setprecision(1) << ns / 1000.0 << "us";
+    else ss << fixed << setprecision(2) << ns / 1000000.0 << "ms";
+    return ss.str();
+}
+
+string formatLatencySummary(const LatencyHistogram &h) {
+    if (h.count() == 0) return "no samples";
+    return "p50 " + formatNs(h.percentile(50)) + "  p99 " + formatNs(h.percentile(99)) +
+        "  p99.9 " + formatNs(h.percentile(99.9)) + "  max " + formatNs(h.max());
+}
+
+static void writeHistogram(ofstream &f, const char *name, const LatencyHistogram &h) {
+    f << "# " << name << " count=" << h.count() << " p50=" << h.percentile(50) << " p99=" << h.percentile(99)
+      << " p99.9=" << h.percentile(99.9) << " max=" << h.max() << "\n";
+    for (int b = 0; b < LatencyHistogram::kBuckets; ++b) {
+        uint64_t c = h.bucketCount(b);
+        if (c) f << name << "," << LatencyHistogram::bucketLow(b) << "," << LatencyHistogram::bucketHigh(b) << "," << c << "\n";
+    }
+}
+
+bool writeLatencyReport(const LatencyStats &stats, const string &path) {
+    ofstream f(path, ios::binary | ios::trunc);
+    if (!f) return false;
+    f << "histogram,low_ns,high_ns,count\n";
+    writeHistogram(f, "trigger_to_emit", stats.triggerToEmit);
+    writeHistogram(f, "step_jitter", stats.stepJitter);
+    writeHistogram(f, "hook_delivery", stats.hookDelivery);
+    return static_cast<bool>(f);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// log-linear buckets, 16 per power of two (~6% worst case error) from 1 ns
+// up to ~36 minutes. single writer per histogram: record() is a relaxed load
+// and store, readers on other threads only ever see slightly stale counts.
+class LatencyHistogram {
+public:
+    static const int kSubBuckets = 16;
+    static const int kMaxMagnitude = 40;
+    static const int kBuckets = (kMaxMagnitude - 2) * kSubBuckets;
+
+    LatencyHistogram();
+
+    void record(int64_t ns) {
+        if (ns < 0) ns = 0;
+        int b = bucketFor(ns);
+        counts_[b].store(counts_[b].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        total_.store(total_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        if (ns > max_.load(std::memory_order_relaxed)) max_.store(ns, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const { return total_.load(std::memory_order_relaxed); }
+    int64_t max() const { return max_.load(std::memory_order_relaxed); }
+    uint64_t bucketCount(int b) const { return counts_[b].load(std::memory_order_relaxed); }
+    int64_t percentile(double p) const;
+
+    static int bucketFor(int64_t ns);
+    static int64_t bucketLow(int b);
+    static int64_t bucketHigh(int b);
+
+private:
+    std::atomic<uint64_t> counts_[kBuckets];
+    std::atomic<uint64_t> total_;
+    std::atomic<int64_t> max_;
+};
+
+struct LatencyStats {
+    LatencyHistogram triggerToEmit;
+    LatencyHistogram stepJitter;
+    LatencyHistogram hookDelivery;
+};
+
+std::string formatLatencySummary(const LatencyHistogram &h);
+bool writeLatencyReport(const LatencyStats &stats, const std::string &path);
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "timing.h"
+#include "macro_program.h"
+#include "latency_stats.h"
+#include "trigger_queue.h"
+#include "trace_recorder.h"
+#include "shared_stats.h"
+
+// shared between the input side and the worker. every edge and stop is
+// followed by wake.signal(), the worker never polls.
+struct MacroControl {
+    // written by the worker, true while any timeline is switched on
+    std::atomic<bool> enabled{false};
+    std::atomic<bool> stop{false};
+    WakeEvent wake;
+    LatencyStats latency;
+    // press/release edges from the hook, consumed in order by the worker
+    SpscRing<TriggerEdge, 256> edges;
+    // On/Off from the control channel, a ring of its own so the hook stays
+    // the only producer of edges
+    SpscRing<TriggerEdge, 16> commands;
+    std::atomic<uint64_t> droppedEdges{0};
+    // written by the worker, cycles restarted from now by nextCycleBase
+    std::atomic<uint64_t> skippedCycles{0};
+    // signalled by the worker whenever an edge changes enabled, for the UI
+    WakeEvent status;
+    // opt-in, set before the worker starts and never changed after
+    TraceRing *trace = nullptr;
+    SharedStatsBlock *stats = nullptr;
+
+    void requestStop() {
+        stop.store(true);
+        wake.signal();
+    }
+
+    // hook side, never blocks or allocates
+    void pushEdge(BindEdge edge, int64_t timeNs, uint8_t timeline = 0) {
+        if (!edges.push(TriggerEdge{ timeNs, edge, timeline })) droppedEdges.fetch_add(1, std::memory_order_relaxed);
+        traceEdge(edge, timeNs, timeline);
+        wake.signal();
+    }
+
+    // control channel side, false if the worker is 16 commands behind
+    bool pushCommand(BindEdge edge, int64_t timeNs, uint8_t timeline = 0) {
+        if (!commands.push(TriggerEdge{ timeNs, edge, timeline })) return false;
+        traceEdge(edge, timeNs, timeline);
+        wake.signal();
+        return true;
+    }
+
+    // worker side, commands first: there are few and they mean now
+    bool popEdge(TriggerEdge &e) { return commands.pop(e) || edges.pop(e); }
+
+    void traceEdge(BindEdge edge, int64_t timeNs, uint8_t timeline) {
+        bool down = edge == BindEdge::Down || edge == BindEdge::On;
+        if (trace) trace->record(down ? TraceKind::EdgeDown : TraceKind::EdgeUp, timeNs, 0, 0, 0, timeline);
+    }
+};
+
+// next cycle starts one period after the previous one; if we fell more than a
+// whole period behind (stall, debugger, suspend) restart from now instead of
+// bursting through the missed cycles.
+inline int64_t nextCycleBase(int64_t base, int64_t periodNs, int64_t nowNs) {
+    int64_t next = base + periodNs;
+    return nowNs - next > periodNs ? nowNs : next;
+}
+
+template <class Sink>
+class MacroEngine {
+public:
+    using Record = typename Sink::Record;
+
+    MacroEngine(Sink &sink, const CompiledProgram<Record> &program) : sink_(sink), program_(&program) {}
+
+    // held keys belong to the old program, let them go first
+    void setProgram(const CompiledProgram<Record> &program) {
+        releaseAll();
+        program_ = &program;
+    }
+
+    void emit(const CompiledFrame &frame) {
+        sink_.emit(&program_->records[frame.first], frame.count);
+        held_ = (held_ & ~frame.clearHeld) | frame.setHeld;
+    }
+
+    void releaseAll() {
+        if (!held_) return;
+        Record batch[kMaxProgramKeys];
+        size_t n = 0;
+        for (uint64_t h = held_; h; h &= h - 1) batch[n++] = program_->releases[lowestBit(h)];
+        sink_.emit(batch, n);
+        held_ = 0;
+    }
+
+    uint64_t held() const { return held_; }
+
+private:
+    static int lowestBit(uint64_t v) {
+        int i = 0;
+        while (!(v & 1)) { v >>= 1; ++i; }
+        return i;
+    }
+
+    Sink &sink_;
+    const CompiledProgram<Record> *program_;
+    uint64_t held_ = 0;
+};
@@ -0,0 +1,279 @@
+#include "macro_program.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+using namespace std;
+
+struct NamedKey { const char *name; uint16_t vk; };
+
+static const NamedKey kNamedKeys[] = {
+    { "backspace", 0x08 }, { "tab", 0x09 }, { "enter", 0x0D }, { "shift", 0x10 }, { "ctrl", 0x11 },
+    { "alt", 0x12 }, { "pause", 0x13 }, { "capslock", 0x14 }, { "esc", 0x1B }, { "space", 0x20 },
+    { "pageup", 0x21 }, { "pagedown", 0x22 }, { "end", 0x23 }, { "home", 0x24 }, { "left", 0x25 },
+    { "up", 0x26 }, { "right", 0x27 }, { "down", 0x28 }, { "insert", 0x2D }, { "delete", 0x2E },
+    { "lshift", 0xA0 }, { "rshift", 0xA1 }, { "lctrl", 0xA2 }, { "rctrl", 0xA3 }, { "lalt", 0xA4 },
+    { "ralt", 0xA5 }, { "=", 0xBB }, { "-", 0xBD }, { ".", 0xBE }, { "/", 0xBF },
+    { "`", 0xC0 }, { "[", 0xDB }, { "]", 0xDD }, { "'", 0xDE },
+};
+
+static string lowerCopy(const string &s) {
+    string r = s;
+    for (auto &c : r) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    return r;
+}
+
+static bool parseInt(const string &s, long &out) {
+    if (s.empty()) return false;
+    char *end = nullptr;
+    long v = strtol(s.c_str(), &end, 0);
+    if (*end != '\0') return false;
+    out = v;
+    return true;
+}
+
+bool parseKeyName(const string &name, uint16_t &vk) {
+    string n = lowerCopy(name);
+    if (n.size() == 1 && isalnum(static_cast<unsigned char>(n[0]))) {
+        vk = static_cast<uint16_t>(toupper(static_cast<unsigned char>(n[0])));
+        return true;
+    }
+    if (n.size() > 2 && n[0] == '0' && n[1] == 'x') {
+        long v = 0;
+        if (!parseInt(n, v) || v <= 0 || v > 0xFE) return false;
+        vk = static_cast<uint16_t>(v);
+        return true;
+    }
+    if (n.size() >= 2 && n[0] == 'f') {
+        long f = 0;
+        if (parseInt(n.substr(1), f) && f >= 1 && f <= 24) {
+            vk = static_cast<uint16_t>(0x70 + f - 1);
+            return true;
+        }
+    }
+    for (const NamedKey &k : kNamedKeys) {
+        if (n == k.name) { vk = k.vk; return true; }
+    }
+    return false;
+}
+
+string keyName(uint16_t vk) {
+    if ((vk >= 'A' && vk <= 'Z') || (vk >= '0' && vk <= '9')) return string(1, static_cast<char>(tolower(vk)));
+    if (vk >= 0x70 && vk <= 0x87) return "f" + to_string(vk - 0x70 + 1);
+    for (const NamedKey &k : kNamedKeys) {
+        if (k.vk == vk) return k.name;
+    }
+    stringstream ss;
+    ss << "0x" << hex << uppercase << vk;
+    return ss.str();
+}
+
+bool expandMacroSteps(const MacroStep *steps, size_t count, vector<MacroStep> &out, string &error) {
+    out.clear();
+    size_t blockStart = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const MacroStep &s = steps[i];
+        switch (s.op) {
+        case StepOp::Wait:
+            if (s.arg < 0) { error = "negative wait"; return false; }
+            out.push_back(s);
+            break;
+        case StepOp::KeyDown:
+        case StepOp::KeyUp:
+            if (s.arg <= 0 || s.arg > 0xFE) { error = "bad key code"; return false; }
+            out.push_back(s);
+            break;
+        case StepOp::Wheel:
+            if (s.arg == 0) { error = "zero wheel delta"; return false; }
+            out.push_back(s);
+            break;
+        case StepOp::Repeat: {
+            if (s.arg < 1) { error = "repeat count must be at least 1"; return false; }
+            size_t blockEnd = out.size();
+            if ((blockEnd - blockStart) * static_cast<size_t>(s.arg) > kMaxProgramSteps) { error = "sequence too long"; return false; }
+            for (int32_t r = 1; r < s.arg; ++r) {
+                for (size_t j = blockStart; j < blockEnd; ++j) out.push_back(out[j]);
+            }
+            blockStart = out.size();
+            break;
+        }
+        }
+        if (out.size() > kMaxProgramSteps) { error = "sequence too long"; return false; }
+    }
+    return true;
+}
+
+bool parseMacroSequence(const string &text, vector<MacroStep> &out, string &error) {
+    out.clear();
+    string item;
+    size_t index = 0;
+    size_t pos = 0;
+    while (pos <= text.size()) {
+        size_t end = text.find_first_of(",;\n", pos);
+        if (end == string::npos) end = text.size();
+        item = text.substr(pos, end - pos);
+        pos = end + 1;
+        ++index;
+
+        stringstream ss(item);
+        string op, arg, extra;
+        ss >> op >> arg >> extra;
+        if (op.empty()) continue;
+        op = lowerCopy(op);
+        if (arg.empty() || !extra.empty()) {
+            error = "step " + to_string(index) + ": expected '<op> <value>'";
+            return false;
+        }
+
+        long v = 0;
+        uint16_t vk = 0;
+        if (op == "down" || op == "up") {
+            if (!parseKeyName(arg, vk)) { error = "step " + to_string(index) + ": unknown key '" + arg + "'"; return false; }
+            out.push_back(op == "down" ? stepKeyDown(vk) : stepKeyUp(vk));
+        } else if (op == "wheel" && parseInt(arg, v) && v != 0 && v >= -32768 && v <= 32767) {
+            out.push_back(stepWheel(static_cast<int32_t>(v)));
+        } else if (op == "wait" && parseInt(arg, v) && v >= 0 && v <= 10000000) {
+            out.push_back(stepWaitUs(static_cast<int32_t>(v)));
+        } else if (op == "repeat" && parseInt(arg, v) && v >= 1 && v <= 1000) {
+            out.push_back(stepRepeat(static_cast<int32_t>(v)));
+        } else {
+            error = "step " + to_string(index) + ": bad step '" + item + "'";
+            return false;
+        }
+    }
+    if (out.empty()) { error = "empty sequence"; return false; }
+    return true;
+}
+
+string formatMacroSequence(const vector<MacroStep> &steps) {
+    string r;
+    for (const MacroStep &s : steps) {
+        if (!r.empty()) r += ", ";
+        switch (s.op) {
+        case StepOp::KeyDown: r += "down " + keyName(static_cast<uint16_t>(s.arg)); break;
+        case StepOp::KeyUp: r += "up " + keyName(static_cast<uint16_t>(s.arg)); break;
+        case StepOp::Wheel: r += "wheel " + to_string(s.arg); break;
+        case StepOp::Wait: r += "wait " + to_string(s.arg); break;
+        case StepOp::Repeat: r += "repeat " + to_string(s.arg); break;
+        }
+    }
+    return r;
+}
+
+static const char kSequenceMagic[4] = { 'I', 'F', 'S', '1' };
+
+static void putVarint(string &out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<char>((v & 0x7F) | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+}
+
+static bool getVarint(const string &in, size_t &pos, uint64_t &v) {
+    v = 0;
+    for (int shift = 0; shift < 64 && pos < in.size(); shift += 7) {
+        uint8_t b = static_cast<uint8_t>(in[pos++]);
+        v |= static_cast<uint64_t>(b & 0x7F) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+static uint32_t commonDivisor(uint32_t a, uint32_t b) {
+    while (b) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+string encodeMacroSequence(const vector<MacroStep> &steps) {
+    uint32_t unit = 0;
+    for (const MacroStep &s : steps) {
+        if (s.op == StepOp::Wait && s.arg > 0) unit = commonDivisor(unit, static_cast<uint32_t>(s.arg));
+    }
+    if (!unit) unit = 1;
+    string out(kSequenceMagic, sizeof(kSequenceMagic));
+    putVarint(out, unit);
+    putVarint(out, steps.size());
+    for (const MacroStep &s : steps) {
+        int64_t arg = s.op == StepOp::Wait ? s.arg / static_cast<int32_t>(unit) : s.arg;
+        out.push_back(static_cast<char>(s.op));
+        putVarint(out, (static_cast<uint64_t>(arg) << 1) ^ static_cast<uint64_t>(arg >> 63));
+    }
+    return out;
+}
+
+bool decodeMacroSequence(const string &bytes, vector<MacroStep> &out, string &error) {
+    out.clear();
+    if (bytes.size() < sizeof(kSequenceMagic) || memcmp(bytes.data(), kSequenceMagic, sizeof(kSequenceMagic)) != 0) {
+        error = "not a recorded sequence";
+        return false;
+    }
+    size_t pos = sizeof(kSequenceMagic);
+    uint64_t unit = 0, count = 0;
+    if (!getVarint(bytes, pos, unit) || !getVarint(bytes, pos, count) || unit < 1 || unit > 10000000 || count > kMaxProgramSteps) {
+        error = "bad recorded sequence header";
+        return false;
+    }
+    for (uint64_t i = 0; i < count; ++i) {
+        uint64_t zigzag = 0;
+        if (pos >= bytes.size()) { error = "recorded sequence cut short"; return false; }
+        uint8_t op = static_cast<uint8_t>(bytes[pos++]);
+        if (!getVarint(bytes, pos, zigzag)) { error = "recorded sequence cut short"; return false; }
+        int64_t arg = static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+        // range first, a crafted varint times the unit would overflow
+        int64_t scale = op == static_cast<uint8_t>(StepOp::Wait) ? static_cast<int64_t>(unit) : 1;
+        if (op > static_cast<uint8_t>(StepOp::Repeat) || arg < INT32_MIN / scale || arg > INT32_MAX / scale) {
+            error = "bad step " + to_string(i + 1) + " in recorded sequence";
+            return false;
+        }
+        arg *= scale;
+        out.push_back(MacroStep{ static_cast<StepOp>(op), static_cast<int32_t>(arg) });
+    }
+    if (pos != bytes.size()) { error = "trailing data after the recorded sequence"; return false; }
+    if (out.empty()) { error = "empty sequence"; return false; }
+    // same rules as a typed sequence, repeat and all
+    vector<MacroStep> flat;
+    return expandMacroSteps(out.data(), out.size(), flat, error);
+}
+
+static const char kBase64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+string encodeMacroSequenceText(const vector<MacroStep> &steps) {
+    string bytes = encodeMacroSequence(steps);
+    string r;
+    r.reserve((bytes.size() + 2) / 3 * 4);
+    for (size_t i = 0; i < bytes.size(); i += 3) {
+        uint32_t v = static_cast<uint8_t>(bytes[i]) << 16;
+        if (i + 1 < bytes.size()) v |= static_cast<uint8_t>(bytes[i + 1]) << 8;
+        if (i + 2 < bytes.size()) v |= static_cast<uint8_t>(bytes[i + 2]);
+        r.push_back(kBase64[(v >> 18) & 63]);
+        r.push_back(kBase64[(v >> 12) & 63]);
+        r.push_back(i + 1 < bytes.size() ? kBase64[(v >> 6) & 63] : '=');
+        r.push_back(i + 2 < bytes.size() ? kBase64[v & 63] : '=');
+    }
+    return r;
+}
+
+bool decodeMacroSequenceText(const string &text, vector<MacroStep> &out, string &error) {
+    string bytes;
+    uint32_t v = 0;
+    int bits = 0;
+    for (char c : text) {
+        if (c == '=') break;
+        const char *at = c ? strchr(kBase64, c) : nullptr;
+        if (!at) { error = "recording is not base64"; return false; }
+        v = (v << 6) | static_cast<uint32_t>(at - kBase64);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            bytes.push_back(static_cast<char>((v >> bits) & 0xFF));
+        }
+    }
+    return decodeMacroSequence(bytes, out, error);
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "input_sink.h"
+
+enum class StepOp : uint8_t { KeyDown, KeyUp, Wheel, Wait, Repeat };
+
+struct MacroStep {
+    StepOp op;
+    int32_t arg;
+};
+
+constexpr MacroStep stepKeyDown(uint16_t vk) { return MacroStep{ StepOp::KeyDown, vk }; }
+constexpr MacroStep stepKeyUp(uint16_t vk) { return MacroStep{ StepOp::KeyUp, vk }; }
+constexpr MacroStep stepWheel(int32_t delta) { return MacroStep{ StepOp::Wheel, delta }; }
+constexpr MacroStep stepWaitUs(int32_t us) { return MacroStep{ StepOp::Wait, us }; }
+constexpr MacroStep stepRepeat(int32_t times) { return MacroStep{ StepOp::Repeat, times }; }
+
+static const int kFirstPersonStepDelayMs = 10;
+static const int kThirdPersonKeyTapDelayMs = 10;
+static const int kWheelDelta = 120;
+static const uint16_t kVkI = 0x49;
+static const uint16_t kVkO = 0x4F;
+
+constexpr MacroStep kFirstPersonProgram[] = {
+    stepWheel(kWheelDelta), stepWaitUs(kFirstPersonStepDelayMs * 1000),
+    stepWheel(-kWheelDelta), stepWaitUs(kFirstPersonStepDelayMs * 1000),
+};
+
+constexpr MacroStep kThirdPersonProgram[] = {
+    stepKeyDown(kVkI), stepWaitUs(kThirdPersonKeyTapDelayMs * 1000),
+    stepKeyDown(kVkO), stepWaitUs(kThirdPersonKeyTapDelayMs * 1000),
+    stepKeyUp(kVkI), stepWaitUs(kThirdPersonKeyTapDelayMs * 1000),
+    stepKeyUp(kVkO), stepWaitUs(kThirdPersonKeyTapDelayMs * 1000),
+};
+
+static const size_t kMaxProgramKeys = 64;
+static const size_t kMaxProgramSteps = 4096;
+static const int kMaxWheelBurst = 16;
+
+// "down i, wait 4000, down o, wait 4000, up i, ..." -> steps. repeat n runs
+// everything since the previous repeat (or the start) n times in total.
+bool parseMacroSequence(const std::string &text, std::vector<MacroStep> &out, std::string &error);
+std::string formatMacroSequence(const std::vector<MacroStep> &steps);
+// the compact binary form recorded sequences are kept in: "IFS1", the
+// greatest common divisor of the waits, the step count, then one op byte and
+// a zigzag varint per step with waits in units of that divisor. a recording
+// on a 1ms grid costs two or three bytes a step. the text variants wrap it
+// in base64 so it fits a json string.
+std::string encodeMacroSequence(const std::vector<MacroStep> &steps);
+bool decodeMacroSequence(const std::string &bytes, std::vector<MacroStep> &out, std::string &error);
+std::string encodeMacroSequenceText(const std::vector<MacroStep> &steps);
+bool decodeMacroSequenceText(const std::string &text, std::vector<MacroStep> &out, std::string &error);
+bool parseKeyName(const std::string &name, uint16_t &vk);
+std::string keyName(uint16_t vk);
+
+// flat per-cycle timeline: steps that fall on the same offset are merged
+// into one frame so the sink can submit them with a single call. records are
+// built once here, the worker only indexes and emits.
+struct CompiledFrame {
+    int64_t atNs;
+    uint32_t first;
+    uint32_t count;
+    uint64_t setHeld;
+    uint64_t clearHeld;
+};
+
+template <class Record>
+struct CompiledProgram {
+    std::vector<CompiledFrame> frames;
+    std::vector<Record> records;
+    std::vector<Record> releases;
+    std::vector<uint16_t> keys;
+    int64_t periodNs = 0;
+};
+
+bool expandMacroSteps(const MacroStep *steps, size_t count, std::vector<MacroStep> &out, std::string &error);
+
+// a sink that can't send every vk (uinput) has supportsKey, the rest take all
+template <class Sink>
+auto sinkSupportsKey(const Sink &sink, uint16_t vk, int) -> decltype(sink.supportsKey(vk)) { return sink.supportsKey(vk); }
+template <class Sink>
+bool sinkSupportsKey(const Sink &, uint16_t, long) { return true; }
+
+template <class Sink>
+bool compileMacroProgram(const Sink &sink, const MacroStep *steps, size_t count, CompiledProgram<typename Sink::Record> &out, std::string &error, int wheelBurst = 1) {
+    std::vector<MacroStep> flat;
+    if (!expandMacroSteps(steps, count, flat, error)) return false;
+    if (wheelBurst < 1 || wheelBurst > kMaxWheelBurst) { error = "wheel burst out of range"; return false; }
+
+    CompiledProgram<typename Sink::Record> p;
+    p.records.reserve(flat.size());
+    int64_t at = 0;
+    for (const MacroStep &s : flat) {
+        if (s.op == StepOp::Wait) { at += static_cast<int64_t>(s.arg) * 1000; continue; }
+        if (p.frames.empty() || p.frames.back().atNs != at) {
+            p.frames.push_back(CompiledFrame{ at, static_cast<uint32_t>(p.records.size()), 0, 0, 0 });
+        }
+        CompiledFrame &f = p.frames.back();
+        if (s.op == StepOp::Wheel) {
+            for (int i = 0; i < wheelBurst; ++i) p.records.push_back(sink.prepare(SinkEventType::Wheel, s.arg));
+            f.count += static_cast<uint32_t>(wheelBurst);
+            continue;
+        }
+        uint16_t vk = static_cast<uint16_t>(s.arg);
+        size_t slot = 0;
+        while (slot < p.keys.size() && p.keys[slot] != vk) ++slot;
+        if (slot == p.keys.size()) {
+            if (slot == kMaxProgramKeys) { error = "too many distinct keys"; return false; }
+            if (!sinkSupportsKey(sink, vk, 0)) { error = "key '" + keyName(vk) + "' can't be sent on this platform"; return false; }
+            p.keys.push_back(vk);
+            p.releases.push_back(sink.prepare(SinkEventType::ScanUp, vk));
+        }
+        uint64_t bit = 1ULL << slot;
+        if (s.op == StepOp::KeyDown) { f.setHeld |= bit; f.clearHeld &= ~bit; }
+        else { f.clearHeld |= bit; f.setHeld &= ~bit; }
+        p.records.push_back(sink.prepare(s.op == StepOp::KeyDown ? SinkEventType::ScanDown : SinkEventType::ScanUp, vk));
+        f.count++;
+    }
+    if (at <= 0) { error = "sequence needs at least one wait"; return false; }
+    if (p.frames.empty()) { error = "sequence has no input steps"; return false; }
+    p.periodNs = at;
+    out = std::move(p);
+    return true;
+}
+
+template <class Sink, size_t N>
+bool compileMacroProgram(const Sink &sink, const MacroStep (&steps)[N], CompiledProgram<typename Sink::Record> &out, std::string &error, int wheelBurst = 1) {
+    return compileMacroProgram(sink, steps, N, out, error, wheelBurst);
+}
+
+template <class Sink>
+bool compileMacroProgram(const Sink &sink, const std::vector<MacroStep> &steps, CompiledProgram<typename Sink::Record> &out, std::string &error, int wheelBurst = 1) {
+    return compileMacroProgram(sink, steps.data(), steps.size(), out, error, wheelBurst);
+}
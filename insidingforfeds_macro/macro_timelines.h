@@ -0,0 +1,370 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "alloc_tracker.h"
+#include "macro_loops.h"
+
+// one worker thread runs up to this many macros side by side, each on its own
+// bind. timeline 0 is the main bind from the config.
+static const int kMaxTimelines = 16;
+
+// what runMacroTimelines runs: a program and an activation mode per
+// timeline. the programs are owned by whoever publishes the set.
+template <class Record>
+struct TimelineSet {
+    const CompiledProgram<Record> *programs[kMaxTimelines] = {};
+    bool toggle[kMaxTimelines] = {};
+    int count = 0;
+};
+
+// program source for runMacroTimelines that never changes
+template <class Record>
+struct FixedTimelines {
+    const TimelineSet<Record> &set;
+    const TimelineSet<Record> *acquire() const { return &set; }
+};
+
+// collects the frames every timeline has due at one instant and hands them
+// to the real sink as a single emit, so two macros stepping on the same
+// tick cost one SendInput / one write instead of two
+template <class Sink>
+class BatchingSink {
+public:
+    using Record = typename Sink::Record;
+
+    explicit BatchingSink(Sink &sink) : sink_(sink) {}
+
+    void emit(const Record *records, size_t count) {
+        if (size_ + count > kCapacity) flush();
+        if (count > kCapacity) {
+            sink_.emit(records, count);
+            return;
+        }
+        std::copy(records, records + count, pending_ + size_);
+        size_ += count;
+    }
+
+    void flush() {
+        if (!size_) return;
+        sink_.emit(pending_, size_);
+        size_ = 0;
+    }
+
+private:
+    static const size_t kCapacity = 256;
+
+    Sink &sink_;
+    Record pending_[kCapacity];
+    size_t size_ = 0;
+};
+
+// binary min-heap of timeline deadlines over fixed arrays. every timeline
+// remembers its slot, so rescheduling or dropping one is O(log n) and
+// nothing is allocated. equal deadlines come out lowest timeline first,
+// which keeps a run repeatable.
+class DeadlineHeap {
+public:
+    DeadlineHeap() {
+        for (int &p : pos_) p = -1;
+    }
+
+    bool empty() const { return size_ == 0; }
+    int top() const { return heap_[0]; }
+    int64_t topDeadline() const { return deadline_[heap_[0]]; }
+
+    void schedule(int t, int64_t deadlineNs) {
+        deadline_[t] = deadlineNs;
+        if (pos_[t] < 0) {
+            pos_[t] = size_;
+            heap_[size_++] = t;
+        }
+        down(up(pos_[t]));
+    }
+
+    void remove(int t) {
+        int i = pos_[t];
+        if (i < 0) return;
+        pos_[t] = -1;
+        if (i == --size_) return;
+        heap_[i] = heap_[size_];
+        pos_[heap_[i]] = i;
+        down(up(i));
+    }
+
+private:
+    bool before(int a, int b) const {
+        return deadline_[a] < deadline_[b] || (deadline_[a] == deadline_[b] && a < b);
+    }
+
+    void place(int i, int t) {
+        heap_[i] = t;
+        pos_[t] = i;
+    }
+
+    int up(int i) {
+        int t = heap_[i];
+        while (i > 0) {
+            int parent = (i - 1) / 2;
+            if (!before(t, heap_[parent])) break;
+            place(i, heap_[parent]);
+            i = parent;
+        }
+        place(i, t);
+        return i;
+    }
+
+    int down(int i) {
+        int t = heap_[i];
+        for (;;) {
+            int child = 2 * i + 1;
+            if (child >= size_) break;
+            if (child + 1 < size_ && before(heap_[child + 1], heap_[child])) ++child;
+            if (!before(heap_[child], t)) break;
+            place(i, heap_[child]);
+            i = child;
+        }
+        place(i, t);
+        return i;
+    }
+
+    int heap_[kMaxTimelines];
+    int pos_[kMaxTimelines];
+    int64_t deadline_[kMaxTimelines];
+    int size_ = 0;
+};
+
+// per timeline state of runMacroTimelines
+template <class Sink>
+struct MacroTimeline {
+    using Record = typename Sink::Record;
+
+    MacroTimeline(Sink &sink, const CompiledProgram<Record> &program) : engine(sink, program), program(&program) {}
+
+    MacroEngine<Sink> engine;
+    const CompiledProgram<Record> *program;
+    // from a newer set, taken over once the running cycle is done
+    const CompiledProgram<Record> *pending = nullptr;
+    ActivationLatch latch;
+    bool running = false;
+    // a trigger always gets at least one whole cycle, so a tap shorter than a
+    // step still does something
+    bool minRun = false;
+    int64_t base = 0;
+    size_t frame = 0;
+    int64_t triggerNs = 0;
+    int64_t lastEmitNs = 0;
+    int64_t lastDeadline = 0;
+};
+
+// runs the macro of every bind on one thread. every running timeline has
+// one entry in a deadline heap; the loop sleeps until the earliest one, then
+// emits every frame that is due by then into one sink batch. a wake costs
+// O(log n) per due frame however many timelines are parked or running.
+// edges carry their timeline (TriggerEdge::timeline), each timeline has its
+// own latch, so hold and toggle behave exactly as with a single bind.
+// a new set from programs.acquire() leaves timelines whose program didn't
+// change alone; a changed one that is running finishes its cycle and
+// starts the next one on the new program, never mid-cycle. acquire() isn't
+// called again until every timeline has switched, so a source only has to
+// keep what its previous acquire() returned alive until the next call.
+// control.enabled is true while any timeline is switched on.
+template <class Sink, class Scheduler, class Programs>
+void runMacroTimelines(Sink &sink, Scheduler &sched, Programs &programs, MacroControl &control) {
+    using Record = typename Sink::Record;
+    using Line = MacroTimeline<BatchingSink<Sink>>;
+    static const CompiledProgram<Record> idle{};
+
+    BatchingSink<Sink> batch(sink);
+    std::vector<Line> lines;
+    lines.reserve(kMaxTimelines);
+    for (int i = 0; i < kMaxTimelines; ++i) lines.emplace_back(batch, idle);
+    DeadlineHeap heap;
+    const TimelineSet<Record> *set = nullptr;
+    int count = 0;
+    int runningLines = 0;
+    TraceRing *trace = control.trace;
+    SharedStatsBlock *stats = control.stats;
+
+    // frames handed to the batch but not yet sent, accounted for after the
+    // flush so trace and stats see the real send time
+    struct DueFrame { int line; uint16_t frame; uint32_t count; int64_t deadline; };
+    static const size_t kMaxDue = 64;
+    DueFrame due[kMaxDue];
+    size_t dueCount = 0;
+    // lines with a frame in the batch. a line that fell behind still sends
+    // one step per emit, a press and its release in one report may never
+    // reach the game
+    uint32_t batchedLines = 0;
+    static_assert(kMaxTimelines <= 32, "batchedLines is a 32 bit mask");
+
+    int pendingLines = 0;
+
+    // held keys go with the old program. a timeline the new set dropped
+    // ends with it
+    auto adopt = [&](int i) {
+        Line &l = lines[i];
+        l.engine.setProgram(*l.pending);
+        l.program = l.pending;
+        l.pending = nullptr;
+        --pendingLines;
+        if (i >= count) {
+            l.latch = ActivationLatch();
+            l.minRun = false;
+        }
+    };
+    auto stopLine = [&](int i, int64_t now) {
+        Line &l = lines[i];
+        l.engine.releaseAll();
+        if (l.pending) adopt(i);
+        if (!l.running) return;
+        heap.remove(i);
+        l.running = false;
+        l.triggerNs = 0;
+        --runningLines;
+        if (trace) trace->record(TraceKind::Park, now, 0, 0, 0, static_cast<uint8_t>(i));
+        if (stats && !runningLines) {
+            statsBeginWrite(*stats);
+            stats->running.store(0, std::memory_order_relaxed);
+            statsEndWrite(*stats);
+        }
+    };
+    auto beginCycle = [&](int i, int64_t now) {
+        Line &l = lines[i];
+        l.frame = 0;
+        heap.schedule(i, l.base + l.program->frames[0].atNs);
+        if (trace) trace->record(TraceKind::CycleStart, now, l.base, 0, 0, static_cast<uint8_t>(i));
+        if (stats) {
+            statsBeginWrite(*stats);
+            statsBump(stats->cycles);
+            if (i == 0) stats->periodNs.store(l.program->periodNs, std::memory_order_relaxed);
+            stats->running.store(1, std::memory_order_relaxed);
+            statsEndWrite(*stats);
+        }
+    };
+    auto flushDue = [&](int64_t emitStart) {
+        batch.flush();
+        if (!dueCount) return;
+        int64_t now = sched.now();
+        if (stats) statsBeginWrite(*stats);
+        for (size_t k = 0; k < dueCount; ++k) {
+            const DueFrame &d = due[k];
+            Line &l = lines[d.line];
+            if (trace) trace->record(TraceKind::Emit, emitStart, d.deadline, static_cast<uint32_t>(now - emitStart), d.frame, static_cast<uint8_t>(d.line));
+            if (stats) {
+                statsBump(stats->emittedEvents, d.count);
+                if (now - d.deadline > kMissedDeadlineNs) statsBump(stats->missedDeadlines);
+            }
+            if (l.lastEmitNs == 0) {
+                if (l.triggerNs) control.latency.triggerToEmit.record(now - l.triggerNs);
+                l.triggerNs = 0;
+            } else {
+                int64_t error = (now - l.lastEmitNs) - (d.deadline - l.lastDeadline);
+                control.latency.stepJitter.record(error < 0 ? -error : error);
+            }
+            l.lastEmitNs = now;
+            l.lastDeadline = d.deadline;
+        }
+        if (stats) {
+            stats->lastEmitNs.store(now, std::memory_order_relaxed);
+            statsEndWrite(*stats);
+        }
+        dueCount = 0;
+        batchedLines = 0;
+    };
+
+    while (!control.stop.load()) {
+        IFF_ALLOC_SCOPE(AllocRegion::MacroStep);
+        uint32_t seen = control.wake.sequence();
+        const TimelineSet<Record> *next = pendingLines ? set : programs.acquire();
+        if (next != set) {
+            set = next;
+            count = std::min(next->count, kMaxTimelines);
+            for (int i = 0; i < kMaxTimelines; ++i) {
+                Line &l = lines[i];
+                const CompiledProgram<Record> *program = i < count ? next->programs[i] : &idle;
+                if (i < count) l.latch.setToggle(next->toggle[i]);
+                if (program == l.program) continue;
+                l.pending = program;
+                ++pendingLines;
+                if (!l.running) adopt(i);
+            }
+            if (trace) trace->record(TraceKind::Program, sched.now());
+        }
+
+        TriggerEdge e;
+        while (control.popEdge(e)) {
+            if (e.timeline >= count) continue;
+            Line &l = lines[e.timeline];
+            bool was = l.latch.on();
+            if (l.latch.apply(e.edge) && !was) {
+                l.minRun = true;
+                if (!l.triggerNs) l.triggerNs = e.timeNs;
+                if (stats) {
+                    statsBeginWrite(*stats);
+                    statsBump(stats->activations);
+                    statsEndWrite(*stats);
+                }
+            }
+        }
+        bool anyOn = false;
+        int64_t now = sched.now();
+        for (int i = 0; i < count; ++i) {
+            Line &l = lines[i];
+            anyOn = anyOn || l.latch.on();
+            bool want = (l.latch.on() || l.minRun) && !l.program->frames.empty();
+            if (want && !l.running) {
+                l.running = true;
+                l.base = now;
+                l.lastEmitNs = 0;
+                ++runningLines;
+                beginCycle(i, now);
+            } else if (!want && l.running) {
+                stopLine(i, now);
+            }
+        }
+        if (anyOn != control.enabled.load()) {
+            control.enabled.store(anyOn);
+            control.status.signal();
+        }
+        batch.flush();
+
+        if (heap.empty()) {
+            sched.park(control.wake, seen);
+            continue;
+        }
+        if (!sched.waitUntil(heap.topDeadline(), control.wake, seen)) continue;
+
+        now = sched.now();
+        while (!heap.empty() && heap.topDeadline() <= now) {
+            int i = heap.top();
+            Line &l = lines[i];
+            const CompiledFrame &frame = l.program->frames[l.frame];
+            if (dueCount == kMaxDue || (batchedLines & (1u << i))) flushDue(now);
+            batchedLines |= 1u << i;
+            due[dueCount++] = DueFrame{ i, static_cast<uint16_t>(l.frame), frame.count, l.base + frame.atNs };
+            l.engine.emit(frame);
+            if (++l.frame < l.program->frames.size()) {
+                heap.schedule(i, l.base + l.program->frames[l.frame].atNs);
+                continue;
+            }
+            l.minRun = false;
+            // the cycle that just ended sets where the next one starts
+            int64_t periodNs = l.program->periodNs;
+            if (l.pending) adopt(i);
+            if (!l.latch.on() || l.program->frames.empty()) {
+                stopLine(i, now);
+                continue;
+            }
+            int64_t next = nextCycleBase(l.base, periodNs, now);
+            if (next != l.base + periodNs) statsBump(control.skippedCycles);
+            l.base = next;
+            beginCycle(i, now);
+        }
+        flushDue(now);
+    }
+    for (Line &l : lines) l.engine.releaseAll();
+    batch.flush();
+}
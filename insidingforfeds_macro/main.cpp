@@ -1,36 +1,40 @@
 #include <windows.h>
-#include <mmsystem.h>
 #include <iostream>
 #include <string>
 #include <thread>
 #include <atomic>
 #include <fstream>
 #include <sstream>
+#include <iomanip>
 #include <algorithm>
 #include <chrono>
 #include <vector>
 #include <cctype>
+#include <memory>
+#include <mutex>
+#include "input_sink.h"
+#include "macro_loops.h"
+#include "macro_timelines.h"
+#include "macro_program.h"
+#include "timing.h"
+#include "latency_stats.h"
+#include "bind_matcher.h"
+#include "console_renderer.h"
+#include "settings.h"
+#include "config_watcher.h"
+#include "rcu_slot.h"
+#include "thread_roles.h"
+#include "shared_stats.h"
+#include "timer_calibration.h"
+#include "control_channel.h"
+#include "alloc_tracker.h"
+#include "sequence_recorder.h"
 
 using namespace std;
 
-enum class ActivationType { Hold, Toggle };
-enum class MacroMode { FirstPerson, ThirdPerson };
-enum class KeybindType { Keyboard, Mouse };
-enum class MouseButton { Left, Right, Middle, X1, X2 };
-
-struct Settings {
-    ActivationType activationType;
-    MacroMode macroMode;
-    KeybindType keybindType;
-    int keyboardVk;
-    MouseButton mouseButton;
-};
-
-static atomic<bool> macroEnabled{false};
-static atomic<bool> stopThreads{false};
+static MacroControl g_control;
 
-static const int kFirstPersonStepDelayMs = 10;
-static const int kThirdPersonKeyTapDelayMs = 10;
+static PlatformSink g_sink;
 
 string toLowerCopy(const string &s) {
     string r = s;
@@ -38,14 +42,6 @@ string toLowerCopy(const string &s) {
     return r;
 }
 
-void sleepMs(int ms) {
-    this_thread::sleep_for(chrono::milliseconds(ms));
-}
-
-void sleepMicro(int us) {
-    this_thread::sleep_for(chrono::microseconds(us));
-}
-
 void printBox(const vector<string>& lines) {
     size_t width = 0;
     for (auto &l : lines) width = max(width, l.size());
@@ -79,282 +75,15 @@ void writeAllText(const string &path, const string &text) {
     f << text;
 }
 
-bool parseJsonStringField(const string &json, const string &key, string &out) {
-    string k = string("\"") + key + string("\"");
-    size_t p = json.find(k);
-    if (p == string::npos) return false;
-    p = json.find(':', p);
-    if (p == string::npos) return false;
-    p = json.find('"', p);
-    if (p == string::npos) return false;
-    size_t q = json.find('"', p + 1);
-    if (q == string::npos) return false;
-    out = json.substr(p + 1, q - p - 1);
-    return true;
-}
-
-bool parseJsonIntField(const string &json, const string &key, int &out) {
-    string k = string("\"") + key + string("\"");
-    size_t p = json.find(k);
-    if (p == string::npos) return false;
-    p = json.find(':', p);
-    if (p == string::npos) return false;
-    while (p < json.size() && (json[p] == ':' || json[p] == ' ')) p++;
-    string num;
-    while (p < json.size() && (isdigit(static_cast<unsigned char>(json[p])) || json[p] == '-')) { num.push_back(json[p]); p++; }
-    if (num.empty()) return false;
-    out = stoi(num);
-    return true;
-}
-
-string toJson(const Settings &s) {
-    string activation = s.activationType == ActivationType::Hold ? "hold" : "toggle";
-    string mode = s.macroMode == MacroMode::FirstPerson ? "first" : "third";
-    string kb = s.keybindType == KeybindType::Keyboard ? "keyboard" : "mouse";
-    string mb;
-    if (s.mouseButton == MouseButton::Left) mb = "left";
-    else if (s.mouseButton == MouseButton::Right) mb = "right";
-    else if (s.mouseButton == MouseButton::Middle) mb = "middle";
-    else if (s.mouseButton == MouseButton::X1) mb = "x1";
-    else mb = "x2";
-    stringstream ss;
-    ss << "{\n";
-    ss << "  \"activation\": \"" << activation << "\",\n";
-    ss << "  \"mode\": \"" << mode << "\",\n";
-    ss << "  \"keybind_type\": \"" << kb << "\",\n";
-    ss << "  \"keyboard_vk\": " << s.keyboardVk << ",\n";
-      ss << "  \"mouse_button\": \"" << mb << "\"\n";
-  ss << "}\n";
-    return ss.str();
-}
-
-bool loadConfig(Settings &s) {
-    if (!fileExists("config.json")) return false;
-    string t = readAllText("config.json");
-    string activation, mode, kbt, mb;
-    int vk = 0;
-    if (!parseJsonStringField(t, "activation", activation)) return false;
-    if (!parseJsonStringField(t, "mode", mode)) return false;
-    if (!parseJsonStringField(t, "keybind_type", kbt)) return false;
-    parseJsonIntField(t, "keyboard_vk", vk);
-    parseJsonStringField(t, "mouse_button", mb);
-
-    activation = toLowerCopy(activation);
-    mode = toLowerCopy(mode);
-    kbt = toLowerCopy(kbt);
-    mb = toLowerCopy(mb);
-    if (activation == "hold") s.activationType = ActivationType::Hold; else s.activationType = ActivationType::Toggle;
-    if (mode == "first") s.macroMode = MacroMode::FirstPerson; else s.macroMode = MacroMode::ThirdPerson;
-    if (kbt == "keyboard") s.keybindType = KeybindType::Keyboard; else s.keybindType = KeybindType::Mouse;
-    s.keyboardVk = vk;
-    if (mb == "left") s.mouseButton = MouseButton::Left;
-    else if (mb == "right") s.mouseButton = MouseButton::Right;
-    else if (mb == "middle") s.mouseButton = MouseButton::Middle;
-    else if (mb == "x1") s.mouseButton = MouseButton::X1;
-    else s.mouseButton = MouseButton::X2;
-
-    return true;
-}
-
-void saveConfig(const Settings &s) {
-    writeAllText("config.json", toJson(s));
-}
-
-int captureNextKeyboardVk() {
-    atomic<int> capturedVk{0};
-    HHOOK hook = SetWindowsHookExA(WH_KEYBOARD_LL, [](int nCode, WPARAM wParam, LPARAM lParam) -> LRESULT {
-        if (nCode == HC_ACTION) {
-            KBDLLHOOKSTRUCT *p = reinterpret_cast<KBDLLHOOKSTRUCT*>(lParam);
-            if (wParam == WM_KEYDOWN || wParam == WM_SYSKEYDOWN) {
-                int vk = static_cast<int>(p->vkCode);
-                PostThreadMessageA(GetCurrentThreadId(), WM_APP + 1, static_cast<WPARAM>(vk), 0);
-            }
-        }
-        return CallNextHookEx(nullptr, nCode, wParam, lParam);
-    }, GetModuleHandleA(nullptr), 0);
-    MSG msg;
-    while (GetMessageA(&msg, nullptr, 0, 0)) {
-        if (msg.message == WM_APP + 1) {
-            capturedVk = static_cast<int>(msg.wParam);
-            break;
-        }
-    }
-    UnhookWindowsHookEx(hook);
-    return capturedVk.load();
-}
-
-MouseButton captureNextMouseButton() {
-    atomic<MouseButton> captured;
-    HHOOK hook = SetWindowsHookExA(WH_MOUSE_LL, [](int nCode, WPARAM wParam, LPARAM lParam) -> LRESULT {
-        if (nCode == HC_ACTION) {
-            MSLLHOOKSTRUCT* p = reinterpret_cast<MSLLHOOKSTRUCT*>(lParam);
-            if (wParam == WM_LBUTTONDOWN) PostThreadMessageA(GetCurrentThreadId(), WM_APP + 2, static_cast<WPARAM>(MouseButton::Left), 0);
-            else if (wParam == WM_RBUTTONDOWN) PostThreadMessageA(GetCurrentThreadId(), WM_APP + 2, static_cast<WPARAM>(MouseButton::Right), 0);
-            else if (wParam == WM_MBUTTONDOWN) PostThreadMessageA(GetCurrentThreadId(), WM_APP + 2, static_cast<WPARAM>(MouseButton::Middle), 0);
-            else if (wParam == WM_XBUTTONDOWN) {
-                WORD xb = HIWORD(p->mouseData);
-                if (xb == XBUTTON1) PostThreadMessageA(GetCurrentThreadId(), WM_APP + 2, static_cast<WPARAM>(MouseButton::X1), 0);
-                else if (xb == XBUTTON2) PostThreadMessageA(GetCurrentThreadId(), WM_APP + 2, static_cast<WPARAM>(MouseButton::X2), 0);
-            }
-        }
-        return CallNextHookEx(nullptr, nCode, wParam, lParam);
-    }, GetModuleHandleA(nullptr), 0);
-    MSG msg;
-    while (GetMessageA(&msg, nullptr, 0, 0)) {
-        if (msg.message == WM_APP + 2) {
-            captured = static_cast<MouseButton>(msg.wParam);
-            break;
-        }
-    }
-    UnhookWindowsHookEx(hook);
-    return captured.load();
-}
-
-struct InputBind { KeybindType type; int vk; MouseButton mb; };
-
-InputBind captureNextBind() {
-    atomic<bool> done{false};
-    atomic<InputBind*> resultPtr{nullptr};
-    InputBind res{};
-    HHOOK kHook = SetWindowsHookExA(WH_KEYBOARD_LL, [](int nCode, WPARAM wParam, LPARAM lParam) -> LRESULT {
-        if (nCode == HC_ACTION && (wParam == WM_KEYDOWN || wParam == WM_SYSKEYDOWN)) {
-            KBDLLHOOKSTRUCT *p = reinterpret_cast<KBDLLHOOKSTRUCT*>(lParam);
-            InputBind* out = new InputBind();
-            out->type = KeybindType::Keyboard;
-            out->vk = static_cast<int>(p->vkCode);
-            out->mb = MouseButton::Left;
-            PostThreadMessageA(GetCurrentThreadId(), WM_APP + 3, reinterpret_cast<WPARAM>(out), 0);
-        }
-        return CallNextHookEx(nullptr, nCode, wParam, lParam);
-    }, GetModuleHandleA(nullptr), 0);
-    HHOOK mHook = SetWindowsHookExA(WH_MOUSE_LL, [](int nCode, WPARAM wParam, LPARAM lParam) -> LRESULT {
-        if (nCode == HC_ACTION) {
-            MSLLHOOKSTRUCT* p = reinterpret_cast<MSLLHOOKSTRUCT*>(lParam);
-            InputBind* out = nullptr;
-            if (wParam == WM_LBUTTONDOWN) { out = new InputBind(); out->type = KeybindType::Mouse; out->mb = MouseButton::Left; out->vk = 0; }
-            else if (wParam == WM_RBUTTONDOWN) { out = new InputBind(); out->type = KeybindType::Mouse; out->mb = MouseButton::Right; out->vk = 0; }
-            else if (wParam == WM_MBUTTONDOWN) { out = new InputBind(); out->type = KeybindType::Mouse; out->mb = MouseButton::Middle; out->vk = 0; }
-            else if (wParam == WM_XBUTTONDOWN) {
-                WORD xb = HIWORD(p->mouseData);
-                if (xb == XBUTTON1) { out = new InputBind(); out->type = KeybindType::Mouse; out->mb = MouseButton::X1; out->vk = 0; }
-                else if (xb == XBUTTON2) { out = new InputBind(); out->type = KeybindType::Mouse; out->mb = MouseButton::X2; out->vk = 0; }
-            }
-            if (out) PostThreadMessageA(GetCurrentThreadId(), WM_APP + 3, reinterpret_cast<WPARAM>(out), 0);
-        }
-        return CallNextHookEx(nullptr, nCode, wParam, lParam);
-    }, GetModuleHandleA(nullptr), 0);
-    MSG msg;
-    while (GetMessageA(&msg, nullptr, 0, 0)) {
-        if (msg.message == WM_APP + 3) {
-            InputBind* ptr = reinterpret_cast<InputBind*>(msg.wParam);
-            res = *ptr;
-            delete ptr;
-            break;
-        }
-    }
-    UnhookWindowsHookEx(kHook);
-    UnhookWindowsHookEx(mHook);
-    return res;
-}
-
-void sendKeyDown(WORD vk) {
-    INPUT in = {};
-    in.type = INPUT_KEYBOARD;
-    in.ki.wVk = vk;
-    SendInput(1, &in, sizeof(INPUT));
-}
-
-void sendKeyUp(WORD vk) {
-    INPUT in = {};
-    in.type = INPUT_KEYBOARD;
-    in.ki.wVk = vk;
-    in.ki.dwFlags = KEYEVENTF_KEYUP;
-    SendInput(1, &in, sizeof(INPUT));
-}
-
-void sendScanDown(WORD vk) {
-    INPUT in = {};
-    in.type = INPUT_KEYBOARD;
-    in.ki.wVk = 0;
-    in.ki.wScan = static_cast<WORD>(MapVirtualKeyA(vk, MAPVK_VK_TO_VSC));
-    in.ki.dwFlags = KEYEVENTF_SCANCODE;
-    SendInput(1, &in, sizeof(INPUT));
-}
-
-void sendScanUp(WORD vk) {
-    INPUT in = {};
-    in.type = INPUT_KEYBOARD;
-    in.ki.wVk = 0;
-    in.ki.wScan = static_cast<WORD>(MapVirtualKeyA(vk, MAPVK_VK_TO_VSC));
-    in.ki.dwFlags = KEYEVENTF_SCANCODE | KEYEVENTF_KEYUP;
-    SendInput(1, &in, sizeof(INPUT));
-}
-
-void sendMouseWheel(int delta) {
-    INPUT in = {};
-    in.type = INPUT_MOUSE;
-    in.mi.dwFlags = MOUSEEVENTF_WHEEL;
-    in.mi.mouseData = delta;
-    SendInput(1, &in, sizeof(INPUT));
+// false with an empty error when there is simply no file yet
+bool loadConfig(const string &path, Settings &s, string &error) {
+    error.clear();
+    if (!fileExists(path)) return false;
+    return parseConfig(readAllText(path), s, error);
 }
 
-void runFirstPersonLoop() {
-    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
-    while (!stopThreads.load()) {
-        if (macroEnabled.load()) {
-            sendMouseWheel(static_cast<int>(WHEEL_DELTA));
-            sleepMs(kFirstPersonStepDelayMs);
-            sendMouseWheel(-static_cast<int>(WHEEL_DELTA));
-            sleepMs(kFirstPersonStepDelayMs);
-        }
-        sleepMs(kFirstPersonStepDelayMs);
-    }
-}
-
-void runThirdPersonLoop() {
-    const WORD VK_I = 0x49;
-    const WORD VK_O = 0x4F;
-    bool iDown = false;
-    bool oDown = false;
-    while (!stopThreads.load()) {
-        if (macroEnabled.load()) {
-            sendScanDown(VK_I);
-            iDown = true;
-            sleepMs(kThirdPersonKeyTapDelayMs);
-            if (!macroEnabled.load()) {
-                if (iDown) { sendScanUp(VK_I); iDown = false; }
-                if (oDown) { sendScanUp(VK_O); oDown = false; }
-                continue;
-            }
-
-            sendScanDown(VK_O);
-            oDown = true;
-            sleepMs(kThirdPersonKeyTapDelayMs);
-            if (!macroEnabled.load()) {
-                if (iDown) { sendScanUp(VK_I); iDown = false; }
-                if (oDown) { sendScanUp(VK_O); oDown = false; }
-                continue;
-            }
-
-            sendScanUp(VK_I);
-            iDown = false;
-            sleepMs(kThirdPersonKeyTapDelayMs);
-            if (!macroEnabled.load()) {
-                if (oDown) { sendScanUp(VK_O); oDown = false; }
-                continue;
-            }
-
-            sendScanUp(VK_O);
-            oDown = false;
-            sleepMs(kThirdPersonKeyTapDelayMs);
-        } else {
-            if (iDown) { sendScanUp(VK_I); iDown = false; }
-            if (oDown) { sendScanUp(VK_O); oDown = false; }
-            sleepMs(kThirdPersonKeyTapDelayMs);
-        }
-    }
-    if (iDown) sendScanUp(VK_I);
-    if (oDown) sendScanUp(VK_O);
+void saveConfig(const string &path, const Settings &s) {
+    writeAllText(path, toJson(s));
 }
 
 string activationToString(ActivationType a) {
@@ -362,13 +91,10 @@ string activationToString(ActivationType a) {
 }
 
 string modeToString(MacroMode m) {
+    if (m == MacroMode::Custom) return "custom";
     return m == MacroMode::FirstPerson ? "1st person" : "3rd person";
 }
 
-string keybindTypeToString(KeybindType k) {
-    return k == KeybindType::Keyboard ? "keyboard" : "mouse";
-}
-
 string mouseButtonToString(MouseButton b) {
     if (b == MouseButton::Left) return "left";
     if (b == MouseButton::Right) return "right";
@@ -390,6 +116,8 @@ void clearConsole() {
 }
 
 static HANDLE statusEvent = nullptr;
+static const int64_t kUiFrameNs = 33000000;
+static const DWORD kUiStatsRefreshMs = 250;
 
 struct ConsoleSize { short cols; short rows; };
 
@@ -463,41 +191,84 @@ void writeCenteredLine(const wstring& text, int cols, WORD attr, bool useAttr) {
     WriteConsoleW(h, L"\n", 1, &written, nullptr);
 }
 
-void drawCenteredUI(const Settings &s, bool running) {
-    vector<wstring> content;
-    content.push_back(L"insidingforfeds macro");
-    content.push_back(running ? L"[ RUNNING ]" : L"[ STOPPED ]");
-    content.push_back(utf8ToWide(string("bind: ") + formatBindString(s)));
-    {
-        wstring mode = utf8ToWide(modeToString(s.macroMode));
-        wstring act = utf8ToWide(activationToString(s.activationType));
-        wstring line = mode + L"  |  " + act;
+// last hot reload result, ui only
+static mutex g_reloadMutex;
+static string g_reloadStatus;
 
-        content.push_back(line);
-    }
-    content.push_back(L"");
-    content.push_back(L"press your bind to start/stop");
+void setReloadStatus(const string &status) {
+    lock_guard<mutex> lock(g_reloadMutex);
+    g_reloadStatus = status;
+}
 
-    size_t width = 0;
-    for (auto &l : content) width = max(width, l.size());
-    wstring top = L"+" + wstring(width + 2, L'-') + L"+";
+string reloadStatus() {
+    lock_guard<mutex> lock(g_reloadMutex);
+    return g_reloadStatus;
+}
 
-    ConsoleSize cs = getConsoleSize();
-    int totalLines = (int)content.size() + 2;
-    int topPad = 0;
-    if (cs.rows > 0) topPad = max(0, (int)cs.rows - totalLines) / 2;
+// launch -> settings known -> worker parked -> hooks installed, on the
+// monotonicNowNs clock
+struct StartupMarks {
+    int64_t launchNs = 0;
+    int64_t settingsNs = 0;
+    atomic<int64_t> workerNs{0};
+    atomic<int64_t> hooksNs{0};
+    bool prompted = false;
+};
+static StartupMarks g_startup;
+// written by the worker before it stores workerNs, read by the ui after
+static string g_timerSummary;
+
+// process creation time, so loader and crt startup count too
+int64_t processLaunchNs() {
+    FILETIME created, exited, kernel, user, now;
+    int64_t nowNs = monotonicNowNs();
+    if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user)) return nowNs;
+    GetSystemTimePreciseAsFileTime(&now);
+    auto ticks = [](const FILETIME &f) { return (static_cast<int64_t>(f.dwHighDateTime) << 32) | f.dwLowDateTime; };
+    int64_t since = (ticks(now) - ticks(created)) * 100;
+    return since > 0 ? nowNs - since : nowNs;
+}
 
-    clearConsole();
-    for (int i = 0; i < topPad; ++i) writeCenteredLine(L"", cs.cols, 0, false);
+static string formatMs(int64_t ns) {
+    stringstream ss;
+    ss << fixed << setprecision(2) << ns / 1000000.0 << "ms";
+    return ss.str();
+}
 
-    writeCenteredLine(top, cs.cols, 0, false);
-    for (size_t i = 0; i < content.size(); ++i) {
-        wstring line = L"| " + content[i] + wstring(width - content[i].size(), L' ') + L" |";
-        bool isStatus = (i == 1);
-        WORD attr = isStatus ? (running ? colorRgb(false, true, false, true) : colorRgb(true, false, false, true)) : 0;
-        writeCenteredLine(line, cs.cols, attr, isStatus);
-    }
-    writeCenteredLine(top, cs.cols, 0, false);
+string formatStartup() {
+    int64_t worker = g_startup.workerNs.load();
+    int64_t hooks = g_startup.hooksNs.load();
+    if (!hooks) return "startup: -";
+    int64_t armed = max(worker, hooks);
+    if (!armed) return "startup: -";
+    string r = "startup: " + formatMs(armed - g_startup.launchNs);
+    if (g_startup.prompted) r = "startup: " + formatMs(g_startup.settingsNs - g_startup.launchNs) + " + setup, armed in " + formatMs(armed - g_startup.settingsNs);
+    return r + " (config " + formatMs(g_startup.settingsNs - g_startup.launchNs) + ", worker " + formatMs(worker - g_startup.settingsNs) +
+        ", hooks " + formatMs(hooks - g_startup.settingsNs) + ")";
+}
+
+void drawStatusUI(ConsoleRenderer &r, const Settings &s, bool running) {
+    static vector<string> content;
+    content.resize(9);
+    content[0] = "insidingforfeds macro";
+    content[1] = running ? "[ RUNNING ]" : "[ STOPPED ]";
+    content[2] = "bind: " + formatBindString(s);
+    content[3] = modeToString(s.macroMode) + "  |  " + activationToString(s.activationType);
+    content[4].clear();
+    if (!s.extraBinds.empty()) content[4] = "+ " + formatExtraBinds(s.extraBinds);
+    content[5] = "trigger->emit: " + formatLatencySummary(g_control.latency.triggerToEmit);
+    content[6] = "step jitter:   " + formatLatencySummary(g_control.latency.stepJitter);
+    content[7] = formatStartup();
+    content[8] = reloadStatus();
+    if (g_startup.workerNs.load()) content.push_back(g_timerSummary);
+    // what the scheduler actually gave us, not what we asked for
+    stringstream roles(threadRoleSummary());
+    for (string line; getline(roles, line);) content.push_back(line);
+    content.push_back("press your bind to start/stop");
+
+    r.clear();
+    r.drawBox(content, 1, running ? CellColor::Green : CellColor::Red);
+    r.present();
 }
 
 void drawCenteredPanel(const vector<string>& lines) {
@@ -541,159 +312,554 @@ void printCenteredPrompt(const string& prompt) {
     WriteConsoleW(h, wp.c_str(), (DWORD)wp.size(), &written, nullptr);
 }
 
-static atomic<bool> g_holdRequest{false};
+static HANDLE g_exitDone = nullptr;
 
-void pressTap(WORD vk) {
-    sendScanDown(vk);
-    sleepMs(1);
-    sendScanUp(vk);
+// all the hook does for the bound key/button: stamp the edge and queue it,
+// hold/toggle is worked out on the worker
+void onBindEdge(BindHit hit, DWORD eventTimeMs) {
+    BindEdge edge = bindHitEdge(hit);
+    g_control.pushEdge(edge, monotonicNowNs(), bindHitTimeline(hit));
+    if (edge == BindEdge::Down) g_control.latency.hookDelivery.record(static_cast<int64_t>(GetTickCount() - eventTimeMs) * 1000000LL);
 }
 
+BOOL WINAPI consoleCtrlHandler(DWORD type) {
+    (void)type;
+    g_control.requestStop();
+    if (statusEvent) SetEvent(statusEvent);
+    if (g_exitDone) WaitForSingleObject(g_exitDone, 4000);
+    return TRUE;
+}
 
+// everything the hook and the worker read from the settings, built in one go
+// off the hot path and published as a whole. the hook picks a new one up
+// between messages, the worker the next time it wakes. timeline 0 is the
+// main bind, 1.. the "binds" from the config in order. a program is shared
+// with the config before when its steps didn't change, so the worker sees the
+// same pointer and leaves that timeline running.
+struct LiveConfig {
+    Settings settings;
+    BindMatcher matcher;
+    shared_ptr<const CompiledProgram<PlatformSink::Record>> programs[kMaxTimelines];
+    TimelineSet<PlatformSink::Record> timelines;
+};
+static_assert(kMaxExtraBinds + 1 <= kMaxTimelines, "every extra bind needs a timeline");
+
+enum LiveConfigReader { kReaderHook, kReaderWorker, kReaderUi, kReaderControl, kLiveConfigReaders };
+static RcuSlot<LiveConfig, kLiveConfigReaders> g_liveConfig;
+// the reloader and the control channel both publish, the slot takes one
+// writer at a time
+static mutex g_publishMutex;
+
+static const UINT kMsgConfigChanged = WM_APP + 10;
+static atomic<DWORD> g_hookThreadId{0};
+// hook thread only, swapped between messages so a callback never sees two
+static const LiveConfig *g_hookConfig = nullptr;
+
+static const int kReloadQuietMs = 100;
+
+// the main bind first, then the extra ones, one per timeline
+static vector<ExtraBind> timelineBinds(const Settings &s) {
+    vector<ExtraBind> binds;
+    binds.push_back(ExtraBind{ s.keybindType, s.keyboardVk, s.mouseButton, s.macroMode, s.activationType });
+    binds.insert(binds.end(), s.extraBinds.begin(), s.extraBinds.end());
+    return binds;
+}
 
-void setMacroEnabled(bool enabled) {
-    bool previous = macroEnabled.exchange(enabled);
-    if (statusEvent && previous != enabled) {
-        SetEvent(statusEvent);
-    }
+static const vector<MacroStep> &modeSteps(const Settings &s, MacroMode mode) {
+    static const vector<MacroStep> firstPerson(begin(kFirstPersonProgram), end(kFirstPersonProgram));
+    static const vector<MacroStep> thirdPerson(begin(kThirdPersonProgram), end(kThirdPersonProgram));
+    if (mode == MacroMode::FirstPerson) return firstPerson;
+    if (mode == MacroMode::ThirdPerson) return thirdPerson;
+    return s.sequence;
 }
 
-struct MonitorState { ActivationType act; KeybindType type; int vk; MouseButton mb; };
-static MonitorState g_monitorState;
+static bool sameSteps(const vector<MacroStep> &a, const vector<MacroStep> &b) {
+    return a.size() == b.size() && equal(a.begin(), a.end(), b.begin(), [](const MacroStep &x, const MacroStep &y) {
+        return x.op == y.op && x.arg == y.arg;
+    });
+}
 
-void startInputMonitor(const MonitorState &ms) {
-    g_monitorState = ms;
-    thread([]{
-        HHOOK kHook = nullptr, mHook = nullptr;
-        if (g_monitorState.type == KeybindType::Keyboard) {
-            kHook = SetWindowsHookExA(WH_KEYBOARD_LL, [](int nCode, WPARAM wParam, LPARAM lParam) -> LRESULT {
-                if (nCode == HC_ACTION) {
-                    KBDLLHOOKSTRUCT *p = reinterpret_cast<KBDLLHOOKSTRUCT*>(lParam);
-                    static bool pressed = false;
-                    if ((wParam == WM_KEYDOWN || wParam == WM_SYSKEYDOWN) && p->vkCode == (DWORD)g_monitorState.vk) {
-                        if (g_monitorState.act == ActivationType::Toggle) {
-                            if (!pressed) {
-                                                                     bool cur = macroEnabled.load();
-                                     if (!cur) {
-                                         setMacroEnabled(true);
-                                     } else {
-                                         setMacroEnabled(false);
-                                     }
-                            }
-                            pressed = true;
-                        } else {
-                            if (!pressed) {
-                                g_holdRequest.store(true);
-                                setMacroEnabled(true);
-                                pressed = true;
-                            }
-                        }
-                    } else if ((wParam == WM_KEYUP || wParam == WM_SYSKEYUP) && p->vkCode == (DWORD)g_monitorState.vk) {
-                        if (g_monitorState.act == ActivationType::Hold) setMacroEnabled(false);
-                        g_holdRequest.store(false);
-                        pressed = false;
-                    }
-                }
-                return CallNextHookEx(nullptr, nCode, wParam, lParam);
-            }, GetModuleHandleA(nullptr), 0);
+// previous is the config being replaced, if any. a timeline whose steps and
+// wheel burst are what previous compiled gets previous' program back instead
+// of a new copy; every program goes to g_sink, so the sink always matches.
+unique_ptr<LiveConfig> buildLiveConfig(const Settings &s, const LiveConfig *previous, string &error) {
+    unique_ptr<LiveConfig> c(new LiveConfig());
+    c->settings = s;
+    vector<ExtraBind> binds = timelineBinds(s);
+    vector<ExtraBind> before;
+    if (previous) before = timelineBinds(previous->settings);
+    for (size_t i = 0; i < binds.size(); ++i) {
+        const ExtraBind &b = binds[i];
+        uint8_t timeline = static_cast<uint8_t>(i);
+        if (b.keybindType == KeybindType::Keyboard) c->matcher.bindKey(b.keyboardVk, timeline);
+        else c->matcher.bindMouse(b.mouseButton, timeline);
+        const vector<MacroStep> &steps = modeSteps(s, b.macroMode);
+        if (i < before.size() && previous->settings.wheelBurst == s.wheelBurst && sameSteps(modeSteps(previous->settings, before[i].macroMode), steps)) {
+            c->programs[i] = previous->programs[i];
         } else {
-            mHook = SetWindowsHookExA(WH_MOUSE_LL, [](int nCode, WPARAM wParam, LPARAM lParam) -> LRESULT {
-                if (nCode == HC_ACTION) {
-                    MSLLHOOKSTRUCT* p = reinterpret_cast<MSLLHOOKSTRUCT*>(lParam);
-                    static bool pressed = false;
-                    bool isDown = false, isUp = false, match = false;
-                    if (g_monitorState.mb == MouseButton::Left) { isDown = wParam == WM_LBUTTONDOWN; isUp = wParam == WM_LBUTTONUP; match = isDown || isUp; }
-                    else if (g_monitorState.mb == MouseButton::Right) { isDown = wParam == WM_RBUTTONDOWN; isUp = wParam == WM_RBUTTONUP; match = isDown || isUp; }
-                    else if (g_monitorState.mb == MouseButton::Middle) { isDown = wParam == WM_MBUTTONDOWN; isUp = wParam == WM_MBUTTONUP; match = isDown || isUp; }
-                    else if (g_monitorState.mb == MouseButton::X1 || g_monitorState.mb == MouseButton::X2) {
-                        if (wParam == WM_XBUTTONDOWN || wParam == WM_XBUTTONUP) {
-                            WORD xb = HIWORD(p->mouseData);
-                            if ((g_monitorState.mb == MouseButton::X1 && xb == XBUTTON1) || (g_monitorState.mb == MouseButton::X2 && xb == XBUTTON2)) {
-                                isDown = wParam == WM_XBUTTONDOWN;
-                                isUp = wParam == WM_XBUTTONUP;
-                                match = true;
-                            }
-                        }
-                    }
-                    if (match) {
-                        if (isDown) {
-                            if (g_monitorState.act == ActivationType::Toggle) {
-                                if (!pressed) {
-                                    bool cur = macroEnabled.load();
-                                    if (!cur) {
-                                        setMacroEnabled(true);
-                                    } else {
-                                        setMacroEnabled(false);
-                                    }
-                                }
-                                pressed = true;
-                            } else {
-                                if (!pressed) {
-                                    g_holdRequest.store(true);
-                                    setMacroEnabled(true);
-                                    pressed = true;
-                                }
-                            }
-                        } else if (isUp) {
-                            if (g_monitorState.act == ActivationType::Hold) setMacroEnabled(false);
-                            g_holdRequest.store(false);
-                            pressed = false;
-                        }
-                    }
-                }
-                return CallNextHookEx(nullptr, nCode, wParam, lParam);
-            }, GetModuleHandleA(nullptr), 0);
+            shared_ptr<CompiledProgram<PlatformSink::Record>> program = make_shared<CompiledProgram<PlatformSink::Record>>();
+            if (!compileMacroProgram(g_sink, steps, *program, error, s.wheelBurst)) {
+                c.reset();
+                return c;
+            }
+            c->programs[i] = move(program);
+        }
+        c->timelines.programs[i] = c->programs[i].get();
+        c->timelines.toggle[i] = b.activationType == ActivationType::Toggle;
+    }
+    c->timelines.count = static_cast<int>(binds.size());
+    return c;
+}
+
+// worker side view of g_liveConfig for runMacroTimelines
+struct LiveProgramSource {
+    const TimelineSet<PlatformSink::Record> *acquire() {
+        return &g_liveConfig.acquire(kReaderWorker)->timelines;
+    }
+};
+
+// our own time per hook call, whatever CallNextHookEx costs belongs to the
+// hooks after us
+static void recordHookCall(int64_t startNs) {
+    SharedStatsBlock *stats = g_control.stats;
+    if (!stats) return;
+    statsBump(stats->hookCalls);
+    statsMax(stats->hookMaxNs, monotonicNowNs() - startNs);
+}
+
+// what a press looks like to the setup screen
+struct InputBind { KeybindType type; int vk; MouseButton mb; };
+
+// bind capture rides on the same hooks as the macro. while armed the hook
+// drops every key or button press into a fixed ring and wakes the setup
+// screen; nothing is allocated in hook context and a press nobody waits for
+// just sits in its slot.
+struct BindCapture {
+    atomic<bool> armed{false};
+    SpscRing<InputBind, 16> presses;
+    WakeEvent wake;
+};
+static BindCapture g_capture;
+
+// recording a custom sequence rides on them too, see recordSequence
+static SequenceRecorder g_recorder;
+
+static void capturePress(const InputBind &b) {
+    if (g_capture.presses.push(b)) g_capture.wake.signal();
+}
+
+static bool mouseButtonFromMessage(WPARAM msg, WORD xbutton, MouseButton &out) {
+    if (msg == WM_LBUTTONDOWN) out = MouseButton::Left;
+    else if (msg == WM_RBUTTONDOWN) out = MouseButton::Right;
+    else if (msg == WM_MBUTTONDOWN) out = MouseButton::Middle;
+    else if (msg == WM_XBUTTONDOWN && xbutton == XBUTTON1) out = MouseButton::X1;
+    else if (msg == WM_XBUTTONDOWN && xbutton == XBUTTON2) out = MouseButton::X2;
+    else return false;
+    return true;
+}
+
+LRESULT CALLBACK keyboardHookProc(int nCode, WPARAM wParam, LPARAM lParam) {
+    if (nCode == HC_ACTION) {
+        IFF_ALLOC_SCOPE(AllocRegion::Hook);
+        int64_t startNs = g_control.stats ? monotonicNowNs() : 0;
+        const KBDLLHOOKSTRUCT *p = reinterpret_cast<KBDLLHOOKSTRUCT*>(lParam);
+        if (g_capture.armed.load(memory_order_relaxed)) {
+            if (wParam == WM_KEYDOWN || wParam == WM_SYSKEYDOWN) capturePress(InputBind{ KeybindType::Keyboard, static_cast<int>(p->vkCode), MouseButton::Left });
+        } else if (g_recorder.armed()) {
+            if (!(p->flags & LLKHF_INJECTED)) g_recorder.key(wParam == WM_KEYDOWN || wParam == WM_SYSKEYDOWN, static_cast<uint16_t>(p->vkCode), monotonicNowNs());
+        } else if (g_hookConfig) {
+            BindHit hit = g_hookConfig->matcher.hitKey(static_cast<uint32_t>(wParam), p->vkCode);
+            if (hit) onBindEdge(hit, p->time);
+        }
+        recordHookCall(startNs);
+    }
+    return CallNextHookEx(nullptr, nCode, wParam, lParam);
+}
+
+LRESULT CALLBACK mouseHookProc(int nCode, WPARAM wParam, LPARAM lParam) {
+    if (nCode == HC_ACTION) {
+        IFF_ALLOC_SCOPE(AllocRegion::Hook);
+        int64_t startNs = g_control.stats ? monotonicNowNs() : 0;
+        const MSLLHOOKSTRUCT *p = reinterpret_cast<MSLLHOOKSTRUCT*>(lParam);
+        MouseButton mb;
+        if (g_capture.armed.load(memory_order_relaxed)) {
+            if (mouseButtonFromMessage(wParam, HIWORD(p->mouseData), mb)) capturePress(InputBind{ KeybindType::Mouse, 0, mb });
+        } else if (g_recorder.armed()) {
+            // steps can't send buttons, only the wheel is kept
+            if (wParam == WM_MOUSEWHEEL && !(p->flags & LLMHF_INJECTED)) g_recorder.wheel(static_cast<short>(HIWORD(p->mouseData)), monotonicNowNs());
+        } else if (g_hookConfig) {
+            BindHit hit = g_hookConfig->matcher.hitMouse(static_cast<uint32_t>(wParam), HIWORD(p->mouseData));
+            if (hit) onBindEdge(hit, p->time);
+        }
+        recordHookCall(startNs);
+    }
+    return CallNextHookEx(nullptr, nCode, wParam, lParam);
+}
+
+// takes the newest config and keeps only the hooks its binds need, plus both
+// while a capture or a recording is armed. a timeline whose bind changed while held gets a
+// synthetic release, otherwise hold mode would keep running with nothing
+// left to let go of. before the first config nothing is taken down, so the
+// hook setup captured with carries straight on into run mode.
+void applyHookConfig(HHOOK &kHook, HHOOK &mHook) {
+    const LiveConfig *previous = g_hookConfig;
+    g_hookConfig = g_liveConfig.acquire(kReaderHook);
+    bool capturing = g_capture.armed.load() || g_recorder.armed();
+    bool wantKeyboard = capturing || (!g_hookConfig && kHook);
+    bool wantMouse = capturing || (!g_hookConfig && mHook);
+    if (g_hookConfig) {
+        auto bindAt = [](const Settings &s, size_t i) {
+            if (i == 0) return ExtraBind{ s.keybindType, s.keyboardVk, s.mouseButton, s.macroMode, s.activationType };
+            return s.extraBinds[i - 1];
+        };
+        const Settings &s = g_hookConfig->settings;
+        size_t count = s.extraBinds.size() + 1;
+        if (previous) {
+            const Settings &o = previous->settings;
+            for (size_t i = 0; i < count && i < o.extraBinds.size() + 1; ++i) {
+                ExtraBind a = bindAt(o, i), b = bindAt(s, i);
+                bool sameBind = a.keybindType == b.keybindType &&
+                    (b.keybindType == KeybindType::Keyboard ? a.keyboardVk == b.keyboardVk : a.mouseButton == b.mouseButton);
+                if (!sameBind) g_control.pushEdge(BindEdge::Up, monotonicNowNs(), static_cast<uint8_t>(i));
+            }
         }
+        for (size_t i = 0; i < count; ++i) {
+            bool keyboard = bindAt(s, i).keybindType == KeybindType::Keyboard;
+            wantKeyboard = wantKeyboard || keyboard;
+            wantMouse = wantMouse || !keyboard;
+        }
+    }
+    if (wantKeyboard && !kHook) kHook = SetWindowsHookExA(WH_KEYBOARD_LL, keyboardHookProc, GetModuleHandleA(nullptr), 0);
+    if (!wantKeyboard && kHook) { UnhookWindowsHookEx(kHook); kHook = nullptr; }
+    if (wantMouse && !mHook) mHook = SetWindowsHookExA(WH_MOUSE_LL, mouseHookProc, GetModuleHandleA(nullptr), 0);
+    if (!wantMouse && mHook) { UnhookWindowsHookEx(mHook); mHook = nullptr; }
+}
+
+static void postToHookThread(UINT msg) {
+    DWORD hookThread = g_hookThreadId.load();
+    if (hookThread) PostThreadMessageA(hookThread, msg, 0, 0);
+}
+
+// the one thread that owns the low level hooks, from before setup until the
+// process exits. it only pumps messages; kMsgConfigChanged makes it look at
+// the config and the capture state again.
+void startInputMonitor(const RealtimeProfile &profile) {
+    HANDLE ready = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+    thread([ready, profile]{
+        // windows drops a low level hook that takes longer than
+        // LowLevelHooksTimeout to answer, this thread must never queue
+        applyThreadRole(ThreadRole::Hook, profile);
+        HHOOK kHook = nullptr, mHook = nullptr;
         MSG msg;
+        // make sure the queue exists before anyone posts to it
+        PeekMessageA(&msg, nullptr, 0, 0, PM_NOREMOVE);
+        g_hookThreadId.store(GetCurrentThreadId());
+        applyHookConfig(kHook, mHook);
+        SetEvent(ready);
         while (GetMessageA(&msg, nullptr, 0, 0)) {
-            if (stopThreads.load()) break;
+            if (g_control.stop.load()) break;
+            if (msg.message == kMsgConfigChanged) {
+                applyHookConfig(kHook, mHook);
+                // first config in: the bind is live from here
+                if (g_hookConfig && !g_startup.hooksNs.load()) {
+                    g_startup.hooksNs.store(monotonicNowNs());
+                    if (statusEvent) SetEvent(statusEvent);
+                }
+            }
         }
         if (kHook) UnhookWindowsHookEx(kHook);
         if (mHook) UnhookWindowsHookEx(mHook);
     }).detach();
+    if (ready) {
+        WaitForSingleObject(ready, INFINITE);
+        CloseHandle(ready);
+    }
+}
+
+// blocks until the next key or mouse button press
+InputBind captureNextBind() {
+    InputBind b{};
+    // presses from an earlier capture nobody took
+    while (g_capture.presses.pop(b)) {}
+    g_capture.armed.store(true);
+    postToHookThread(kMsgConfigChanged);
+    for (;;) {
+        uint32_t seen = g_capture.wake.sequence();
+        if (g_capture.presses.pop(b)) break;
+        g_capture.wake.wait(seen);
+    }
+    g_capture.armed.store(false);
+    return b;
+}
+
+// records a custom sequence through the hooks: everything from the first key
+// or wheel step until esc, then snapped to the quantumUs grid. false with the
+// reason when there is nothing usable, the caller asks again
+bool recordSequence(int quantumUs, Settings &s, string &summary) {
+    vector<RecordedInput> inputs;
+    inputs.reserve(SequenceRecorder::kCapacity);
+    g_recorder.arm();
+    postToHookThread(kMsgConfigChanged);
+    g_recorder.waitFinished(inputs);
+    postToHookThread(kMsgConfigChanged);
+
+    vector<MacroStep> steps;
+    RecordingReport report;
+    CompiledProgram<PlatformSink::Record> check;
+    string error;
+    if (g_recorder.dropped()) {
+        summary = "too much input, " + to_string(g_recorder.dropped()) + " events were lost";
+        return false;
+    }
+    if (!compileRecording(inputs, g_recorder.endNs(), quantumUs, steps, report, error) || !compileMacroProgram(g_sink, steps, check, error, s.wheelBurst)) {
+        summary = error;
+        return false;
+    }
+    s.sequence = steps;
+    s.sequenceRecorded = true;
+    stringstream ss;
+    ss << report.edges << " steps (" << report.merged << " merged), " << encodeMacroSequence(steps).size() << " bytes, cycle " << formatMs(report.periodNs)
+       << ", off by " << formatMs(report.meanErrorNs) << " avg / " << formatMs(report.maxErrorNs) << " max on a " << quantumUs << "us grid";
+    summary = ss.str();
+    return true;
+}
+
+// the setup screen around recordSequence, until a recording works
+void promptRecording(int quantumUs, Settings &s) {
+    for (;;) {
+        drawCenteredPanel({ "setup", "record your sequence: play it once,", "it starts with your first key or wheel step, esc ends it" });
+        // the enter that answered the last prompt is still coming back up
+        Sleep(300);
+        string summary;
+        if (recordSequence(quantumUs, s, summary)) {
+            drawCenteredPanel({ "setup", "sequence recorded", summary });
+            setReloadStatus("recorded: " + summary);
+            Sleep(1500);
+            return;
+        }
+        drawCenteredPanel({ "setup", "recording failed, once more", summary });
+        Sleep(1500);
+    }
+}
+
+// watches the config file, parses and compiles on its own low priority
+// thread, then swaps the result in. a broken file keeps the running config.
+void startConfigReloader(const string &path) {
+    thread([path]{
+        applyThreadRole(ThreadRole::Background, RealtimeProfile{});
+        ConfigWatcher watcher(path);
+        if (!watcher.ok()) return;
+        int reloads = 0;
+        while (watcher.waitForSave(kReloadQuietMs) == WatchResult::Changed) {
+            if (g_control.stop.load()) break;
+
+            IFF_ALLOC_SCOPE(AllocRegion::Config);
+            Settings s{};
+            string error;
+            unique_ptr<LiveConfig> next;
+            bool ok = loadConfig(path, s, error);
+            if (ok) {
+                // built against what is published, under the lock so the
+                // control channel can't swap that out in between
+                lock_guard<mutex> lock(g_publishMutex);
+                next = buildLiveConfig(s, g_liveConfig.current(), error);
+                ok = next != nullptr;
+                if (ok) g_liveConfig.publish(move(next));
+            }
+            if (!ok) {
+                setReloadStatus("config error: " + (error.empty() ? string("file is gone") : error));
+            } else {
+                postToHookThread(kMsgConfigChanged);
+                setReloadStatus("config reloaded (" + to_string(++reloads) + ")");
+            }
+            if (statusEvent) SetEvent(statusEvent);
+        }
+    }).detach();
 }
 
-int main() {
-    timeBeginPeriod(1);
-    SetPriorityClass(GetCurrentProcess(), ABOVE_NORMAL_PRIORITY_CLASS);
-    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+static SharedStats *g_sharedStats = nullptr;
+
+// SetMode / SetBind on a copy of the running settings, with the same rules
+// the config file has
+static bool applyControlChange(const ControlRequest &req, Settings &s, string &error) {
+    vector<ExtraBind> binds = timelineBinds(s);
+    if (req.timeline >= binds.size()) { error = "no bind " + to_string(req.timeline); return false; }
+    ExtraBind &b = binds[req.timeline];
+    if (req.op == static_cast<uint8_t>(ControlOp::SetMode)) {
+        if (req.kind > static_cast<uint8_t>(MacroMode::Custom)) { error = "unknown mode"; return false; }
+        b.macroMode = static_cast<MacroMode>(req.kind);
+        if (b.macroMode == MacroMode::Custom && s.sequence.empty()) { error = "custom mode needs a \"sequence\""; return false; }
+    } else {
+        if (req.kind == static_cast<uint8_t>(KeybindType::Keyboard)) {
+            if (req.value == 0 || req.value > 0xFE) { error = "vk out of range"; return false; }
+            b.keybindType = KeybindType::Keyboard;
+            b.keyboardVk = static_cast<int>(req.value);
+        } else if (req.kind == static_cast<uint8_t>(KeybindType::Mouse)) {
+            if (req.value > static_cast<uint32_t>(MouseButton::X2)) { error = "unknown mouse button"; return false; }
+            b.keybindType = KeybindType::Mouse;
+            b.mouseButton = static_cast<MouseButton>(req.value);
+        } else {
+            error = "unknown bind type";
+            return false;
+        }
+    }
+    s.keybindType = binds[0].keybindType;
+    s.keyboardVk = binds[0].keyboardVk;
+    s.mouseButton = binds[0].mouseButton;
+    s.macroMode = binds[0].macroMode;
+    s.extraBinds.assign(binds.begin() + 1, binds.end());
+    return checkBinds(s, error);
+}
+
+// the control channel's thread. enable and disable go to the worker through
+// MacroControl::commands, mode and bind swap in a new LiveConfig like a
+// reload does; either way the worker has it at its next wake, which the
+// command itself triggers. nothing here is saved to the config file.
+static ControlReply handleControl(const ControlRequest &req) {
+    IFF_ALLOC_SCOPE(AllocRegion::Control);
+    ControlReply r{};
+    r.op = req.op;
+    r.status = static_cast<uint8_t>(ControlStatus::Ok);
+    const LiveConfig *live = g_liveConfig.acquire(kReaderControl);
+    int timelines = live->timelines.count;
+    string error;
+    switch (static_cast<ControlOp>(req.op)) {
+    case ControlOp::Enable:
+    case ControlOp::Disable: {
+        BindEdge edge = req.op == static_cast<uint8_t>(ControlOp::Enable) ? BindEdge::On : BindEdge::Off;
+        if (req.timeline >= timelines) r.status = static_cast<uint8_t>(ControlStatus::BadRequest);
+        else if (!g_control.pushCommand(edge, monotonicNowNs(), req.timeline)) r.status = static_cast<uint8_t>(ControlStatus::Failed);
+        break;
+    }
+    case ControlOp::SetMode:
+    case ControlOp::SetBind: {
+        // held until published, so a reload in between is built on rather
+        // than overwritten
+        unique_lock<mutex> lock(g_publishMutex);
+        Settings s = g_liveConfig.acquire(kReaderControl)->settings;
+        unique_ptr<LiveConfig> next;
+        if (!applyControlChange(req, s, error)) {
+            r.status = static_cast<uint8_t>(ControlStatus::BadRequest);
+        } else if (!(next = buildLiveConfig(s, g_liveConfig.current(), error))) {
+            r.status = static_cast<uint8_t>(ControlStatus::Failed);
+        } else {
+            g_liveConfig.publish(move(next));
+            lock.unlock();
+            // the hook swaps its bind table, the worker its programs
+            postToHookThread(kMsgConfigChanged);
+            g_control.wake.signal();
+        }
+        setReloadStatus(error.empty() ? "control: settings changed (not saved)" : "control: " + error);
+        if (statusEvent) SetEvent(statusEvent);
+        break;
+    }
+    case ControlOp::QueryStats:
+        fillControlStats(g_control, g_sharedStats, r);
+        break;
+    case ControlOp::Shutdown:
+        g_control.requestStop();
+        if (statusEvent) SetEvent(statusEvent);
+        break;
+    default:
+        r.status = static_cast<uint8_t>(ControlStatus::BadRequest);
+    }
+    r.enabled = g_control.enabled.load() ? 1 : 0;
+    r.timelines = static_cast<uint8_t>(timelines);
+    return r;
+}
+
+int main(int argc, char **argv) {
+    g_startup.launchNs = processLaunchNs();
+    CommandLine cl;
+    string argError;
+    if (!parseCommandLine(argc, argv, cl, argError)) {
+        cerr << argError << "\n" << kUsage;
+        return 2;
+    }
+    if (cl.help) {
+        cout << kUsage;
+        return 0;
+    }
+
+    const RealtimeProfile profile = cl.profile;
+    applyProcessProfile(profile);
 
     SetConsoleOutputCP(CP_UTF8);
     SetConsoleCP(CP_UTF8);
 
-    hideCursor();
+    if (!cl.headless) hideCursor();
     statusEvent = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+    g_exitDone = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+    SetConsoleCtrlHandler(consoleCtrlHandler, TRUE);
     CONSOLE_SCREEN_BUFFER_INFO csbiInit{};
     if (GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &csbiInit)) {
         g_defaultAttributes = csbiInit.wAttributes;
     }
-
-    vector<string> header = {
-        "made by @insidingforfeds on dc,",
-        "dm for source ;p",
-        "cpp version"
-    };
-    printBox(header);
+    // up before setup, so binding a key and running the macro share one
+    // hook thread and the hook used for capture stays in place afterwards
+    startInputMonitor(profile);
 
     Settings s{};
-
-    bool haveConfig = loadConfig(s);
-    if (haveConfig) {
+    string configError;
+    bool haveConfig = loadConfig(cl.configPath, s, configError);
+    if (!haveConfig && !configError.empty()) {
+        if (cl.yes) {
+            cerr << cl.configPath << ": " << configError << "\n";
+            return 1;
+        }
+        drawCenteredPanel({ "setup", cl.configPath + " is broken, starting over", configError });
+        Sleep(1500);
+    }
+    unsigned have = haveConfig ? kSetAll : 0;
+    if (haveConfig && !cl.yes && (cl.set & kSetAll) != kSetAll) {
         vector<string> lines = {
             "setup",
             "found saved settings"
         };
         drawCenteredPanel(lines);
         printCenteredPrompt("Use last config? (y/n): ");
+        g_startup.prompted = true;
         string ans; getline(cin, ans);
-        if (toLowerCopy(ans) == "y" || toLowerCopy(ans) == "yes") {
-        } else {
-            haveConfig = false;
+        if (toLowerCopy(ans) != "y" && toLowerCopy(ans) != "yes") have = 0;
+    }
+    applyOverrides(cl, s);
+    string bindError;
+    if ((cl.set & kSetBind) && !checkBinds(s, bindError)) {
+        cerr << "--bind: " << bindError << "\n";
+        return 2;
+    }
+    bool changed = cl.set != 0;
+    have |= cl.set;
+    if (cl.record) {
+        if (cl.headless) {
+            cerr << "--record needs the console, it can't run headless\n";
+            return 2;
         }
+        promptRecording(cl.recordQuantumUs, s);
+        s.macroMode = MacroMode::Custom;
+        have |= kSetMode;
+        changed = true;
+        g_startup.prompted = true;
+    }
+    if (s.macroMode == MacroMode::Custom && s.sequence.empty()) {
+        cerr << "custom mode needs a \"sequence\" in " << cl.configPath << "\n";
+        return 2;
+    }
+    if (cl.yes && have != kSetAll) {
+        cerr << "--yes without a saved config needs --activation, --mode and --bind\n" << kUsage;
+        return 2;
     }
 
-    if (!haveConfig) {
-        {
+    if (have != kSetAll) {
+        g_startup.prompted = true;
+        changed = true;
+        vector<string> header = {
+            "made by @insidingforfeds on dc,",
+            "dm for source ;p",
+            "cpp version"
+        };
+        printBox(header);
+        if (!(have & kSetActivation)) {
             vector<string> lines = {
                 "setup",
                 "choose activation",
@@ -704,18 +870,22 @@ int main() {
             string a; getline(cin, a); a = toLowerCopy(a);
             if (a == "1" || a == "hold" || a == "hold key") s.activationType = ActivationType::Hold; else s.activationType = ActivationType::Toggle;
         }
-        {
+        if (!(have & kSetMode)) {
             vector<string> lines = {
                 "setup",
                 "choose mode",
-                "1 = 1st person, 2 = 3rd person"
+                "1 = 1st person, 2 = 3rd person, 3 = record your own"
             };
             drawCenteredPanel(lines);
             printCenteredPrompt("Macro mode: ");
             string m; getline(cin, m); m = toLowerCopy(m);
-            if (m == "1" || m == "first" || m == "1st" || m == "one") s.macroMode = MacroMode::FirstPerson; else s.macroMode = MacroMode::ThirdPerson;
+            if (m == "1" || m == "first" || m == "1st" || m == "one") s.macroMode = MacroMode::FirstPerson;
+            else if (m == "3" || m == "record" || m == "custom") {
+                promptRecording(cl.recordQuantumUs, s);
+                s.macroMode = MacroMode::Custom;
+            } else s.macroMode = MacroMode::ThirdPerson;
         }
-        {
+        if (!(have & kSetBind)) {
             vector<string> lines = {
                 "setup",
                 "bind a key or mouse button",
@@ -723,56 +893,173 @@ int main() {
             };
             drawCenteredPanel(lines);
             Sleep(300);
-            InputBind b = captureNextBind();
-            s.keybindType = b.type;
+            InputBind b;
+            for (;;) {
+                b = captureNextBind();
+                s.keybindType = b.type;
+                if (b.type == KeybindType::Keyboard) s.keyboardVk = b.vk;
+                else s.mouseButton = b.mb;
+                if (checkBinds(s, bindError)) break;
+                // one of the config's "binds" already has it
+                drawCenteredPanel({ "setup", bindError, "press another key or mouse button" });
+                Sleep(300);
+            }
             if (b.type == KeybindType::Keyboard) {
-                s.keyboardVk = b.vk;
                 vector<string> conf = { "setup", "input captured", (string)"VK 0x" + (static_cast<stringstream&&>(stringstream() << hex << uppercase << s.keyboardVk)).str() };
                 drawCenteredPanel(conf);
             } else {
-                s.mouseButton = b.mb;
                 vector<string> conf = { "setup", "input captured", string("mouse ") + mouseButtonToString(s.mouseButton) };
                 drawCenteredPanel(conf);
             }
         }
+    }
 
-        {
+    if (changed) {
+        if (cl.yes) {
+            saveConfig(cl.configPath, s);
+        } else {
             vector<string> lines = { "setup", "save settings for next launch?" };
             drawCenteredPanel(lines);
             printCenteredPrompt("Save config? (y/n): ");
+            g_startup.prompted = true;
             string sv; getline(cin, sv);
-            if (toLowerCopy(sv) == "y" || toLowerCopy(sv) == "yes") saveConfig(s);
+            if (toLowerCopy(sv) == "y" || toLowerCopy(sv) == "yes") saveConfig(cl.configPath, s);
         }
     }
+    g_startup.settingsNs = monotonicNowNs();
 
-    thread worker;
-    if (s.macroMode == MacroMode::FirstPerson) worker = thread(runFirstPersonLoop); else worker = thread(runThirdPersonLoop);
+    string compileError;
+    unique_ptr<LiveConfig> initial = buildLiveConfig(s, nullptr, compileError);
+    if (!initial) {
+        cerr << compileError << "\n";
+        return 1;
+    }
+    g_liveConfig.publish(move(initial));
+
+    if (!cl.tracePath.empty()) {
+        // never freed: the detached hook thread may record until the process
+        // is gone, and the mapped pages reach the file either way
+        TraceRing *trace = new TraceRing;
+        string traceError;
+        if (!trace->open(cl.tracePath, cl.traceRecords, traceError)) {
+            cerr << traceError << "\n";
+            return 1;
+        }
+        g_control.trace = trace;
+    }
+    if (cl.sharedStats) {
+        // same as the trace, the hook thread outlives main
+        SharedStats *stats = new SharedStats;
+        string statsError;
+        if (stats->create(statsError)) {
+            g_sharedStats = stats;
+            g_control.stats = stats->block();
+            g_sink.setStats(stats->block());
+        } else {
+            setReloadStatus("shared stats off: " + statsError);
+        }
+    }
 
-    MonitorState ms{ s.activationType, s.keybindType, s.keyboardVk, s.mouseButton };
-    startInputMonitor(ms);
+    const string calibrationPath = timerCalibrationPath(cl.configPath);
+    const bool recalibrate = cl.recalibrate;
+    thread worker([profile, calibrationPath, recalibrate]{
+        applyThreadRole(ThreadRole::Worker, profile);
+        // measured on this thread, after its priority is set: the overshoot
+        // the steps will see. only the first launch pays for it.
+        TimerCalibration timers = loadOrCalibrateTimers(calibrationPath, recalibrate);
+        g_timerSummary = timerCalibrationSummary(timers);
+        DeadlineScheduler sched(timers.backend, timers.spinNs);
+        // the loop parks straight away, nothing is enabled yet. armed from
+        // here: debug builds count what the hot paths allocate from now on
+        allocReset();
+        g_startup.workerNs.store(monotonicNowNs());
+        LiveProgramSource programs;
+        runMacroTimelines(g_sink, sched, programs, g_control);
+    });
+
+    postToHookThread(kMsgConfigChanged);
+    startConfigReloader(cl.configPath);
+
+    ControlServer control;
+    thread controlThread;
+    int exitCode = 0;
+    const string controlName = !cl.controlName.empty() ? cl.controlName : cl.headless ? defaultControlName() : string();
+    if (!controlName.empty()) {
+        string controlError;
+        if (control.open(controlName, controlError)) {
+            // left at normal priority, above the ui and the reloader, so a
+            // command never queues behind them on a busy box
+            controlThread = thread([&control] { control.run(handleControl); });
+            if (cl.headless) cerr << "control: " << controlName << "\n";
+        } else if (cl.headless) {
+            // nothing could ever turn it on or off
+            cerr << controlError << "\n";
+            g_control.requestStop();
+            exitCode = 1;
+        } else {
+            setReloadStatus("control channel off: " + controlError);
+        }
+    }
+    auto shutdown = [&] {
+        g_control.requestStop();
+        if (worker.joinable()) worker.join();
+        control.stop();
+        if (controlThread.joinable()) controlThread.join();
+        writeLatencyReport(g_control.latency, "latency.csv");
+#ifdef IFF_TRACK_ALLOCS
+        // hook and macro step have to be missing from it
+        writeAllText("alloc_report.txt", allocReport());
+#endif
+        SetEvent(g_exitDone);
+    };
+    if (cl.headless) {
+        // the worker only returns once something asked to stop: the
+        // shutdown command, ctrl+c or the console closing
+        if (worker.joinable()) worker.join();
+        shutdown();
+        return exitCode;
+    }
 
-    bool last = macroEnabled.load();
+    // the status screen is the least important thing running, keep it out of
+    // the way of the hook and the worker
+    applyThreadRole(ThreadRole::Ui, profile);
     clearConsole();
-    drawCenteredUI(s, last);
+    ConsoleRenderer renderer;
+    bool dirty = true;
+    uint64_t lastSamples = 0;
+    int64_t nextFrameNs = 0;
+    while (!g_control.stop.load()) {
+        int64_t now = monotonicNowNs();
+        if (dirty && now >= nextFrameNs) {
+            IFF_ALLOC_SCOPE(AllocRegion::Ui);
+            drawStatusUI(renderer, g_liveConfig.acquire(kReaderUi)->settings, g_control.enabled.load());
+            dirty = false;
+            nextFrameNs = now + kUiFrameNs;
+        }
 
-    ConsoleSize lastSize = getConsoleSize();
-    while (true) {
-        DWORD waitRes = WaitForSingleObject(statusEvent, 500);
+        // latency numbers only move while running, stopped we sleep until
+        // something actually happens
+        DWORD timeout = INFINITE;
+        if (dirty) timeout = static_cast<DWORD>((nextFrameNs - now + 999999) / 1000000);
+        else if (g_control.enabled.load()) timeout = kUiStatsRefreshMs;
+        HANDLE waitHandles[3] = { statusEvent, g_control.status.handle(), renderer.eventHandle() };
+        DWORD waitRes = WaitForMultipleObjects(renderer.eventHandle() ? 3 : 2, waitHandles, FALSE, timeout);
         if (waitRes == WAIT_OBJECT_0) {
             ResetEvent(statusEvent);
-        }
-        bool cur = macroEnabled.load();
-        ConsoleSize curSize = getConsoleSize();
-        bool sizeChanged = (curSize.cols != lastSize.cols || curSize.rows != lastSize.rows);
-        if (cur != last || sizeChanged) {
-            drawCenteredUI(s, cur);
-            last = cur;
-            lastSize = curSize;
+            dirty = true;
+        } else if (waitRes == WAIT_OBJECT_0 + 1) dirty = true;
+        else if (waitRes == WAIT_OBJECT_0 + 2) renderer.drainEvents();
+
+        // the window can also scroll or resize without a buffer size event,
+        // the check is one call and only runs when we woke up anyway
+        if (renderer.updateSize()) dirty = true;
+        uint64_t samples = g_control.latency.triggerToEmit.count() + g_control.latency.stepJitter.count();
+        if (samples != lastSamples) {
+            lastSamples = samples;
+            dirty = true;
         }
     }
 
-    stopThreads.store(true);
-    if (worker.joinable()) worker.join();
-    timeEndPeriod(1);
+    shutdown();
     return 0;
 } 
\ No newline at end of file
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// single writer, a fixed set of readers. readers get the current object with
+// one load and one store to their own cache line, no locks. what a reader got
+// from its last two acquire() calls stays valid, so it can finish with the
+// previous object after picking up the new one; the writer frees a retired
+// object only after every reader has moved past it.
+// a reader that never comes back (parked worker, idle hook) just delays the
+// free, it never blocks the writer. a published object is never moved, so it
+// may hold pointers into itself.
+template <class T, int Readers>
+class RcuSlot {
+public:
+    RcuSlot() {
+        for (auto &s : seen_) s.value.store(0);
+    }
+
+    ~RcuSlot() {
+        delete current_.load();
+        for (Node *n : retired_) delete n;
+    }
+
+    RcuSlot(const RcuSlot &) = delete;
+    RcuSlot &operator=(const RcuSlot &) = delete;
+
+    // reader side, reader is 0..Readers-1 and each index has one thread
+    const T *acquire(int reader) {
+        Node *n = current_.load();
+        if (!n) return nullptr;
+        Seen &s = seen_[reader];
+        s.value.store(s.last ? s.last : n->generation);
+        s.last = n->generation;
+        return n->value.get();
+    }
+
+    // writer side, the last object published. valid until the next publish
+    const T *current() const {
+        Node *n = current_.load();
+        return n ? n->value.get() : nullptr;
+    }
+
+    void publish(std::unique_ptr<T> next) {
+        Node *n = new Node{ std::move(next), ++generation_ };
+        Node *old = current_.exchange(n);
+        if (old) retired_.push_back(old);
+        reclaim();
+    }
+
+    void reclaim() {
+        uint64_t oldest = UINT64_MAX;
+        for (auto &s : seen_) {
+            uint64_t g = s.value.load();
+            if (g < oldest) oldest = g;
+        }
+        size_t keep = 0;
+        for (Node *n : retired_) {
+            if (n->generation < oldest) delete n;
+            else retired_[keep++] = n;
+        }
+        retired_.resize(keep);
+    }
+
+    size_t retiredCount() const { return retired_.size(); }
+
+private:
+    struct Node {
+        std::unique_ptr<T> value;
+        uint64_t generation;
+    };
+    struct alignas(64) Seen {
+        std::atomic<uint64_t> value;
+        // reader only, generation of the previous acquire()
+        uint64_t last = 0;
+    };
+
+    std::atomic<Node *> current_{nullptr};
+    Seen seen_[Readers];
+    uint64_t generation_ = 0;
+    std::vector<Node *> retired_;
+};
@@ -0,0 +1,143 @@
+#include "sequence_recorder.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+using namespace std;
+
+void SequenceRecorder::arm(uint16_t stopVk) {
+    armed_.store(false, memory_order_release);
+    RecordedInput stale;
+    while (ring_.pop(stale)) {}
+    stopVk_ = stopVk;
+    endNs_.store(0, memory_order_relaxed);
+    dropped_.store(0, memory_order_relaxed);
+    armed_.store(true, memory_order_release);
+}
+
+bool SequenceRecorder::waitFinished(vector<RecordedInput> &out, int64_t deadlineNs) {
+    RecordedInput in;
+    for (;;) {
+        uint32_t seen = wake_.sequence();
+        while (ring_.pop(in)) out.push_back(in);
+        if (endNs()) break;
+        if (!wake_.wait(seen, deadlineNs)) {
+            armed_.store(false, memory_order_release);
+            while (ring_.pop(in)) out.push_back(in);
+            return false;
+        }
+    }
+    while (ring_.pop(in)) out.push_back(in);
+    return true;
+}
+
+void SequenceRecorder::push(const RecordedInput &in) {
+    if (!ring_.push(in)) dropped_.fetch_add(1, memory_order_relaxed);
+    wake_.signal();
+}
+
+void SequenceRecorder::key(bool down, uint16_t vk, int64_t atNs) {
+    if (vk == stopVk_) {
+        if (!down) return;
+        armed_.store(false, memory_order_release);
+        endNs_.store(atNs, memory_order_release);
+        wake_.signal();
+        return;
+    }
+    push(RecordedInput{ atNs, down ? RecordedKind::KeyDown : RecordedKind::KeyUp, vk });
+}
+
+void SequenceRecorder::wheel(int32_t delta, int64_t atNs) {
+    if (delta) push(RecordedInput{ atNs, RecordedKind::Wheel, delta });
+}
+
+namespace {
+
+struct TimedStep {
+    int64_t atNs;
+    int64_t recordedNs;
+    MacroStep step;
+};
+
+} // namespace
+
+bool compileRecording(const vector<RecordedInput> &in, int64_t endNs, int quantumUs, vector<MacroStep> &out, RecordingReport &report, string &error) {
+    report = RecordingReport{};
+    report.inputs = in.size();
+    if (quantumUs < 50 || quantumUs > 100000) { error = "quantum out of range (50-100000us)"; return false; }
+    if (in.empty()) { error = "nothing was recorded"; return false; }
+    const int64_t q = static_cast<int64_t>(quantumUs) * 1000;
+    // releases of keys held from before the recording don't start it
+    auto first = find_if(in.begin(), in.end(), [](const RecordedInput &r) { return r.kind != RecordedKind::KeyUp; });
+    if (first == in.end()) { error = "only releases were recorded"; return false; }
+    const int64_t t0 = first->atNs;
+    auto snap = [&](int64_t t) { return (max<int64_t>(t - t0, 0) + q / 2) / q * q; };
+
+    vector<TimedStep> steps;
+    steps.reserve(in.size());
+    // quantized press time per held key, -1 while up, and the last release
+    int64_t pressedAt[256], releasedAt[256];
+    fill(begin(pressedAt), end(pressedAt), -1);
+    fill(begin(releasedAt), end(releasedAt), -q);
+    for (const RecordedInput &r : in) {
+        int64_t at = snap(r.atNs);
+        if (r.kind == RecordedKind::Wheel) {
+            // notches in the same step and direction go out as one bigger one
+            TimedStep *last = steps.empty() ? nullptr : &steps.back();
+            if (last && last->step.op == StepOp::Wheel && last->atNs == at && (last->step.arg > 0) == (r.arg > 0) && abs(last->step.arg + r.arg) <= 32767) {
+                last->step.arg += r.arg;
+                ++report.merged;
+                continue;
+            }
+            steps.push_back(TimedStep{ at, r.atNs - t0, stepWheel(r.arg) });
+            continue;
+        }
+        if (r.arg <= 0 || r.arg > 0xFE) { ++report.merged; continue; }
+        int64_t &pressed = pressedAt[r.arg];
+        if (r.kind == RecordedKind::KeyDown) {
+            if (pressed >= 0) { ++report.merged; continue; }
+            // a release pushed back a step must not overtake the next press
+            at = max(at, releasedAt[r.arg] + q);
+            pressed = at;
+            steps.push_back(TimedStep{ at, r.atNs - t0, stepKeyDown(static_cast<uint16_t>(r.arg)) });
+        } else {
+            if (pressed < 0) { ++report.merged; continue; }
+            at = max(at, pressed + q);
+            steps.push_back(TimedStep{ at, r.atNs - t0, stepKeyUp(static_cast<uint16_t>(r.arg)) });
+            releasedAt[r.arg] = at;
+            pressed = -1;
+        }
+    }
+    if (steps.empty()) { error = "no keys or wheel steps were recorded"; return false; }
+
+    int64_t period = snap(endNs);
+    for (int vk = 0; vk < 256; ++vk) {
+        if (pressedAt[vk] < 0) continue;
+        int64_t at = max(period, pressedAt[vk] + q);
+        steps.push_back(TimedStep{ at, max<int64_t>(endNs - t0, 0), stepKeyUp(static_cast<uint16_t>(vk)) });
+    }
+    stable_sort(steps.begin(), steps.end(), [](const TimedStep &a, const TimedStep &b) { return a.atNs < b.atNs; });
+    // the next cycle's first step may not share a tick with this one's last
+    period = max(period, steps.back().atNs + q);
+    if (period > kMaxRecordingNs) { error = "recording longer than " + to_string(kMaxRecordingNs / 1000000000LL) + "s"; return false; }
+
+    out.clear();
+    int64_t cursor = 0, errorSum = 0;
+    for (const TimedStep &t : steps) {
+        if (t.atNs > cursor) {
+            out.push_back(stepWaitUs(static_cast<int32_t>((t.atNs - cursor) / 1000)));
+            cursor = t.atNs;
+        }
+        out.push_back(t.step);
+        report.recordedNs.push_back(t.recordedNs);
+        int64_t e = t.atNs > t.recordedNs ? t.atNs - t.recordedNs : t.recordedNs - t.atNs;
+        report.maxErrorNs = max(report.maxErrorNs, e);
+        errorSum += e;
+    }
+    out.push_back(stepWaitUs(static_cast<int32_t>((period - cursor) / 1000)));
+    if (out.size() > kMaxProgramSteps) { error = "recording has more than " + to_string(kMaxProgramSteps) + " steps"; return false; }
+    report.edges = steps.size();
+    report.periodNs = period;
+    report.meanErrorNs = errorSum / static_cast<int64_t>(steps.size());
+    return true;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "macro_program.h"
+#include "timing.h"
+#include "trigger_queue.h"
+
+enum class RecordedKind : uint8_t { KeyDown, KeyUp, Wheel };
+
+// one input the user performed while a recording was armed
+struct RecordedInput {
+    int64_t atNs;
+    RecordedKind kind;
+    // the vk, or the wheel delta
+    int32_t arg;
+};
+
+static const int kDefaultRecordQuantumUs = 1000;
+static const int64_t kMaxRecordingNs = 60LL * 1000000000LL;
+// esc ends a recording and is never part of one
+static const uint16_t kRecordStopVk = 0x1B;
+
+// records a sequence off live input. the hook (or the evdev thread) stamps
+// each key edge and wheel notch into a fixed ring, the setup thread drains it
+// while it waits for the stop key. one producer at a time; nothing on the
+// input side allocates or blocks, a full ring is counted and fails the
+// recording instead.
+class SequenceRecorder {
+public:
+    static const size_t kCapacity = 4096;
+
+    // setup side. clears what an earlier recording left behind
+    void arm(uint16_t stopVk = kRecordStopVk);
+    // blocks until the stop key and returns everything before it; false if
+    // deadlineNs (monotonic, < 0 = never) came first, the recorder is
+    // disarmed either way
+    bool waitFinished(std::vector<RecordedInput> &out, int64_t deadlineNs = -1);
+    // when the stop key went down
+    int64_t endNs() const { return endNs_.load(std::memory_order_acquire); }
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    // input side
+    bool armed() const { return armed_.load(std::memory_order_acquire); }
+    void key(bool down, uint16_t vk, int64_t atNs);
+    void wheel(int32_t delta, int64_t atNs);
+
+private:
+    void push(const RecordedInput &in);
+
+    std::atomic<bool> armed_{false};
+    std::atomic<int64_t> endNs_{0};
+    std::atomic<uint64_t> dropped_{0};
+    // written before armed_ is set
+    uint16_t stopVk_ = kRecordStopVk;
+    SpscRing<RecordedInput, kCapacity> ring_;
+    WakeEvent wake_;
+};
+
+// how far the compiled program is from what was performed
+struct RecordingReport {
+    size_t inputs = 0;
+    // key and wheel steps kept
+    size_t edges = 0;
+    // autorepeat downs, ups without a down, wheel notches folded together
+    size_t merged = 0;
+    int64_t periodNs = 0;
+    // |step time - recorded time| over the kept edges
+    int64_t maxErrorNs = 0;
+    int64_t meanErrorNs = 0;
+    // per key / wheel step of the output in order, when it was performed
+    // (from the first input)
+    std::vector<int64_t> recordedNs;
+};
+
+// recorded inputs -> steps on a quantumUs grid, ready for
+// compileMacroProgram. a cycle starts at the first input and ends at endNs
+// (the stop press), so replaying it back to back keeps the gap the user left
+// before stopping. keys still held at the end are released there, and a
+// press and its release never land on the same step, a tap stays a tap.
+bool compileRecording(const std::vector<RecordedInput> &in, int64_t endNs, int quantumUs, std::vector<MacroStep> &out, RecordingReport &report, std::string &error);
@@ -0,0 +1,481 @@
+#include "settings.h"
+
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+using namespace std;
+
+const char *const kUsage =
+    "usage: insidingforfeds_macro [--config path] [--activation hold|toggle] [--mode first|third|custom]\n"
+    "                             [--bind key|x1|x2|mmb|lmb|rmb] [--yes]\n"
+    "                             [--realtime] [--mmcss games|audio|none] [--pin-worker cpu] [--pin-hook cpu]\n"
+    "                             [--lock-memory] [--trace file] [--trace-records n] [--no-shared-stats] [--recalibrate]\n"
+    "                             [--headless] [--control name] [--record] [--record-quantum-us n]\n"
+    "  --yes          use the saved config without asking, save without asking, never prompt\n"
+    "  --realtime     high priority class and mmcss on windows, SCHED_FIFO on linux\n"
+    "  --pin-worker   keep the macro thread on one cpu, --pin-hook the same for the hook\n"
+    "  --lock-memory  keep the process resident (mlockall / locked working set)\n"
+    "  --trace        record every edge and emit into a ring file for insidingforfeds_bench trace\n"
+    "  --recalibrate  measure the timers again, the result is kept in timer_calibration.json next to the config\n"
+    "  --headless     no console, no prompts (like --yes); driven through the control channel\n"
+    "  --control      serve the control channel on this pipe / socket, the default name when headless\n"
+    "  --record       play a sequence once (esc ends it) and run it as the custom mode, timing snapped\n"
+    "                 to --record-quantum-us (default 1000)\n";
+
+static string lowerCopy(const string &s) {
+    string r = s;
+    for (auto &c : r) if (c >= 'A' && c <= 'Z') c = static_cast<char>(c - 'A' + 'a');
+    return r;
+}
+
+bool parseActivationName(const string &name, ActivationType &out) {
+    string n = lowerCopy(name);
+    if (n == "hold" || n == "1") out = ActivationType::Hold;
+    else if (n == "toggle" || n == "2") out = ActivationType::Toggle;
+    else return false;
+    return true;
+}
+
+bool parseModeName(const string &name, MacroMode &out) {
+    string n = lowerCopy(name);
+    if (n == "first" || n == "1st" || n == "1") out = MacroMode::FirstPerson;
+    else if (n == "third" || n == "3rd" || n == "2") out = MacroMode::ThirdPerson;
+    else if (n == "custom") out = MacroMode::Custom;
+    else return false;
+    return true;
+}
+
+bool parseMouseButtonName(const string &name, MouseButton &out) {
+    string n = lowerCopy(name);
+    if (n == "left" || n == "lmb") out = MouseButton::Left;
+    else if (n == "right" || n == "rmb") out = MouseButton::Right;
+    else if (n == "middle" || n == "mmb") out = MouseButton::Middle;
+    else if (n == "x1") out = MouseButton::X1;
+    else if (n == "x2") out = MouseButton::X2;
+    else return false;
+    return true;
+}
+
+const char *mouseButtonName(MouseButton b) {
+    switch (b) {
+    case MouseButton::Left: return "left";
+    case MouseButton::Right: return "right";
+    case MouseButton::Middle: return "middle";
+    case MouseButton::X1: return "x1";
+    case MouseButton::X2: return "x2";
+    }
+    return "x2";
+}
+
+bool parseBindSpec(const string &spec, Settings &out, string &error) {
+    string n = lowerCopy(spec);
+    if (n.compare(0, 6, "mouse:") == 0) n = n.substr(6);
+    MouseButton mb;
+    if (parseMouseButtonName(n, mb)) {
+        out.keybindType = KeybindType::Mouse;
+        out.mouseButton = mb;
+        return true;
+    }
+    if (n.compare(0, 4, "key:") == 0) n = n.substr(4);
+    uint16_t vk = 0;
+    if (!parseKeyName(n, vk) || vk == 0 || vk > 0xFE) {
+        error = "unknown bind '" + spec + "'";
+        return false;
+    }
+    out.keybindType = KeybindType::Keyboard;
+    out.keyboardVk = vk;
+    return true;
+}
+
+static string bindSpecName(KeybindType type, int vk, MouseButton mb) {
+    if (type == KeybindType::Mouse) return mouseButtonName(mb);
+    // "left" and "right" are arrow keys too, the mouse wins without a prefix
+    string name = keyName(static_cast<uint16_t>(vk));
+    MouseButton clash;
+    return parseMouseButtonName(name, clash) ? "key:" + name : name;
+}
+
+static bool sameBind(KeybindType type, int vk, MouseButton mb, const ExtraBind &b) {
+    if (type != b.keybindType) return false;
+    return type == KeybindType::Keyboard ? vk == b.keyboardVk : mb == b.mouseButton;
+}
+
+bool parseExtraBinds(const string &text, vector<ExtraBind> &out, string &error) {
+    out.clear();
+    size_t index = 0;
+    size_t pos = 0;
+    while (pos <= text.size()) {
+        size_t end = text.find_first_of(",;\n", pos);
+        if (end == string::npos) end = text.size();
+        stringstream ss(text.substr(pos, end - pos));
+        pos = end + 1;
+        ++index;
+
+        string bind, mode, activation, extra;
+        ss >> bind >> mode >> activation >> extra;
+        if (bind.empty()) continue;
+        string where = "bind " + to_string(index) + ": ";
+        if (activation.empty() || !extra.empty()) { error = where + "expected '<bind> <mode> <activation>'"; return false; }
+        Settings parsed{};
+        ExtraBind b{};
+        if (!parseBindSpec(bind, parsed, error)) { error = where + error; return false; }
+        b.keybindType = parsed.keybindType;
+        b.keyboardVk = parsed.keyboardVk;
+        b.mouseButton = parsed.mouseButton;
+        if (!parseModeName(mode, b.macroMode)) { error = where + "expected first, third or custom, got '" + mode + "'"; return false; }
+        if (!parseActivationName(activation, b.activationType)) { error = where + "expected hold or toggle, got '" + activation + "'"; return false; }
+        for (const ExtraBind &o : out) {
+            if (sameBind(o.keybindType, o.keyboardVk, o.mouseButton, b)) { error = where + "'" + bind + "' is bound twice"; return false; }
+        }
+        if (out.size() == static_cast<size_t>(kMaxExtraBinds)) { error = "at most " + to_string(kMaxExtraBinds) + " extra binds"; return false; }
+        out.push_back(b);
+    }
+    return true;
+}
+
+bool checkBinds(const Settings &s, string &error) {
+    for (size_t i = 0; i < s.extraBinds.size(); ++i) {
+        const ExtraBind &b = s.extraBinds[i];
+        string name = "'" + bindSpecName(b.keybindType, b.keyboardVk, b.mouseButton) + "'";
+        if (sameBind(s.keybindType, s.keyboardVk, s.mouseButton, b)) { error = name + " is already the main bind"; return false; }
+        for (size_t j = 0; j < i; ++j) {
+            const ExtraBind &o = s.extraBinds[j];
+            if (sameBind(o.keybindType, o.keyboardVk, o.mouseButton, b)) { error = name + " is bound twice"; return false; }
+        }
+    }
+    return true;
+}
+
+string formatExtraBinds(const vector<ExtraBind> &binds) {
+    string r;
+    for (const ExtraBind &b : binds) {
+        if (!r.empty()) r += "; ";
+        r += bindSpecName(b.keybindType, b.keyboardVk, b.mouseButton);
+        r += b.macroMode == MacroMode::FirstPerson ? " first" : b.macroMode == MacroMode::ThirdPerson ? " third" : " custom";
+        r += b.activationType == ActivationType::Hold ? " hold" : " toggle";
+    }
+    return r;
+}
+
+string toJson(const Settings &s) {
+    string activation = s.activationType == ActivationType::Hold ? "hold" : "toggle";
+    string mode = s.macroMode == MacroMode::FirstPerson ? "first" : s.macroMode == MacroMode::ThirdPerson ? "third" : "custom";
+    string kb = s.keybindType == KeybindType::Keyboard ? "keyboard" : "mouse";
+    stringstream ss;
+    ss << "{\n";
+    ss << "  \"version\": " << kConfigVersion << ",\n";
+    ss << "  \"activation\": \"" << activation << "\",\n";
+    ss << "  \"mode\": \"" << mode << "\",\n";
+    ss << "  \"keybind_type\": \"" << kb << "\",\n";
+    ss << "  \"keyboard_vk\": " << s.keyboardVk << ",\n";
+    ss << "  \"mouse_button\": \"" << mouseButtonName(s.mouseButton) << "\",\n";
+    bool customExtra = false;
+    for (const ExtraBind &b : s.extraBinds) customExtra = customExtra || b.macroMode == MacroMode::Custom;
+    if ((s.macroMode == MacroMode::Custom || customExtra) && s.sequenceRecorded) ss << "  \"recording\": \"" << encodeMacroSequenceText(s.sequence) << "\",\n";
+    else if (s.macroMode == MacroMode::Custom || customExtra) ss << "  \"sequence\": \"" << formatMacroSequence(s.sequence) << "\",\n";
+    if (!s.extraBinds.empty()) ss << "  \"binds\": \"" << formatExtraBinds(s.extraBinds) << "\",\n";
+    ss << "  \"wheel_burst\": " << s.wheelBurst << "\n";
+    ss << "}\n";
+    return ss.str();
+}
+
+namespace {
+
+enum ConfigKey : unsigned {
+    kKeyVersion = 1 << 0,
+    kKeyActivation = 1 << 1,
+    kKeyMode = 1 << 2,
+    kKeyKeybindType = 1 << 3,
+    kKeyKeyboardVk = 1 << 4,
+    kKeyMouseButton = 1 << 5,
+    kKeySequence = 1 << 6,
+    kKeyWheelBurst = 1 << 7,
+    kKeyBinds = 1 << 8,
+    kKeyRecording = 1 << 9,
+};
+
+struct KeyInfo { const char *name; ConfigKey key; bool isString; };
+
+const KeyInfo kConfigKeys[] = {
+    { "version", kKeyVersion, false },
+    { "activation", kKeyActivation, true },
+    { "mode", kKeyMode, true },
+    { "keybind_type", kKeyKeybindType, true },
+    { "keyboard_vk", kKeyKeyboardVk, false },
+    { "mouse_button", kKeyMouseButton, true },
+    { "sequence", kKeySequence, true },
+    { "wheel_burst", kKeyWheelBurst, false },
+    { "binds", kKeyBinds, true },
+    { "recording", kKeyRecording, true },
+};
+
+class ConfigReader {
+public:
+    ConfigReader(const string &text, string &error) : begin_(text.data()), p_(text.data()), end_(text.data() + text.size()), error_(error) {}
+
+    bool fail(const string &msg) {
+        int line = 1, col = 1;
+        for (const char *c = begin_; c < p_ && c < end_; ++c) {
+            if (*c == '\n') { ++line; col = 1; } else ++col;
+        }
+        error_ = "line " + to_string(line) + ", col " + to_string(col) + ": " + msg;
+        return false;
+    }
+
+    void skipSpace() {
+        while (p_ < end_ && (*p_ == ' ' || *p_ == '\t' || *p_ == '\r' || *p_ == '\n')) ++p_;
+    }
+
+    bool atEnd() { skipSpace(); return p_ == end_; }
+    char peek() { skipSpace(); return p_ < end_ ? *p_ : '\0'; }
+
+    bool expect(char c) {
+        if (peek() != c) return fail(string("expected '") + c + "'");
+        ++p_;
+        return true;
+    }
+
+    bool readString(string &out) {
+        if (peek() != '"') return fail("expected a string");
+        ++p_;
+        out.clear();
+        while (p_ < end_ && *p_ != '"') {
+            char c = *p_++;
+            if (c == '\n') { --p_; return fail("unterminated string"); }
+            if (c != '\\') { out.push_back(c); continue; }
+            if (p_ == end_) break;
+            char e = *p_++;
+            switch (e) {
+            case '"': case '\\': case '/': out.push_back(e); break;
+            case 'n': out.push_back('\n'); break;
+            case 't': out.push_back('\t'); break;
+            default: --p_; return fail(string("unsupported escape '\\") + e + "'");
+            }
+        }
+        if (p_ == end_) return fail("unterminated string");
+        ++p_;
+        return true;
+    }
+
+    bool readInt(int &out) {
+        skipSpace();
+        const char *start = p_;
+        bool negative = p_ < end_ && *p_ == '-';
+        if (negative) ++p_;
+        long long v = 0;
+        const char *digits = p_;
+        while (p_ < end_ && *p_ >= '0' && *p_ <= '9') {
+            v = v * 10 + (*p_ - '0');
+            if (v > INT_MAX) { p_ = start; return fail("number out of range"); }
+            ++p_;
+        }
+        if (p_ == digits) { p_ = start; return fail("expected a number"); }
+        if (p_ < end_ && (*p_ == '.' || *p_ == 'e' || *p_ == 'E')) { p_ = start; return fail("expected a whole number"); }
+        out = static_cast<int>(negative ? -v : v);
+        return true;
+    }
+
+    const char *pos() const { return p_; }
+    void rewind(const char *p) { p_ = p; }
+
+private:
+    const char *begin_;
+    const char *p_;
+    const char *end_;
+    string &error_;
+};
+
+} // namespace
+
+bool parseConfig(const string &text, Settings &out, string &error) {
+    ConfigReader r(text, error);
+    Settings s{};
+    unsigned seen = 0;
+    string key, value, sequence;
+    key.reserve(16);
+    value.reserve(32);
+
+    if (!r.expect('{')) return false;
+    if (r.peek() == '}') return r.fail("empty config");
+    for (;;) {
+        r.skipSpace();
+        const char *keyPos = r.pos();
+        if (!r.readString(key)) return false;
+        const KeyInfo *info = nullptr;
+        for (const KeyInfo &k : kConfigKeys) {
+            if (key == k.name) { info = &k; break; }
+        }
+        if (!info) { r.rewind(keyPos); return r.fail("unknown key \"" + key + "\""); }
+        if (seen & info->key) { r.rewind(keyPos); return r.fail("\"" + key + "\" given twice"); }
+        seen |= info->key;
+        if (!r.expect(':')) return false;
+
+        r.skipSpace();
+        const char *valuePos = r.pos();
+        int number = 0;
+        if (info->isString ? !r.readString(value) : !r.readInt(number)) return false;
+        auto bad = [&](const string &msg) { r.rewind(valuePos); return r.fail(key + ": " + msg); };
+        switch (info->key) {
+        case kKeyVersion:
+            if (number < 0) return bad("must be positive");
+            if (number > kConfigVersion) return bad("file is version " + to_string(number) + ", this build reads up to " + to_string(kConfigVersion));
+            break;
+        case kKeyActivation:
+            if (value == "hold") s.activationType = ActivationType::Hold;
+            else if (value == "toggle") s.activationType = ActivationType::Toggle;
+            else return bad("expected \"hold\" or \"toggle\", got \"" + value + "\"");
+            break;
+        case kKeyMode:
+            if (value == "first") s.macroMode = MacroMode::FirstPerson;
+            else if (value == "third") s.macroMode = MacroMode::ThirdPerson;
+            else if (value == "custom") s.macroMode = MacroMode::Custom;
+            else return bad("expected \"first\", \"third\" or \"custom\", got \"" + value + "\"");
+            break;
+        case kKeyKeybindType:
+            if (value == "keyboard") s.keybindType = KeybindType::Keyboard;
+            else if (value == "mouse") s.keybindType = KeybindType::Mouse;
+            else return bad("expected \"keyboard\" or \"mouse\", got \"" + value + "\"");
+            break;
+        case kKeyKeyboardVk:
+            if (number < 0 || number > 0xFE) return bad("expected a virtual key code 1-254");
+            s.keyboardVk = number;
+            break;
+        case kKeyMouseButton:
+            if (value == "left") s.mouseButton = MouseButton::Left;
+            else if (value == "right") s.mouseButton = MouseButton::Right;
+            else if (value == "middle") s.mouseButton = MouseButton::Middle;
+            else if (value == "x1") s.mouseButton = MouseButton::X1;
+            else if (value == "x2") s.mouseButton = MouseButton::X2;
+            else return bad("expected left, right, middle, x1 or x2, got \"" + value + "\"");
+            break;
+        case kKeySequence:
+            if (seen & kKeyRecording) return bad("\"recording\" is already given, keep one of them");
+            if (!parseMacroSequence(value, s.sequence, sequence)) return bad(sequence);
+            break;
+        case kKeyWheelBurst:
+            if (number < 1 || number > kMaxWheelBurst) return bad("expected 1-" + to_string(kMaxWheelBurst));
+            s.wheelBurst = number;
+            break;
+        case kKeyBinds:
+            if (!parseExtraBinds(value, s.extraBinds, sequence)) return bad(sequence);
+            break;
+        case kKeyRecording:
+            if (seen & kKeySequence) return bad("\"sequence\" is already given, keep one of them");
+            if (!decodeMacroSequenceText(value, s.sequence, sequence)) return bad(sequence);
+            s.sequenceRecorded = true;
+            break;
+        }
+
+        if (r.peek() == ',') { r.expect(','); continue; }
+        if (!r.expect('}')) return false;
+        break;
+    }
+    if (!r.atEnd()) return r.fail("trailing data after the closing '}'");
+
+    static const ConfigKey required[] = { kKeyActivation, kKeyMode, kKeyKeybindType };
+    for (ConfigKey k : required) {
+        if (!(seen & k)) {
+            for (const KeyInfo &info : kConfigKeys) if (info.key == k) error = string("missing \"") + info.name + "\"";
+            return false;
+        }
+    }
+    if (s.keybindType == KeybindType::Keyboard && s.keyboardVk == 0) { error = "keyboard bind needs \"keyboard_vk\""; return false; }
+    if (s.keybindType == KeybindType::Mouse && !(seen & kKeyMouseButton)) { error = "mouse bind needs \"mouse_button\""; return false; }
+    if (!checkBinds(s, error)) { error = "binds: " + error; return false; }
+    bool custom = s.macroMode == MacroMode::Custom;
+    for (const ExtraBind &b : s.extraBinds) custom = custom || b.macroMode == MacroMode::Custom;
+    if (custom) {
+        if (!(seen & (kKeySequence | kKeyRecording))) { error = "custom mode needs \"sequence\" or \"recording\""; return false; }
+        CompiledProgram<RecordingSink::Record> check;
+        RecordingSink probe(0);
+        if (!compileMacroProgram(probe, s.sequence, check, error, s.wheelBurst)) { error = "sequence: " + error; return false; }
+    }
+    out = s;
+    return true;
+}
+
+bool parseCommandLine(int argc, char **argv, CommandLine &out, string &error) {
+    for (int i = 1; i < argc; ++i) {
+        const char *a = argv[i];
+        auto value = [&](string &v) {
+            if (i + 1 >= argc) { error = string(a) + " needs a value"; return false; }
+            v = argv[++i];
+            return true;
+        };
+        string v;
+        if (strcmp(a, "--yes") == 0 || strcmp(a, "-y") == 0) {
+            out.yes = true;
+        } else if (strcmp(a, "--help") == 0 || strcmp(a, "-h") == 0) {
+            out.help = true;
+        } else if (strcmp(a, "--config") == 0) {
+            if (!value(out.configPath)) return false;
+        } else if (strcmp(a, "--activation") == 0) {
+            if (!value(v)) return false;
+            if (!parseActivationName(v, out.overrides.activationType)) { error = "--activation: expected hold or toggle, got '" + v + "'"; return false; }
+            out.set |= kSetActivation;
+        } else if (strcmp(a, "--mode") == 0) {
+            if (!value(v)) return false;
+            if (!parseModeName(v, out.overrides.macroMode)) { error = "--mode: expected first, third or custom, got '" + v + "'"; return false; }
+            out.set |= kSetMode;
+        } else if (strcmp(a, "--bind") == 0) {
+            if (!value(v)) return false;
+            if (!parseBindSpec(v, out.overrides, error)) { error = "--bind: " + error; return false; }
+            out.set |= kSetBind;
+        } else if (strcmp(a, "--realtime") == 0) {
+            out.profile.realtime = true;
+        } else if (strcmp(a, "--lock-memory") == 0) {
+            out.profile.lockMemory = true;
+        } else if (strcmp(a, "--mmcss") == 0) {
+            if (!value(v)) return false;
+            if (!parseMmcssTask(lowerCopy(v), out.profile.mmcss)) { error = "--mmcss: expected games, audio or none, got '" + v + "'"; return false; }
+        } else if (strcmp(a, "--pin-worker") == 0 || strcmp(a, "--pin-hook") == 0) {
+            if (!value(v)) return false;
+            char *end = nullptr;
+            long cpu = strtol(v.c_str(), &end, 10);
+            if (v.empty() || *end || cpu < 0 || cpu > 1023) { error = string(a) + ": expected a cpu number, got '" + v + "'"; return false; }
+            int &slot = strcmp(a, "--pin-worker") == 0 ? out.profile.workerCpu : out.profile.hookCpu;
+            slot = static_cast<int>(cpu);
+        } else if (strcmp(a, "--no-shared-stats") == 0) {
+            out.sharedStats = false;
+        } else if (strcmp(a, "--recalibrate") == 0) {
+            out.recalibrate = true;
+        } else if (strcmp(a, "--headless") == 0) {
+            out.headless = true;
+            out.yes = true;
+        } else if (strcmp(a, "--control") == 0) {
+            if (!value(out.controlName)) return false;
+        } else if (strcmp(a, "--record") == 0) {
+            out.record = true;
+        } else if (strcmp(a, "--record-quantum-us") == 0) {
+            if (!value(v)) return false;
+            char *end = nullptr;
+            long us = strtol(v.c_str(), &end, 10);
+            if (v.empty() || *end || us < 50 || us > 100000) { error = "--record-quantum-us: expected 50-100000, got '" + v + "'"; return false; }
+            out.recordQuantumUs = static_cast<int>(us);
+        } else if (strcmp(a, "--trace") == 0) {
+            if (!value(out.tracePath)) return false;
+        } else if (strcmp(a, "--trace-records") == 0) {
+            if (!value(v)) return false;
+            char *end = nullptr;
+            long long n = strtoll(v.c_str(), &end, 10);
+            if (v.empty() || *end || n < 1024 || n > (1LL << 26)) { error = "--trace-records: expected 1024.." + to_string(1LL << 26) + ", got '" + v + "'"; return false; }
+            out.traceRecords = static_cast<uint64_t>(n);
+        } else {
+            error = string("unknown option ") + a;
+            return false;
+        }
+    }
+    return true;
+}
+
+void applyOverrides(const CommandLine &cl, Settings &s) {
+    if (cl.set & kSetActivation) s.activationType = cl.overrides.activationType;
+    if (cl.set & kSetMode) s.macroMode = cl.overrides.macroMode;
+    if (cl.set & kSetBind) {
+        s.keybindType = cl.overrides.keybindType;
+        if (s.keybindType == KeybindType::Keyboard) s.keyboardVk = cl.overrides.keyboardVk;
+        else s.mouseButton = cl.overrides.mouseButton;
+    }
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "bind_matcher.h"
+#include "macro_program.h"
+#include "sequence_recorder.h"
+#include "thread_roles.h"
+
+enum class ActivationType { Hold, Toggle };
+enum class MacroMode { FirstPerson, ThirdPerson, Custom };
+
+// another macro on its own bind, run by the same worker next to the main one
+// ("binds" in the config). custom mode uses the config's "sequence" or
+// "recording".
+struct ExtraBind {
+    KeybindType keybindType;
+    int keyboardVk;
+    MouseButton mouseButton;
+    MacroMode macroMode;
+    ActivationType activationType;
+};
+
+// the main bind is timeline 0, see kMaxTimelines
+static const int kMaxExtraBinds = 15;
+
+struct Settings {
+    ActivationType activationType;
+    MacroMode macroMode;
+    KeybindType keybindType;
+    int keyboardVk;
+    MouseButton mouseButton;
+    std::vector<MacroStep> sequence;
+    // the sequence came from a recording, saved as "recording" (compact
+    // binary, base64) instead of the step text
+    bool sequenceRecorded = false;
+    int wheelBurst = 1;
+    std::vector<ExtraBind> extraBinds;
+};
+
+// bumped whenever a key changes meaning. files without "version" predate it
+// and are read as version 0, which has the same keys.
+static const int kConfigVersion = 1;
+
+std::string toJson(const Settings &s);
+// one pass over the text, no lookups per key. unknown or repeated keys, bad
+// values and out of range numbers are errors ("line 3, col 12: ...").
+bool parseConfig(const std::string &text, Settings &out, std::string &error);
+
+bool parseActivationName(const std::string &name, ActivationType &out);
+bool parseModeName(const std::string &name, MacroMode &out);
+bool parseMouseButtonName(const std::string &name, MouseButton &out);
+const char *mouseButtonName(MouseButton b);
+// "x2", "mmb", "lmb", "rmb", "mouse:left" or any key name parseKeyName knows
+bool parseBindSpec(const std::string &spec, Settings &out, std::string &error);
+// "x1 third toggle; f first hold": bind, mode and activation per entry
+bool parseExtraBinds(const std::string &text, std::vector<ExtraBind> &out, std::string &error);
+std::string formatExtraBinds(const std::vector<ExtraBind> &binds);
+// no key or button on two binds, the bind table would only fire one of them
+bool checkBinds(const Settings &s, std::string &error);
+
+static const unsigned kSetActivation = 1;
+static const unsigned kSetMode = 2;
+static const unsigned kSetBind = 4;
+static const unsigned kSetAll = kSetActivation | kSetMode | kSetBind;
+
+struct CommandLine {
+    std::string configPath = "config.json";
+    bool yes = false;
+    bool help = false;
+    // which parts of `overrides` the flags set
+    unsigned set = 0;
+    Settings overrides{};
+    // scheduling only, never saved to the config
+    RealtimeProfile profile{};
+    // empty = no trace recording
+    std::string tracePath;
+    uint64_t traceRecords = 1 << 20;
+    // live counters in shared memory for insidingforfeds_bench stats
+    bool sharedStats = true;
+    // measure the timers again instead of using timer_calibration.json
+    bool recalibrate = false;
+    // no console at all, driven through the control channel; implies yes
+    bool headless = false;
+    // where the control channel listens, empty = off unless headless
+    std::string controlName;
+    // record a new custom sequence at startup, snapped to this grid
+    bool record = false;
+    int recordQuantumUs = kDefaultRecordQuantumUs;
+};
+
+bool parseCommandLine(int argc, char **argv, CommandLine &out, std::string &error);
+void applyOverrides(const CommandLine &cl, Settings &s);
+extern const char *const kUsage;
@@ -0,0 +1,187 @@
+#include "shared_stats.h"
+
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "timing.h"
+
+using namespace std;
+
+static const char kStatsMagic[8] = { 'I', 'F', 'F', 'S', 'T', 'A', 'T', 'S' };
+
+SharedStats::~SharedStats() {
+    close();
+}
+
+#ifndef _WIN32
+// initialized by a process that is gone
+static bool staleSegment(const char *name) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) return errno == ENOENT;
+    struct stat st;
+    bool stale = false;
+    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(SharedStatsBlock)) {
+        void *view = mmap(nullptr, sizeof(SharedStatsBlock), PROT_READ, MAP_SHARED, fd, 0);
+        if (view != MAP_FAILED) {
+            const SharedStatsBlock *b = static_cast<const SharedStatsBlock *>(view);
+            stale = memcmp(b->magic, kStatsMagic, sizeof(kStatsMagic)) == 0 && b->pid && kill(static_cast<pid_t>(b->pid), 0) != 0 && errno == ESRCH;
+            munmap(view, sizeof(SharedStatsBlock));
+        }
+    }
+    ::close(fd);
+    return stale;
+}
+#endif
+
+bool SharedStats::create(string &error, const char *name) {
+    close();
+    void *view = nullptr;
+#ifdef _WIN32
+    HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, sizeof(SharedStatsBlock), name);
+    if (mapping && GetLastError() == ERROR_ALREADY_EXISTS) {
+        CloseHandle(mapping);
+        error = "another instance already publishes stats";
+        return false;
+    }
+    if (mapping) view = MapViewOfFile(mapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, sizeof(SharedStatsBlock));
+    if (!view) {
+        error = "can't create shared stats (" + to_string(GetLastError()) + ")";
+        if (mapping) CloseHandle(mapping);
+        return false;
+    }
+    mapping_ = mapping;
+#else
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    // a leftover from a crashed run is replaced, a live instance keeps its block
+    if (fd < 0 && errno == EEXIST && staleSegment(name)) {
+        shm_unlink(name);
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    }
+    if (fd < 0 && errno == EEXIST) {
+        error = "another instance already publishes stats";
+        return false;
+    }
+    if (fd < 0 || ftruncate(fd, sizeof(SharedStatsBlock)) != 0) {
+        error = string("can't create shared stats (") + strerror(errno) + ")";
+        if (fd >= 0) ::close(fd);
+        return false;
+    }
+    view = mmap(nullptr, sizeof(SharedStatsBlock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (view == MAP_FAILED) {
+        error = string("can't map shared stats (") + strerror(errno) + ")";
+        shm_unlink(name);
+        return false;
+    }
+#endif
+    block_ = static_cast<SharedStatsBlock *>(view);
+    owner_ = true;
+    name_ = name;
+    memset(view, 0, sizeof(SharedStatsBlock));
+    block_->version = kSharedStatsVersion;
+    block_->size = sizeof(SharedStatsBlock);
+#ifdef _WIN32
+    block_->pid = GetCurrentProcessId();
+#else
+    block_->pid = static_cast<uint32_t>(getpid());
+#endif
+    // magic last, a reader that sees it sees the rest
+    atomic_thread_fence(memory_order_release);
+    memcpy(block_->magic, kStatsMagic, sizeof(kStatsMagic));
+    return true;
+}
+
+bool SharedStats::open(string &error, const char *name) {
+    close();
+    void *view = nullptr;
+#ifdef _WIN32
+    HANDLE mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+    if (mapping) view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!view) {
+        error = "macro not running (no shared stats)";
+        if (mapping) CloseHandle(mapping);
+        return false;
+    }
+    mapping_ = mapping;
+#else
+    int fd = shm_open(name, O_RDONLY, 0);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(SharedStatsBlock)) {
+        error = "macro not running (no shared stats)";
+        if (fd >= 0) ::close(fd);
+        return false;
+    }
+    view = mmap(nullptr, sizeof(SharedStatsBlock), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (view == MAP_FAILED) {
+        error = string("can't map shared stats (") + strerror(errno) + ")";
+        return false;
+    }
+#endif
+    block_ = static_cast<SharedStatsBlock *>(view);
+    name_ = name;
+    if (memcmp(block_->magic, kStatsMagic, sizeof(kStatsMagic)) != 0) {
+        error = "shared stats are not initialized yet";
+        close();
+        return false;
+    }
+    // an older writer has a shorter block, we only read what it has
+    if (block_->version != kSharedStatsVersion || block_->size < sizeof(SharedStatsBlock)) {
+        error = "shared stats version " + to_string(block_->version) + ", this reader knows " + to_string(kSharedStatsVersion);
+        close();
+        return false;
+    }
+    return true;
+}
+
+void SharedStats::close() {
+    if (!block_) return;
+#ifdef _WIN32
+    UnmapViewOfFile(block_);
+    CloseHandle(static_cast<HANDLE>(mapping_));
+    mapping_ = nullptr;
+#else
+    munmap(block_, sizeof(SharedStatsBlock));
+    if (owner_) shm_unlink(name_.c_str());
+#endif
+    block_ = nullptr;
+    owner_ = false;
+}
+
+bool SharedStats::snapshot(SharedStatsSnapshot &out) const {
+    if (!block_) return false;
+    const SharedStatsBlock &b = *block_;
+    for (int attempt = 0; attempt < 1000; ++attempt) {
+        uint32_t before = b.seq.load(memory_order_acquire);
+        if (before & 1) {
+            cpuRelax();
+            continue;
+        }
+        out.cycles = b.cycles.load(memory_order_relaxed);
+        out.emittedEvents = b.emittedEvents.load(memory_order_relaxed);
+        out.missedDeadlines = b.missedDeadlines.load(memory_order_relaxed);
+        out.activations = b.activations.load(memory_order_relaxed);
+        out.periodNs = b.periodNs.load(memory_order_relaxed);
+        out.lastEmitNs = b.lastEmitNs.load(memory_order_relaxed);
+        out.running = b.running.load(memory_order_relaxed) != 0;
+        atomic_thread_fence(memory_order_acquire);
+        if (b.seq.load(memory_order_relaxed) != before) continue;
+        out.version = b.version;
+        out.pid = b.pid;
+        out.sendFailures = b.sendFailures.load(memory_order_relaxed);
+        out.shortWrites = b.shortWrites.load(memory_order_relaxed);
+        out.hookCalls = b.hookCalls.load(memory_order_relaxed);
+        out.hookMaxNs = b.hookMaxNs.load(memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+static const uint32_t kSharedStatsVersion = 1;
+// emits that start this long after their deadline count as missed, same
+// default as the trace analyzer
+static const int64_t kMissedDeadlineNs = 500000;
+
+#ifdef _WIN32
+static const char *const kSharedStatsName = "Local\\insidingforfeds_macro_stats";
+#else
+static const char *const kSharedStatsName = "/insidingforfeds_macro_stats";
+#endif
+
+// fixed layout, lives in named shared memory so other processes (overlays,
+// loggers) can read it. fields are only ever appended, `size` tells a reader
+// how much of the block the writer knows about.
+//
+// the worker group has a single writer, the macro worker, and is updated as
+// a unit under the seqlock `seq` (odd while a write is in progress). the
+// sink counters are bumped from inside the send call and the hook group by
+// the hook thread, both outside the seqlock, so they can be one step ahead
+// of the worker group.
+struct SharedStatsBlock {
+    char magic[8];                     // "IFFSTATS"
+    uint32_t version;
+    uint32_t size;
+    uint32_t pid;
+    std::atomic<uint32_t> seq;
+    // worker group
+    std::atomic<uint64_t> cycles;
+    std::atomic<uint64_t> emittedEvents;
+    std::atomic<uint64_t> missedDeadlines;
+    std::atomic<uint64_t> activations;
+    // cycle length of timeline 0, the main bind
+    std::atomic<int64_t> periodNs;
+    std::atomic<int64_t> lastEmitNs;
+    std::atomic<uint32_t> running;
+    uint32_t reserved0;
+    // sink, SendInput returning 0 / fewer than asked, write() failing / short
+    alignas(64) std::atomic<uint64_t> sendFailures;
+    std::atomic<uint64_t> shortWrites;
+    // hook thread
+    alignas(64) std::atomic<uint64_t> hookCalls;
+    std::atomic<int64_t> hookMaxNs;
+};
+
+// plain copy of one consistent read
+struct SharedStatsSnapshot {
+    uint32_t version;
+    uint32_t pid;
+    uint64_t cycles;
+    uint64_t emittedEvents;
+    uint64_t missedDeadlines;
+    uint64_t activations;
+    int64_t periodNs;
+    int64_t lastEmitNs;
+    bool running;
+    uint64_t sendFailures;
+    uint64_t shortWrites;
+    uint64_t hookCalls;
+    int64_t hookMaxNs;
+};
+
+// every counter has one writing thread, so a relaxed load and store is
+// enough and skips the locked add
+inline void statsBump(std::atomic<uint64_t> &c, uint64_t n = 1) {
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+inline void statsMax(std::atomic<int64_t> &m, int64_t v) {
+    if (v > m.load(std::memory_order_relaxed)) m.store(v, std::memory_order_relaxed);
+}
+
+inline void statsBeginWrite(SharedStatsBlock &b) {
+    b.seq.store(b.seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+inline void statsEndWrite(SharedStatsBlock &b) {
+    b.seq.store(b.seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+// owns the mapping. the app creates it, readers open it read-only.
+class SharedStats {
+public:
+    SharedStats() = default;
+    ~SharedStats();
+    SharedStats(const SharedStats &) = delete;
+    SharedStats &operator=(const SharedStats &) = delete;
+
+    // fails while a live instance has the name, a crashed one's is replaced.
+    // only the creator unlinks it again
+    bool create(std::string &error, const char *name = kSharedStatsName);
+    bool open(std::string &error, const char *name = kSharedStatsName);
+    void close();
+
+    SharedStatsBlock *block() const { return block_; }
+    // false if the writer kept the seqlock busy for every retry
+    bool snapshot(SharedStatsSnapshot &out) const;
+
+private:
+    SharedStatsBlock *block_ = nullptr;
+    bool owner_ = false;
+    std::string name_;
+#ifdef _WIN32
+    void *mapping_ = nullptr;
+#endif
+};
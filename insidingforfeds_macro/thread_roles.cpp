@@ -0,0 +1,196 @@
+#include "thread_roles.h"
+#include "alloc_tracker.h"
+
+#include <mutex>
+#include <sstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <avrt.h>
+#else
+#include <cerrno>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+using namespace std;
+
+static mutex g_reportMutex;
+static string g_processReport;
+static string g_reports[4];
+
+const char *threadRoleName(ThreadRole role) {
+    switch (role) {
+    case ThreadRole::Hook: return "hook";
+    case ThreadRole::Worker: return "worker";
+    case ThreadRole::Ui: return "ui";
+    case ThreadRole::Background: return "background";
+    }
+    return "?";
+}
+
+bool parseMmcssTask(const string &name, MmcssTask &out) {
+    if (name == "games") out = MmcssTask::Games;
+    else if (name == "audio" || name == "pro-audio") out = MmcssTask::ProAudio;
+    else if (name == "none") out = MmcssTask::None;
+    else return false;
+    return true;
+}
+
+static void recordReport(ThreadRole role, const string &report) {
+    lock_guard<mutex> lock(g_reportMutex);
+    g_reports[static_cast<int>(role)] = report;
+}
+
+string threadRoleSummary() {
+    lock_guard<mutex> lock(g_reportMutex);
+    string r;
+    if (!g_processReport.empty()) r = "process: " + g_processReport;
+    for (int i = 0; i < 4; ++i) {
+        if (g_reports[i].empty()) continue;
+        if (!r.empty()) r += "\n";
+        r += threadRoleName(static_cast<ThreadRole>(i));
+        r += ": ";
+        r += g_reports[i];
+    }
+    return r;
+}
+
+static void recordProcessReport(const string &report) {
+    lock_guard<mutex> lock(g_reportMutex);
+    g_processReport = report;
+}
+
+static int pinnedCpu(ThreadRole role, const RealtimeProfile &p) {
+    if (role == ThreadRole::Worker) return p.workerCpu;
+    if (role == ThreadRole::Hook) return p.hookCpu;
+    return -1;
+}
+
+#ifdef _WIN32
+static const char *priorityName(int p) {
+    switch (p) {
+    case THREAD_PRIORITY_TIME_CRITICAL: return "time critical";
+    case THREAD_PRIORITY_HIGHEST: return "highest";
+    case THREAD_PRIORITY_ABOVE_NORMAL: return "above normal";
+    case THREAD_PRIORITY_NORMAL: return "normal";
+    case THREAD_PRIORITY_BELOW_NORMAL: return "below normal";
+    case THREAD_PRIORITY_LOWEST: return "lowest";
+    }
+    return "other";
+}
+
+string applyProcessProfile(const RealtimeProfile &profile) {
+    stringstream ss;
+    DWORD cls = profile.realtime ? HIGH_PRIORITY_CLASS : ABOVE_NORMAL_PRIORITY_CLASS;
+    bool ok = SetPriorityClass(GetCurrentProcess(), cls) != 0;
+    ss << (GetPriorityClass(GetCurrentProcess()) == HIGH_PRIORITY_CLASS ? "high" : "above normal") << " class";
+    if (!ok) ss << " (denied)";
+    if (profile.lockMemory) {
+        // a bigger minimum working set keeps our pages resident under memory
+        // pressure, the closest thing to mlockall
+        bool locked = SetProcessWorkingSetSize(GetCurrentProcess(), 64 << 20, 256 << 20) != 0;
+        ss << (locked ? ", working set locked" : ", working set lock denied");
+    }
+    recordProcessReport(ss.str());
+    return ss.str();
+}
+
+string applyThreadRole(ThreadRole role, const RealtimeProfile &profile) {
+    allocTagThread(threadRoleName(role));
+    int wanted = THREAD_PRIORITY_NORMAL;
+    switch (role) {
+    case ThreadRole::Hook: wanted = THREAD_PRIORITY_TIME_CRITICAL; break;
+    case ThreadRole::Worker: wanted = THREAD_PRIORITY_HIGHEST; break;
+    case ThreadRole::Ui: wanted = THREAD_PRIORITY_BELOW_NORMAL; break;
+    case ThreadRole::Background: wanted = THREAD_PRIORITY_LOWEST; break;
+    }
+    SetThreadPriority(GetCurrentThread(), wanted);
+    stringstream ss;
+    ss << priorityName(GetThreadPriority(GetCurrentThread()));
+
+    bool wantsMmcss = profile.realtime && profile.mmcss != MmcssTask::None && (role == ThreadRole::Worker || role == ThreadRole::Hook);
+    if (wantsMmcss) {
+        // the handle stays registered for the life of the thread
+        DWORD taskIndex = 0;
+        const wchar_t *task = profile.mmcss == MmcssTask::ProAudio ? L"Pro Audio" : L"Games";
+        HANDLE mm = AvSetMmThreadCharacteristicsW(task, &taskIndex);
+        if (mm) {
+            AvSetMmThreadPriority(mm, role == ThreadRole::Hook ? AVRT_PRIORITY_CRITICAL : AVRT_PRIORITY_HIGH);
+            ss << ", mmcss " << (profile.mmcss == MmcssTask::ProAudio ? "pro audio" : "games");
+        } else {
+            ss << ", mmcss denied (" << GetLastError() << ")";
+        }
+    }
+
+    int cpu = pinnedCpu(role, profile);
+    if (cpu >= 0) {
+        if (cpu < static_cast<int>(sizeof(DWORD_PTR) * 8) && SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << cpu)) ss << ", cpu " << cpu;
+        else ss << ", pin to cpu " << cpu << " denied";
+    }
+    string r = ss.str();
+    recordReport(role, r);
+    return r;
+}
+#else
+string applyProcessProfile(const RealtimeProfile &profile) {
+    stringstream ss;
+    ss << "nice " << getpriority(PRIO_PROCESS, 0);
+    if (profile.lockMemory) {
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0) ss << ", memory locked";
+        else ss << ", mlockall denied (" << strerror(errno) << ")";
+    }
+    recordProcessReport(ss.str());
+    return ss.str();
+}
+
+string applyThreadRole(ThreadRole role, const RealtimeProfile &profile) {
+    allocTagThread(threadRoleName(role));
+    stringstream ss;
+    bool fifo = false;
+    if (profile.realtime && (role == ThreadRole::Worker || role == ThreadRole::Hook)) {
+        sched_param sp{};
+        sp.sched_priority = role == ThreadRole::Hook ? 85 : 80;
+        int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+        if (err == 0) fifo = true;
+        else ss << "SCHED_FIFO denied (" << strerror(err) << "), ";
+    }
+    if (!fifo) {
+        // nice is per thread on linux when given the tid
+        int nice = 0;
+        switch (role) {
+        case ThreadRole::Hook: nice = -10; break;
+        case ThreadRole::Worker: nice = -8; break;
+        case ThreadRole::Ui: nice = 5; break;
+        case ThreadRole::Background: nice = 10; break;
+        }
+        pid_t tid = static_cast<pid_t>(syscall(SYS_gettid));
+        setpriority(PRIO_PROCESS, static_cast<id_t>(tid), nice);
+        errno = 0;
+        int got = getpriority(PRIO_PROCESS, static_cast<id_t>(tid));
+        ss << "nice " << got;
+    } else {
+        int policy = 0;
+        sched_param sp{};
+        pthread_getschedparam(pthread_self(), &policy, &sp);
+        ss << (policy == SCHED_FIFO ? "SCHED_FIFO " : "policy ") << sp.sched_priority;
+    }
+
+    int cpu = pinnedCpu(role, profile);
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (cpu < CPU_SETSIZE && pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0) ss << ", cpu " << cpu;
+        else ss << ", pin to cpu " << cpu << " denied";
+    }
+    string r = ss.str();
+    recordReport(role, r);
+    return r;
+}
+#endif
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+
+// every long lived thread says what it is once, right after it starts, and
+// gets the priority for that job: the hook has to answer within
+// LowLevelHooksTimeout, the worker has to wake on time, the ui and the file
+// watcher can wait.
+enum class ThreadRole { Hook, Worker, Ui, Background };
+
+enum class MmcssTask { None, Games, ProAudio };
+
+struct RealtimeProfile {
+    // mmcss on windows, SCHED_FIFO on linux, for the hook and the worker
+    bool realtime = false;
+    MmcssTask mmcss = MmcssTask::Games;
+    // -1 leaves the scheduler alone
+    int workerCpu = -1;
+    int hookCpu = -1;
+    // mlockall on linux, a locked working set on windows
+    bool lockMemory = false;
+};
+
+const char *threadRoleName(ThreadRole role);
+bool parseMmcssTask(const std::string &name, MmcssTask &out);
+
+// process wide part (priority class, memory locking), call once from main
+std::string applyProcessProfile(const RealtimeProfile &profile);
+// calling thread only. returns and records what was actually granted, which
+// can be less than asked for (no CAP_SYS_NICE, mmcss service off, ...)
+std::string applyThreadRole(ThreadRole role, const RealtimeProfile &profile);
+// the process line and one line per role applied so far, for the status box
+std::string threadRoleSummary();
@@ -0,0 +1,184 @@
+#include "timer_calibration.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// linux has the futex wait and nothing else to choose, it is still measured
+// for the spin
+static const TimerBackend kProbeOrder[] = {
+#ifdef _WIN32
+    TimerBackend::WaitableTimer, TimerBackend::EventWait,
+#else
+    TimerBackend::Futex,
+#endif
+};
+
+static bool backendFromName(const string &name, TimerBackend &out) {
+    static const TimerBackend all[] = { TimerBackend::EventWait, TimerBackend::WaitableTimer, TimerBackend::Futex };
+    for (TimerBackend b : all) {
+        if (name == timerBackendName(b)) { out = b; return true; }
+    }
+    return false;
+}
+
+static bool probeBackend(TimerBackend backend, int samples, TimerProbe &out) {
+    // no spin, so waitUntil returns when the kernel wakes us. the same
+    // cancellable wait the worker sleeps in, on an event nobody signals
+    DeadlineScheduler sched(backend, 0);
+    if (sched.backend() != backend) return false;
+    WakeEvent idle;
+    vector<int64_t> late;
+    late.reserve(samples);
+    for (int i = 0; i < samples; ++i) {
+        // spread the waits so none of them lines up with the timer tick
+        int64_t deadline = monotonicNowNs() + 500000 + (i * 137000LL) % 1500000;
+        sched.waitUntil(deadline, idle, idle.sequence());
+        late.push_back(max<int64_t>(0, monotonicNowNs() - deadline));
+    }
+    sort(late.begin(), late.end());
+    out.backend = backend;
+    out.p50Ns = late[late.size() / 2];
+    out.p99Ns = late[min(late.size() - 1, late.size() * 99 / 100)];
+    out.maxNs = late.back();
+    return true;
+}
+
+TimerCalibration calibrateTimers(int samples) {
+    TimerCalibration c;
+    c.cpus = static_cast<int>(thread::hardware_concurrency());
+    if (samples < 10) samples = 10;
+    for (TimerBackend b : kProbeOrder) {
+        TimerProbe p;
+        if (c.probeCount < kMaxTimerProbes && probeBackend(b, samples, p)) c.probes[c.probeCount++] = p;
+    }
+    if (!c.probeCount) return c;
+    // lowest p99 wins, the earlier (preferred) backend on a tie
+    const TimerProbe *best = &c.probes[0];
+    for (int i = 1; i < c.probeCount; ++i) {
+        if (c.probes[i].p99Ns < best->p99Ns) best = &c.probes[i];
+    }
+    c.backend = best->backend;
+    c.spinNs = min(kMaxSpinNs, max(kMinSpinNs, best->p99Ns + kSpinMarginNs));
+    return c;
+}
+
+string timerCalibrationJson(const TimerCalibration &c) {
+    stringstream ss;
+    ss << "{\n";
+    ss << "  \"version\": " << kTimerCalibrationVersion << ",\n";
+    ss << "  \"cpus\": " << c.cpus << ",\n";
+    ss << "  \"backend\": \"" << timerBackendName(c.backend) << "\",\n";
+    ss << "  \"spin_ns\": " << c.spinNs << ",\n";
+    ss << "  \"probes\": [\n";
+    for (int i = 0; i < c.probeCount; ++i) {
+        const TimerProbe &p = c.probes[i];
+        ss << "    { \"backend\": \"" << timerBackendName(p.backend) << "\", \"p50_ns\": " << p.p50Ns << ", \"p99_ns\": " << p.p99Ns
+           << ", \"max_ns\": " << p.maxNs << " }" << (i + 1 < c.probeCount ? "," : "") << "\n";
+    }
+    ss << "  ]\n";
+    ss << "}\n";
+    return ss.str();
+}
+
+// `"key": value` on one line, a number or a quoted string
+static bool findValue(const string &line, const char *key, string &out) {
+    string tag = string("\"") + key + "\": ";
+    size_t at = line.find(tag);
+    if (at == string::npos) return false;
+    at += tag.size();
+    if (at < line.size() && line[at] == '"') {
+        size_t close = line.find('"', at + 1);
+        if (close == string::npos) return false;
+        out = line.substr(at + 1, close - at - 1);
+        return true;
+    }
+    size_t stop = line.find_first_of(", }", at);
+    out = line.substr(at, stop == string::npos ? string::npos : stop - at);
+    return !out.empty();
+}
+
+static bool findNumber(const string &line, const char *key, long long &out) {
+    string v;
+    if (!findValue(line, key, v)) return false;
+    char *end = nullptr;
+    out = strtoll(v.c_str(), &end, 10);
+    return *end == '\0';
+}
+
+// only ever reads what timerCalibrationJson wrote, one value (or probe) per
+// line; anything else and the caller measures again
+bool parseTimerCalibration(const string &text, TimerCalibration &out) {
+    TimerCalibration c;
+    stringstream in(text);
+    string line, name;
+    long long version = -1, n = 0;
+    bool haveBackend = false, haveSpin = false;
+    while (getline(in, line)) {
+        if (line.find("\"p50_ns\"") != string::npos) {
+            if (c.probeCount == kMaxTimerProbes) return false;
+            TimerProbe &p = c.probes[c.probeCount++];
+            long long p50 = 0, p99 = 0, mx = 0;
+            if (!findValue(line, "backend", name) || !backendFromName(name, p.backend)) return false;
+            if (!findNumber(line, "p50_ns", p50) || !findNumber(line, "p99_ns", p99) || !findNumber(line, "max_ns", mx)) return false;
+            p.p50Ns = p50;
+            p.p99Ns = p99;
+            p.maxNs = mx;
+        } else if (findNumber(line, "version", n)) {
+            version = n;
+        } else if (findNumber(line, "cpus", n)) {
+            c.cpus = static_cast<int>(n);
+        } else if (findNumber(line, "spin_ns", n)) {
+            if (n < kMinSpinNs || n > kMaxSpinNs) return false;
+            c.spinNs = n;
+            haveSpin = true;
+        } else if (findValue(line, "backend", name)) {
+            if (!backendFromName(name, c.backend)) return false;
+            haveBackend = true;
+        }
+    }
+    if (version != kTimerCalibrationVersion || !haveBackend || !haveSpin) return false;
+    c.fromCache = true;
+    out = c;
+    return true;
+}
+
+string timerCalibrationPath(const string &configPath) {
+    size_t slash = configPath.find_last_of("/\\");
+    return slash == string::npos ? "timer_calibration.json" : configPath.substr(0, slash + 1) + "timer_calibration.json";
+}
+
+TimerCalibration loadOrCalibrateTimers(const string &path, bool recalibrate) {
+    if (!recalibrate) {
+        ifstream f(path, ios::binary);
+        stringstream ss;
+        ss << f.rdbuf();
+        TimerCalibration cached;
+        // a different machine behind the same folder (usb stick, synced
+        // dir) gets its own numbers
+        if (f && parseTimerCalibration(ss.str(), cached) && cached.cpus == static_cast<int>(thread::hardware_concurrency())) {
+            // the backend has to exist here too
+            DeadlineScheduler probe(cached.backend, cached.spinNs);
+            if (probe.backend() == cached.backend) return cached;
+        }
+    }
+    TimerCalibration c = calibrateTimers();
+    ofstream out(path, ios::binary | ios::trunc);
+    out << timerCalibrationJson(c);
+    return c;
+}
+
+string timerCalibrationSummary(const TimerCalibration &c) {
+    stringstream ss;
+    ss << "timer: " << timerBackendName(c.backend) << ", spin " << c.spinNs / 1000 << "us";
+    for (int i = 0; i < c.probeCount; ++i) {
+        if (c.probes[i].backend == c.backend) ss << " (p99 late " << c.probes[i].p99Ns / 1000 << "us)";
+    }
+    ss << (c.fromCache ? " cached" : " calibrated");
+    return ss.str();
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "timing.h"
+
+// how late one wait primitive woke up, with no spin after it
+struct TimerProbe {
+    TimerBackend backend = TimerBackend::EventWait;
+    int64_t p50Ns = 0;
+    int64_t p99Ns = 0;
+    int64_t maxNs = 0;
+};
+
+static const int kMaxTimerProbes = 4;
+// bumped when the file changes meaning, an old file is measured again
+static const int kTimerCalibrationVersion = 2;
+// the spin covers the p99 overshoot plus this, within the clamp below
+static const int64_t kSpinMarginNs = 30000;
+static const int64_t kMinSpinNs = 20000;
+static const int64_t kMaxSpinNs = 2000000;
+
+// what DeadlineScheduler should use on this machine. a step shorter than
+// spinNs is spun through entirely, a longer one sleeps on backend until
+// spinNs before the deadline.
+struct TimerCalibration {
+    TimerBackend backend = defaultTimerBackend();
+    int64_t spinNs = kDefaultSpinNs;
+    TimerProbe probes[kMaxTimerProbes];
+    int probeCount = 0;
+    int cpus = 0;
+    bool fromCache = false;
+};
+
+// waits `samples` times (0.5-2ms each) on every primitive this platform has
+// and keeps the one with the lowest p99 overshoot. run it on the thread that
+// will do the waiting, its priority and mmcss class change the numbers.
+TimerCalibration calibrateTimers(int samples = 160);
+
+std::string timerCalibrationJson(const TimerCalibration &c);
+bool parseTimerCalibration(const std::string &text, TimerCalibration &out);
+// "timer_calibration.json" in the config's folder
+std::string timerCalibrationPath(const std::string &configPath);
+// the cached result if it was measured on this machine by this build,
+// otherwise calibrates and rewrites the file
+TimerCalibration loadOrCalibrateTimers(const std::string &path, bool recalibrate);
+std::string timerCalibrationSummary(const TimerCalibration &c);
@@ -0,0 +1,169 @@
+#include "timing.h"
+
+#include <thread>
+#include <chrono>
+
+#ifdef _WIN32
+#include <mmsystem.h>
+#else
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+using namespace std;
+
+#ifdef _WIN32
+static int64_t qpcFrequency() {
+    static const int64_t f = [] { LARGE_INTEGER li; QueryPerformanceFrequency(&li); return static_cast<int64_t>(li.QuadPart); }();
+    return f;
+}
+
+int64_t monotonicNowNs() {
+    LARGE_INTEGER li;
+    QueryPerformanceCounter(&li);
+    int64_t c = li.QuadPart;
+    int64_t f = qpcFrequency();
+    return (c / f) * 1000000000LL + (c % f) * 1000000000LL / f;
+}
+
+TimerBackend defaultTimerBackend() {
+    return TimerBackend::WaitableTimer;
+}
+#else
+int64_t monotonicNowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+TimerBackend defaultTimerBackend() {
+    return TimerBackend::Futex;
+}
+
+static timespec toTimespec(int64_t ns) {
+    timespec ts;
+    ts.tv_sec = static_cast<time_t>(ns / 1000000000LL);
+    ts.tv_nsec = static_cast<long>(ns % 1000000000LL);
+    return ts;
+}
+#endif
+
+#ifdef _WIN32
+WakeEvent::WakeEvent() {
+    event_ = CreateEventA(nullptr, FALSE, FALSE, nullptr);
+}
+
+WakeEvent::~WakeEvent() {
+    if (event_) CloseHandle(event_);
+}
+
+void WakeEvent::signal() {
+    seq_.fetch_add(1, memory_order_acq_rel);
+    SetEvent(event_);
+}
+
+bool WakeEvent::wait(uint32_t seen, int64_t deadlineNs) const {
+    while (sequence() == seen) {
+        DWORD ms = INFINITE;
+        if (deadlineNs >= 0) {
+            int64_t remaining = deadlineNs - monotonicNowNs();
+            if (remaining <= 0) return false;
+            ms = static_cast<DWORD>((remaining + 999999) / 1000000);
+        }
+        if (WaitForSingleObject(event_, ms) == WAIT_TIMEOUT && sequence() == seen) return false;
+    }
+    return true;
+}
+#else
+static uint32_t *futexWord(const atomic<uint32_t> &a) {
+    return reinterpret_cast<uint32_t *>(const_cast<atomic<uint32_t> *>(&a));
+}
+
+WakeEvent::WakeEvent() = default;
+WakeEvent::~WakeEvent() = default;
+
+void WakeEvent::signal() {
+    seq_.fetch_add(1, memory_order_acq_rel);
+    syscall(SYS_futex, futexWord(seq_), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+}
+
+bool WakeEvent::wait(uint32_t seen, int64_t deadlineNs) const {
+    // FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC timeout, the same
+    // hrtimer clock_nanosleep(TIMER_ABSTIME) uses
+    timespec ts = toTimespec(deadlineNs);
+    while (sequence() == seen) {
+        long r = syscall(SYS_futex, futexWord(seq_), FUTEX_WAIT_BITSET_PRIVATE, seen, deadlineNs >= 0 ? &ts : nullptr, nullptr, FUTEX_BITSET_MATCH_ANY);
+        if (r < 0 && errno == ETIMEDOUT) return sequence() != seen;
+    }
+    return true;
+}
+#endif
+
+const char *timerBackendName(TimerBackend b) {
+    switch (b) {
+    case TimerBackend::EventWait: return "event wait";
+    case TimerBackend::WaitableTimer: return "waitable timer";
+    case TimerBackend::Futex: return "futex";
+    }
+    return "?";
+}
+
+DeadlineScheduler::DeadlineScheduler(TimerBackend backend, int64_t spinNs) : backend_(backend), spinNs_(spinNs) {
+#ifdef _WIN32
+    if (backend_ == TimerBackend::Futex) backend_ = TimerBackend::WaitableTimer;
+    if (backend_ == TimerBackend::WaitableTimer) {
+        timer_ = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+        if (!timer_) {
+            // pre-1803 builds have no high resolution timers, fall back to a
+            // normal one and raise the tick only for as long as we need it
+            timer_ = CreateWaitableTimerExW(nullptr, nullptr, 0, TIMER_ALL_ACCESS);
+            raisedPeriod_ = timeBeginPeriod(1) == 0;
+        }
+        if (!timer_) backend_ = TimerBackend::EventWait;
+    }
+#else
+    backend_ = TimerBackend::Futex;
+#endif
+}
+
+DeadlineScheduler::~DeadlineScheduler() {
+#ifdef _WIN32
+    if (timer_) CloseHandle(timer_);
+    if (raisedPeriod_) timeEndPeriod(1);
+#endif
+}
+
+bool DeadlineScheduler::kernelSleepUntil(int64_t deadlineNs, const WakeEvent &cancel, uint32_t seen) {
+#ifdef _WIN32
+    if (backend_ == TimerBackend::WaitableTimer) {
+        int64_t remaining = deadlineNs - monotonicNowNs();
+        if (remaining <= 0) return cancel.sequence() == seen;
+        LARGE_INTEGER due;
+        due.QuadPart = -(remaining / 100);
+        if (due.QuadPart != 0 && SetWaitableTimer(timer_, &due, 0, nullptr, nullptr, FALSE)) {
+            HANDLE handles[2] = { cancel.handle(), timer_ };
+            while (cancel.sequence() == seen) {
+                if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0) return cancel.sequence() == seen;
+            }
+            CancelWaitableTimer(timer_);
+            return false;
+        }
+    }
+#endif
+    // a futex wait (an event wait on windows) on the same absolute deadline
+    return !cancel.wait(seen, deadlineNs);
+}
+
+bool DeadlineScheduler::waitUntil(int64_t deadlineNs, const WakeEvent &cancel, uint32_t seen) {
+    if (deadlineNs - monotonicNowNs() > spinNs_ && !kernelSleepUntil(deadlineNs - spinNs_, cancel, seen)) return false;
+    int64_t spinLimit = monotonicNowNs() + spinNs_;
+    for (;;) {
+        if (cancel.sequence() != seen) return false;
+        int64_t t = monotonicNowNs();
+        if (t >= deadlineNs || t >= spinLimit) return true;
+        cpuRelax();
+    }
+}
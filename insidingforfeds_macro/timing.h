@@ -0,0 +1,85 @@
+#pragma once
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include <cstdint>
+#include <atomic>
+
+int64_t monotonicNowNs();
+
+// what the worker's cancellable wait sleeps on. on linux that is always a
+// futex wait on an absolute deadline, windows has a timer to choose
+enum class TimerBackend : uint8_t { EventWait, WaitableTimer, Futex };
+
+TimerBackend defaultTimerBackend();
+const char *timerBackendName(TimerBackend b);
+
+static const int64_t kDefaultSpinNs = 200000;
+
+inline void cpuRelax() {
+#if defined(_WIN32)
+    YieldProcessor();
+#elif defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// wakes a parked thread on state changes. waiters snapshot sequence() before
+// checking their condition and pass it to wait(), so a signal that lands in
+// between is never lost. futex on linux, auto-reset event on windows.
+class WakeEvent {
+public:
+    WakeEvent();
+    ~WakeEvent();
+    WakeEvent(const WakeEvent &) = delete;
+    WakeEvent &operator=(const WakeEvent &) = delete;
+
+    void signal();
+    uint32_t sequence() const { return seq_.load(std::memory_order_acquire); }
+    // false on timeout; deadlineNs < 0 waits forever
+    bool wait(uint32_t seen, int64_t deadlineNs = -1) const;
+
+#ifdef _WIN32
+    HANDLE handle() const { return event_; }
+#endif
+
+private:
+    std::atomic<uint32_t> seq_{0};
+#ifdef _WIN32
+    HANDLE event_ = nullptr;
+#endif
+};
+
+// waits on absolute CLOCK_MONOTONIC / QPC deadlines: the kernel timer gets us
+// to within spinNs of the deadline and a bounded spin covers the rest, so
+// oversleep of one step never pushes back the next one.
+class DeadlineScheduler {
+public:
+    explicit DeadlineScheduler(TimerBackend backend = defaultTimerBackend(), int64_t spinNs = kDefaultSpinNs);
+    ~DeadlineScheduler();
+    DeadlineScheduler(const DeadlineScheduler &) = delete;
+    DeadlineScheduler &operator=(const DeadlineScheduler &) = delete;
+
+    int64_t now() const { return monotonicNowNs(); }
+    // returns false as soon as cancel moves past seen, true at the deadline
+    bool waitUntil(int64_t deadlineNs, const WakeEvent &cancel, uint32_t seen);
+    // idle wait with no deadline. goes through the scheduler so a simulated
+    // clock can stand in for the real one
+    void park(const WakeEvent &wake, uint32_t seen) const { wake.wait(seen); }
+
+    TimerBackend backend() const { return backend_; }
+    int64_t spinNs() const { return spinNs_; }
+
+private:
+    bool kernelSleepUntil(int64_t deadlineNs, const WakeEvent &cancel, uint32_t seen);
+
+    TimerBackend backend_;
+    int64_t spinNs_;
+#ifdef _WIN32
+    HANDLE timer_ = nullptr;
+    bool raisedPeriod_ = false;
+#endif
+};
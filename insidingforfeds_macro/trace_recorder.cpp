@@ -0,0 +1,160 @@
+#include "trace_recorder.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+#include "timing.h"
+
+using namespace std;
+
+static const char kTraceMagic[8] = { 'I', 'F', 'F', 'T', 'R', 'A', 'C', 'E' };
+
+TraceRing::~TraceRing() {
+    close();
+}
+
+bool TraceRing::open(const string &path, uint64_t capacity, string &error) {
+    close();
+    uint64_t cap = 1024;
+    while (cap < capacity && cap < (1ull << 26)) cap <<= 1;
+    size_t bytes = sizeof(TraceFileHeader) + static_cast<size_t>(cap) * sizeof(TraceRecord);
+    void *view = nullptr;
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        error = "can't create " + path + " (" + to_string(GetLastError()) + ")";
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, static_cast<DWORD>(static_cast<uint64_t>(bytes) >> 32), static_cast<DWORD>(bytes), nullptr);
+    if (mapping) view = MapViewOfFile(mapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, bytes);
+    if (!view) {
+        error = "can't map " + path + " (" + to_string(GetLastError()) + ")";
+        if (mapping) CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    file_ = file;
+    mapping_ = mapping;
+#else
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        error = "can't create " + path + " (" + strerror(errno) + ")";
+        return false;
+    }
+    // allocate the blocks now, a sparse file could fault into the filesystem
+    // on the hot path later
+    int err = posix_fallocate(fd, 0, static_cast<off_t>(bytes));
+    if (err != 0) err = ftruncate(fd, static_cast<off_t>(bytes)) == 0 ? 0 : errno;
+    if (err == 0) {
+        view = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (view == MAP_FAILED) { view = nullptr; err = errno; }
+    }
+    if (!view) {
+        error = "can't map " + path + " (" + strerror(err) + ")";
+        ::close(fd);
+        return false;
+    }
+    fd_ = fd;
+#endif
+    mappedBytes_ = bytes;
+    header_ = static_cast<TraceFileHeader *>(view);
+    records_ = reinterpret_cast<TraceRecord *>(header_ + 1);
+    mask_ = cap - 1;
+    // touch every page so the first records don't take page faults
+    memset(view, 0, bytes);
+    memcpy(header_->magic, kTraceMagic, sizeof(kTraceMagic));
+    header_->version = kTraceVersion;
+    header_->recordSize = sizeof(TraceRecord);
+    header_->capacity = cap;
+    header_->createdNs = monotonicNowNs();
+    header_->head.store(0, memory_order_release);
+    return true;
+}
+
+void TraceRing::close() {
+    if (!header_) return;
+#ifdef _WIN32
+    FlushViewOfFile(header_, 0);
+    UnmapViewOfFile(header_);
+    CloseHandle(static_cast<HANDLE>(mapping_));
+    CloseHandle(static_cast<HANDLE>(file_));
+    file_ = mapping_ = nullptr;
+#else
+    msync(header_, mappedBytes_, MS_ASYNC);
+    munmap(header_, mappedBytes_);
+    ::close(fd_);
+    fd_ = -1;
+#endif
+    header_ = nullptr;
+    records_ = nullptr;
+    mappedBytes_ = 0;
+}
+
+bool readTraceFile(const string &path, vector<TraceRecord> &out, int64_t &createdNs, string &error) {
+    ifstream f(path, ios::binary);
+    if (!f) {
+        error = "can't open " + path;
+        return false;
+    }
+    // plain fields only, the atomic head is read through its bytes
+    char raw[sizeof(TraceFileHeader)];
+    if (!f.read(raw, sizeof(raw))) {
+        error = path + ": too short for a trace header";
+        return false;
+    }
+    uint32_t version = 0, recordSize = 0;
+    uint64_t capacity = 0, head = 0;
+    memcpy(&version, raw + offsetof(TraceFileHeader, version), sizeof(version));
+    memcpy(&recordSize, raw + offsetof(TraceFileHeader, recordSize), sizeof(recordSize));
+    memcpy(&capacity, raw + offsetof(TraceFileHeader, capacity), sizeof(capacity));
+    memcpy(&createdNs, raw + offsetof(TraceFileHeader, createdNs), sizeof(createdNs));
+    memcpy(&head, raw + offsetof(TraceFileHeader, head), sizeof(head));
+    if (memcmp(raw, kTraceMagic, sizeof(kTraceMagic)) != 0) {
+        error = path + ": not a trace file";
+        return false;
+    }
+    if (version > kTraceVersion || recordSize != sizeof(TraceRecord)) {
+        error = path + ": trace version " + to_string(version) + " is newer than this tool";
+        return false;
+    }
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        error = path + ": bad ring capacity";
+        return false;
+    }
+    vector<TraceRecord> ring(static_cast<size_t>(capacity));
+    if (!f.read(reinterpret_cast<char *>(ring.data()), static_cast<streamsize>(capacity * sizeof(TraceRecord)))) {
+        error = path + ": ring is cut short";
+        return false;
+    }
+    // seq is the 1-based write index: anything older than one lap behind head
+    // was overwritten, a zero seq was never finished
+    uint64_t oldest = head > capacity ? head - capacity : 0;
+    out.clear();
+    for (const TraceRecord &r : ring) {
+        if (r.seq > oldest && r.seq <= head) out.push_back(r);
+    }
+    sort(out.begin(), out.end(), [](const TraceRecord &a, const TraceRecord &b) { return a.seq < b.seq; });
+    return true;
+}
+
+const char *traceKindName(uint8_t kind) {
+    switch (static_cast<TraceKind>(kind)) {
+    case TraceKind::EdgeDown: return "edge_down";
+    case TraceKind::EdgeUp: return "edge_up";
+    case TraceKind::CycleStart: return "cycle";
+    case TraceKind::Emit: return "emit";
+    case TraceKind::Park: return "park";
+    case TraceKind::Program: return "program";
+    }
+    return "unknown";
+}
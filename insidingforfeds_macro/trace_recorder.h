@@ -0,0 +1,92 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// what one trace record describes. the numbers are part of the file format,
+// only ever append.
+enum class TraceKind : uint8_t {
+    EdgeDown = 1,   // bind pressed, timeNs from the hook
+    EdgeUp = 2,     // bind released
+    CycleStart = 3, // auxNs = cycle base
+    Emit = 4,       // timeNs = sink call start, auxNs = deadline, durationNs = sink call
+    Park = 5,       // worker went idle, all keys released
+    Program = 6,    // worker switched to a new compiled program
+};
+
+// 32 bytes, two per cache line. seq is written last, so a reader can tell a
+// finished record from one that was being overwritten when the file was
+// copied.
+struct TraceRecord {
+    int64_t timeNs;
+    int64_t auxNs;
+    uint32_t durationNs;
+    uint16_t arg;
+    uint8_t kind;
+    uint8_t timeline;   // 0 for the main bind, was reserved (always 0) before
+    uint64_t seq;
+};
+static_assert(sizeof(TraceRecord) == 32, "trace record layout is the file format");
+
+static const uint32_t kTraceVersion = 1;
+
+struct TraceFileHeader {
+    char magic[8];          // "IFFTRACE"
+    uint32_t version;
+    uint32_t recordSize;
+    uint64_t capacity;      // records in the ring, power of two
+    int64_t createdNs;      // monotonic clock when the file was opened
+    std::atomic<uint64_t> head; // records ever written, next one goes to head % capacity
+    uint8_t reserved[24];
+};
+static_assert(sizeof(TraceFileHeader) == 64, "trace header layout is the file format");
+
+// fixed size ring of TraceRecord in a memory mapped file. the file is sized
+// and mapped up front, record() is a fetch_add and a 32 byte store, the kernel
+// writes the pages back whenever it likes and the data survives a crash.
+// any number of threads may record.
+class TraceRing {
+public:
+    TraceRing() = default;
+    ~TraceRing();
+    TraceRing(const TraceRing &) = delete;
+    TraceRing &operator=(const TraceRing &) = delete;
+
+    // capacity is rounded up to a power of two, an existing file is replaced
+    bool open(const std::string &path, uint64_t capacity, std::string &error);
+    void close();
+    bool isOpen() const { return header_ != nullptr; }
+
+    void record(TraceKind kind, int64_t timeNs, int64_t auxNs = 0, uint32_t durationNs = 0, uint16_t arg = 0, uint8_t timeline = 0) {
+        uint64_t n = header_->head.fetch_add(1, std::memory_order_relaxed);
+        TraceRecord &r = records_[n & mask_];
+        r.seq = 0;
+        r.timeNs = timeNs;
+        r.auxNs = auxNs;
+        r.durationNs = durationNs;
+        r.arg = arg;
+        r.kind = static_cast<uint8_t>(kind);
+        r.timeline = timeline;
+        std::atomic_thread_fence(std::memory_order_release);
+        r.seq = n + 1;
+    }
+
+private:
+    TraceFileHeader *header_ = nullptr;
+    TraceRecord *records_ = nullptr;
+    uint64_t mask_ = 0;
+    size_t mappedBytes_ = 0;
+#ifdef _WIN32
+    void *file_ = nullptr;
+    void *mapping_ = nullptr;
+#else
+    int fd_ = -1;
+#endif
+};
+
+// offline side: reads a trace file (live or finished) and returns the
+// complete records oldest first
+bool readTraceFile(const std::string &path, std::vector<TraceRecord> &out, int64_t &createdNs, std::string &error);
+const char *traceKindName(uint8_t kind);
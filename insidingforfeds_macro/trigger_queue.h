@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "bind_matcher.h"
+
+struct TriggerEdge {
+    int64_t timeNs;
+    BindEdge edge;
+    // which macro the bind belongs to, 0 unless several run side by side
+    uint8_t timeline;
+};
+
+// lock-free single producer / single consumer ring. the producer only writes
+// tail_, the consumer only head_, each on its own cache line. no allocation,
+// push() fails instead of blocking when the consumer is N behind.
+template <class T, size_t N>
+class SpscRing {
+    static_assert(N && (N & (N - 1)) == 0, "ring size must be a power of two");
+
+public:
+    bool push(const T &v) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) == N) return false;
+        slots_[tail & (N - 1)] = v;
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &out) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) return false;
+        out = slots_[head & (N - 1)];
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const { return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire); }
+
+private:
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+    alignas(64) T slots_[N];
+};
+
+// turns the bind's press/release edges into on/off. repeated downs (key
+// autorepeat) are ignored until the matching up, so in toggle mode the state
+// is always the parity of real presses.
+class ActivationLatch {
+public:
+    void setToggle(bool toggle) { toggle_ = toggle; }
+
+    bool apply(BindEdge edge) {
+        if (edge == BindEdge::Down) {
+            if (pressed_) return on_;
+            pressed_ = true;
+            on_ = toggle_ ? !on_ : true;
+        } else if (edge == BindEdge::Up) {
+            pressed_ = false;
+            if (!toggle_) on_ = false;
+        } else if (edge == BindEdge::On || edge == BindEdge::Off) {
+            // a held bind still lets go of it in hold mode
+            on_ = edge == BindEdge::On;
+        }
+        return on_;
+    }
+
+    bool on() const { return on_; }
+
+private:
+    bool toggle_ = false;
+    bool pressed_ = false;
+    bool on_ = false;
+};